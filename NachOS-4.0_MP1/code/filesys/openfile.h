@@ -33,12 +33,10 @@ class OpenFile {
     ~OpenFile() { Close(file); }			// close the file
 
     int ReadAt(char *into, int numBytes, int position) { 
-    		Lseek(file, position, 0); 
-		return ReadPartial(file, into, numBytes); 
+		return ReadPartialAt(file, into, numBytes, position); 
 		}	
     int WriteAt(char *from, int numBytes, int position) { 
-    		Lseek(file, position, 0); 
-		WriteFile(file, from, numBytes); 
+		WriteFileAt(file, from, numBytes, position); 
 		return numBytes;
 		}	
     int Read(char *into, int numBytes) {
@@ -52,7 +50,7 @@ class OpenFile {
 		return numWritten;
 		}
 
-    int Length() { Lseek(file, 0, 2); return Tell(file); }
+    int Length() { return FileLength(file); }
     
   private:
     int file;
@@ -30,6 +30,7 @@
 #include <unistd.h>
 #include <sys/time.h>
 #include <sys/file.h>
+#include <sys/stat.h>
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <cerrno>
@@ -367,6 +368,46 @@ WriteFile(int fd, char *buffer, int nBytes)
     ASSERT(retVal == nBytes);
 }
 
+//----------------------------------------------------------------------
+// ReadPartialAt
+// 	Read characters from an open file, starting at "offset", returning
+//	as many as are available.  The location within the file does not
+//	change, so no Lseek is needed first.
+//----------------------------------------------------------------------
+
+int
+ReadPartialAt(int fd, char *buffer, int nBytes, int offset)
+{
+    return pread(fd, buffer, nBytes, offset);
+}
+
+//----------------------------------------------------------------------
+// WriteFileAt
+// 	Write characters to an open file, starting at "offset", without
+//	changing the location within the file.  Abort if write fails.
+//----------------------------------------------------------------------
+
+void
+WriteFileAt(int fd, char *buffer, int nBytes, int offset)
+{
+    int retVal = pwrite(fd, buffer, nBytes, offset);
+    ASSERT(retVal == nBytes);
+}
+
+//----------------------------------------------------------------------
+// FileLength
+// 	Return the number of bytes in an open file.  Abort on error.
+//----------------------------------------------------------------------
+
+int
+FileLength(int fd)
+{
+    struct stat buf;
+    int retVal = fstat(fd, &buf);
+    ASSERT(retVal == 0);
+    return buf.st_size;
+}
+
 //----------------------------------------------------------------------
 // Lseek
 // 	Change the location within an open file.  Abort on error.
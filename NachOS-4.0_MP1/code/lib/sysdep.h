@@ -48,6 +48,9 @@ extern int OpenForReadWrite(char *name, bool crashOnError);
 extern void Read(int fd, char *buffer, int nBytes);
 extern int ReadPartial(int fd, char *buffer, int nBytes);
 extern void WriteFile(int fd, char *buffer, int nBytes);
+extern int ReadPartialAt(int fd, char *buffer, int nBytes, int offset);
+extern void WriteFileAt(int fd, char *buffer, int nBytes, int offset);
+extern int FileLength(int fd);
 extern void Lseek(int fd, int offset, int whence);
 extern int Tell(int fd);
 extern int Close(int fd);
@@ -41,9 +41,19 @@
 #ifdef FILESYS_STUB 		// Temporarily implement file system calls as 
 				// calls to UNIX, until the real file system
 				// implementation is available
+// OpenFileIds handed out by OpenId; 0 and 1 are the console
+#define FirstFileId	(SysConsoleOutput + 1)
+#define MaxOpenFiles	20
+
 class FileSystem {
   public:
-    FileSystem() { for (int i = 0; i < 20; i++) fileDescriptorTable[i] = NULL; }
+    FileSystem() {
+	numFree = 0;
+	for (int i = MaxOpenFiles - 1; i >= 0; i--) {
+	    fileDescriptorTable[i] = NULL;
+	    freeIds[numFree++] = FirstFileId + i;	// lowest id on top
+	}
+    }
 
     bool Create(char *name) {
 	int fileDescriptor = OpenForWrite(name);
@@ -59,64 +69,51 @@ class FileSystem {
 	  if (fileDescriptor == -1) return NULL;
 	  return new OpenFile(fileDescriptor);
     }
+	//the id indexes "fileDescriptorTable"; a closed one is reused
 	OpenFileId OpenId(char *name){
+		if(numFree == 0)	return -1;
 		OpenFile *file = Open(name);
-    int i = 0;
-		while(i < 20){
-			if(fileDescriptorTable[i]==NULL){
-				fileDescriptorTable[i] = file;
-				break;
-			}
-      ++i;
-		}
-    if(i >= 20)  return -1;
 		if(file==NULL)	return -1;
-		return file->getID();
+		OpenFileId id = freeIds[--numFree];
+		fileDescriptorTable[id - FirstFileId] = file;
+		return id;
+	}
+	OpenFile *Lookup(OpenFileId id){
+		if(id < FirstFileId || id >= FirstFileId + MaxOpenFiles)
+			return NULL;
+		return fileDescriptorTable[id - FirstFileId];
 	}
 	//Write: always write at the last of file
 	int Write(char *buf, int size, OpenFileId id){
-		OpenFile *file = new OpenFile(id);
-    int i = 0;
-    while(i < 20){
-      OpenFile *tmp = fileDescriptorTable[i];
-      if(tmp!=NULL && tmp->getID()==(OpenFileId)id){
-          file = tmp;
-          break;
-      }
-      ++i;
-    }
-    if(i>=20)  return -1;
-		int fileDescriptor = file->Write(buf, size);
-		if(fileDescriptor<0)	return -1;
-		return fileDescriptor;
+		OpenFile *file = Lookup(id);
+		if(file==NULL)	return -1;
+		int numWritten = file->Write(buf, size);
+		if(numWritten<0)	return -1;
+		return numWritten;
 	}
 	//Read: always read from the start of file
 	int Read(char *buf, int size, OpenFileId id){
-		OpenFile *file = new OpenFile(id);
-    int i = 0;
-    while(i < 20){
-      OpenFile *tmp = fileDescriptorTable[i];
-      if(tmp!=NULL && tmp->getID()==(OpenFileId)id){
-          file = tmp;
-          break;
-      }
-      ++i;
-    }
-    	if(i>=20)  return -1;
-		int fileDescriptor = file->Read(buf, size);
-		if(fileDescriptor<0)	return -1;
-		return fileDescriptor;
+		OpenFile *file = Lookup(id);
+		if(file==NULL)	return -1;
+		int numRead = file->Read(buf, size);
+		if(numRead<0)	return -1;
+		return numRead;
 	}
 	
 	int CloseId(OpenFileId id){
-		int fileDescriptor = Close(id);
-		if(fileDescriptor>=0)	return 1;
-		else return 0;
+		OpenFile *file = Lookup(id);
+		if(file==NULL)	return 0;
+		delete file;			// closes the UNIX file
+		fileDescriptorTable[id - FirstFileId] = NULL;
+		freeIds[numFree++] = id;
+		return 1;
 	}
 
     bool Remove(char *name) { return Unlink(name) == 0; }
 
-	OpenFile *fileDescriptorTable[20];
+	OpenFile *fileDescriptorTable[MaxOpenFiles];
+	OpenFileId freeIds[MaxOpenFiles];	// ids not in use, as a stack
+	int numFree;
 	
 };
 
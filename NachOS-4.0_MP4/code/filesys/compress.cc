@@ -0,0 +1,145 @@
+// compress.cc
+//	Routines to compress and decompress file data.  See compress.h.
+//
+//	The compressor is greedy: at each position, it looks up the last
+//	position whose next MinMatch bytes hashed to the same value, and
+//	takes the match there if there is one, however short.  This is
+//	far from the best compression, but extents are small, and it
+//	keeps both directions to a single pass.
+//
+// Copyright (c) 1992-1996 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#include "copyright.h"
+#include "compress.h"
+#include "sysdep.h"
+
+#define MinMatch 	3		// shortest match worth a run
+#define MaxMatch 	(127 + MinMatch)	// longest match in one run
+#define MaxLiterals 	128		// most literals in one run
+#define MaxOffset 	65536		// farthest back a match can be
+#define HashBits 	10		// size of the table of positions
+
+// hash of the MinMatch bytes at "p"
+#define HashOf(p) \
+    ((((p)[0] << 16 | (p)[1] << 8 | (p)[2]) * 2654435761u) >> (32 - HashBits))
+
+//----------------------------------------------------------------------
+// PutLiterals
+// 	Append "count" literal bytes to the compressed data, in runs of at
+//	most MaxLiterals.  Return FALSE if they do not fit.
+//
+//	"from" is the bytes to append
+//	"into" is the compressed data, of which "*out" bytes are used
+//	"room" is the size of "into"
+//----------------------------------------------------------------------
+
+static bool
+PutLiterals(unsigned char *from, int count, char *into, int *out, int room)
+{
+    while (count > 0) {
+	int run = (count > MaxLiterals) ? MaxLiterals : count;
+
+	if (*out + 1 + run > room)
+	    return FALSE;
+	into[(*out)++] = run - 1;
+	memcpy(&into[*out], from, run);
+	*out += run;
+	from += run;
+	count -= run;
+    }
+    return TRUE;
+}
+
+//----------------------------------------------------------------------
+// Compress
+// 	Compress "length" bytes of "from" into "into", and return the
+//	number of compressed bytes.  Give up, returning -1, as soon as they
+//	would not fit in "room" bytes; the caller then stores the data as
+//	it is.
+//----------------------------------------------------------------------
+
+int
+Compress(char *from, int length, char *into, int room)
+{
+    unsigned char *in = (unsigned char *) from;
+    int last[1 << HashBits];		// last position with each hash
+    int pos = 0, literals = 0, out = 0;
+    int candidate, match, offset;
+
+    for (int i = 0; i < (1 << HashBits); i++)
+	last[i] = -1;
+
+    while (pos + MinMatch <= length) {
+	unsigned hash = HashOf(&in[pos]);
+
+	candidate = last[hash];
+	last[hash] = pos;
+	if (candidate < 0 || pos - candidate > MaxOffset
+		|| memcmp(&in[candidate], &in[pos], MinMatch) != 0) {
+	    pos++;
+	    continue;
+	}
+	match = MinMatch;
+	while (pos + match < length && match < MaxMatch
+		&& in[candidate + match] == in[pos + match])
+	    match++;
+
+	if (!PutLiterals(&in[literals], pos - literals, into, &out, room)
+		|| out + 3 > room)
+	    return -1;
+	offset = pos - candidate - 1;
+	into[out++] = 128 + match - MinMatch;
+	into[out++] = offset & 0xff;
+	into[out++] = offset >> 8;
+
+	// the positions inside the match can start later matches
+	for (int i = pos + 1; i < pos + match && i + MinMatch <= length; i++)
+	    last[HashOf(&in[i])] = i;
+	pos += match;
+	literals = pos;
+    }
+    if (!PutLiterals(&in[literals], length - literals, into, &out, room))
+	return -1;
+    return out;
+}
+
+//----------------------------------------------------------------------
+// Decompress
+// 	Decompress the "length" bytes of "from" into "into", and return
+//	the number of bytes they stand for.  Return -1 if the data is not
+//	the output of Compress, or stands for more than "room" bytes.
+//----------------------------------------------------------------------
+
+int
+Decompress(char *from, int length, char *into, int room)
+{
+    unsigned char *in = (unsigned char *) from;
+    int pos = 0, out = 0;
+    int count, offset;
+
+    while (pos < length) {
+	int control = in[pos++];
+
+	if (control < 128) {		// literals
+	    count = control + 1;
+	    if (pos + count > length || out + count > room)
+		return -1;
+	    memcpy(&into[out], &in[pos], count);
+	    pos += count;
+	} else {			// match
+	    count = control - 128 + MinMatch;
+	    if (pos + 2 > length)
+		return -1;
+	    offset = (in[pos] | in[pos + 1] << 8) + 1;
+	    pos += 2;
+	    if (offset > out || out + count > room)
+		return -1;
+	    for (int i = 0; i < count; i++)	// may overlap, byte by byte
+		into[out + i] = into[out - offset + i];
+	}
+	out += count;
+    }
+    return out;
+}
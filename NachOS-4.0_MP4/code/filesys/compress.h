@@ -0,0 +1,44 @@
+// compress.h
+//	Routines to compress and decompress file data with a small, fast
+//	LZ77-style codec.  They are used to store the data of compressed
+//	files, one extent at a time (see filehdr.h).
+//
+//	Compressed data is a sequence of runs, each starting with a control
+//	byte "c":
+//	  c < 128:  c + 1 literal bytes follow, to be copied as they are;
+//	  c >= 128: copy (c - 128) + MinMatch bytes of the output, starting
+//		    "offset" bytes back, where offset - 1 is stored in the
+//		    next two bytes, low byte first.  The copy may overlap
+//		    the bytes it produces, as in "aaaa...".
+//
+// Copyright (c) 1992-1996 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include "copyright.h"
+#include "disk.h"
+
+// The data of a compressed file is compressed in extents of ExtentSectors
+// blocks: the first ExtentSize bytes of the file, the next ExtentSize
+// bytes, and so on.  Each extent is compressed on its own, so that reading
+// any byte of the file only takes decompressing one extent.
+#define ExtentSectors 	8
+#define ExtentSize 	(ExtentSectors * SectorSize)
+
+// A compressed extent starts with the number of bytes of data it holds,
+// and the number of compressed bytes that follow.
+#define ExtentHeaderSize (2 * sizeof(short))
+
+int Compress(char *from, int length, char *into, int room);
+					// Compress "length" bytes; return the
+					// compressed length, or -1 if it
+					// does not fit in "room" bytes
+int Decompress(char *from, int length, char *into, int room);
+					// Undo Compress; return the length
+					// of the data, or -1 if "from" is
+					// not valid compressed data
+
+#endif // COMPRESS_H
@@ -0,0 +1,148 @@
+// dedup.cc
+//	Routines to manage the index of data block contents used to
+//	deduplicate file data.  See dedup.h.
+//
+// Copyright (c) 1992-1996 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#include "copyright.h"
+#include "dedup.h"
+#include "main.h"
+#include "synchdisk.h"
+
+//----------------------------------------------------------------------
+// DedupIndex::DedupIndex
+// 	Initialize an index holding no sectors.
+//
+//	"numSectors" is the number of sectors on the disk
+//----------------------------------------------------------------------
+
+DedupIndex::DedupIndex(int numSectors)
+{
+    numBuckets = 1;
+    while (numBuckets < numSectors / 4)
+	numBuckets *= 2;
+    buckets = new int[numBuckets];
+    next = new int[numSectors];
+    hashes = new unsigned[numSectors];
+    for (int i = 0; i < numBuckets; i++)
+	buckets[i] = -1;
+    for (int i = 0; i < numSectors; i++)
+	next[i] = -2;
+    numIndexed = numHits = numCompared = 0;
+}
+
+//----------------------------------------------------------------------
+// DedupIndex::~DedupIndex
+//----------------------------------------------------------------------
+
+DedupIndex::~DedupIndex()
+{
+    delete [] buckets;
+    delete [] next;
+    delete [] hashes;
+}
+
+//----------------------------------------------------------------------
+// DedupIndex::Hash
+// 	Return the FNV-1a hash of a block of data.
+//----------------------------------------------------------------------
+
+unsigned
+DedupIndex::Hash(char *data)
+{
+    unsigned hash = 2166136261u;
+
+    for (int i = 0; i < SectorSize; i++) {
+	hash ^= (unsigned char) data[i];
+	hash *= 16777619u;
+    }
+    return hash;
+}
+
+//----------------------------------------------------------------------
+// DedupIndex::Find
+// 	Return a sector in the index, not among "exclude", that holds the
+//	same bytes as "data", or -1 if there is none.  Candidates with the
+//	right hash are read back from the disk and compared.
+//
+//	"data" is a block of SectorSize bytes
+//	"hash" is its hash
+//	"exclude" holds the sectors about to be written, whose contents
+//	on disk are about to change
+//	"numExclude" is the number of them
+//----------------------------------------------------------------------
+
+int
+DedupIndex::Find(char *data, unsigned hash, int *exclude, int numExclude)
+{
+    char buf[SectorSize];
+    int i;
+
+    for (int s = buckets[hash & (numBuckets - 1)]; s != -1; s = next[s]) {
+	if (hashes[s] != hash)
+	    continue;
+	for (i = 0; i < numExclude && exclude[i] != s; i++)
+	    ;
+	if (i < numExclude)
+	    continue;
+	kernel->synchDisk->ReadSector(s, buf);
+	numCompared++;
+	if (memcmp(buf, data, SectorSize) == 0)
+	    return s;
+    }
+    return -1;
+}
+
+//----------------------------------------------------------------------
+// DedupIndex::Add
+// 	Note that "sector" holds data with the given hash, replacing
+//	whatever it held before.
+//----------------------------------------------------------------------
+
+void
+DedupIndex::Add(int sector, unsigned hash)
+{
+    int bucket = hash & (numBuckets - 1);
+
+    Forget(sector);
+    hashes[sector] = hash;
+    next[sector] = buckets[bucket];
+    buckets[bucket] = sector;
+    numIndexed++;
+}
+
+//----------------------------------------------------------------------
+// DedupIndex::Forget
+// 	Remove "sector" from the index, if it is there.
+//----------------------------------------------------------------------
+
+void
+DedupIndex::Forget(int sector)
+{
+    int *link;
+
+    if (next[sector] == -2)
+	return;
+    link = &buckets[hashes[sector] & (numBuckets - 1)];
+    while (*link != sector)
+	link = &next[*link];
+    *link = next[sector];
+    next[sector] = -2;
+    numIndexed--;
+}
+
+//----------------------------------------------------------------------
+// DedupIndex::Move
+// 	The data of "from" has been copied to "to", and "from" released.
+//----------------------------------------------------------------------
+
+void
+DedupIndex::Move(int from, int to)
+{
+    if (next[from] == -2)
+	return;
+    Forget(from);
+    Add(to, hashes[from]);
+}
@@ -0,0 +1,58 @@
+// dedup.h
+//	Data structures for finding the data block, if any, that already
+//	holds the contents of a block about to be written, so that a file
+//	can share that block instead of taking a new sector of its own.
+//
+//	The index maps a hash of the contents of each data block to the
+//	sector holding it.  Blocks with the same hash are chained in a
+//	bucket; a match is only trusted once the contents, read back from
+//	the disk, compare equal.  Sharing a block is then just a clone of
+//	that one block: it gets an extra reference (see refcount.h), and is
+//	copied on write like any other shared block.
+//
+//	The index is only kept in memory, while deduplication is enabled;
+//	it is rebuilt from the files on disk when it is enabled.  Every
+//	data sector that is freed, overwritten or moved must be reported
+//	to it, so that it never points at a sector holding something else.
+//
+// Copyright (c) 1992-1996 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#ifndef DEDUP_H
+#define DEDUP_H
+
+#include "copyright.h"
+
+class DedupIndex {
+  public:
+    DedupIndex(int numSectors);		// Initialize an empty index
+    ~DedupIndex();
+
+    static unsigned Hash(char *data);	// Hash of a block of SectorSize bytes
+
+    int Find(char *data, unsigned hash, int *exclude, int numExclude);
+					// Sector not in "exclude" that
+					// holds "data", or -1
+    void Add(int sector, unsigned hash);
+					// "sector" now holds data with
+					// that hash
+    void Forget(int sector);		// "sector" no longer holds data
+    void Move(int from, int to);	// The data of "from" is now in "to"
+
+    int NumIndexed() { return numIndexed; }
+					// Number of sectors in the index
+    int numHits;			// Blocks shared instead of written
+    int numCompared;			// Blocks read back to compare
+
+  private:
+    int numBuckets;			// Size of "buckets", a power of 2
+    int *buckets;			// First sector with each hash value,
+					// or -1
+    int *next;				// Next sector in the same bucket; -1
+					// at the end, -2 if not in the index
+    unsigned *hashes;			// Hash of the data of each sector
+    int numIndexed;
+};
+
+#endif // DEDUP_H
@@ -80,6 +80,9 @@ Directory::FetchFrom(OpenFile *file)
 void
 Directory::WriteBack(OpenFile *file)
 {
+    //MP4 dedup: a file sharing a directory block would see it change
+    // under it, as directories are written in place
+    file->SetDirectory();
     (void) file->WriteAt((char *)table, tableSize * sizeof(DirectoryEntry), 0);
 }
 
@@ -215,16 +218,14 @@ Directory::List(bool recursive, int layer)
                 cout<<" FILE\n";
             }else{  //is directory => check whether recursive search deeper dir or not
                 cout<<" DIR\n";
-                //keep same as filesys.cc
-                int numDirEntry = 64;
+                //descend by the subdirectory's header sector; its
+                //entries are read once, with no lookup by path
                 if(recursive){
-                    OpenFile *subDirFile = new OpenFile(table[i].sector);
-                    Directory *subDir = new Directory(numDirEntry);
-                    subDir->FetchFrom(subDirFile);
+                    OpenFile subDirFile(table[i].sector);
+                    Directory subDir(tableSize);	// all directories are the same size
+                    subDir.FetchFrom(&subDirFile);
                     //recursive call list, with layer = curlayer+1
-                    subDir->List(recursive, layer+1);
-                    delete(subDir);
-                    delete(subDirFile);
+                    subDir.List(recursive, layer+1);
                 }
             }
             ++idx;
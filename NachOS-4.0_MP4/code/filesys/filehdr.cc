@@ -25,6 +25,8 @@
 #include "copyright.h"
 
 #include "filehdr.h"
+#include "refcount.h"
+#include "dedup.h"
 #include "debug.h"
 #include "synchdisk.h"
 #include "main.h"
@@ -45,6 +47,8 @@ FileHeader::FileHeader()
 	//MP4
 	nextHeader = NULL;
 	nextHeaderSector = -1;
+	compressed = FALSE;
+	changed = TRUE;			// not on disk yet
 }
 
 //----------------------------------------------------------------------
@@ -76,57 +80,178 @@ FileHeader::~FileHeader()
 bool
 FileHeader::Allocate(PersistentBitmap *freeMap, int fileSize)
 { 
+    //MP4 inline: small files need no data blocks at all
+    changed = TRUE;
+    if (fileSize <= (int) InlineSize) {
+	numBytes = fileSize;
+	numSectors = 0;
+	memset(dataSectors, 0, sizeof(dataSectors));
+	return TRUE;
+    }
+    numBytes = 0;
+    numSectors = 0;
+    return GrowBlocks(freeMap, fileSize);
+}
+
+//----------------------------------------------------------------------
+// FileHeader::GrowBlocks
+// 	Allocate data blocks for this header until it covers "newSize"
+//	bytes (or MaxFileSize, whichever is smaller), and continue in the
+//	next header of the chain for the rest, allocating that header if
+//	needed.  Return FALSE if the disk is full.
+//
+//	"freeMap" is the bit map of free disk sectors
+//	"newSize" is the size of the file from this header on, in bytes
+//----------------------------------------------------------------------
+
+bool
+FileHeader::GrowBlocks(PersistentBitmap *freeMap, int newSize)
+{
 	//MP4
 	//check if exceed one header file size?
-	int remaining = fileSize - MaxFileSize;
+	int remaining = newSize - MaxFileSize;
+	int sectors;
+	int oldBytes = numBytes;
 	if(remaining > 0){
 		numBytes = MaxFileSize;
 	}else{
-		numBytes = fileSize;
+		numBytes = newSize;
+	}
+	if(numBytes != oldBytes){
+		changed = TRUE;		// only the last headers grow
 	}
 	//divide 'numBytes' not fileSize
-    numSectors  = divRoundUp(numBytes, SectorSize);
-    if (freeMap->NumClear() < numSectors)
+    sectors = divRoundUp(numBytes, SectorSize);
+    if (sectors > numSectors && freeMap->NumClear() < sectors - numSectors)
 	return FALSE;		// not enough space
 
-    for (int i = 0; i < numSectors; i++) {
+    for (int i = numSectors; i < sectors; i++) {
 	dataSectors[i] = freeMap->FindAndSet();
 	// since we checked that there was enough free space,
 	// we expect this to succeed
 	ASSERT(dataSectors[i] >= 0);
     }
+    numSectors = sectors;
 
     //MP4
     if(remaining > 0){
-    	nextHeader = new FileHeader;
-    	nextHeaderSector = freeMap->FindAndSet();
-    	if(nextHeaderSector==-1){
-    		delete nextHeader;
-    		return FALSE;
+    	if(nextHeader==NULL){
+    		nextHeaderSector = freeMap->FindAndSet();
+    		if(nextHeaderSector==-1){
+    			return FALSE;
+    		}
+    		nextHeader = new FileHeader;
+    		nextHeader->numBytes = 0;
+    		nextHeader->numSectors = 0;
+    		changed = TRUE;
     	}
-    	return nextHeader->Allocate(freeMap, remaining);
+    	return nextHeader->GrowBlocks(freeMap, remaining);
     }
 
     return TRUE;
 }
 
+//----------------------------------------------------------------------
+// FileHeader::SectorsNeeded
+// 	Return how many sectors, data blocks and chained headers, growing
+//	the file to "newSize" bytes takes from the bitmap.  An inline
+//	file that still fits in its header needs none.
+//
+//	"newSize" is the new length of the file, in bytes
+//----------------------------------------------------------------------
+
+int
+FileHeader::SectorsNeeded(int newSize)
+{
+    if (newSize <= FileLength())
+	return 0;
+    if (IsInline() && newSize <= (int) InlineSize)
+	return 0;
+
+    // data blocks plus headers of the grown file, minus what we have
+    // (holes of compressed extents are not filled in)
+    return divRoundUp(newSize, SectorSize) + divRoundUp(newSize, MaxFileSize)
+		- SectorList(0, NULL) - NumHoles();
+}
+
+//----------------------------------------------------------------------
+// FileHeader::Extend
+// 	Grow the file to "newSize" bytes.  An inline file stays inline as
+//	long as it fits in InlineSize bytes; beyond that its data is moved
+//	into a newly allocated data block, and the file grows from there
+//	like any other.  Return FALSE, without changing anything, if there
+//	are not enough free sectors.
+//
+//	"freeMap" is the bit map of free disk sectors, or NULL if
+//	SectorsNeeded says no sectors are needed
+//	"newSize" is the new length of the file, in bytes
+//----------------------------------------------------------------------
+
+bool
+FileHeader::Extend(PersistentBitmap *freeMap, int newSize)
+{
+    int needed = SectorsNeeded(newSize);
+    bool success;
+
+    if (newSize <= FileLength())
+	return TRUE;
+    if (IsInline() && newSize <= (int) InlineSize) {
+	numBytes = newSize;
+	changed = TRUE;
+	return TRUE;
+    }
+    if (needed > 0 && freeMap->NumClear() < needed)
+	return FALSE;
+
+    if (IsInline()) {
+	char buf[SectorSize];
+	int sector = freeMap->FindAndSet();
+
+	memset(buf, 0, sizeof(buf));
+	memcpy(buf, InlineData(), numBytes);
+	kernel->synchDisk->WriteSector(sector, buf);
+	memset(dataSectors, -1, sizeof(dataSectors));
+	dataSectors[0] = sector;
+	numSectors = 1;
+	changed = TRUE;
+    }
+    success = GrowBlocks(freeMap, newSize);
+    ASSERT(success);			// we checked there was room
+    return TRUE;
+}
+
 //----------------------------------------------------------------------
 // FileHeader::Deallocate
-// 	De-allocate all the space allocated for data blocks for this file.
+// 	De-allocate all the space allocated for data blocks for this file,
+//	and for the headers chained after this one.  The caller frees the
+//	sector of this header.  A data block shared with a clone, or
+//	with a file holding the same data, only loses a reference.
+//	Holes in compressed extents have nothing to free.
 //
 //	"freeMap" is the bit map of free disk sectors
+//	"refs" counts the references to shared sectors
+//	"dedup" is told which data blocks are freed, or is NULL
 //----------------------------------------------------------------------
 
 void 
-FileHeader::Deallocate(PersistentBitmap *freeMap)
+FileHeader::Deallocate(PersistentBitmap *freeMap, RefCount *refs,
+		DedupIndex *dedup)
 {
 	//MP4: recursive delete fileblock, from the last header
 	if(nextHeader!=NULL){
-    	nextHeader->Deallocate(freeMap);
+    	nextHeader->Deallocate(freeMap, refs, dedup);
+	ASSERT(freeMap->Test(nextHeaderSector));
+	freeMap->Clear(nextHeaderSector);
     }
     for (int i = 0; i < numSectors; i++) {
+	if (dataSectors[i] == NoSector)
+	    continue;
 	ASSERT(freeMap->Test((int) dataSectors[i]));  // ought to be marked!
+	if (refs->Unshare(dataSectors[i]))
+	    continue;
 	freeMap->Clear((int) dataSectors[i]);
+	if (dedup != NULL)
+	    dedup->Forget(dataSectors[i]);
     }
 }
 
@@ -156,6 +281,11 @@ FileHeader::FetchFrom(int sector)
     memcpy(dataSectors, buf + offset, NumDirect * sizeof(int));
     offset += NumDirect * sizeof(int);
     memcpy(&nextHeaderSector, buf + offset, sizeof(nextHeaderSector));
+    //MP4 compress
+    compressed = (numBytes & CompressedFlag) != 0;
+    numBytes &= ~CompressedFlag;
+
+    changed = FALSE;
 
     if(nextHeaderSector!=-1){
     	nextHeader = new FileHeader;
@@ -178,16 +308,54 @@ FileHeader::FetchFrom(int sector)
 
 void
 FileHeader::WriteBack(int sector)
+{
+    WriteOne(sector);
+    if(nextHeaderSector!=-1){
+    	nextHeader->WriteBack(nextHeaderSector);
+    } 
+}
+
+//----------------------------------------------------------------------
+// FileHeader::WriteChanged
+// 	Write back only the headers of the chain that changed in core.
+//	Growing a file changes its last header or two, and rewriting a
+//	few blocks the headers that point at them; the rest of a long
+//	chain need not be written again.
+//
+//	"sector" is the disk sector to contain the file header
+//----------------------------------------------------------------------
+
+void
+FileHeader::WriteChanged(int sector)
+{
+    for (FileHeader *hdr = this; hdr != NULL; hdr = hdr->nextHeader) {
+	if (hdr->changed)
+	    hdr->WriteOne(sector);
+	sector = hdr->nextHeaderSector;
+    }
+}
+
+//----------------------------------------------------------------------
+// FileHeader::WriteOne
+// 	Write this header alone to disk, without the rest of the chain.
+//
+//	"sector" is the disk sector to contain the file header
+//----------------------------------------------------------------------
+
+void
+FileHeader::WriteOne(int sector)
 {
 	/*
 		MP4:
 		Use the same placing sequence to write 'in-core' information back to sector
 	*/
 	char buf[SectorSize];
+	//MP4 compress
+	int diskBytes = compressed ? (numBytes | CompressedFlag) : numBytes;
 	
 	int offset = 0;
-	memcpy(buf + offset, &numBytes, sizeof(numBytes));
-    offset += sizeof(numBytes);
+	memcpy(buf + offset, &diskBytes, sizeof(diskBytes));
+    offset += sizeof(diskBytes);
     memcpy(buf + offset, &numSectors, sizeof(numSectors));
     offset += sizeof(numSectors);
     memcpy(buf + offset, dataSectors, NumDirect * sizeof(int));
@@ -195,10 +363,7 @@ FileHeader::WriteBack(int sector)
     memcpy(buf + offset, &nextHeaderSector, sizeof(nextHeaderSector));
 
     kernel->synchDisk->WriteSector(sector, buf);
-
-    if(nextHeaderSector!=-1){
-    	nextHeader->WriteBack(nextHeaderSector);
-    } 
+    changed = FALSE;
 	
 	/*
 		MP4 Hint:
@@ -236,6 +401,52 @@ FileHeader::ByteToSector(int offset)
 	}
 }
 
+//----------------------------------------------------------------------
+// FileHeader::ByteToSectors
+// 	Fill "list" with the disk sectors holding "count" consecutive
+//	sectors of the file, starting with the one containing byte
+//	"offset".  Same as calling ByteToSector on each of them, but the
+//	chain of headers is walked only once, which matters for large
+//	transfers.
+//
+//	"offset" is the location within the file of the first byte
+//	"count" is the number of sectors to look up
+//	"list" is where to store the disk sector numbers
+//----------------------------------------------------------------------
+
+void
+FileHeader::ByteToSectors(int offset, int count, int *list)
+{
+    FileHeader *hdr = this;
+    int idx = offset / SectorSize;
+
+    while (idx >= (int) NumDirect) {		// skip to the right header
+	hdr = hdr->nextHeader;
+	ASSERT(hdr != NULL);
+	idx -= NumDirect;
+    }
+    for (int i = 0; i < count; i++) {
+	if (idx == (int) NumDirect) {
+	    hdr = hdr->nextHeader;
+	    ASSERT(hdr != NULL);
+	    idx = 0;
+	}
+	list[i] = hdr->dataSectors[idx++];
+    }
+}
+
+//MP4 iostat
+//----------------------------------------------------------------------
+// FileHeader::NumHeaders
+// 	Return the number of headers in the chain, this one included.
+//----------------------------------------------------------------------
+
+int
+FileHeader::NumHeaders()
+{
+    return 1 + ((nextHeader != NULL) ? nextHeader->NumHeaders() : 0);
+}
+
 //----------------------------------------------------------------------
 // FileHeader::FileLength
 // 	Return the number of bytes in the file.
@@ -253,6 +464,149 @@ FileHeader::FileLength()
     return totalNumBytes;
 }
 
+//----------------------------------------------------------------------
+// FileHeader::SectorList
+// 	Collect every sector used by the file, in the order the file would
+//	occupy them if it were laid out contiguously: this header, its data
+//	sectors, then the next header of the chain and its data, and so on.
+//	Return the number of sectors collected.  Holes in compressed
+//	extents are left out.
+//
+//	"sector" is the disk sector containing this file header
+//	"list" is where to store the sector numbers, or NULL to only count
+//----------------------------------------------------------------------
+
+int
+FileHeader::SectorList(int sector, int *list)
+{
+    int count = 0;
+
+    if (list != NULL)
+	list[count] = sector;
+    count++;
+    for (int i = 0; i < numSectors; i++) {
+	if (dataSectors[i] == NoSector)
+	    continue;
+	if (list != NULL)
+	    list[count] = dataSectors[i];
+	count++;
+    }
+    //MP4: continue with the rest of the header chain
+    if (nextHeader != NULL)
+	count += nextHeader->SectorList(nextHeaderSector,
+				(list == NULL) ? NULL : list + count);
+    return count;
+}
+
+//----------------------------------------------------------------------
+// FileHeader::Relocate
+// 	Copy the data blocks of the file into a contiguous run of sectors,
+//	laid out as in SectorList, with this header at "sector".  Only the
+//	in-core header is updated; the caller is responsible for marking the
+//	new run in the bitmap, writing the header back to "sector", and
+//	releasing the old sectors.
+//
+//	"sector" is the first sector of a free run large enough for
+//	the whole chain (see SectorList)
+//----------------------------------------------------------------------
+
+void
+FileHeader::Relocate(int sector)
+{
+    char buf[SectorSize];
+    int next = sector + 1;
+
+    for (int i = 0; i < numSectors; i++, next++) {
+	if (dataSectors[i] == NoSector) {
+	    next--;			// holes take no room
+	    continue;
+	}
+	kernel->synchDisk->ReadSector(dataSectors[i], buf);
+	kernel->synchDisk->WriteSector(next, buf);
+	dataSectors[i] = next;
+    }
+    changed = TRUE;
+    //MP4: the next header directly follows our last data block
+    if (nextHeader != NULL) {
+	nextHeaderSector = next;
+	nextHeader->Relocate(next);
+    }
+}
+
+//----------------------------------------------------------------------
+// FileHeader::Clone
+// 	Turn this header chain, just fetched from another file, into the
+//	header chain of a clone of that file: give each chained header a
+//	sector of its own, and add a reference to every data block, which
+//	the two files now share.  The caller allocates the sector of this
+//	first header, and writes the chain back there.  Return FALSE,
+//	sharing nothing, if the disk is too full for the headers.
+//
+//	"freeMap" is the bit map of free disk sectors
+//	"refs" counts the references to shared sectors
+//----------------------------------------------------------------------
+
+bool
+FileHeader::Clone(PersistentBitmap *freeMap, RefCount *refs)
+{
+    FileHeader *hdr;
+
+    for (hdr = this; hdr->nextHeader != NULL; hdr = hdr->nextHeader) {
+	hdr->changed = TRUE;
+	hdr->nextHeader->changed = TRUE;
+	hdr->nextHeaderSector = freeMap->FindAndSet();
+	if (hdr->nextHeaderSector == -1)
+	    return FALSE;
+    }
+    for (hdr = this; hdr != NULL; hdr = hdr->nextHeader)
+	for (int i = 0; i < hdr->numSectors; i++)
+	    if (hdr->dataSectors[i] != NoSector)
+		refs->Share(hdr->dataSectors[i]);
+    return TRUE;
+}
+
+//----------------------------------------------------------------------
+// FileHeader::NumHoles
+// 	Return the number of data blocks of this header and the headers
+//	chained after it that are holes (NoSector) in compressed extents.
+//----------------------------------------------------------------------
+
+int
+FileHeader::NumHoles()
+{
+    int holes = 0;
+
+    for (int i = 0; i < numSectors; i++)
+	if (dataSectors[i] == NoSector)
+	    holes++;
+    if (nextHeader != NULL)
+	holes += nextHeader->NumHoles();
+    return holes;
+}
+
+//----------------------------------------------------------------------
+// FileHeader::SetDataSector
+// 	Make data block "index" of the file (counting from the start of
+//	the file, across the header chain) be "sector".  Only the in-core
+//	header changes.  "sector" is NoSector for a hole in a compressed
+//	extent.
+//----------------------------------------------------------------------
+
+void
+FileHeader::SetDataSector(int index, int sector)
+{
+    //MP4: every header but the last one is full
+    if (index >= (int) NumDirect) {
+	ASSERT(nextHeader != NULL);
+	nextHeader->SetDataSector(index - NumDirect, sector);
+	return;
+    }
+    ASSERT(index < numSectors);
+    if (dataSectors[index] != sector)
+	changed = TRUE;
+    dataSectors[index] = sector;
+}
+
 //----------------------------------------------------------------------
 // FileHeader::Print
 // 	Print the contents of the file header, and the contents of all
@@ -265,11 +619,32 @@ FileHeader::Print()
     int i, j, k;
     char *data = new char[SectorSize];
 
-    printf("FileHeader contents.  File size: %d.  File blocks:\n", numBytes);
+    //MP4 inline
+    if (IsInline()) {
+	printf("FileHeader contents.  File size: %d.  Inline data:\n", numBytes);
+	for (j = 0; j < numBytes; j++) {
+	    if ('\040' <= InlineData()[j] && InlineData()[j] <= '\176')
+		printf("%c", InlineData()[j]);
+	    else
+		printf("\\%x", (unsigned char)InlineData()[j]);
+	}
+	printf("\n");
+	delete [] data;
+	return;
+    }
+
+    printf("FileHeader contents.  File size: %d.  File blocks%s:\n", numBytes,
+	    compressed ? " (compressed)" : "");
     for (i = 0; i < numSectors; i++)
-	printf("%d ", dataSectors[i]);
+	if (dataSectors[i] == NoSector)
+	    printf("- ");
+	else
+	    printf("%d ", dataSectors[i]);
     printf("\nFile contents:\n");
     for (i = k = 0; i < numSectors; i++) {
+	//MP4 compress: compressed data is printed as it is stored
+	if (dataSectors[i] == NoSector)
+	    continue;
 	kernel->synchDisk->ReadSector(dataSectors[i], data);
         for (j = 0; (j < SectorSize) && (k < numBytes); j++, k++) {
 	    if ('\040' <= data[j] && data[j] <= '\176')   // isprint(data[j])
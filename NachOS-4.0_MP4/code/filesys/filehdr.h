@@ -17,10 +17,20 @@
 #include "disk.h"
 #include "pbitmap.h"
 
+class RefCount;
+class DedupIndex;
+
 // File data part: header size - 'three' integer variable(numBytes, numSectors, nextSector)
 // File size = data part * size per sector
 #define NumDirect 	((SectorSize - 3 * sizeof(int)) / sizeof(int))
 #define MaxFileSize 	(NumDirect * SectorSize)
+//MP4 inline: files this small keep their data in place of "dataSectors"
+#define InlineSize 	(NumDirect * sizeof(int))
+//MP4 compress: a data block with no sector, past the end of the compressed
+//data of its extent (see compress.h)
+#define NoSector 	-1
+//MP4 compress: set in "numBytes" on disk for a compressed file
+#define CompressedFlag 	0x40000000
 
 // The following class defines the Nachos "file header" (in UNIX terms,  
 // the "i-node"), describing where on disk to find all of the data in the file.
@@ -46,22 +56,77 @@ class FileHeader {
     bool Allocate(PersistentBitmap *bitMap, int fileSize);// Initialize a file header, 
 						//  including allocating space 
 						//  on disk for the file data
-    void Deallocate(PersistentBitmap *bitMap);  // De-allocate this file's 
-						//  data blocks
+    void Deallocate(PersistentBitmap *bitMap, RefCount *refs,
+		DedupIndex *dedup);
+						// De-allocate this file's
+						//  data blocks, except those
+						//  still shared with another
+						//  file
+    //MP4 inline
+    bool Extend(PersistentBitmap *bitMap, int newSize);
+						// Grow the file to "newSize"
+						//  bytes, moving inline data
+						//  to a data block if needed
+    int SectorsNeeded(int newSize);	// Number of free sectors that
+						//  takes
+    bool IsInline() { return numSectors == 0; }
+						// Is the file data stored
+						//  in the header itself?
+    char *InlineData() { return (char *) dataSectors; }
+						// Inline data of the file
+    //MP4 compress
+    bool IsCompressed() { return compressed; }
+						// Is the data written to
+						//  the file compressed?
+    void SetCompressed() { compressed = TRUE; changed = TRUE; }
+						// Compress what is written
+						//  from now on
 
     void FetchFrom(int sectorNumber); 	// Initialize file header from disk
     void WriteBack(int sectorNumber); 	// Write modifications to file header
 					//  back to disk
+    //MP4 inline
+    void WriteChanged(int sectorNumber);
+					// Same, but only for the headers
+					//  of the chain changed in core
+					//  since they were read or written
 
     int ByteToSector(int offset);	// Convert a byte offset into the file
 					// to the disk sector containing
 					// the byte
+    void ByteToSectors(int offset, int count, int *list);
+					// Same, for "count" consecutive
+					// sectors starting at "offset"
 
     int FileLength();			// Return the length of the file 
 					// in bytes
+    //MP4 iostat
+    int NumHeaders();			// Number of headers in the chain
 
     void Print();			// Print the contents of the file.
 
+    //MP4 defrag
+    int SectorList(int sector, int *list);
+					// Store the header and data sectors
+					// of the whole header chain into
+					// "list" in layout order (header,
+					// its data, next header, ...) and
+					// return how many there are.
+					// "list" may be NULL to just count.
+    void Relocate(int sector);		// Move the chain into the free,
+					// contiguous run of sectors that
+					// starts at "sector"; the caller
+					// writes the header back afterwards
+
+    //MP4 clone
+    bool Clone(PersistentBitmap *bitMap, RefCount *refs);
+					// Turn this in-core copy of a header
+					// chain into a clone that shares
+					// its data blocks
+    void SetDataSector(int index, int sector);
+					// Replace data block "index" of the
+					// file by "sector"
+
   private:
 	
 	/*
@@ -79,13 +144,29 @@ class FileHeader {
 		
 	*/
 	
+    bool GrowBlocks(PersistentBitmap *bitMap, int newSize);
+					// Allocate data blocks (and chained
+					// headers) up to "newSize" bytes
+    int NumHoles();			// Number of data blocks of the chain
+					// with no sector (NoSector)
+    //MP4 inline
+    void WriteOne(int sectorNumber);	// Write this header alone to disk
+
     int numBytes;			// Number of bytes in the file
-    int numSectors;			// Number of data sectors in the file
+    int numSectors;			// Number of data sectors in the file,
+					// 0 if the data is stored inline
     int dataSectors[NumDirect];		// Disk sector numbers for each data 
-					// block in the file
+					// block in the file, or the file
+					// data itself if it fits in
+					// InlineSize bytes
     //MP4
     FileHeader *nextHeader;	//'in-core'
     int nextHeaderSector;	//'disk'
+    //MP4 compress
+    bool compressed;		//'disk', as CompressedFlag in numBytes of
+				// the first header
+    //MP4 inline
+    bool changed;		//'in-core', this header differs from disk
 };
 
 #endif // FILEHDR_H
@@ -30,7 +30,7 @@
 //
 // 	Our implementation at this point has the following restrictions:
 //
-//	   there is no synchronization for concurrent accesses
+//	   (MP4 lock: concurrent accesses are synchronized, see below)
 //	   files have a fixed size, set when the file is created
 //	   files cannot be bigger than about 3KB in size
 //	   there is no hierarchical directory structure, and only a limited
@@ -39,6 +39,26 @@
 //	    (if Nachos exits in the middle of an operation that modifies
 //	    the file system, it may corrupt the disk)
 //
+//MP4 lock
+//	Concurrent operations are synchronized by several locks, always
+//	acquired in this order, so that no two threads can wait for each
+//	other:
+//
+//	   "treeLock", held for reading by every operation that looks up a
+//	     path, and for writing while directories vanish or move (Remove
+//	     of a directory, Defrag), so that lookups need no other lock
+//	   the directory locks (DirLock), one per directory, held for
+//	     writing to change its entries, parent before child
+//	   the file locks (FileLock), one per file header, held by OpenFile
+//	     for reading or writing the file, and to change its header
+//	   "allocLock", held to change the bitmap, the reference counts or
+//	     the dedup index
+//	   the synchronous disk, which queues the requests of any number of
+//	     threads
+//
+//	So operations in different directories, and reads and writes of
+//	different files, proceed in parallel, except while they allocate.
+//
 // Copyright (c) 1992-1993 The Regents of the University of California.
 // All rights reserved.  See copyright.h for copyright notice and limitation 
 // of liability and disclaimer of warranty provisions.
@@ -51,19 +71,18 @@
 #include "directory.h"
 #include "filehdr.h"
 #include "filesys.h"
-
-// Sectors containing the file headers for the bitmap of free sectors,
-// and the directory of files.  These file headers are placed in well-known 
-// sectors, so that they can be located on boot-up.
-#define FreeMapSector 		0
-#define DirectorySector 	1
+#include "refcount.h"
+#include "dedup.h"
+#include "compress.h"
+#include "iostats.h"
+#include "synchdisk.h"
+#include "synch.h"
+#include "main.h"
 
 // Initial file sizes for the bitmap and directory; until the file system
 // supports extensible files, the directory size sets the maximum number 
 // of files that can be loaded onto the disk.
 #define FreeMapFileSize 	(NumSectors / BitsInByte)
-//MP4: extend to '64' files/subdirectories per directory
-#define NumDirEntries 		64
 #define DirectoryFileSize 	(sizeof(DirectoryEntry) * NumDirEntries)
 
 //----------------------------------------------------------------------
@@ -82,11 +101,19 @@
 FileSystem::FileSystem(bool format)
 { 
     DEBUG(dbgFile, "Initializing the file system.");
+    //MP4 iostat: the system files are opened below, before "kernel" knows
+    // about us, so only their later traffic is counted
+    ioStats = new IOStats(NumSectors);
+    ioStats->Name(FreeMapSector, "[bitmap]");
+    ioStats->Name(DirectorySector, "/");
+    ioStats->Name(RefCountSector, "[refcounts]");
+    ioStats->Name(FormatSector, "[format]");
     if (format) {
         PersistentBitmap *freeMap = new PersistentBitmap(NumSectors);
         Directory *directory = new Directory(NumDirEntries);
 		FileHeader *mapHdr = new FileHeader;
 		FileHeader *dirHdr = new FileHeader;
+		FileHeader *refHdr = new FileHeader;
 
         DEBUG(dbgFile, "Formatting the file system.");
 
@@ -94,12 +121,17 @@ FileSystem::FileSystem(bool format)
 		// (make sure no one else grabs these!)
 		freeMap->Mark(FreeMapSector);	    
 		freeMap->Mark(DirectorySector);
+		freeMap->Mark(RefCountSector);
+		freeMap->Mark(FormatSector);
+		WriteFormat();
 
 		// Second, allocate space for the data blocks containing the contents
 		// of the directory and bitmap files.  There better be enough space!
 
 		ASSERT(mapHdr->Allocate(freeMap, FreeMapFileSize));
 		ASSERT(dirHdr->Allocate(freeMap, DirectoryFileSize));
+		//MP4 clone: nothing is shared yet, the table starts out empty
+		ASSERT(refHdr->Allocate(freeMap, 0));
 
 		// Flush the bitmap and directory FileHeaders back to disk
 		// We need to do this before we can "Open" the file, since open
@@ -109,6 +141,7 @@ FileSystem::FileSystem(bool format)
         DEBUG(dbgFile, "Writing headers back to disk.");
 		mapHdr->WriteBack(FreeMapSector);    
 		dirHdr->WriteBack(DirectorySector);
+		refHdr->WriteBack(RefCountSector);
 
 		// OK to open the bitmap and directory files now
 		// The file system operations assume these two files are left open
@@ -116,6 +149,7 @@ FileSystem::FileSystem(bool format)
 
         freeMapFile = new OpenFile(FreeMapSector);
         directoryFile = new OpenFile(DirectorySector);
+        refCountFile = new OpenFile(RefCountSector);
      
 		// Once we have the files "open", we can write the initial version
 		// of each file back to disk.  The directory at this point is completely
@@ -135,16 +169,78 @@ FileSystem::FileSystem(bool format)
 		delete directory; 
 		delete mapHdr; 
 		delete dirHdr;
+		delete refHdr;
     } else {
+		//MP4 format: nothing else on a disk of another format can be
+		// trusted, not even the headers of the system files
+		CheckFormat();
 		// if we are not formatting the disk, just open the files representing
 		// the bitmap and directory; these are left open while Nachos is running
         freeMapFile = new OpenFile(FreeMapSector);
         directoryFile = new OpenFile(DirectorySector);
+        refCountFile = new OpenFile(RefCountSector);
+    }
+    refs = new RefCount;
+    refs->FetchFrom(refCountFile);
+    dedup = NULL;
+    //MP4 lock
+    treeLock = new RWLock("tree lock");
+    allocLock = new Lock("alloc lock");
+    dirLocks = new RWLock *[NumSectors];
+    fileLocks = new RWLock *[NumSectors];
+    headerVersions = new int[NumSectors];
+    for (int i = 0; i < NumSectors; i++) {
+	dirLocks[i] = NULL;
+	fileLocks[i] = NULL;
+	headerVersions[i] = 0;
+    }
+    //MP4 fd table
+    openCount = new int[NumSectors];
+    for (int i = 0; i < NumSectors; i++)
+	openCount[i] = 0;
+}
+
+//----------------------------------------------------------------------
+// FileSystem::WriteFormat
+// 	Write the format marker into FormatSector, when the disk is
+//	formatted (by -f, or by mkfs).
+//----------------------------------------------------------------------
+
+void
+FileSystem::WriteFormat()
+{
+    int marker[SectorSize / sizeof(int)];
+
+    memset(marker, 0, sizeof(marker));
+    marker[0] = FormatMagic;
+    marker[1] = FormatVersion;
+    kernel->synchDisk->WriteSector(FormatSector, (char *) marker);
+}
+
+//----------------------------------------------------------------------
+// FileSystem::CheckFormat
+// 	Stop Nachos, with a message, if the disk was not formatted in
+//	this version of the on-disk format: an old disk lays out its
+//	headers differently, and would be misread and then corrupted.
+//----------------------------------------------------------------------
+
+void
+FileSystem::CheckFormat()
+{
+    int marker[SectorSize / sizeof(int)];
+
+    kernel->synchDisk->ReadSector(FormatSector, (char *) marker);
+    if (marker[0] != FormatMagic) {
+	cerr << "The disk has no Nachos file system of this format; "
+	     << "format it with -f\n";
+	Exit(1);
     }
-    for(int i=0;i<20;i++){
-        fileDescriptorTable[i] = NULL;
+    if (marker[1] != FormatVersion) {
+	cerr << "The disk is in version " << marker[1] << " of the file "
+	     << "system format, not " << FormatVersion << "; format it "
+	     << "with -f\n";
+	Exit(1);
     }
-    top = 0;
 }
 
 //----------------------------------------------------------------------
@@ -155,9 +251,21 @@ FileSystem::~FileSystem()
 {
 	delete freeMapFile;
 	delete directoryFile;
-    for(int i=0;i<top;i++){
-        fileDescriptorTable[i] = NULL;
-    }
+	delete refs;
+	delete refCountFile;
+	delete dedup;
+	//MP4 lock
+	for (int i = 0; i < NumSectors; i++) {
+	    delete dirLocks[i];
+	    delete fileLocks[i];
+	}
+	delete [] dirLocks;
+	delete [] fileLocks;
+	delete [] headerVersions;
+	delete allocLock;
+	delete treeLock;
+	delete ioStats;
+	delete [] openCount;
 }
 
 //----------------------------------------------------------------------
@@ -182,8 +290,9 @@ FileSystem::~FileSystem()
 //	 	no free entry for file in directory
 //	 	no free space for data blocks for the file 
 //
-// 	Note that this implementation assumes there is no concurrent access
-//	to the file system!
+//	MP4 lock: the parent directory is locked for writing, and the
+//	bitmap only while the sectors are found; the new header and the
+//	directory are written back after that.
 //
 //	"name" -- name of file to be created
 //	"initialSize" -- size of file to be created
@@ -197,12 +306,14 @@ FileSystem::Create(char *pathName, int initialSize, bool isDir)
     FileHeader *hdr;
     int sector;
     bool success;
+    int startTicks = ioStats->StartOperation();	//MP4 iostat
 
     //MP4
     if(isDir)   initialSize = DirectoryFileSize;
     //check path length <= 255
     if(strlen(pathName) > 255){
         printf("Path %s exceeds Max path length 255\n", pathName);
+        ioStats->EndOperation(FsCreate, startTicks);
         return FALSE;
     }
 
@@ -216,10 +327,15 @@ FileSystem::Create(char *pathName, int initialSize, bool isDir)
     //use the buf to 'cut' the path, in order not to change the original pathName
     strcpy(buf, pathName);
 
+    treeLock->AcquireRead();		//MP4 lock
     OpenFile *curDirFile = getSubDir(buf);
     if(curDirFile==NULL){   //directory not found or just root
+        treeLock->ReleaseRead();
+        ioStats->EndOperation(FsCreate, startTicks);
         return FALSE;
     }
+    RWLock *dirLock = DirLock(curDirFile->HeaderSector());
+    dirLock->AcquireWrite();
 
     directory = new Directory(NumDirEntries);
     directory->FetchFrom(curDirFile);
@@ -229,23 +345,29 @@ FileSystem::Create(char *pathName, int initialSize, bool isDir)
       success = FALSE;			// file is already in directory
     }
     else {	
+        hdr = new FileHeader;
+        allocLock->Acquire();
         freeMap = new PersistentBitmap(freeMapFile,NumSectors);
         sector = freeMap->FindAndSet();	// find a sector to hold the file header
     	if (sector == -1)	
             success = FALSE;		// no free block for file header 
         else if (!directory->Add(name, sector, isDir))
             success = FALSE;	// no space in directory
-	else {
-    	    hdr = new FileHeader;
-	    if (!hdr->Allocate(freeMap, initialSize))
-            	success = FALSE;	// no space on disk for data
-	    else {	
-	    	success = TRUE;
-		// everthing worked, flush all changes back to disk
-    	    	hdr->WriteBack(sector);
-                //MP4: store back to 'curDirFile' 		
-    	    	directory->WriteBack(curDirFile);
-    	    	freeMap->WriteBack(freeMapFile);
+	else if (!hdr->Allocate(freeMap, initialSize))
+            success = FALSE;	// no space on disk for data
+	else {	
+	    success = TRUE;
+	    freeMap->WriteBack(freeMapFile);
+	}
+        allocLock->Release();
+        delete freeMap;
+
+	if (success) {
+	    ioStats->NewInode(sector, pathName);	//MP4 iostat
+	    // everthing worked, flush all changes back to disk
+    	    hdr->WriteBack(sector);
+            //MP4: store back to 'curDirFile' 		
+    	    directory->WriteBack(curDirFile);
             
             //MP4: if this file is "DIR" -> initialize directory structure
             if(isDir)
@@ -256,15 +378,16 @@ FileSystem::Create(char *pathName, int initialSize, bool isDir)
                 delete dirFile;
                 delete dir;
             }
-	    }
-            delete hdr;
 	}
-        delete freeMap;
+        delete hdr;
     }
+    dirLock->ReleaseWrite();
+    treeLock->ReleaseRead();
     //remember to delete curDirFile, if it's not root
     if(curDirFile!=NULL && curDirFile!=directoryFile)   delete curDirFile;
 
     delete directory;
+    ioStats->EndOperation(FsCreate, startTicks);
     return success;
 }
 
@@ -283,6 +406,7 @@ FileSystem::Open(char *pathName)
 { 
     OpenFile *openFile = NULL;
     int sector;
+    int startTicks = ioStats->StartOperation();	//MP4 iostat
 
     DEBUG(dbgFile, "Opening file" << pathName);
 
@@ -290,33 +414,33 @@ FileSystem::Open(char *pathName)
     char name[1024], buf[1024];
     getFileName(name, pathName);
     strcpy(buf, pathName);
+    treeLock->AcquireRead();		//MP4 lock
     OpenFile *curDirFile = getSubDir(buf);
     if(curDirFile==NULL){   //file not found
+        treeLock->ReleaseRead();
+        ioStats->EndOperation(FsOpen, startTicks);
         return NULL;
     }
+    RWLock *dirLock = DirLock(curDirFile->HeaderSector());
+    dirLock->AcquireRead();
 
     Directory *directory = new Directory(NumDirEntries);
     directory->FetchFrom(curDirFile);
 
     sector = directory->Find(name); 
 
-    //MP4
-    //at most 20 file opened at a time
-    if(top>=20){
-        if(curDirFile!=NULL && curDirFile!=directoryFile)   delete curDirFile;
-        delete directory;
-        return NULL;
-    }
-
     if (sector >= 0){
+        ioStats->Name(sector, pathName);	//MP4 iostat
         openFile = new OpenFile(sector);// name was found in directory 
-        fileDescriptorTable[top++] = openFile;
     }
+    dirLock->ReleaseRead();
+    treeLock->ReleaseRead();
 
     //remember to delete curDirFile, if it's not root
     if(curDirFile!=NULL && curDirFile!=directoryFile)   delete curDirFile;
 		
     delete directory;
+    ioStats->EndOperation(FsOpen, startTicks);
     return openFile;				// return NULL if not found
 }
 
@@ -331,6 +455,16 @@ FileSystem::Open(char *pathName)
 //	Return TRUE if the file was deleted, FALSE if the file wasn't
 //	in the file system.
 //
+//	The path is resolved once; a directory removed recursively is then
+//	walked by the sectors of its subdirectories (see RemoveTree), and
+//	the bitmap and the parent directory are written back only once,
+//	however many files the tree holds.
+//
+//	MP4 lock: removing a directory holds "treeLock" for writing, so
+//	that no lookup can be inside it.  Removing a file waits for the
+//	threads reading or writing it to finish.
+//
+//	"recursive" -- also remove everything under a directory
 //	"name" -- the text name of the file to be removed
 //----------------------------------------------------------------------
 
@@ -339,80 +473,647 @@ FileSystem::Remove(bool recursive, char *pathName)
 { 
     Directory *directory;
     PersistentBitmap *freeMap;
-    FileHeader *fileHdr;
+    OpenFile *curDirFile;
+    RWLock *dirLock = NULL, *fileLock = NULL;
     int sector;
+    bool isDir;
+    bool exclusive = FALSE;	//MP4 lock: holding "treeLock" for writing
+    int startTicks = ioStats->StartOperation();	//MP4 iostat
 
     //MP4
     char name[1024], buf[1024];
     getFileName(name, pathName);
-    strcpy(buf, pathName);
 
-    OpenFile *curDirFile = getSubDir(buf);
-    if(curDirFile==NULL){
-        return NULL;
-    }
-    
     directory = new Directory(NumDirEntries);
-    directory->FetchFrom(curDirFile);
-
-    sector = directory->Find(name);
+    for (;;) {
+	strcpy(buf, pathName);
+	if (exclusive)
+	    treeLock->AcquireWrite();
+	else
+	    treeLock->AcquireRead();
+	curDirFile = getSubDir(buf);
+	if(curDirFile==NULL){
+	    sector = -1;
+	    break;
+	}
+	if (!exclusive) {
+	    dirLock = DirLock(curDirFile->HeaderSector());
+	    dirLock->AcquireWrite();
+	}
+	directory->FetchFrom(curDirFile);
+
+	sector = directory->Find(name);
+	if (sector == -1)
+	    break;			// file not found
+	isDir = directory->isDir(name);
+	if (!isDir || exclusive)
+	    break;
+
+	//MP4 lock: a directory goes away only while no lookup can be
+	// inside it; start over with the whole tree to ourselves
+	dirLock->ReleaseWrite();
+	dirLock = NULL;
+	treeLock->ReleaseRead();
+	if(curDirFile!=directoryFile)   delete curDirFile;
+	exclusive = TRUE;
+    }
     if (sector == -1) {
+       if (dirLock != NULL)
+	   dirLock->ReleaseWrite();
+       if (exclusive)
+	   treeLock->ReleaseWrite();
+       else
+	   treeLock->ReleaseRead();
        //MP4
        if(curDirFile!=NULL && curDirFile!=directoryFile)   delete curDirFile;
        delete directory;
+       ioStats->EndOperation(FsRemove, startTicks);
        return FALSE;			 // file not found 
     }
-    if(directory->isDir(name)){
+    if(isDir){
         //cout<<"Remove Dir "<<name<<endl;
         printf("Remove Dir %s\n", name);
     }
-    else
+    else {
         printf("Remove File %s\n", name);
+	//MP4 lock: wait for the threads reading or writing the file
+	fileLock = FileLock(sector);
+	fileLock->AcquireWrite();
+    }
 
     //MP4 bonus: recursive remove a directory
     //PS: target dir will 'never' be the root
-    if(directory->isDir(name) && recursive){
-        OpenFile *targetDirFile = new OpenFile(sector);
-        Directory *targetDir = new Directory(NumDirEntries);
-        targetDir->FetchFrom(targetDirFile);
-
-        for(int i=0;i<targetDir->tableSize;i++){
-            if(targetDir->table[i].inUse){
-                //modified the path -> add addition one '/', ready for appending filename at the back
-                char targetPath[1024];
-                strcpy(targetPath, pathName);
-                int len = strlen(targetPath);
-                targetPath[len] = '/';
-                //append the file at the back
-                strcpy(targetPath+len+1, targetDir->table[i].name);
-                Remove(recursive, targetPath);
-            }
-        }
-        delete targetDir;
-        delete targetDirFile;
-    }
-    fileHdr = new FileHeader;
-    fileHdr->FetchFrom(sector);
+    ::List<int> *doomed = new ::List<int>;
+    if(isDir && recursive)
+        RemoveTree(sector, doomed);
+    doomed->Append(sector);
 
+    allocLock->Acquire();
     freeMap = new PersistentBitmap(freeMapFile,NumSectors);
+    while (!doomed->IsEmpty())
+	RemoveFile(doomed->RemoveFront(), freeMap);
+    freeMap->WriteBack(freeMapFile);		// flush to disk
+    refs->WriteBack(refCountFile);		// (after the bitmap; may grow)
+    allocLock->Release();
 
-    fileHdr->Deallocate(freeMap);  		// remove data blocks
-    freeMap->Clear(sector);			// remove header block
     directory->Remove(name);
-
-    freeMap->WriteBack(freeMapFile);		// flush to disk
     //MP4: to 'curDir'
     directory->WriteBack(curDirFile);        // flush to disk
 
+    if (fileLock != NULL)
+	fileLock->ReleaseWrite();
+    if (dirLock != NULL)
+	dirLock->ReleaseWrite();
+    if (exclusive)
+	treeLock->ReleaseWrite();
+    else
+	treeLock->ReleaseRead();
     //remember to delete curDirFile, if it's not root
     if(curDirFile!=NULL && curDirFile!=directoryFile)   delete curDirFile;
 
-    delete fileHdr;
+    delete doomed;
     delete directory;
     delete freeMap;
+    ioStats->EndOperation(FsRemove, startTicks);
     return TRUE;
 } 
 
+//----------------------------------------------------------------------
+// FileSystem::RemoveTree
+// 	Append to "doomed" the header sectors of everything under the
+//	directory whose header is at "sector", descending into
+//	subdirectories by their header sectors.  Nothing is freed yet:
+//	the caller frees them all at once, under "allocLock", which it
+//	cannot hold while reading the directories.
+//----------------------------------------------------------------------
+
+void
+FileSystem::RemoveTree(int sector, ::List<int> *doomed)
+{
+    OpenFile *dirFile = new OpenFile(sector);
+    Directory *dir = new Directory(NumDirEntries);
+
+    dir->FetchFrom(dirFile);
+    for (int i = 0; i < dir->tableSize; i++) {
+	DirectoryEntry *entry = &dir->table[i];
+
+	if (!entry->inUse)
+	    continue;
+	if (entry->isDir) {
+	    printf("Remove Dir %s\n", entry->name);
+	    RemoveTree(entry->sector, doomed);
+	} else {
+	    printf("Remove File %s\n", entry->name);
+	}
+	doomed->Append(entry->sector);
+    }
+    delete dir;
+    delete dirFile;
+}
+
+//----------------------------------------------------------------------
+// FileSystem::RemoveFile
+// 	Clear in "freeMap" the header and data sectors of the file whose
+//	header is at "sector".
+//----------------------------------------------------------------------
+
+void
+FileSystem::RemoveFile(int sector, PersistentBitmap *freeMap)
+{
+    FileHeader *fileHdr = new FileHeader;
+
+    fileHdr->FetchFrom(sector);
+    fileHdr->Deallocate(freeMap, refs, dedup);	// remove data blocks
+    freeMap->Clear(sector);			// remove header block
+    delete fileHdr;
+}
+
+//----------------------------------------------------------------------
+// FileSystem::Extend
+// 	Grow an open file to "newSize" bytes, taking any sectors it needs
+//	from the bitmap, and flush the bitmap and the file header to disk.
+//	Return FALSE if the disk is full.
+//
+//	An inline file that still fits in its header needs no sectors;
+//	then only the in-core header changes, and the caller writes it
+//	back together with the new data.  A file that grows into the rest
+//	of its last block needs no sectors either, and the bitmap is left
+//	alone.  Either way only the headers that changed are written.
+//
+//	MP4 lock: the reference count file grows while "allocLock" is
+//	already held, by whoever writes the counts back.
+//
+//	"hdr" is the in-core header of the file
+//	"sector" is the disk sector holding that header
+//	"newSize" is the new length of the file, in bytes
+//----------------------------------------------------------------------
+
+bool
+FileSystem::Extend(FileHeader *hdr, int sector, int newSize)
+{
+    PersistentBitmap *freeMap;
+    bool success;
+    bool held = allocLock->IsHeldByCurrentThread();
+
+    if (hdr->IsInline() && newSize <= (int) InlineSize)
+	return hdr->Extend(NULL, newSize);
+    if (hdr->SectorsNeeded(newSize) == 0) {
+	hdr->Extend(NULL, newSize);
+	hdr->WriteChanged(sector);
+	HeaderChanged(sector);
+	return TRUE;
+    }
+
+    DEBUG(dbgFile, "Extending file at sector " << sector << " to " << newSize);
+    if (!held)
+	allocLock->Acquire();
+    freeMap = new PersistentBitmap(freeMapFile,NumSectors);
+    success = hdr->Extend(freeMap, newSize);
+    if (success) {
+	freeMap->WriteBack(freeMapFile);
+	hdr->WriteChanged(sector);
+	HeaderChanged(sector);
+    }
+    if (!held)
+	allocLock->Release();
+    delete freeMap;
+    return success;
+}
+
+//----------------------------------------------------------------------
+// FileSystem::Clone
+// 	Create the file "toPath" as a clone of the file "fromPath": it gets
+//	header sectors of its own, but shares every data block with the
+//	original, so that no data is copied.  Whichever file later writes
+//	to a shared block gets its own copy of that block (see Unshare).
+//
+//	Return FALSE if "fromPath" is not a file, "toPath" already exists
+//	or cannot be created, or there is no room for the headers.
+//
+//	MP4 lock: the original is locked for reading while it is cloned,
+//	so that no write to it is half done.
+//----------------------------------------------------------------------
+
+bool
+FileSystem::Clone(char *fromPath, char *toPath)
+{
+    Directory *directory;
+    PersistentBitmap *freeMap;
+    FileHeader *hdr;
+    int fromSector, sector;
+    bool success = FALSE;
+    char name[1024], buf[1024];
+
+    DEBUG(dbgFile, "Cloning file " << fromPath << " to " << toPath);
+
+    // find the original
+    getFileName(name, fromPath);
+    strcpy(buf, fromPath);
+    treeLock->AcquireRead();		//MP4 lock
+    OpenFile *curDirFile = getSubDir(buf);
+    if (curDirFile == NULL) {
+	treeLock->ReleaseRead();
+	return FALSE;
+    }
+    RWLock *dirLock = DirLock(curDirFile->HeaderSector());
+    dirLock->AcquireRead();
+    directory = new Directory(NumDirEntries);
+    directory->FetchFrom(curDirFile);
+    fromSector = directory->Find(name);
+    if (fromSector != -1 && directory->isDir(name))
+	fromSector = -1;			// only files can be cloned
+    dirLock->ReleaseRead();
+    if (curDirFile != directoryFile)
+	delete curDirFile;
+    delete directory;
+    if (fromSector == -1) {
+	treeLock->ReleaseRead();
+	return FALSE;
+    }
+
+    // and where the clone goes
+    getFileName(name, toPath);
+    strcpy(buf, toPath);
+    curDirFile = getSubDir(buf);
+    if (curDirFile == NULL) {
+	treeLock->ReleaseRead();
+	return FALSE;
+    }
+    dirLock = DirLock(curDirFile->HeaderSector());
+    dirLock->AcquireWrite();
+    directory = new Directory(NumDirEntries);
+    directory->FetchFrom(curDirFile);
+
+    if (directory->Find(name) == -1 && strlen(name) <= FileNameMaxLen) {
+	RWLock *fromLock = FileLock(fromSector);
+
+	hdr = new FileHeader;
+	fromLock->AcquireRead();
+	hdr->FetchFrom(fromSector);
+	allocLock->Acquire();
+	freeMap = new PersistentBitmap(freeMapFile,NumSectors);
+	sector = freeMap->FindAndSet();
+	if (sector != -1 && directory->Add(name, sector, FALSE)
+		&& hdr->Clone(freeMap, refs)) {
+	    success = TRUE;
+	    freeMap->WriteBack(freeMapFile);
+	    refs->WriteBack(refCountFile);	// (after the bitmap; may grow)
+	}
+	allocLock->Release();
+	fromLock->ReleaseRead();
+	if (success) {
+	    ioStats->NewInode(sector, toPath);	//MP4 iostat
+	    hdr->WriteBack(sector);
+	    directory->WriteBack(curDirFile);
+	}
+	delete hdr;
+	delete freeMap;
+    }
+    dirLock->ReleaseWrite();
+    treeLock->ReleaseRead();
+    if (curDirFile != directoryFile)
+	delete curDirFile;
+    delete directory;
+    return success;
+}
+
+//----------------------------------------------------------------------
+// FileSystem::Unshare
+// 	Copy-on-write: called by OpenFile::WriteAt with the data blocks it
+//	is about to overwrite entirely.  Any of them still shared with a
+//	clone is replaced, in "sectors" and in the file header, by a newly
+//	allocated sector, and loses one reference.  The caller writes the
+//	new contents to all of "sectors", so nothing needs to be copied
+//	here.  Return FALSE, changing nothing, if the disk is full.
+//
+//	"hdr" is the in-core header of the file
+//	"sector" is the disk sector holding that header
+//	"first" is the index in the file of the first block written
+//	"count" is the number of blocks written
+//	"sectors" holds their sector numbers
+//----------------------------------------------------------------------
+
+bool
+FileSystem::Unshare(FileHeader *hdr, int sector, int first, int count,
+		int *sectors)
+{
+    PersistentBitmap *freeMap;
+    int numShared = 0;
+
+    //MP4 lock: the system files are never shared, and are written
+    // with "allocLock" held
+    if (sector == FreeMapSector || sector == RefCountSector)
+	return TRUE;
+    allocLock->Acquire();
+    if (refs->NumShared() == 0) {
+	allocLock->Release();
+	return TRUE;				// nothing is shared
+    }
+    for (int i = 0; i < count; i++)
+	if (refs->Extra(sectors[i]) > 0)
+	    numShared++;
+    if (numShared == 0) {
+	allocLock->Release();
+	return TRUE;
+    }
+
+    DEBUG(dbgFile, "Unsharing " << numShared << " blocks of file at sector " << sector);
+    freeMap = new PersistentBitmap(freeMapFile,NumSectors);
+    if (freeMap->NumClear() < numShared) {
+	allocLock->Release();
+	delete freeMap;
+	return FALSE;
+    }
+    for (int i = 0; i < count; i++) {
+	if (refs->Extra(sectors[i]) > 0) {
+	    refs->Unshare(sectors[i]);
+	    sectors[i] = freeMap->FindAndSet();
+	    hdr->SetDataSector(first + i, sectors[i]);
+	}
+    }
+    freeMap->WriteBack(freeMapFile);
+    hdr->WriteChanged(sector);
+    HeaderChanged(sector);
+    refs->WriteBack(refCountFile);		// (after the bitmap; may grow)
+    allocLock->Release();
+    delete freeMap;
+    return TRUE;
+}
+
+//----------------------------------------------------------------------
+// FileSystem::EnableDedup
+// 	Turn on deduplication of file data: from now on, a block written
+//	with the same contents as a data block already on disk shares
+//	that block instead of keeping a sector of its own.  The index of
+//	block contents starts with the data of every file on disk.
+//
+//	MP4 lock: the index is built before anyone can use it, without
+//	"allocLock"; blocks that change meanwhile no longer match their
+//	entries, and Dedup checks that a match is still in use.
+//----------------------------------------------------------------------
+
+void
+FileSystem::EnableDedup()
+{
+    DedupIndex *index;
+
+    if (dedup != NULL)
+	return;
+    index = new DedupIndex(NumSectors);
+    treeLock->AcquireRead();
+    IndexTree(DirectorySector, index);
+    treeLock->ReleaseRead();
+    DEBUG(dbgFile, "Dedup index holds " << index->NumIndexed() << " blocks");
+    allocLock->Acquire();
+    if (dedup == NULL)
+	dedup = index;
+    else
+	delete index;			// someone else got there first
+    allocLock->Release();
+}
+
+//----------------------------------------------------------------------
+// FileSystem::IndexTree
+// 	Add every data block of the files under the directory whose header
+//	is at "sector" to "index".  Blocks that are already shared were
+//	indexed through the first file met.
+//----------------------------------------------------------------------
+
+void
+FileSystem::IndexTree(int sector, DedupIndex *index)
+{
+    OpenFile *dirFile = new OpenFile(sector);
+    Directory *dir = new Directory(NumDirEntries);
+    FileHeader *hdr;
+    char buf[SectorSize];
+    int numSectors, *list;
+
+    dir->FetchFrom(dirFile);
+    for (int i = 0; i < dir->tableSize; i++) {
+	DirectoryEntry *entry = &dir->table[i];
+
+	if (!entry->inUse)
+	    continue;
+	if (entry->isDir) {
+	    IndexTree(entry->sector, index);
+	    continue;
+	}
+	hdr = new FileHeader;
+	FileLock(entry->sector)->AcquireRead();		//MP4 lock
+	hdr->FetchFrom(entry->sector);
+	FileLock(entry->sector)->ReleaseRead();
+	numSectors = hdr->IsInline() ? 0
+			: divRoundUp(hdr->FileLength(), SectorSize);
+	list = new int[numSectors];
+	hdr->ByteToSectors(0, numSectors, list);
+	for (int j = 0; j < numSectors; j++) {
+	    if (list[j] == NoSector)	// hole of a compressed extent
+		continue;
+	    kernel->synchDisk->ReadSector(list[j], buf);
+	    index->Add(list[j], DedupIndex::Hash(buf));
+	}
+	delete [] list;
+	delete hdr;
+    }
+    delete dir;
+    delete dirFile;
+}
+
+//----------------------------------------------------------------------
+// FileSystem::Dedup
+// 	Called by OpenFile::WriteAt, after Unshare, with the data blocks
+//	it is about to write.  Each block whose contents are already on
+//	disk, in the index or earlier in this same write, is pointed at
+//	that copy instead: the copy gains a reference, the sector the
+//	block had loses one, and "shared" tells the caller not to write
+//	it.  The other blocks are entered into the index with their new
+//	contents.  The bitmap and the reference counts are written
+//	through here too, and are never shared; nor are directories,
+//	which do not come here (OpenFile::SetDirectory).  Only data
+//	blocks are ever indexed, and a sector is forgotten when it is
+//	freed, so no header sector can be found and shared either.
+//
+//	MP4 lock: the caller holds the file lock, so nobody else writes
+//	"sectors"; a block in the index is compared with the disk under
+//	"allocLock", and only shared while it is still in use.
+//
+//	"hdr" is the in-core header of the file
+//	"sector" is the disk sector holding that header
+//	"first" is the index in the file of the first block written
+//	"count" is the number of blocks written
+//	"sectors" holds their sector numbers
+//	"data" holds their new contents
+//	"shared" is set for each block that was not written
+//----------------------------------------------------------------------
+
+void
+FileSystem::Dedup(FileHeader *hdr, int sector, int first, int count,
+		int *sectors, char *data, bool *shared)
+{
+    PersistentBitmap *freeMap = NULL;
+    unsigned *hashes;
+    int match, numHits = 0;
+
+    for (int i = 0; i < count; i++)
+	shared[i] = FALSE;
+    if (dedup == NULL || sector == FreeMapSector || sector == RefCountSector)
+	return;
+
+    allocLock->Acquire();
+    hashes = new unsigned[count];
+    for (int i = 0; i < count; i++) {
+	char *block = &data[i * SectorSize];
+
+	hashes[i] = DedupIndex::Hash(block);
+	// blocks written earlier in this call are not on disk yet
+	match = -1;
+	for (int j = 0; j < i && match == -1; j++)
+	    if (hashes[j] == hashes[i] && sectors[j] != sectors[i]
+		    && memcmp(&data[j * SectorSize], block, SectorSize) == 0)
+		match = sectors[j];
+	if (match == -1)
+	    match = dedup->Find(block, hashes[i], sectors, count);
+	if (match != -1 && freeMap == NULL)
+	    freeMap = new PersistentBitmap(freeMapFile,NumSectors);
+	if (match != -1 && !freeMap->Test(match)) {
+	    dedup->Forget(match);		// freed since it was indexed
+	    match = -1;
+	}
+	if (match == -1) {
+	    dedup->Add(sectors[i], hashes[i]);
+	    continue;
+	}
+
+	DEBUG(dbgFile, "Block " << first + i << " of file at sector " << sector << " shares sector " << match);
+	if (!refs->Unshare(sectors[i])) {
+	    freeMap->Clear(sectors[i]);
+	    dedup->Forget(sectors[i]);
+	}
+	refs->Share(match);
+	hdr->SetDataSector(first + i, match);
+	sectors[i] = match;
+	shared[i] = TRUE;
+	numHits++;
+    }
+    if (numHits > 0) {
+	dedup->numHits += numHits;
+	freeMap->WriteBack(freeMapFile);
+	hdr->WriteChanged(sector);
+	HeaderChanged(sector);
+	refs->WriteBack(refCountFile);	// (after the bitmap; may grow)
+    }
+    allocLock->Release();
+    delete freeMap;
+    delete [] hashes;
+}
+
+//----------------------------------------------------------------------
+// FileSystem::DedupReport
+// 	Print what deduplication did in this run, and how much space all
+//	the sharing of data blocks (by dedup and by clones) saves on disk.
+//----------------------------------------------------------------------
+
+void
+FileSystem::DedupReport()
+{
+    int saved;
+
+    allocLock->Acquire();			//MP4 lock
+    saved = refs->NumSaved();
+    if (dedup != NULL)
+	printf("Dedup: %d blocks indexed, %d writes shared an existing block, "
+		"%d blocks compared\n", dedup->NumIndexed(), dedup->numHits,
+		dedup->numCompared);
+    printf("Sharing saves %d sectors (%d bytes) in %d shared sectors\n",
+	    saved, saved * SectorSize, refs->NumShared());
+    allocLock->Release();
+}
+
+//----------------------------------------------------------------------
+// FileSystem::Repack
+// 	Called by OpenFile::WriteAt for a compressed file, with the data
+//	blocks of the whole extents it is about to write.  Extent "k" of
+//	them keeps "used[k]" leading blocks, which must have sectors of
+//	their own; the rest of its blocks become holes (NoSector), and
+//	their sectors are released.  As for Unshare, "sectors" and the
+//	file header are updated, and the caller writes the new contents
+//	to every sector left in "sectors".  Return FALSE, changing
+//	nothing, if the disk is full.
+//
+//	"hdr" is the in-core header of the file
+//	"sector" is the disk sector holding that header
+//	"first" is the index in the file of the first block, the first
+//	of an extent
+//	"count" is the number of blocks
+//	"sectors" holds their sector numbers, or NoSector
+//	"used" is the number of blocks each extent keeps
+//----------------------------------------------------------------------
+
+bool
+FileSystem::Repack(FileHeader *hdr, int sector, int first, int count,
+		int *sectors, int *used)
+{
+    PersistentBitmap *freeMap;
+    int numNew = 0, numReleased = 0, numFreed = 0;
+    bool keep;
+
+    allocLock->Acquire();			//MP4 lock
+    for (int i = 0; i < count; i++) {
+	keep = (i % ExtentSectors) < used[i / ExtentSectors];
+	if (dedup != NULL && sectors[i] != NoSector)
+	    dedup->Forget(sectors[i]);		// contents change either way
+	if (keep && (sectors[i] == NoSector || refs->Extra(sectors[i]) > 0))
+	    numNew++;
+	else if (!keep && sectors[i] != NoSector) {
+	    numReleased++;
+	    if (refs->Extra(sectors[i]) == 0)
+		numFreed++;
+	}
+    }
+    if (numNew == 0 && numReleased == 0) {
+	// same sectors as before, but other OpenFiles of the file may
+	// hold the old data of these extents in their extent cache
+	HeaderChanged(sector);
+	allocLock->Release();
+	return TRUE;
+    }
+
+    DEBUG(dbgFile, "Repacking file at sector " << sector << ": " << numNew << " new, " << numReleased << " released");
+    freeMap = new PersistentBitmap(freeMapFile,NumSectors);
+    if (freeMap->NumClear() + numFreed < numNew) {
+	allocLock->Release();
+	delete freeMap;
+	return FALSE;
+    }
+    // release first, so that the kept blocks can reuse the sectors
+    for (int i = 0; i < count; i++) {
+	keep = (i % ExtentSectors) < used[i / ExtentSectors];
+	if (keep || sectors[i] == NoSector)
+	    continue;
+	if (!refs->Unshare(sectors[i]))
+	    freeMap->Clear(sectors[i]);
+	sectors[i] = NoSector;
+	hdr->SetDataSector(first + i, NoSector);
+    }
+    for (int i = 0; i < count; i++) {
+	keep = (i % ExtentSectors) < used[i / ExtentSectors];
+	if (!keep || (sectors[i] != NoSector && refs->Extra(sectors[i]) == 0))
+	    continue;
+	if (sectors[i] != NoSector)
+	    refs->Unshare(sectors[i]);		// copy-on-write
+	sectors[i] = freeMap->FindAndSet();
+	ASSERT(sectors[i] != -1);		// we checked there was room
+	hdr->SetDataSector(first + i, sectors[i]);
+    }
+    freeMap->WriteBack(freeMapFile);
+    hdr->WriteChanged(sector);
+    HeaderChanged(sector);
+    refs->WriteBack(refCountFile);		// (after the bitmap; may grow)
+    allocLock->Release();
+    delete freeMap;
+    return TRUE;
+}
+
 //----------------------------------------------------------------------
 // FileSystem::List
 // 	List all the files in the file system directory.
@@ -421,6 +1122,12 @@ FileSystem::Remove(bool recursive, char *pathName)
 void
 FileSystem::List(bool recursive, char *listDirPath)
 {   
+    int startTicks = ioStats->StartOperation();	//MP4 iostat
+
+    //MP4 lock: each directory is read in one piece, so holding the
+    // tree in place is enough
+    treeLock->AcquireRead();
+
     //MP4
     //case: list root
     if(!strcmp(listDirPath, "/")){
@@ -428,6 +1135,8 @@ FileSystem::List(bool recursive, char *listDirPath)
         directory->FetchFrom(directoryFile);
         directory->List(recursive, 0);
         delete directory;
+        treeLock->ReleaseRead();
+        ioStats->EndOperation(FsList, startTicks);
         return;
     }
 
@@ -437,6 +1146,8 @@ FileSystem::List(bool recursive, char *listDirPath)
 
     OpenFile *curDirFile = getSubDir(buf);
     if(curDirFile==NULL){
+        treeLock->ReleaseRead();
+        ioStats->EndOperation(FsList, startTicks);
         return;
     }
 
@@ -453,10 +1164,12 @@ FileSystem::List(bool recursive, char *listDirPath)
         delete targetDir;
         delete tmp;
     }
+    treeLock->ReleaseRead();
 
     //remember to delete curDirFile, if it's not root
     if(curDirFile!=NULL && curDirFile!=directoryFile)   delete curDirFile;
     delete directory;
+    ioStats->EndOperation(FsList, startTicks);
 }
 
 //----------------------------------------------------------------------
@@ -474,9 +1187,12 @@ FileSystem::Print()
 {
     FileHeader *bitHdr = new FileHeader;
     FileHeader *dirHdr = new FileHeader;
-    PersistentBitmap *freeMap = new PersistentBitmap(freeMapFile,NumSectors);
+    PersistentBitmap *freeMap;
     Directory *directory = new Directory(NumDirEntries);
 
+    treeLock->AcquireRead();			//MP4 lock
+    allocLock->Acquire();
+    freeMap = new PersistentBitmap(freeMapFile,NumSectors);
     printf("Bit map file header:\n");
     bitHdr->FetchFrom(FreeMapSector);
     bitHdr->Print();
@@ -486,9 +1202,22 @@ FileSystem::Print()
     dirHdr->Print();
 
     freeMap->Print();
+    allocLock->Release();
 
     directory->FetchFrom(directoryFile);
     directory->Print();
+    treeLock->ReleaseRead();
+
+    //MP4 clone
+    allocLock->Acquire();
+    if (refs->NumShared() > 0)
+	refs->Print();
+    allocLock->Release();
+    //MP4 dedup
+    if (dedup != NULL)
+	DedupReport();
+    //MP4 iostat
+    ioStats->Print();
 
     delete bitHdr;
     delete dirHdr;
@@ -496,11 +1225,292 @@ FileSystem::Print()
     delete directory;
 }
 
+//----------------------------------------------------------------------
+// FindFreeRun
+// 	Return the first sector of the smallest run of free sectors in
+//	"freeMap" that can hold "length" sectors, or -1 if there is none.
+//	Picking the best fit fills the holes left by removed files, rather
+//	than carving up the large free area at the end of the disk.
+//----------------------------------------------------------------------
+
+static int
+FindFreeRun(Bitmap *freeMap, int length)
+{
+    int best = -1, bestLength = 0, run = 0;
+
+    for (int i = 0; i <= NumSectors; i++) {
+	if (i < NumSectors && !freeMap->Test(i)) {
+	    run++;
+	    continue;
+	}
+	if (run >= length && (best == -1 || run < bestLength)) {
+	    best = i - run;
+	    bestLength = run;
+	}
+	run = 0;
+    }
+    return best;
+}
+
+//----------------------------------------------------------------------
+// PrintFreeSpace
+// 	Print how the free sectors of the disk are spread out: the number
+//	of free runs, the largest one, and the fraction of free space that
+//	lies outside the largest run.
+//----------------------------------------------------------------------
+
+static void
+PrintFreeSpace(Bitmap *freeMap)
+{
+    int runs = 0, largest = 0, total = 0, run = 0;
+
+    for (int i = 0; i <= NumSectors; i++) {
+	if (i < NumSectors && !freeMap->Test(i)) {
+	    run++;
+	    continue;
+	}
+	if (run > 0) {
+	    runs++;
+	    total += run;
+	    if (run > largest)
+		largest = run;
+	    run = 0;
+	}
+    }
+    printf("Free space: %d sectors in %d run(s), largest run %d sectors, "
+	"fragmentation %d%%\n", total, runs, largest,
+	(total == 0) ? 0 : 100 - (100 * largest) / total);
+}
+
+//----------------------------------------------------------------------
+// FileSystem::Defrag
+// 	Walk the whole directory tree, printing the number of extents
+//	(runs of consecutive sectors, counting the header chain) of every
+//	file and directory, and the fragmentation of the free space.
+//
+//	If "relocate" is set, every fragmented file or directory is copied
+//	into the smallest free run that can hold its headers and data, and
+//	its directory entry and the bitmap are updated.  Files that are
+//	currently open, files sharing blocks with a clone, and the bitmap
+//	and root directory files (whose headers live in well-known
+//	sectors), are left where they are.
+//
+//	MP4 lock: relocating holds "treeLock" for writing, since
+//	directories move, while reads and writes of open files go on.  The
+//	bitmap is only locked, and read afresh, while one file moves.
+//----------------------------------------------------------------------
+
+void
+FileSystem::Defrag(bool relocate)
+{
+    PersistentBitmap *freeMap;
+
+    if (relocate)
+	treeLock->AcquireWrite();
+    else
+	treeLock->AcquireRead();
+    defragFiles = defragFragmented = defragMoved = 0;
+    allocLock->Acquire();
+    freeMap = new PersistentBitmap(freeMapFile, NumSectors);
+    allocLock->Release();
+    PrintFreeSpace(freeMap);
+    delete freeMap;
+    DefragDir(directoryFile, "", relocate);
+    printf("%d file(s), %d fragmented", defragFiles, defragFragmented);
+    if (relocate) {
+	printf(", %d relocated\n", defragMoved);
+	allocLock->Acquire();
+	freeMap = new PersistentBitmap(freeMapFile, NumSectors);
+	allocLock->Release();
+	PrintFreeSpace(freeMap);
+	delete freeMap;
+    } else {
+	printf("\n");
+    }
+    if (relocate)
+	treeLock->ReleaseWrite();
+    else
+	treeLock->ReleaseRead();
+}
+
+//----------------------------------------------------------------------
+// FileSystem::DefragDir
+// 	Defragment every entry of one directory.  Subdirectories are
+//	handled depth first, so that a directory is only moved after all of
+//	its own entries have been updated.
+//
+//	"dirFile" is the open directory
+//	"dirPath" is its path name, for printing
+//----------------------------------------------------------------------
+
+void
+FileSystem::DefragDir(OpenFile *dirFile, char *dirPath, bool relocate)
+{
+    Directory *directory = new Directory(NumDirEntries);
+    char path[1024];
+
+    directory->FetchFrom(dirFile);
+    for (int i = 0; i < directory->tableSize; i++) {
+	DirectoryEntry *entry = &directory->table[i];
+
+	if (!entry->inUse)
+	    continue;
+	sprintf(path, "%s/%s", dirPath, entry->name);
+	if (entry->isDir) {
+	    OpenFile *subDirFile = new OpenFile(entry->sector);
+	    DefragDir(subDirFile, path, relocate);
+	    delete subDirFile;
+	}
+	DefragFile(entry, directory, dirFile, path, relocate);
+    }
+    delete directory;
+}
+
+//----------------------------------------------------------------------
+// FileSystem::DefragFile
+// 	Report the extents of one file, and if asked to, move it into a
+//	contiguous run of sectors.  The new run is taken from the bitmap
+//	first; the directory entry is then updated and flushed, and only
+//	after that are the old sectors given away.
+//
+//	"entry" is the entry of the file in "directory"
+//	"dirFile" is the open directory
+//	"path" is the file name, for printing
+//----------------------------------------------------------------------
+
+void
+FileSystem::DefragFile(DirectoryEntry *entry, Directory *directory,
+		OpenFile *dirFile, char *path, bool relocate)
+{
+    FileHeader *hdr = new FileHeader;
+    PersistentBitmap *freeMap;
+    RWLock *fileLock = FileLock(entry->sector);
+    int sector = entry->sector;
+    int numSectors, extents, shared, newSector, i;
+    int *list;
+
+    //MP4 lock: whoever has the file open is not kept out by "treeLock"
+    if (relocate)
+	fileLock->AcquireWrite();
+    else
+	fileLock->AcquireRead();
+    hdr->FetchFrom(sector);
+    numSectors = hdr->SectorList(sector, NULL);
+    list = new int[numSectors];
+    hdr->SectorList(sector, list);
+
+    allocLock->Acquire();
+    extents = 1;
+    shared = refs->Extra(list[0]);
+    for (i = 1; i < numSectors; i++) {
+	if (list[i] != list[i - 1] + 1)
+	    extents++;
+	shared += refs->Extra(list[i]);
+    }
+    allocLock->Release();
+    printf("%s: %d extent(s), %d sector(s)\n", path, extents, numSectors);
+    defragFiles++;
+
+    newSector = -1;
+    if (extents > 1) {
+	defragFragmented++;
+	if (relocate && IsOpen(sector)) {
+	    printf("  in use, left in place\n");
+	} else if (relocate && shared > 0) {
+	    //MP4 clone: moving the blocks would move them for the clones too
+	    printf("  shares blocks with a clone, left in place\n");
+	} else if (relocate) {
+	    allocLock->Acquire();
+	    freeMap = new PersistentBitmap(freeMapFile, NumSectors);
+	    newSector = FindFreeRun(freeMap, numSectors);
+	    if (newSector == -1) {
+		printf("  no free run of %d sectors, left in place\n",
+			numSectors);
+	    } else {
+		for (i = 0; i < numSectors; i++)
+		    freeMap->Mark(newSector + i);
+		hdr->Relocate(newSector);
+		hdr->WriteBack(newSector);
+		freeMap->WriteBack(freeMapFile);
+	    }
+	    allocLock->Release();
+	    delete freeMap;
+	}
+    }
+    if (relocate)
+	fileLock->ReleaseWrite();
+    else
+	fileLock->ReleaseRead();
+
+    if (newSector != -1) {
+	// flush the new location before giving the old sectors away
+	entry->sector = newSector;
+	directory->WriteBack(dirFile);
+
+	allocLock->Acquire();
+	freeMap = new PersistentBitmap(freeMapFile, NumSectors);
+	for (i = 0; i < numSectors; i++) {
+	    freeMap->Clear(list[i]);
+	    if (dedup != NULL)
+		dedup->Move(list[i], newSector + i);
+	}
+	freeMap->WriteBack(freeMapFile);
+	allocLock->Release();
+	ioStats->Move(sector, newSector);	//MP4 iostat
+	delete freeMap;
+	printf("  moved to sectors %d-%d\n", newSector,
+		newSector + numSectors - 1);
+	defragMoved++;
+    }
+    delete [] list;
+    delete hdr;
+}
+
+//MP4 lock
+//----------------------------------------------------------------------
+// FileSystem::DirLock
+// 	Return the lock on the entries of the directory whose header is at
+//	"sector", creating it the first time.  Held for writing to add or
+//	remove entries, so that two threads creating files in the same
+//	directory do not both take the same free entry.
+//----------------------------------------------------------------------
+
+RWLock *
+FileSystem::DirLock(int sector)
+{
+    ASSERT(sector >= 0 && sector < NumSectors);
+    if (dirLocks[sector] == NULL)
+	dirLocks[sector] = new RWLock("dir lock");
+    return dirLocks[sector];
+}
+
+//----------------------------------------------------------------------
+// FileSystem::FileLock
+// 	Return the lock on the header and data of the file whose header is
+//	at "sector", creating it the first time, or NULL for the bitmap and
+//	the reference counts, which "allocLock" protects instead.
+//----------------------------------------------------------------------
+
+RWLock *
+FileSystem::FileLock(int sector)
+{
+    ASSERT(sector >= 0 && sector < NumSectors);
+    if (sector == FreeMapSector || sector == RefCountSector)
+	return NULL;
+    if (fileLocks[sector] == NULL)
+	fileLocks[sector] = new RWLock("file lock");
+    return fileLocks[sector];
+}
+
 //MP4
+//	getSubDir is called with "treeLock" held, so no directory on the
+//	path can go away; each directory is read in one piece, under its
+//	file lock, so no other lock is needed.
 OpenFile* FileSystem::getSubDir(char *pathName)
 {
     Directory *curDir = new Directory(NumDirEntries);
     OpenFile *curDirFile = directoryFile;
+    char path[1024] = "";		//MP4 iostat: path walked so far
     curDir->FetchFrom(curDirFile);
 
     //method: use strtok() function to find out '/' in the path
@@ -532,6 +1542,9 @@ OpenFile* FileSystem::getSubDir(char *pathName)
             if(curDirFile!=directoryFile){
                 delete curDirFile;
             }
+            strcat(path, "/");
+            strcat(path, cut);
+            ioStats->Name(subDirSector, path);
             curDirFile = new OpenFile(subDirSector);
             curDir->FetchFrom(curDirFile);
             cut = nextcut;
@@ -549,5 +1562,66 @@ void FileSystem::getFileName(char *result, char *pathName)
     strcpy(result, pathName+idx+1);
 }
 
+//----------------------------------------------------------------------
+// FileSystem::SelfTest
+// 	Check, on a scratch file and directory in the root directory,
+//	behavior that no single command shows: each part ASSERTs what it
+//	expects.  The scratch files are removed afterwards.  Parts that
+//	need dedup only run with -dedup.
+//----------------------------------------------------------------------
+
+void
+FileSystem::SelfTest()
+{
+    char *name = "/fstest";
+    char *data = new char[ExtentSize];
+    char *check = new char[ExtentSize];
+    int size = ExtentSize;		// one extent, kept in the cache
+    OpenFile *writer, *reader;
+
+    printf("File system self test\n");
+    ASSERT(Create(name, 0, FALSE));
+
+    //MP4 compress: an extent rewritten into the sectors it had already
+    // is not read from another OpenFile's stale extent cache
+    writer = Open(name);
+    reader = Open(name);
+    writer->SetCompressed();
+    memset(data, 'a', size);
+    ASSERT(writer->WriteAt(data, size, 0) == size);
+    ASSERT(reader->ReadAt(check, size, 0) == size);
+    ASSERT(memcmp(data, check, size) == 0);
+    memset(data, 'b', size);		// compresses just as well
+    ASSERT(writer->WriteAt(data, size, 0) == size);
+    ASSERT(reader->ReadAt(check, size, 0) == size);
+    ASSERT(memcmp(data, check, size) == 0);
+    delete writer;
+    delete reader;
+    ASSERT(Remove(FALSE, name));
+
+    //MP4 dedup: a file written with the contents of a directory block
+    // does not share it, since the directory changes in place
+    if (dedup != NULL) {
+	int numShared = refs->NumShared();
+
+	ASSERT(Create("/fsdir", 0, TRUE));
+	ASSERT(Create("/fsdir/fsentry", 0, FALSE));	// in its first block
+	reader = Open("/fsdir");
+	ASSERT(reader->ReadAt(data, SectorSize, 0) == SectorSize);
+	delete reader;
+	ASSERT(Create(name, 0, FALSE));
+	writer = Open(name);
+	ASSERT(writer->WriteAt(data, SectorSize, 0) == SectorSize);
+	delete writer;
+	ASSERT(refs->NumShared() == numShared);
+	ASSERT(Remove(FALSE, name));
+	ASSERT(Remove(TRUE, "/fsdir"));
+    }
+
+    delete [] data;
+    delete [] check;
+    printf("File system self test passed\n");
+}
+
 #endif // FILESYS_STUB
 
@@ -42,9 +42,10 @@
 				// implementation is available
 class FileSystem {
   public:
-    FileSystem() { for (int i = 0; i < 20; i++) fileDescriptorTable[i] = NULL; }
+    FileSystem() {}
 
-    bool Create(char *name) {
+    bool Create(char *name, int initialSize = 0, bool isDir = FALSE) {
+	if (isDir) return FALSE;	// UNIX files only, no directories
 	int fileDescriptor = OpenForWrite(name);
 
 	if (fileDescriptor == -1) return FALSE;
@@ -61,11 +62,56 @@ class FileSystem {
 
     bool Remove(char *name) { return Unlink(name) == 0; }
 
-	OpenFile *fileDescriptorTable[20];
-	
+    bool Clone(char *from, char *to) {	// a plain copy: UNIX files
+					// share no data
+	OpenFile *src = Open(from);
+	char buffer[1024];
+	int numRead, position = 0;
+
+	if (src == NULL) return FALSE;
+	if (!Create(to)) { delete src; return FALSE; }
+	OpenFile *dst = Open(to);
+	while ((numRead = src->ReadAt(buffer, sizeof(buffer), position)) > 0) {
+	    dst->WriteAt(buffer, numRead, position);
+	    position += numRead;
+	}
+	delete src;
+	delete dst;
+	return TRUE;
+	}
 };
 
 #else // FILESYS
+class PersistentBitmap;
+class FileHeader;
+class RefCount;
+class DedupIndex;
+class Directory;
+class DirectoryEntry;
+class Lock;
+class RWLock;
+class IOStats;
+template <class T> class List;
+
+// Sectors containing the file headers for the bitmap of free sectors,
+// and the directory of files.  These file headers are placed in well-known 
+// sectors, so that they can be located on boot-up (and by the host-side
+// tools that read disk images).
+#define FreeMapSector 		0
+#define DirectorySector 	1
+//MP4 clone: the counts of references to sectors shared by clones
+#define RefCountSector 		2
+//MP4 format: a sector that says which format the disk was made in,
+// FormatMagic then FormatVersion.  Formatting writes it; a disk without
+// it, or of another version, is refused rather than misread.  Bump the
+// version whenever the layout of what is on disk changes.
+#define FormatSector 		3
+#define FormatMagic 		0x4e414653	// "NAFS"
+#define FormatVersion 		1
+
+//MP4: extend to '64' files/subdirectories per directory
+#define NumDirEntries 		64
+
 class FileSystem {
   public:
     FileSystem(bool format);		// Initialize the file system.
@@ -92,18 +138,117 @@ class FileSystem {
 
     
     void getFileName(char *result, char *path);
-    
-    //MP4:
-    OpenFile *fileDescriptorTable[20];
-    int top;
+
+    //MP4 inline
+    bool Extend(FileHeader *hdr, int sector, int newSize);
+					// Grow the file whose header "hdr"
+					// is stored at "sector"
+
+    //MP4 clone
+    bool Clone(char *fromPath, char *toPath);
+					// Create "toPath" as a copy-on-write
+					// clone of the file "fromPath"
+    bool Unshare(FileHeader *hdr, int sector, int first, int count,
+		int *sectors);		// Give a file its own copy of the
+					// shared data blocks among "sectors"
+					// before they are written
+
+    //MP4 dedup
+    void EnableDedup();			// Share data blocks identical to
+					// ones already on disk from now on
+    void Dedup(FileHeader *hdr, int sector, int first, int count,
+		int *sectors, char *data, bool *shared);
+					// Point the blocks about to be
+					// written at existing copies of
+					// "data", where there are any
+    void DedupReport();			// Print the space saved by sharing
+
+    //MP4 compress
+    bool Repack(FileHeader *hdr, int sector, int first, int count,
+		int *sectors, int *used);
+					// Give the extents of a compressed
+					// file about to be written the
+					// number of sectors "used" says
+
+    //MP4 defrag
+    void Defrag(bool relocate);		// Report per-file extents and free
+					// space fragmentation; if "relocate",
+					// move each fragmented file into a
+					// contiguous run of sectors
+
+    //MP4 lock
+    RWLock *DirLock(int sector);	// Lock on the entries of the
+					// directory whose header is at "sector"
+    RWLock *FileLock(int sector);	// Lock on the header and data of the
+					// file whose header is at "sector"
+    int HeaderVersion(int sector) { return headerVersions[sector]; }
+    void HeaderChanged(int sector) { headerVersions[sector]++; }
+					// Count the changes to the header at
+					// "sector", so that every OpenFile
+					// of the file can tell its copy of
+					// the header is stale
+
+    //MP4 fd table
+    void FileOpened(int sector) { openCount[sector]++; }
+    void FileClosed(int sector) { openCount[sector]--; }
+					// A user program opened/closed the
+					// file whose header is at "sector"
+
+    //MP4 iostat
+    IOStats *ioStats;			// Disk traffic of each file and
+					// directory, and operation latencies
+
+    void SelfTest();			// Check the file system on a scratch
+					// file (see -F)
     
 
   private:
   	OpenFile* getSubDir(char *pathName);
+
+    //MP4 format
+    void WriteFormat();			// Write the format marker
+    void CheckFormat();			// Refuse a disk without it
+
+
+    //MP4 bonus: recursive remove, walking directories by sector
+    void RemoveTree(int sector, ::List<int> *doomed);
+    void RemoveFile(int sector, PersistentBitmap *freeMap);
+
+    //MP4 dedup
+    void IndexTree(int sector, DedupIndex *index);
+					// Add the file data under the
+					// directory at "sector" to "index"
+
+    //MP4 defrag
+    void DefragDir(OpenFile *dirFile, char *dirPath, bool relocate);
+    void DefragFile(DirectoryEntry *entry, Directory *directory,
+		OpenFile *dirFile, char *path, bool relocate);
+    bool IsOpen(int sector) { return openCount[sector] > 0; }
+					// Is the file at "sector" open?
+    int *openCount;			// user program opens of each file
+    int defragFiles;			// Statistics of the running Defrag
+    int defragFragmented;
+    int defragMoved;
+
    OpenFile* freeMapFile;		// Bit map of free disk blocks,
 					// represented as a file
+   //MP4 clone
+   OpenFile* refCountFile;		// Extra references to shared data
+					// blocks, represented as a file
+   RefCount* refs;			// ... and kept in memory
+   //MP4 dedup
+   DedupIndex* dedup;			// Contents of the data blocks, or
+					// NULL if deduplication is off
    OpenFile* directoryFile;		// "Root" directory -- list of 
 					// file names, represented as a file
+   //MP4 lock: see filesys.cc for the order they are acquired in
+   RWLock* treeLock;			// Held for writing while directories
+					// vanish or move
+   Lock* allocLock;			// Protects the bitmap, "refs" and
+					// "dedup"
+   RWLock** dirLocks;			// DirLock of each sector, or NULL
+   RWLock** fileLocks;			// FileLock of each sector, or NULL
+   int* headerVersions;			// HeaderVersion of each sector
 
 };
 
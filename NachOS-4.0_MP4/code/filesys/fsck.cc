@@ -0,0 +1,423 @@
+// fsck.cc
+//	Host-side consistency checker for Nachos disk images:
+//
+//		fsck [-d debugFlags] [-j numThreads] [-r] [diskFile]
+//
+//	The image ("DISK_0" by default) is mapped into memory, and a pool
+//	of host threads walks every directory tree and every chain of
+//	file headers, starting from the well-known header sectors of the
+//	bitmap, the reference counts and the root directory.  Each sector
+//	a header or a data block refers to is "claimed"; claims are
+//	counted atomically, so the threads need no lock except around the
+//	queue of work.
+//
+//	The claims are then compared with the bitmap of free sectors, and
+//	with the reference counts of data blocks shared by clones or by
+//	deduplication:
+//	  - a sector marked in use that nothing claims is leaked;
+//	  - a sector claimed but marked free can be handed out again;
+//	  - a sector claimed more often than its reference count is
+//	    shared by files that do not know it (or a chain loops);
+//	  - a sector claimed less often than its count is never freed.
+//	Broken headers (sectors out of range, impossible sizes) are
+//	reported with the path of the file, and not followed further.
+//
+//	With "-r", the bitmap is rewritten to match the claims, and
+//	counts that are too high are lowered, which repairs the first,
+//	second and last kinds of problem.  Sectors claimed too often
+//	are only reported; fixing them means deciding which file loses.
+//	If any header was broken, the files below it were not walked, so
+//	leaked sectors are left marked in use rather than freed.
+//
+//	Exit status is 0 if the image is consistent, 1 if problems were
+//	found (even if repaired), 2 if the image could not be read, or
+//	lacks the format marker of this version of the file system.
+//
+//	The header chains are checked sector by sector as stored on disk
+//	(the layout of FileHeader::FetchFrom) before any of them is handed
+//	to FileHeader or Directory, which trust what they read.
+//
+// Copyright (c) 1992-1996 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#include "copyright.h"
+#include "main.h"
+#include "filesys.h"
+#include "filehdr.h"
+#include "directory.h"
+#include "pbitmap.h"
+#include "refcount.h"
+#include "openfile.h"
+#include "sysdep.h"
+#include "hostdisk.h"
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// A file or directory still to be checked
+class FsckWork {
+  public:
+    FsckWork(int s, bool d, char *p) { sector = s; isDir = d; path = strdup(p); }
+    ~FsckWork() { free(path); }
+
+    int sector;				// its first header
+    bool isDir;				// read it as a directory?
+    char *path;				// for messages
+    FsckWork *next;			// next in the queue
+};
+
+static int *claims;			// times each sector is referred to
+static FsckWork *queue = NULL;		// work not yet picked up
+static int pending = 0;			// work queued or being checked
+static pthread_mutex_t queueLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queueReady = PTHREAD_COND_INITIALIZER;
+static pthread_mutex_t printLock = PTHREAD_MUTEX_INITIALIZER;
+
+static int numFiles = 0, numDirs = 0, numBroken = 0;
+
+// Largest number of headers a chain on this disk can have
+static const int MaxChain = NumSectors / (NumDirect + 1) + 1;
+
+//----------------------------------------------------------------------
+// Problem
+//      Report a problem with the file at "path".
+//----------------------------------------------------------------------
+
+static void
+Problem(char *path, const char *what, int sector)
+{
+    pthread_mutex_lock(&printLock);
+    printf("fsck: %s: %s (sector %d)\n", path, what, sector);
+    numBroken++;
+    pthread_mutex_unlock(&printLock);
+}
+
+//----------------------------------------------------------------------
+// Claim
+//      Count one more reference to "sector", and return how many there
+//	were before.
+//----------------------------------------------------------------------
+
+static int
+Claim(int sector)
+{
+    return __sync_fetch_and_add(&claims[sector], 1);
+}
+
+//----------------------------------------------------------------------
+// AddWork
+//      Queue a file or directory to be checked by some thread.
+//----------------------------------------------------------------------
+
+static void
+AddWork(FsckWork *work)
+{
+    pthread_mutex_lock(&queueLock);
+    work->next = queue;
+    queue = work;
+    pending++;
+    pthread_cond_signal(&queueReady);
+    pthread_mutex_unlock(&queueLock);
+}
+
+//----------------------------------------------------------------------
+// CheckChain
+//      Claim the header and data sectors of the file whose first header
+//	is at "sector", checking each header as stored on disk.  Return
+//	FALSE if the chain is broken, or is already claimed by another
+//	file (in which case it has been or will be checked from there).
+//	Data sectors may legitimately be claimed by several clones; that
+//	is checked against the reference counts once the walk is over.
+//	Only compressed files may have holes (NoSector) among their data
+//	blocks.
+//----------------------------------------------------------------------
+
+static bool
+CheckChain(FsckWork *work)
+{
+    int sector = work->sector;
+    bool compressed = FALSE;
+
+    for (int count = 0; sector != -1; count++) {
+	if (sector < 0 || sector >= NumSectors) {
+	    Problem(work->path, "header sector out of range", sector);
+	    return FALSE;
+	}
+	if (Claim(sector) > 0) {
+	    Problem(work->path, count == 0 ? "header shared with another file"
+				: "header chain is cross-linked or loops", sector);
+	    return FALSE;
+	}
+	if (count == MaxChain) {
+	    Problem(work->path, "header chain too long", sector);
+	    return FALSE;
+	}
+
+	// same layout as FileHeader::FetchFrom
+	int *hdr = (int *) &hostImage[sector * SectorSize];
+	int numBytes = hdr[0];
+	int numSectors = hdr[1];
+	if (count == 0) {
+	    compressed = (numBytes & CompressedFlag) != 0;
+	    numBytes &= ~CompressedFlag;
+	}
+	int *dataSectors = &hdr[2];
+	int nextHeaderSector = hdr[2 + NumDirect];
+
+	if (count == 0 && numSectors == 0) {	// inline file
+	    if (numBytes < 0 || numBytes > (int) InlineSize
+			|| nextHeaderSector != -1) {
+		Problem(work->path, "bad inline header", sector);
+		return FALSE;
+	    }
+	    return TRUE;
+	}
+	if (numSectors < 1 || numSectors > (int) NumDirect || numBytes < 0
+		|| numBytes > numSectors * SectorSize
+		|| (nextHeaderSector != -1 && numSectors < (int) NumDirect)) {
+	    Problem(work->path, "bad file header", sector);
+	    return FALSE;
+	}
+	for (int i = 0; i < numSectors; i++) {
+	    if (compressed && dataSectors[i] == NoSector)
+		continue;
+	    if (dataSectors[i] < 0 || dataSectors[i] >= NumSectors) {
+		Problem(work->path, "data sector out of range", dataSectors[i]);
+		return FALSE;
+	    }
+	    Claim(dataSectors[i]);	// may be shared with a clone
+	}
+	sector = nextHeaderSector;
+    }
+    return TRUE;
+}
+
+//----------------------------------------------------------------------
+// CheckDirectory
+//      Queue the entries of the directory "work", whose header chain has
+//	already been checked.
+//----------------------------------------------------------------------
+
+static void
+CheckDirectory(FsckWork *work)
+{
+    OpenFile *dirFile = new OpenFile(work->sector);
+    Directory *directory = new Directory(NumDirEntries);
+    char path[1024];
+
+    directory->FetchFrom(dirFile);
+    for (int i = 0; i < directory->tableSize; i++) {
+	DirectoryEntry *entry = &directory->table[i];
+
+	if (!entry->inUse)
+	    continue;
+	entry->name[FileNameMaxLen] = '\0';
+	snprintf(path, sizeof(path), "%s%s%s", work->path,
+		strcmp(work->path, "/") == 0 ? "" : "/", entry->name);
+	AddWork(new FsckWork(entry->sector, entry->isDir, path));
+    }
+    delete directory;
+    delete dirFile;
+}
+
+//----------------------------------------------------------------------
+// Worker
+//      Body of each host thread: check queued files and directories
+//	until there is nothing left queued or being checked.
+//----------------------------------------------------------------------
+
+static void *
+Worker(void *unused)
+{
+    FsckWork *work;
+
+    for (;;) {
+	pthread_mutex_lock(&queueLock);
+	while (queue == NULL && pending > 0)
+	    pthread_cond_wait(&queueReady, &queueLock);
+	if (queue == NULL) {			// pending == 0: all done
+	    pthread_mutex_unlock(&queueLock);
+	    return NULL;
+	}
+	work = queue;
+	queue = work->next;
+	pthread_mutex_unlock(&queueLock);
+
+	DEBUG(dbgFile, "fsck: checking " << work->path);
+	if (CheckChain(work)) {
+	    if (work->isDir) {
+		__sync_fetch_and_add(&numDirs, 1);
+		CheckDirectory(work);
+	    } else {
+		__sync_fetch_and_add(&numFiles, 1);
+	    }
+	}
+	delete work;
+
+	pthread_mutex_lock(&queueLock);
+	if (--pending == 0)
+	    pthread_cond_broadcast(&queueReady);
+	pthread_mutex_unlock(&queueLock);
+    }
+}
+
+//----------------------------------------------------------------------
+// ReportSectors
+//      Print how many sectors are in a class of problem, and the first
+//	few of them.
+//----------------------------------------------------------------------
+
+static void
+ReportSectors(const char *what, int *list, int count)
+{
+    if (count == 0)
+	return;
+    printf("fsck: %d %s sector(s):", count, what);
+    for (int i = 0; i < count && i < 10; i++)
+	printf(" %d", list[i]);
+    printf(count > 10 ? " ...\n" : "\n");
+}
+
+//----------------------------------------------------------------------
+// main
+// 	Map the disk image, walk it with "-j" threads, and compare what
+//	was found with the bitmap.
+//----------------------------------------------------------------------
+
+int
+main(int argc, char **argv)
+{
+    char *debugArg = "";
+    char *diskName = "DISK_0";
+    int numThreads = sysconf(_SC_NPROCESSORS_ONLN);
+    bool repair = FALSE;
+    double start = HostSeconds();
+    int fd;
+    char *mapped;
+    struct stat info;
+
+    for (int i = 1; i < argc; i++) {
+	if (strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+	    debugArg = argv[++i];
+	} else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+	    numThreads = atoi(argv[++i]);
+	} else if (strcmp(argv[i], "-r") == 0) {
+	    repair = TRUE;
+	} else if (argv[i][0] != '-') {
+	    diskName = argv[i];
+	} else {
+	    printf("Usage: fsck [-d debugFlags] [-j numThreads] [-r] [diskFile]\n");
+	    return 2;
+	}
+    }
+    if (numThreads < 1)
+	numThreads = 1;
+
+    if ((fd = open(diskName, repair ? O_RDWR : O_RDONLY)) < 0
+	    || fstat(fd, &info) < 0 || info.st_size < DiskSize) {
+	printf("fsck: %s is not a disk image\n", diskName);
+	return 2;
+    }
+    mapped = (char *) mmap(NULL, DiskSize, PROT_READ | (repair ? PROT_WRITE : 0),
+			MAP_SHARED, fd, 0);
+    if (mapped == MAP_FAILED || *(int *) mapped != MagicNumber) {
+	printf("fsck: %s is not a disk image\n", diskName);
+	return 2;
+    }
+    hostImage = mapped + MagicSize;
+    HostDiskInit(debugArg);
+
+    // an image of another format would be misread, and "repaired" wrong
+    int *marker = (int *) (hostImage + FormatSector * SectorSize);
+    if (marker[0] != FormatMagic || marker[1] != FormatVersion) {
+	printf("fsck: %s is not in version %d of the file system format\n",
+		diskName, FormatVersion);
+	return 2;
+    }
+
+    // the bitmap and reference counts are needed to go any further
+    claims = new int[NumSectors];
+    memset(claims, 0, NumSectors * sizeof(int));
+    claims[FormatSector] = 1;		// the format marker
+    FsckWork freeMapWork(FreeMapSector, FALSE, "[free map]");
+    FsckWork refCountWork(RefCountSector, FALSE, "[ref counts]");
+    if (!CheckChain(&freeMapWork) || !CheckChain(&refCountWork)) {
+	printf("fsck: the free map or reference counts are broken, "
+		"cannot check\n");
+	return 1;
+    }
+
+    // walk the whole directory tree
+    AddWork(new FsckWork(DirectorySector, TRUE, "/"));
+
+    pthread_t *threads = new pthread_t[numThreads];
+    for (int i = 0; i < numThreads; i++)
+	pthread_create(&threads[i], NULL, Worker, NULL);
+    for (int i = 0; i < numThreads; i++)
+	pthread_join(threads[i], NULL);
+    delete [] threads;
+
+    // compare with the bitmap and the reference counts
+    OpenFile *freeMapFile = new OpenFile(FreeMapSector);
+    PersistentBitmap *freeMap = new PersistentBitmap(freeMapFile, NumSectors);
+    OpenFile *refCountFile = new OpenFile(RefCountSector);
+    RefCount *refs = new RefCount;
+    int *leaked = new int[NumSectors], numLeaked = 0;
+    int *unmarked = new int[NumSectors], numUnmarked = 0;
+    int *shared = new int[NumSectors], numShared = 0;
+    int *overcounted = new int[NumSectors], numOvercounted = 0;
+    int numUsed = 0, numCloned = 0, numSaved = 0;
+
+    refs->FetchFrom(refCountFile);
+    for (int i = 0; i < NumSectors; i++) {
+	int expected = 1 + refs->Extra(i);
+
+	if (claims[i] > 0)
+	    numUsed++;
+	if (claims[i] > 1 && claims[i] <= expected) {
+	    numCloned++;
+	    numSaved += claims[i] - 1;
+	}
+	if (claims[i] > expected) {
+	    shared[numShared++] = i;
+	} else if (expected > 1 && claims[i] < expected) {
+	    overcounted[numOvercounted++] = i;
+	    if (repair && numBroken == 0)
+		refs->Set(i, claims[i] > 0 ? claims[i] - 1 : 0);
+	}
+	if (claims[i] == 0 && freeMap->Test(i)) {
+	    leaked[numLeaked++] = i;
+	    if (repair && numBroken == 0)
+		freeMap->Clear(i);
+	} else if (claims[i] > 0 && !freeMap->Test(i)) {
+	    unmarked[numUnmarked++] = i;
+	    if (repair)
+		freeMap->Mark(i);
+	}
+    }
+    ReportSectors("leaked (marked in use, not referenced)", leaked, numLeaked);
+    ReportSectors("in use but marked free", unmarked, numUnmarked);
+    ReportSectors("referenced more often than counted", shared, numShared);
+    ReportSectors("counted more often than referenced", overcounted,
+		numOvercounted);
+
+    if (repair && (numLeaked > 0 || numUnmarked > 0 || numOvercounted > 0)) {
+	freeMap->WriteBack(freeMapFile);
+	refs->WriteBack(refCountFile);
+	msync(mapped, DiskSize, MS_SYNC);
+	printf("fsck: bitmap and reference counts repaired\n");
+    }
+    int numProblems = numBroken + numLeaked + numUnmarked + numShared
+		+ numOvercounted;
+    printf("fsck: %d file(s), %d directories, %d sectors in use (%d shared, "
+	    "saving %d), %d problem(s), %d thread(s), %.3f s\n", numFiles,
+	    numDirs, numUsed, numCloned, numSaved, numProblems, numThreads,
+	    HostSeconds() - start);
+
+    munmap(mapped, DiskSize);
+    close(fd);
+    return numProblems == 0 ? 0 : 1;
+}
@@ -0,0 +1,159 @@
+// hostdisk.cc
+//	Stand-ins for the kernel and the synchronous disk, for host-side
+//	tools that link the file system code.  See hostdisk.h.
+//
+// Copyright (c) 1992-1996 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#include "copyright.h"
+#include "main.h"
+#include "synch.h"
+#include "synchdisk.h"
+#include "hostdisk.h"
+
+// global variables used by the file system code
+Kernel *kernel;
+Debug *debug;
+
+char *hostImage = NULL;
+int hostLastSector = -1;
+
+//----------------------------------------------------------------------
+// HostDiskInit
+// 	Create the stand-in kernel and its disk, and turn on the debug
+//	flags in "debugArg".  The tool creates "kernel->fileSystem"
+//	itself, once "hostImage" is set.
+//----------------------------------------------------------------------
+
+void
+HostDiskInit(char *debugArg)
+{
+    debug = new Debug(debugArg);
+    kernel = new Kernel(0, NULL);
+    kernel->synchDisk = new SynchDisk();
+}
+
+//----------------------------------------------------------------------
+// Kernel::Kernel
+// 	Stand-in for the kernel: the file system code only needs the
+//	"synchDisk" and "fileSystem" pointers.
+//----------------------------------------------------------------------
+
+Kernel::Kernel(int argc, char **argv)
+{
+    currentThread = NULL;
+    scheduler = NULL;
+    interrupt = NULL;
+    stats = NULL;
+    alarm = NULL;
+    machine = NULL;
+    synchConsoleIn = NULL;
+    synchConsoleOut = NULL;
+    synchDisk = NULL;
+    fileSystem = NULL;
+    postOfficeIn = NULL;
+    postOfficeOut = NULL;
+    hostName = 0;
+}
+
+//----------------------------------------------------------------------
+// SynchDisk
+// 	Stand-in for the synchronous disk, backed by "hostImage".
+//----------------------------------------------------------------------
+
+SynchDisk::SynchDisk()
+{
+    disk = NULL;
+    pending = NULL;
+    active = NULL;
+    headSector = 0;
+    sectorsRead = sectorsWritten = 0;	// (the tools do not count)
+}
+
+SynchDisk::~SynchDisk()
+{
+}
+
+void
+SynchDisk::ReadSector(int sectorNumber, char* data)
+{
+    ASSERT((sectorNumber >= 0) && (sectorNumber < NumSectors));
+    bcopy(&hostImage[sectorNumber * SectorSize], data, SectorSize);
+}
+
+void
+SynchDisk::WriteSector(int sectorNumber, char* data)
+{
+    ASSERT((sectorNumber >= 0) && (sectorNumber < NumSectors));
+    bcopy(data, &hostImage[sectorNumber * SectorSize], SectorSize);
+    if (sectorNumber > hostLastSector)
+	hostLastSector = sectorNumber;
+}
+
+void
+SynchDisk::CallBack()
+{
+}
+
+//MP4 lock
+//----------------------------------------------------------------------
+// Lock, RWLock
+// 	Stand-ins for the locks of the file system.  The tools have no
+//	Nachos threads to synchronize, so there is nothing to wait for.
+//----------------------------------------------------------------------
+
+Lock::Lock(char* debugName)
+{
+    name = debugName;
+    semaphore = NULL;
+    lockHolder = NULL;
+}
+
+Lock::~Lock()
+{
+}
+
+void
+Lock::Acquire()
+{
+}
+
+void
+Lock::Release()
+{
+}
+
+RWLock::RWLock(char* debugName)
+{
+    name = debugName;
+    lock = NULL;
+    changed = NULL;
+    numReaders = 0;
+    numWaitingWriters = 0;
+    writer = NULL;
+}
+
+RWLock::~RWLock()
+{
+}
+
+void
+RWLock::AcquireRead()
+{
+}
+
+void
+RWLock::ReleaseRead()
+{
+}
+
+void
+RWLock::AcquireWrite()
+{
+}
+
+void
+RWLock::ReleaseWrite()
+{
+}
@@ -0,0 +1,32 @@
+// hostdisk.h
+//	Stand-ins that let host-side tools (mkfs, fsck) link the Nachos
+//	file system code without the rest of the kernel.
+//
+//	The file system code only reaches the rest of the kernel through
+//	"kernel->synchDisk" (and "kernel->fileSystem", when a file grows).
+//	hostdisk.cc provides a Kernel with just those pointers, and a
+//	SynchDisk whose sectors are an image in host memory, "hostImage",
+//	rather than the simulated disk.  Requests complete immediately,
+//	and reads of the image are safe from several host threads at once.
+//	The locks of the file system are stand-ins that never wait.
+//
+//	A tool points "hostImage" at NumSectors * SectorSize bytes (for
+//	instance, a disk file mapped into memory past its magic number),
+//	then calls HostDiskInit before using the file system code.
+//
+// Copyright (c) 1992-1996 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#ifndef HOSTDISK_H
+#define HOSTDISK_H
+
+#include "copyright.h"
+
+extern char *hostImage;			// the sectors of the disk
+extern int hostLastSector;		// highest sector written so far
+
+extern void HostDiskInit(char *debugArg);
+					// Set up "kernel" and "debug"
+
+#endif // HOSTDISK_H
@@ -0,0 +1,296 @@
+// iostats.cc
+//	Routines to account for the disk traffic of the file system.  See
+//	iostats.h.
+//
+//	The counters are updated without disabling interrupts: Nachos
+//	threads only switch at well-defined points, never in the middle of
+//	an increment.
+//
+// Copyright (c) 1992-1996 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#include "copyright.h"
+#include "iostats.h"
+#include "main.h"
+#include "disk.h"
+#include "synchdisk.h"
+#include <stdio.h>
+
+static char *opNames[NumFsOperations] = { "create", "open", "remove", "list" };
+
+//----------------------------------------------------------------------
+// IOStats::IOStats
+// 	Initialize the counters of "numInodes" header sectors, and of every
+//	operation, to zero.
+//----------------------------------------------------------------------
+
+IOStats::IOStats(int numInodes)
+{
+    this->numInodes = numInodes;
+    inodes = new InodeStats[numInodes];
+    memset(inodes, 0, numInodes * sizeof(InodeStats));
+    for (int i = 0; i < NumFsOperations; i++)
+	opCount[i] = opTicks[i] = opMaxTicks[i] = 0;
+    printAtHalt = FALSE;
+    jsonAtHalt = NULL;
+}
+
+//----------------------------------------------------------------------
+// IOStats::~IOStats
+//----------------------------------------------------------------------
+
+IOStats::~IOStats()
+{
+    for (int i = 0; i < numInodes; i++)
+	delete [] inodes[i].name;
+    delete [] inodes;
+}
+
+//----------------------------------------------------------------------
+// IOStats::NewInode
+// 	A file or directory was just created, with its header at "sector":
+//	forget whatever was counted for a removed file there before.
+//----------------------------------------------------------------------
+
+void
+IOStats::NewInode(int sector, char *name)
+{
+    delete [] inodes[sector].name;
+    memset(&inodes[sector], 0, sizeof(InodeStats));
+    Name(sector, name);
+}
+
+//----------------------------------------------------------------------
+// IOStats::Name
+// 	Remember "name" as the path of the inode at "sector", unless it
+//	already has one.
+//----------------------------------------------------------------------
+
+void
+IOStats::Name(int sector, char *name)
+{
+    if (inodes[sector].name != NULL)
+	return;
+    inodes[sector].name = new char[strlen(name) + 1];
+    strcpy(inodes[sector].name, name);
+}
+
+//----------------------------------------------------------------------
+// IOStats::Move
+// 	The defragmenter moved the header at "from" to "to": the counters
+//	go with it.
+//----------------------------------------------------------------------
+
+void
+IOStats::Move(int from, int to)
+{
+    delete [] inodes[to].name;
+    inodes[to] = inodes[from];
+    memset(&inodes[from], 0, sizeof(InodeStats));
+}
+
+//----------------------------------------------------------------------
+// IOStats::Read/Write
+// 	Count a ReadAt/WriteAt of the inode at "sector" that moved
+//	"numBytes" bytes, starting at "position".
+//----------------------------------------------------------------------
+
+void
+IOStats::Read(int sector, int position, int numBytes)
+{
+    InodeStats *inode = &inodes[sector];
+
+    inode->reads++;
+    if (numBytes <= 0)
+	return;
+    inode->bytesRead += numBytes;
+    inode->sectorsRead += divRoundDown(position + numBytes - 1, SectorSize)
+	    - divRoundDown(position, SectorSize) + 1;
+}
+
+void
+IOStats::Write(int sector, int position, int numBytes)
+{
+    InodeStats *inode = &inodes[sector];
+
+    inode->writes++;
+    if (numBytes <= 0)
+	return;
+    inode->bytesWritten += numBytes;
+    inode->sectorsWritten += divRoundDown(position + numBytes - 1, SectorSize)
+	    - divRoundDown(position, SectorSize) + 1;
+}
+
+//----------------------------------------------------------------------
+// IOStats::HeaderWalk
+// 	Count a read of the header chain of the inode at "sector" from
+//	disk, "numHeaders" sectors long.
+//----------------------------------------------------------------------
+
+void
+IOStats::HeaderWalk(int sector, int numHeaders)
+{
+    inodes[sector].headerWalks++;
+    inodes[sector].headersRead += numHeaders;
+}
+
+//----------------------------------------------------------------------
+// IOStats::StartOperation/EndOperation
+// 	Measure the latency of an operation, in ticks of simulated time:
+//	StartOperation returns the time it starts, to be handed to
+//	EndOperation when it returns.  The host-side tools have no clock,
+//	and measure nothing.
+//----------------------------------------------------------------------
+
+int
+IOStats::StartOperation()
+{
+    return (kernel->stats != NULL) ? kernel->stats->totalTicks : 0;
+}
+
+void
+IOStats::EndOperation(FsOperation op, int startTicks)
+{
+    int ticks = StartOperation() - startTicks;
+
+    opCount[op]++;
+    opTicks[op] += ticks;
+    if (ticks > opMaxTicks[op])
+	opMaxTicks[op] = ticks;
+}
+
+//----------------------------------------------------------------------
+// IOStats::Print
+// 	Print the counters of every operation, and of every inode with any
+//	traffic, one per line, then every sector the disk transferred.
+//----------------------------------------------------------------------
+
+void
+IOStats::Print()
+{
+    printf("File system operations:\n");
+    printf("  %-8s %8s %10s %10s\n", "op", "calls", "ticks", "max ticks");
+    for (int i = 0; i < NumFsOperations; i++)
+	printf("  %-8s %8d %10d %10d\n", opNames[i], opCount[i], opTicks[i],
+		opMaxTicks[i]);
+
+    printf("File system I/O by inode:\n");
+    printf("  %6s %6s %6s %9s %9s %7s %7s %5s %7s  %s\n", "sector",
+	    "reads", "writes", "bytes rd", "bytes wr", "sec rd", "sec wr",
+	    "walks", "headers", "path");
+    for (int i = 0; i < numInodes; i++) {
+	InodeStats *inode = &inodes[i];
+
+	if (inode->reads == 0 && inode->writes == 0 && inode->headerWalks == 0)
+	    continue;
+	printf("  %6d %6d %6d %9d %9d %7d %7d %5d %7d  %s\n", i,
+		inode->reads, inode->writes, inode->bytesRead,
+		inode->bytesWritten, inode->sectorsRead, inode->sectorsWritten,
+		inode->headerWalks, inode->headersRead,
+		(inode->name != NULL) ? inode->name : "?");
+    }
+    printf("Disk sectors transferred: %d read, %d written\n",
+	    kernel->synchDisk->SectorsRead(),
+	    kernel->synchDisk->SectorsWritten());
+}
+
+//----------------------------------------------------------------------
+// PutJSONString
+// 	Write "s" to "out" as a JSON string, or null if there is none.
+//----------------------------------------------------------------------
+
+static void
+PutJSONString(FILE *out, char *s)
+{
+    if (s == NULL) {
+	fprintf(out, "null");
+	return;
+    }
+    fputc('"', out);
+    for (; *s != '\0'; s++) {
+	if (*s == '"' || *s == '\\')
+	    fputc('\\', out);
+	fputc(*s, out);
+    }
+    fputc('"', out);
+}
+
+//----------------------------------------------------------------------
+// IOStats::WriteJSON
+// 	Write the same counters as Print to the UNIX file "fileName", as a
+//	JSON object:
+//
+//	{"ticks": N,
+//	 "operations": {"create": {"calls": N, "ticks": N, "maxTicks": N},
+//			...},
+//	 "inodes": [{"sector": N, "path": "/a/b" or null, "reads": N, ...},
+//		    ...],
+//	 "disk": {"sectorsRead": N, "sectorsWritten": N}}
+//
+//	Return FALSE if the file cannot be written.
+//----------------------------------------------------------------------
+
+bool
+IOStats::WriteJSON(char *fileName)
+{
+    FILE *out = fopen(fileName, "w");
+    bool first = TRUE;
+
+    if (out == NULL)
+	return FALSE;
+    fprintf(out, "{\"ticks\": %d,\n \"operations\": {", StartOperation());
+    for (int i = 0; i < NumFsOperations; i++)
+	fprintf(out, "%s\n  \"%s\": {\"calls\": %d, \"ticks\": %d, "
+		"\"maxTicks\": %d}", (i == 0) ? "" : ",", opNames[i],
+		opCount[i], opTicks[i], opMaxTicks[i]);
+    fprintf(out, "},\n \"inodes\": [");
+    for (int i = 0; i < numInodes; i++) {
+	InodeStats *inode = &inodes[i];
+
+	if (inode->reads == 0 && inode->writes == 0 && inode->headerWalks == 0)
+	    continue;
+	fprintf(out, "%s\n  {\"sector\": %d, \"path\": ", first ? "" : ",", i);
+	PutJSONString(out, inode->name);
+	fprintf(out, ", \"reads\": %d, \"writes\": %d, \"bytesRead\": %d, "
+		"\"bytesWritten\": %d, \"sectorsRead\": %d, "
+		"\"sectorsWritten\": %d, \"headerWalks\": %d, "
+		"\"headersRead\": %d}", inode->reads, inode->writes,
+		inode->bytesRead, inode->bytesWritten, inode->sectorsRead,
+		inode->sectorsWritten, inode->headerWalks, inode->headersRead);
+	first = FALSE;
+    }
+    fprintf(out, "],\n \"disk\": {\"sectorsRead\": %d, "
+	    "\"sectorsWritten\": %d}}\n", kernel->synchDisk->SectorsRead(),
+	    kernel->synchDisk->SectorsWritten());
+    fclose(out);
+    return TRUE;
+}
+
+//----------------------------------------------------------------------
+// IOStats::ReportAtHalt
+// 	Ask for the counters to be printed, and/or written to the UNIX
+//	file "jsonFileName", when Nachos halts; by then they include the
+//	traffic of every user program.
+//----------------------------------------------------------------------
+
+void
+IOStats::ReportAtHalt(bool print, char *jsonFileName)
+{
+    printAtHalt = print;
+    jsonAtHalt = jsonFileName;
+}
+
+//----------------------------------------------------------------------
+// IOStats::Halt
+// 	Nachos is halting: report what ReportAtHalt asked for.
+//----------------------------------------------------------------------
+
+void
+IOStats::Halt()
+{
+    if (printAtHalt)
+	Print();
+    if (jsonAtHalt != NULL && !WriteJSON(jsonAtHalt))
+	printf("Unable to write file system I/O counters to %s\n", jsonAtHalt);
+}
@@ -0,0 +1,89 @@
+// iostats.h
+//	Data structures to account for the disk traffic of the file system,
+//	so that we can see which files and directories generate it.
+//
+//	Each inode -- a file or directory, named by the sector of its file
+//	header -- counts the reads and writes made through its OpenFiles,
+//	the bytes moved, the data sectors those bytes span, and how often
+//	its header chain was read from disk.  Each path operation (Create,
+//	Open, Remove, List) counts its calls and their latency, in ticks of
+//	simulated time.
+//
+//	Those counters follow what files ask for.  The sectors the disk
+//	actually read and wrote -- headers, the bitmap and the reference
+//	counts written back as files change, blocks read to be partly
+//	rewritten or compared by dedup -- are counted by SynchDisk, and
+//	reported with them.
+//
+//	Inodes are named by the paths they are created or opened by, so
+//	that reporting needs no disk access; it can be done as Nachos
+//	halts.  A file created over the header sector of a removed one
+//	starts its counts afresh.
+//
+// Copyright (c) 1992-1996 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#ifndef IOSTATS_H
+#define IOSTATS_H
+
+#include "copyright.h"
+
+// The path operations whose latency is measured
+enum FsOperation { FsCreate, FsOpen, FsRemove, FsList, NumFsOperations };
+
+// The counters of one inode
+class InodeStats {
+  public:
+    int reads, writes;			// ReadAt/WriteAt calls
+    int bytesRead, bytesWritten;	// bytes they moved
+    int sectorsRead, sectorsWritten;	// data sectors those bytes span
+    int headerWalks;			// times the header chain was read
+    int headersRead;			// header sectors read by those walks
+    char *name;				// path of the inode, or NULL
+};
+
+class IOStats {
+  public:
+    IOStats(int numInodes);		// Initialize all counters to zero
+    ~IOStats();
+
+    void NewInode(int sector, char *name);
+					// A file or directory was created
+					// with its header at "sector"
+    void Name(int sector, char *name);	// Name the inode at "sector", if it
+					// has no name yet
+    void Move(int from, int to);	// The header at "from" moved to "to"
+
+    void Read(int sector, int position, int numBytes);
+    void Write(int sector, int position, int numBytes);
+					// Count a read/write of "numBytes"
+					// at "position" of an inode
+    void HeaderWalk(int sector, int numHeaders);
+					// Count a read of the header chain
+
+    int StartOperation();		// Return the time now, in ticks
+    void EndOperation(FsOperation op, int startTicks);
+					// Count an operation started then
+
+    void Print();			// Print the counters to stdout
+    bool WriteJSON(char *fileName);	// Write them to a UNIX file, as
+					// JSON; FALSE if it cannot be opened
+
+    void ReportAtHalt(bool print, char *jsonFileName);
+					// What to report when Nachos halts
+    void Halt();			// Report it
+
+  private:
+    int numInodes;
+    InodeStats *inodes;			// counters of each header sector
+    int opCount[NumFsOperations];	// calls of each operation
+    int opTicks[NumFsOperations];	// total latency of those calls
+    int opMaxTicks[NumFsOperations];	// longest of them
+
+    bool printAtHalt;			// Print at halt?
+    char *jsonAtHalt;			// Write JSON to this file at halt,
+					// or NULL
+};
+
+#endif // IOSTATS_H
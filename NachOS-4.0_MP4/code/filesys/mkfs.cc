@@ -0,0 +1,198 @@
+// mkfs.cc
+//	Host-side tool that builds a complete Nachos disk image ("DISK_0"
+//	by default) from a directory tree on the host, in one pass:
+//
+//		mkfs [-d debugFlags] [-o diskFile] hostDirectory
+//
+//	Every directory under "hostDirectory" becomes a Nachos directory,
+//	and every regular file a Nachos file, with the same path.
+//
+//	Rather than re-implementing the on-disk format, mkfs links the
+//	real file system code (FileSystem, Directory, FileHeader,
+//	PersistentBitmap, OpenFile), over the in-memory disk of
+//	hostdisk.h.  The image is written out to the UNIX file in a
+//	single pass at the end, in the same format Disk expects.  Since
+//	the disk starts out empty and files are written one after the
+//	other, each file's sectors are laid out contiguously.
+//
+// Copyright (c) 1992-1996 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#include "copyright.h"
+#include "main.h"
+#include "filesys.h"
+#include "filehdr.h"
+#include "openfile.h"
+#include "sysdep.h"
+#include "hostdisk.h"
+#include <dirent.h>
+#include <sys/stat.h>
+
+static const int TransferSize = 32 * MaxFileSize;
+static int numErrors = 0;
+
+//----------------------------------------------------------------------
+// CopyFile
+//      Copy the UNIX file "from" to the new Nachos file "to".
+//----------------------------------------------------------------------
+
+static void
+CopyFile(char *from, char *to, int fileLength, char *buffer)
+{
+    int fd, amountRead;
+    OpenFile *openFile;
+
+    if ((fd = OpenForReadWrite(from, FALSE)) < 0) {
+	printf("mkfs: couldn't open %s\n", from);
+	numErrors++;
+	return;
+    }
+    if (!kernel->fileSystem->Create(to, fileLength, FALSE)) {
+	printf("mkfs: couldn't create %s\n", to);
+	numErrors++;
+	Close(fd);
+	return;
+    }
+    openFile = kernel->fileSystem->Open(to);
+    ASSERT(openFile != NULL);
+    while ((amountRead = ReadPartial(fd, buffer, TransferSize)) > 0)
+	openFile->Write(buffer, amountRead);
+    delete openFile;
+    Close(fd);
+}
+
+static int
+CompareNames(const void *a, const void *b)
+{
+    return strcmp(*(char * const *) a, *(char * const *) b);
+}
+
+//----------------------------------------------------------------------
+// CopyTree
+//      Recreate the contents of the UNIX directory "from" under the
+//	Nachos directory "to" ("" for the root).  Entries are copied in
+//	name order, so the same tree always gives the same image.
+//----------------------------------------------------------------------
+
+static void
+CopyTree(char *from, char *to, char *buffer)
+{
+    DIR *dir;
+    struct dirent *entry;
+    struct stat info;
+    char **names, **more;
+    char hostPath[1024], nachosPath[1024];
+    int numNames = 0, maxNames = 16;
+
+    if ((dir = opendir(from)) == NULL) {
+	printf("mkfs: couldn't open directory %s\n", from);
+	numErrors++;
+	return;
+    }
+    names = new char *[maxNames];
+    while ((entry = readdir(dir)) != NULL) {
+	if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+	    continue;
+	if (numNames == maxNames) {
+	    more = new char *[2 * maxNames];
+	    memcpy(more, names, maxNames * sizeof(char *));
+	    delete [] names;
+	    names = more;
+	    maxNames *= 2;
+	}
+	names[numNames++] = strdup(entry->d_name);
+    }
+    closedir(dir);
+    qsort(names, numNames, sizeof(char *), CompareNames);
+
+    for (int i = 0; i < numNames; i++) {
+	snprintf(hostPath, sizeof(hostPath), "%s/%s", from, names[i]);
+	snprintf(nachosPath, sizeof(nachosPath), "%s/%s", to, names[i]);
+	if (stat(hostPath, &info) < 0) {
+	    printf("mkfs: couldn't stat %s\n", hostPath);
+	    numErrors++;
+	} else if (S_ISDIR(info.st_mode)) {
+	    DEBUG(dbgFile, "mkfs: directory " << nachosPath);
+	    if (!kernel->fileSystem->Create(nachosPath, 0, TRUE)) {
+		printf("mkfs: couldn't create directory %s\n", nachosPath);
+		numErrors++;
+	    } else {
+		CopyTree(hostPath, nachosPath, buffer);
+	    }
+	} else if (S_ISREG(info.st_mode)) {
+	    DEBUG(dbgFile, "mkfs: file " << nachosPath << " size " << info.st_size);
+	    CopyFile(hostPath, nachosPath, info.st_size, buffer);
+	}
+	free(names[i]);
+    }
+    delete [] names;
+}
+
+//----------------------------------------------------------------------
+// WriteImage
+//      Write the disk image to the UNIX file "name", laid out the way
+//	Disk expects it: the magic number, then the sectors.  Sectors past
+//	the last one used are left as a hole, as Disk does for a new disk.
+//----------------------------------------------------------------------
+
+static void
+WriteImage(char *name)
+{
+    int fd = OpenForWrite(name);
+    int magicNum = MagicNumber;
+    int tmp = 0;
+
+    WriteFile(fd, (char *) &magicNum, MagicSize);
+    WriteFile(fd, hostImage, (hostLastSector + 1) * SectorSize);
+    Lseek(fd, DiskSize - sizeof(int), 0);
+    WriteFile(fd, (char *) &tmp, sizeof(int));
+    Close(fd);
+}
+
+//----------------------------------------------------------------------
+// main
+// 	Format an in-memory disk, copy the host tree into it, and write
+//	it out.
+//----------------------------------------------------------------------
+
+int
+main(int argc, char **argv)
+{
+    char *debugArg = "";
+    char *diskName = "DISK_0";
+    char *treeName = NULL;
+    char *buffer;
+    double start = HostSeconds();
+
+    for (int i = 1; i < argc; i++) {
+	if (strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+	    debugArg = argv[++i];
+	} else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+	    diskName = argv[++i];
+	} else if (treeName == NULL && argv[i][0] != '-') {
+	    treeName = argv[i];
+	} else {
+	    treeName = NULL;
+	    break;
+	}
+    }
+    if (treeName == NULL) {
+	printf("Usage: mkfs [-d debugFlags] [-o diskFile] hostDirectory\n");
+	return 1;
+    }
+
+    hostImage = new char[NumSectors * SectorSize];
+    memset(hostImage, 0, NumSectors * SectorSize);
+    HostDiskInit(debugArg);
+    kernel->fileSystem = new FileSystem(TRUE);	// format
+
+    buffer = new char[TransferSize];
+    CopyTree(treeName, "", buffer);
+    delete [] buffer;
+
+    WriteImage(diskName);
+    printf("mkfs: wrote %s up to sector %d, %d error(s), %.3f s\n",
+	    diskName, hostLastSector, numErrors, HostSeconds() - start);
+    return numErrors == 0 ? 0 : 1;
+}
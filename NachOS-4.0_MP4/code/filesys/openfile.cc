@@ -17,6 +17,10 @@
 #include "filehdr.h"
 #include "openfile.h"
 #include "synchdisk.h"
+#include "filesys.h"
+#include "compress.h"
+#include "iostats.h"
+#include "synch.h"
 
 //----------------------------------------------------------------------
 // OpenFile::OpenFile
@@ -28,9 +32,25 @@
 
 OpenFile::OpenFile(int sector)
 { 
+    RWLock *lock;
+
     hdr = new FileHeader;
-    hdr->FetchFrom(sector);
     seekPosition = 0;
+    hdrSector = sector;
+    extentCache = NULL;
+    cachedExtent = -1;
+    isDirectory = FALSE;
+
+    //MP4 lock: not while the header is half written
+    lock = FileLock();
+    if (lock != NULL)
+	lock->AcquireRead();
+    hdrVersion = (lock != NULL) ? kernel->fileSystem->HeaderVersion(sector) : 0;
+    hdr->FetchFrom(sector);
+    if (lock != NULL)
+	lock->ReleaseRead();
+    if (kernel->fileSystem != NULL)	//MP4 iostat
+	kernel->fileSystem->ioStats->HeaderWalk(sector, hdr->NumHeaders());
 }
 
 //----------------------------------------------------------------------
@@ -41,6 +61,7 @@ OpenFile::OpenFile(int sector)
 OpenFile::~OpenFile()
 {
     delete hdr;
+    delete [] extentCache;
 }
 
 //----------------------------------------------------------------------
@@ -86,8 +107,139 @@ OpenFile::Write(char *into, int numBytes)
    return result;
 }
 
+//MP4 lock
+//----------------------------------------------------------------------
+// OpenFile::FileLock
+// 	Return the lock on this file, or NULL while there is no file
+//	system yet (as it formats the disk), and for the system files,
+//	which the file system locks itself.
+//----------------------------------------------------------------------
+
+RWLock *
+OpenFile::FileLock()
+{
+    if (kernel->fileSystem == NULL)
+	return NULL;
+    return kernel->fileSystem->FileLock(hdrSector);
+}
+
+//----------------------------------------------------------------------
+// OpenFile::LockFile/UnlockFile
+// 	Lock the file for reading or for writing around an access.
+//
+//	Another OpenFile of the same file may have changed the header on
+//	disk (growing the file, or moving its blocks) since "hdr" was
+//	read; once the lock is held, "hdr" is brought up to date.  That
+//	needs the lock for writing, so a reader that finds its header
+//	stale lets go, refreshes it, and then reads.
+//
+//	"writing" -- lock the file for writing, rather than reading
+//----------------------------------------------------------------------
+
+void
+OpenFile::LockFile(bool writing)
+{
+    RWLock *lock = FileLock();
+
+    if (lock == NULL)
+	return;
+    if (writing) {
+	lock->AcquireWrite();
+	RefreshHeader();
+	return;
+    }
+    lock->AcquireRead();
+    while (hdrVersion != kernel->fileSystem->HeaderVersion(hdrSector)) {
+	lock->ReleaseRead();
+	lock->AcquireWrite();
+	RefreshHeader();
+	lock->ReleaseWrite();
+	lock->AcquireRead();
+    }
+}
+
+void
+OpenFile::UnlockFile(bool writing)
+{
+    RWLock *lock = FileLock();
+
+    if (lock == NULL)
+	return;
+    if (writing) {
+	// our own changes to the header are already in "hdr"
+	hdrVersion = kernel->fileSystem->HeaderVersion(hdrSector);
+	lock->ReleaseWrite();
+    } else {
+	lock->ReleaseRead();
+    }
+}
+
+//----------------------------------------------------------------------
+// OpenFile::RefreshHeader
+// 	Re-read the file header, if it changed since "hdr" was read.
+//	Called with the file locked for writing.
+//----------------------------------------------------------------------
+
+void
+OpenFile::RefreshHeader()
+{
+    int version = kernel->fileSystem->HeaderVersion(hdrSector);
+    FileHeader *fresh;
+
+    if (version == hdrVersion)
+	return;
+    DEBUG(dbgFile, "Re-reading the header of file at sector " << hdrSector);
+    fresh = new FileHeader;
+    fresh->FetchFrom(hdrSector);
+    delete hdr;
+    hdr = fresh;
+    hdrVersion = version;
+    kernel->fileSystem->ioStats->HeaderWalk(hdrSector, hdr->NumHeaders());
+    cachedExtent = -1;			// its sectors may have moved
+}
+
 //----------------------------------------------------------------------
 // OpenFile::ReadAt/WriteAt
+// 	Read/write a portion of a file, starting at "position", with the
+//	file locked: any number of threads may read it at once, but a
+//	thread writing it has it to itself.  Reading a compressed file
+//	changes "extentCache", so that is done as a writer too.
+//----------------------------------------------------------------------
+
+int
+OpenFile::ReadAt(char *into, int numBytes, int position)
+{
+    bool writing = hdr->IsCompressed();
+    int result;
+
+    LockFile(writing);
+    if (!writing && hdr->IsCompressed()) {	// it just became so
+	UnlockFile(FALSE);
+	writing = TRUE;
+	LockFile(TRUE);
+    }
+    result = ReadBlocks(into, numBytes, position);
+    UnlockFile(writing);
+    if (kernel->fileSystem != NULL)	//MP4 iostat
+	kernel->fileSystem->ioStats->Read(hdrSector, position, result);
+    return result;
+}
+
+int
+OpenFile::WriteAt(char *from, int numBytes, int position)
+{
+    int result;
+
+    LockFile(TRUE);
+    result = WriteBlocks(from, numBytes, position);
+    UnlockFile(TRUE);
+    if (kernel->fileSystem != NULL)	//MP4 iostat
+	kernel->fileSystem->ioStats->Write(hdrSector, position, result);
+    return result;
+}
+
+//----------------------------------------------------------------------
+// OpenFile::ReadBlocks/WriteBlocks
 // 	Read/write a portion of a file, starting at "position".
 //	Return the number of bytes actually written or read, but has
 //	no side effects (except that Write modifies the file, of course).
@@ -113,10 +265,11 @@ OpenFile::Write(char *into, int numBytes)
 //----------------------------------------------------------------------
 
 int
-OpenFile::ReadAt(char *into, int numBytes, int position)
+OpenFile::ReadBlocks(char *into, int numBytes, int position)
 {
     int fileLength = hdr->FileLength();
     int i, firstSector, lastSector, numSectors;
+    int *sectors;
     char *buf;
 
     if ((numBytes <= 0) || (position >= fileLength))
@@ -125,36 +278,70 @@ OpenFile::ReadAt(char *into, int numBytes, int position)
 	numBytes = fileLength - position;
     DEBUG(dbgFile, "Reading " << numBytes << " bytes at " << position << " from file of length " << fileLength);
 
+    //MP4 inline: the data is already in memory, along with the header
+    if (hdr->IsInline()) {
+	bcopy(hdr->InlineData() + position, into, numBytes);
+	return numBytes;
+    }
+    //MP4 compress
+    if (hdr->IsCompressed())
+	return ReadExtents(into, numBytes, position);
+
     firstSector = divRoundDown(position, SectorSize);
     lastSector = divRoundDown(position + numBytes - 1, SectorSize);
     numSectors = 1 + lastSector - firstSector;
 
     // read in all the full and partial sectors that we need
     buf = new char[numSectors * SectorSize];
+    sectors = new int[numSectors];
+    hdr->ByteToSectors(firstSector * SectorSize, numSectors, sectors);
     for (i = firstSector; i <= lastSector; i++)	
-        kernel->synchDisk->ReadSector(hdr->ByteToSector(i * SectorSize), 
+        kernel->synchDisk->ReadSector(sectors[i - firstSector], 
 					&buf[(i - firstSector) * SectorSize]);
 
     // copy the part we want
     bcopy(&buf[position - (firstSector * SectorSize)], into, numBytes);
+    delete [] sectors;
     delete [] buf;
     return numBytes;
 }
 
 int
-OpenFile::WriteAt(char *from, int numBytes, int position)
+OpenFile::WriteBlocks(char *from, int numBytes, int position)
 {
     int fileLength = hdr->FileLength();
+    int oldLength = fileLength;
     int i, firstSector, lastSector, numSectors;
+    int *sectors;
+    bool *shared;
     bool firstAligned, lastAligned;
     char *buf;
 
-    if ((numBytes <= 0) || (position >= fileLength))
+    if ((numBytes <= 0) || (position > fileLength))
 	return 0;				// check request
-    if ((position + numBytes) > fileLength)
-	numBytes = fileLength - position;
+    //MP4 inline: writing at or past the end grows the file, if possible
+    if ((position + numBytes) > fileLength) {
+	if (kernel->fileSystem->Extend(hdr, hdrSector, position + numBytes))
+	    fileLength = hdr->FileLength();
+	else
+	    numBytes = fileLength - position;
+	if (numBytes <= 0)
+	    return 0;
+    }
     DEBUG(dbgFile, "Writing " << numBytes << " bytes at " << position << " from file of length " << fileLength);
 
+    //MP4 inline: update the data in the header, and write the header back
+    if (hdr->IsInline()) {
+	bcopy(from, hdr->InlineData() + position, numBytes);
+	hdr->WriteBack(hdrSector);
+	if (kernel->fileSystem != NULL)
+	    kernel->fileSystem->HeaderChanged(hdrSector);
+	return numBytes;
+    }
+    //MP4 compress
+    if (hdr->IsCompressed())
+	return WriteExtents(from, numBytes, position, oldLength);
+
     firstSector = divRoundDown(position, SectorSize);
     lastSector = divRoundDown(position + numBytes - 1, SectorSize);
     numSectors = 1 + lastSector - firstSector;
@@ -168,23 +355,214 @@ OpenFile::WriteAt(char *from, int numBytes, int position)
     lastAligned = ((position + numBytes) == ((lastSector + 1) * SectorSize));
 
 // read in first and last sector, if they are to be partially modified
-    if (!firstAligned)
-        ReadAt(buf, SectorSize, firstSector * SectorSize);	
-    if (!lastAligned && ((firstSector != lastSector) || firstAligned))
-        ReadAt(&buf[(lastSector - firstSector) * SectorSize], 
+// (sectors that only just got allocated past the old end hold nothing yet)
+    if (!firstAligned && (firstSector * SectorSize < oldLength))
+        ReadBlocks(buf, SectorSize, firstSector * SectorSize);	
+    if (!lastAligned && ((firstSector != lastSector) || firstAligned)
+		&& (lastSector * SectorSize < oldLength))
+        ReadBlocks(&buf[(lastSector - firstSector) * SectorSize], 
 				SectorSize, lastSector * SectorSize);	
 
 // copy in the bytes we want to change 
     bcopy(from, &buf[position - (firstSector * SectorSize)], numBytes);
 
 // write modified sectors back
+    sectors = new int[numSectors];
+    hdr->ByteToSectors(firstSector * SectorSize, numSectors, sectors);
+    //MP4 clone: blocks still shared with a clone are copied on write
+    //(there is no file system yet while it formats the disk)
+    if (kernel->fileSystem != NULL && !kernel->fileSystem->Unshare(hdr,
+		hdrSector, firstSector, numSectors, sectors)) {
+	delete [] sectors;
+	delete [] buf;
+	return 0;				// disk full
+    }
+    //MP4 dedup: blocks already on disk are shared instead of written
+    shared = new bool[numSectors];
+    if (kernel->fileSystem != NULL && !isDirectory)
+	kernel->fileSystem->Dedup(hdr, hdrSector, firstSector, numSectors,
+		sectors, buf, shared);
+    else
+	memset(shared, 0, numSectors * sizeof(bool));
     for (i = firstSector; i <= lastSector; i++)	
-        kernel->synchDisk->WriteSector(hdr->ByteToSector(i * SectorSize), 
+	if (!shared[i - firstSector])
+	    kernel->synchDisk->WriteSector(sectors[i - firstSector], 
 					&buf[(i - firstSector) * SectorSize]);
+    delete [] shared;
+    delete [] sectors;
     delete [] buf;
     return numBytes;
 }
 
+//----------------------------------------------------------------------
+// OpenFile::SetCompressed
+// 	Compress the data written to the file from now on.  Data already
+//	in the file stays as it is, until it is written again.
+//----------------------------------------------------------------------
+
+void
+OpenFile::SetCompressed()
+{
+    LockFile(TRUE);
+    if (!hdr->IsCompressed()) {
+	hdr->SetCompressed();
+	hdr->WriteBack(hdrSector);
+	if (kernel->fileSystem != NULL)
+	    kernel->fileSystem->HeaderChanged(hdrSector);
+    }
+    UnlockFile(TRUE);
+}
+
+//----------------------------------------------------------------------
+// OpenFile::FetchExtent
+// 	Bring the data of extent number "extent" of a compressed file into
+//	"extentCache", reading only the sectors it is stored in.  An extent
+//	whose blocks all have sectors is stored as it is; otherwise its
+//	leading sectors, up to the first hole, hold its compressed data.
+//	The cache is zero past the data of the extent.
+//----------------------------------------------------------------------
+
+void
+OpenFile::FetchExtent(int extent)
+{
+    int sectors[ExtentSectors];
+    char packed[ExtentSize];
+    short lengths[2];			// data and compressed lengths
+    int first = extent * ExtentSectors;
+    int slots = min(ExtentSectors,
+		divRoundUp(hdr->FileLength(), SectorSize) - first);
+    int used, length;
+
+    if (extentCache == NULL)
+	extentCache = new char[ExtentSize];
+    if (extent == cachedExtent)
+	return;
+
+    hdr->ByteToSectors(first * SectorSize, slots, sectors);
+    for (used = 0; used < slots && sectors[used] != NoSector; used++)
+	;
+    memset(extentCache, 0, ExtentSize);
+    if (used == slots) {
+	for (int i = 0; i < slots; i++)
+	    kernel->synchDisk->ReadSector(sectors[i],
+					&extentCache[i * SectorSize]);
+    } else {
+	for (int i = 0; i < used; i++)
+	    kernel->synchDisk->ReadSector(sectors[i], &packed[i * SectorSize]);
+	memcpy(lengths, packed, ExtentHeaderSize);
+	length = Decompress(&packed[ExtentHeaderSize], lengths[1],
+				extentCache, ExtentSize);
+	ASSERT(length == lengths[0]);
+    }
+    cachedExtent = extent;
+}
+
+//----------------------------------------------------------------------
+// OpenFile::ReadExtents
+// 	ReadAt for a compressed file: copy out of each extent in turn,
+//	decompressed into the extent cache.  Sequential reads only
+//	decompress each extent once.  The request has been checked by
+//	ReadAt.
+//----------------------------------------------------------------------
+
+int
+OpenFile::ReadExtents(char *into, int numBytes, int position)
+{
+    int done, offset, amount;
+
+    for (done = 0; done < numBytes; done += amount) {
+	offset = (position + done) % ExtentSize;
+	amount = min(ExtentSize - offset, numBytes - done);
+	FetchExtent((position + done) / ExtentSize);
+	bcopy(&extentCache[offset], &into[done], amount);
+    }
+    return numBytes;
+}
+
+//----------------------------------------------------------------------
+// OpenFile::WriteExtents
+// 	WriteAt for a compressed file, once WriteAt has grown it as needed.
+//	Every extent the write touches is rebuilt in the extent cache,
+//	compressed, and stored in its leading blocks; the blocks this
+//	leaves over become holes (see FileSystem::Repack).  An extent that
+//	would not take fewer sectors compressed is stored as it is.
+//
+//	"oldLength" is the length of the file before it was grown
+//----------------------------------------------------------------------
+
+int
+OpenFile::WriteExtents(char *from, int numBytes, int position, int oldLength)
+{
+    int fileLength = hdr->FileLength();
+    int firstExtent = position / ExtentSize;
+    int lastExtent = (position + numBytes - 1) / ExtentSize;
+    int numExtents = 1 + lastExtent - firstExtent;
+    int first = firstExtent * ExtentSectors;
+    int count = min((lastExtent + 1) * ExtentSectors,
+		divRoundUp(fileLength, SectorSize)) - first;
+    int *sectors = new int[count];
+    int *used = new int[numExtents];
+    char *packed = new char[numExtents * ExtentSize];
+    short lengths[2];			// data and compressed lengths
+    int start, length, slots, lo, hi, packedLength;
+    bool success;
+
+    if (extentCache == NULL)
+	extentCache = new char[ExtentSize];
+    memset(packed, 0, numExtents * ExtentSize);
+    for (int k = 0; k < numExtents; k++) {
+	char *block = &packed[k * ExtentSize];
+
+	start = (firstExtent + k) * ExtentSize;
+	length = min(ExtentSize, fileLength - start);
+	slots = divRoundUp(length, SectorSize);
+
+	// keep whatever part of the old data is not overwritten
+	if (start < oldLength
+		&& (position > start || position + numBytes < start + length)) {
+	    FetchExtent(firstExtent + k);
+	    if (oldLength - start < ExtentSize)	// grown: nothing there yet
+		memset(&extentCache[oldLength - start], 0,
+			ExtentSize - (oldLength - start));
+	} else {
+	    memset(extentCache, 0, ExtentSize);
+	}
+	cachedExtent = firstExtent + k;
+	lo = max(position, start);
+	hi = min(position + numBytes, start + length);
+	bcopy(&from[lo - position], &extentCache[lo - start], hi - lo);
+
+	packedLength = Compress(extentCache, length, &block[ExtentHeaderSize],
+			(slots - 1) * SectorSize - ExtentHeaderSize);
+	if (packedLength < 0) {
+	    bcopy(extentCache, block, slots * SectorSize);
+	    used[k] = slots;
+	} else {
+	    lengths[0] = length;
+	    lengths[1] = packedLength;
+	    memcpy(block, lengths, ExtentHeaderSize);
+	    used[k] = divRoundUp(ExtentHeaderSize + packedLength, SectorSize);
+	}
+    }
+    DEBUG(dbgFile, "Writing " << numExtents << " compressed extents from extent " << firstExtent);
+
+    hdr->ByteToSectors(first * SectorSize, count, sectors);
+    success = kernel->fileSystem->Repack(hdr, hdrSector, first, count,
+				sectors, used);
+    if (success) {
+	for (int i = 0; i < count; i++)
+	    if (sectors[i] != NoSector)
+		kernel->synchDisk->WriteSector(sectors[i],
+					&packed[i * SectorSize]);
+    } else {
+	cachedExtent = -1;		// the cache is not on disk
+    }
+    delete [] sectors;
+    delete [] used;
+    delete [] packed;
+    return success ? numBytes : 0;
+}
+
 //----------------------------------------------------------------------
 // OpenFile::Length
 // 	Return the number of bytes in the file.
@@ -193,7 +571,12 @@ OpenFile::WriteAt(char *from, int numBytes, int position)
 int
 OpenFile::Length() 
 { 
-    return hdr->FileLength(); 
+    int length;
+
+    LockFile(FALSE);			//MP4 lock: it may have grown
+    length = hdr->FileLength();
+    UnlockFile(FALSE);
+    return length;
 }
 
 #endif //FILESYS_STUB
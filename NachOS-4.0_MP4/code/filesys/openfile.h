@@ -9,9 +9,9 @@
 //
 //	The other is the "real" implementation, that turns these
 //	operations into read and write disk sector requests. 
-//	In this baseline implementation of the file system, we don't 
-//	worry about concurrent accesses to the file system
-//	by different threads.
+//	MP4 lock: each file has a readers/writer lock (see
+//	FileSystem::FileLock), which ReadAt and WriteAt take, so that
+//	different threads can use the same file at once.
 //
 // Copyright (c) 1992-1993 The Regents of the University of California.
 // All rights reserved.  See copyright.h for copyright notice and limitation 
@@ -33,12 +33,10 @@ class OpenFile {
     ~OpenFile() { Close(file); }			// close the file
 
     int ReadAt(char *into, int numBytes, int position) { 
-    		Lseek(file, position, 0); 
-		return ReadPartial(file, into, numBytes); 
+		return ReadPartialAt(file, into, numBytes, position); 
 		}	
     int WriteAt(char *from, int numBytes, int position) { 
-    		Lseek(file, position, 0); 
-		WriteFile(file, from, numBytes); 
+		WriteFileAt(file, from, numBytes, position); 
 		return numBytes;
 		}	
     int Read(char *into, int numBytes) {
@@ -52,7 +50,8 @@ class OpenFile {
 		return numWritten;
 		}
 
-    int Length() { Lseek(file, 0, 2); return Tell(file); }
+    int Length() { return FileLength(file); }
+    void SetDirectory() {}		// (UNIX shares no blocks)
     
   private:
     int file;
@@ -61,6 +60,7 @@ class OpenFile {
 
 #else // FILESYS
 class FileHeader;
+class RWLock;
 
 class OpenFile {
   public:
@@ -81,15 +81,57 @@ class OpenFile {
     					// Read/write bytes from the file,
 					// bypassing the implicit position.
     int WriteAt(char *from, int numBytes, int position);
+					// Writing at or past the end of
+					// the file extends it
 
     int Length(); 			// Return the number of bytes in the
 					// file (this interface is simpler 
 					// than the UNIX idiom -- lseek to 
 					// end of file, tell, lseek back 
+
+    //MP4 defrag
+    int HeaderSector() { return hdrSector; }
+					// Disk sector holding the file header
+    int Position() { return seekPosition; }
+					// Where the next Read or Write starts
+
+    //MP4 compress
+    void SetCompressed();		// Compress the data written to the
+					// file from now on
+
+    //MP4 dedup
+    void SetDirectory() { isDirectory = TRUE; }
+					// The file holds a directory, whose
+					// blocks are never shared
     
   private:
     FileHeader *hdr;			// Header for this file 
     int seekPosition;			// Current position within the file
+    int hdrSector;			// Where "hdr" lives on disk
+
+    //MP4 lock
+    int ReadBlocks(char *into, int numBytes, int position);
+    int WriteBlocks(char *from, int numBytes, int position);
+					// ReadAt/WriteAt, with the file
+					// already locked
+    RWLock *FileLock();			// The lock on this file, or NULL
+    void LockFile(bool writing);	// Lock the file, and bring "hdr" up
+					// to date with the disk
+    void UnlockFile(bool writing);
+    void RefreshHeader();		// Re-read "hdr" if it is stale
+    int hdrVersion;			// FileSystem::HeaderVersion "hdr" is
+					// as of
+    bool isDirectory;			// Set by SetDirectory
+
+    //MP4 compress
+    int ReadExtents(char *into, int numBytes, int position);
+    int WriteExtents(char *from, int numBytes, int position, int oldLength);
+					// ReadAt/WriteAt for compressed files
+    void FetchExtent(int extent);	// Bring the data of "extent" into
+					// "extentCache"
+    char *extentCache;			// Data of the last extent read or
+					// written, uncompressed
+    int cachedExtent;			// Which extent that is, or -1
 };
 
 #endif // FILESYS
@@ -8,6 +8,7 @@
 
 #include "copyright.h"
 #include "pbitmap.h"
+#include "disk.h"
 
 //----------------------------------------------------------------------
 // PersistentBitmap::PersistentBitmap(int)
@@ -21,6 +22,7 @@
 
 PersistentBitmap::PersistentBitmap(int numItems):Bitmap(numItems) 
 { 
+    onDisk = NULL;
 }
 
 //----------------------------------------------------------------------
@@ -40,7 +42,8 @@ PersistentBitmap::PersistentBitmap(OpenFile *file, int numItems):Bitmap(numItems
     // map has already been initialized by the BitMap constructor,
     // but we will just overwrite that with the contents of the
     // map found in the file
-    file->ReadAt((char *)map, numWords * sizeof(unsigned), 0);
+    onDisk = NULL;
+    FetchFrom(file);
 }
 
 //----------------------------------------------------------------------
@@ -50,6 +53,7 @@ PersistentBitmap::PersistentBitmap(OpenFile *file, int numItems):Bitmap(numItems
 
 PersistentBitmap::~PersistentBitmap()
 { 
+    delete [] onDisk;
 }
 
 //----------------------------------------------------------------------
@@ -63,17 +67,46 @@ void
 PersistentBitmap::FetchFrom(OpenFile *file) 
 {
     file->ReadAt((char *)map, numWords * sizeof(unsigned), 0);
+    if (onDisk == NULL)
+	onDisk = new unsigned int[numWords];
+    memcpy(onDisk, map, numWords * sizeof(unsigned));
 }
 
 //----------------------------------------------------------------------
 // PersistentBitmap::WriteBack
 // 	Store the contents of a persistent bitmap to a Nachos file.
 //
+//	MP4 inline: a bitmap read from "file" only writes back the
+//	sectors of it that changed since, in runs of adjacent sectors;
+//	most allocations touch one sector of a bitmap hundreds long.
+//
 //	"file" is the place to write the bitmap to
 //----------------------------------------------------------------------
 
 void
 PersistentBitmap::WriteBack(OpenFile *file)
 {
-   file->WriteAt((char *)map, numWords * sizeof(unsigned), 0);
+    const int wordsPerSector = SectorSize / sizeof(unsigned);
+    int first, last;
+
+    if (onDisk == NULL) {
+	file->WriteAt((char *)map, numWords * sizeof(unsigned), 0);
+	onDisk = new unsigned int[numWords];
+	memcpy(onDisk, map, numWords * sizeof(unsigned));
+	return;
+    }
+    for (first = 0; first < numWords; first = last) {
+	last = min(first + wordsPerSector, numWords);
+	if (memcmp(&map[first], &onDisk[first],
+			(last - first) * sizeof(unsigned)) == 0)
+	    continue;
+	// extend the run over the changed sectors that follow
+	while (last < numWords && memcmp(&map[last], &onDisk[last],
+		(min(last + wordsPerSector, numWords) - last)
+			* sizeof(unsigned)) != 0)
+	    last = min(last + wordsPerSector, numWords);
+	file->WriteAt((char *)&map[first], (last - first) * sizeof(unsigned),
+			first * sizeof(unsigned));
+	memcpy(&onDisk[first], &map[first], (last - first) * sizeof(unsigned));
+    }
 }
@@ -30,6 +30,11 @@ class PersistentBitmap : public Bitmap {
 
     void FetchFrom(OpenFile *file);     // read bitmap from the disk
     void WriteBack(OpenFile *file); 	// write bitmap contents to disk 
+
+  private:
+    //MP4 inline
+    unsigned int *onDisk;		// contents as last read or written,
+					// or NULL if never read
 };
 
 #endif // PBITMAP_H
@@ -0,0 +1,294 @@
+// refcount.cc
+//	Routines to manage the table of extra references to shared data
+//	sectors.  See refcount.h.
+//
+//	On disk, the table is the number of runs, followed by that many
+//	(first sector, number of sectors, extra references) triples.
+//
+// Copyright (c) 1992-1996 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#include "copyright.h"
+#include "refcount.h"
+#include "debug.h"
+
+// fields of a run
+#define RunFirst(i)	runs[3 * (i)]
+#define RunLength(i)	runs[3 * (i) + 1]
+#define RunExtra(i)	runs[3 * (i) + 2]
+
+//----------------------------------------------------------------------
+// RefCount::RefCount
+// 	Initialize a table with no shared sectors.
+//----------------------------------------------------------------------
+
+RefCount::RefCount()
+{
+    numRuns = 0;
+    numShared = 0;
+    maxRuns = 16;
+    runs = new int[3 * maxRuns];
+    dirty = FALSE;
+}
+
+//----------------------------------------------------------------------
+// RefCount::~RefCount
+//----------------------------------------------------------------------
+
+RefCount::~RefCount()
+{
+    delete [] runs;
+}
+
+//----------------------------------------------------------------------
+// RefCount::Find
+// 	Binary search for the first run that ends after "sector".  That
+//	run holds "sector" if it starts at or before it; otherwise it is
+//	where a run for "sector" would have to be inserted.
+//----------------------------------------------------------------------
+
+int
+RefCount::Find(int sector)
+{
+    int low = 0, high = numRuns;
+
+    while (low < high) {
+	int mid = (low + high) / 2;
+
+	if (RunFirst(mid) + RunLength(mid) <= sector)
+	    low = mid + 1;
+	else
+	    high = mid;
+    }
+    return low;
+}
+
+//----------------------------------------------------------------------
+// RefCount::Insert, RefCount::Delete
+// 	Add a run at index "i" of the table, or remove run "i".
+//----------------------------------------------------------------------
+
+void
+RefCount::Insert(int i, int first, int length, int extra)
+{
+    if (numRuns == maxRuns) {
+	int *more = new int[6 * maxRuns];
+
+	memcpy(more, runs, numRuns * 3 * sizeof(int));
+	delete [] runs;
+	runs = more;
+	maxRuns *= 2;
+    }
+    memmove(&RunFirst(i + 1), &RunFirst(i), (numRuns - i) * 3 * sizeof(int));
+    RunFirst(i) = first;
+    RunLength(i) = length;
+    RunExtra(i) = extra;
+    numRuns++;
+}
+
+void
+RefCount::Delete(int i)
+{
+    memmove(&RunFirst(i), &RunFirst(i + 1), (numRuns - i - 1) * 3 * sizeof(int));
+    numRuns--;
+}
+
+//----------------------------------------------------------------------
+// RefCount::Merge
+// 	Join runs "i" and "i"+1 into one if they are adjacent and have
+//	the same number of extra references.
+//----------------------------------------------------------------------
+
+void
+RefCount::Merge(int i)
+{
+    if (i < 0 || i + 1 >= numRuns)
+	return;
+    if (RunFirst(i) + RunLength(i) == RunFirst(i + 1)
+	    && RunExtra(i) == RunExtra(i + 1)) {
+	RunLength(i) += RunLength(i + 1);
+	Delete(i + 1);
+    }
+}
+
+//----------------------------------------------------------------------
+// RefCount::Extra
+// 	Return the number of references to "sector" besides the first
+//	one; 0 if the sector is not shared.
+//----------------------------------------------------------------------
+
+int
+RefCount::Extra(int sector)
+{
+    int i;
+
+    if (numRuns == 0)
+	return 0;
+    i = Find(sector);
+    if (i < numRuns && RunFirst(i) <= sector)
+	return RunExtra(i);
+    return 0;
+}
+
+//----------------------------------------------------------------------
+// RefCount::Set
+// 	Set the number of extra references to "sector".  The run holding
+//	it, if any, is split around it; the pieces are then joined again
+//	with their neighbours where possible.
+//----------------------------------------------------------------------
+
+void
+RefCount::Set(int sector, int extra)
+{
+    int i = Find(sector);
+    int old = 0;
+
+    if (i < numRuns && RunFirst(i) <= sector) {
+	int first = RunFirst(i);
+	int last = first + RunLength(i) - 1;
+
+	old = RunExtra(i);
+	if (old == extra)
+	    return;
+	Delete(i);
+	if (sector < last)
+	    Insert(i, sector + 1, last - sector, old);
+	if (extra > 0)
+	    Insert(i, sector, 1, extra);
+	if (first < sector) {
+	    Insert(i, first, sector - first, old);
+	    i++;			// "i" is the run after the left piece
+	}
+    } else if (extra > 0) {
+	Insert(i, sector, 1, extra);
+    } else {
+	return;
+    }
+    // the pieces of the split run are already as joined as can be
+    Merge(i);
+    Merge(i - 1);
+
+    if (old == 0)
+	numShared++;
+    else if (extra == 0)
+	numShared--;
+    dirty = TRUE;
+}
+
+//----------------------------------------------------------------------
+// RefCount::Share
+// 	Note one more file referring to "sector".
+//----------------------------------------------------------------------
+
+void
+RefCount::Share(int sector)
+{
+    Set(sector, Extra(sector) + 1);
+}
+
+//----------------------------------------------------------------------
+// RefCount::Unshare
+// 	Drop one reference to "sector".  Return TRUE if other files
+//	still refer to it, FALSE if that was the last reference, in which
+//	case the caller frees the sector.
+//----------------------------------------------------------------------
+
+bool
+RefCount::Unshare(int sector)
+{
+    int extra = Extra(sector);
+
+    if (extra == 0)
+	return FALSE;
+    Set(sector, extra - 1);
+    return TRUE;
+}
+
+//----------------------------------------------------------------------
+// RefCount::NumSaved
+// 	Return the number of sectors saved by sharing: every extra
+//	reference would otherwise be a copy of the sector.
+//----------------------------------------------------------------------
+
+int
+RefCount::NumSaved()
+{
+    int saved = 0;
+
+    for (int i = 0; i < numRuns; i++)
+	saved += RunLength(i) * RunExtra(i);
+    return saved;
+}
+
+//----------------------------------------------------------------------
+// RefCount::FetchFrom
+// 	Read the table from a Nachos file.  An empty file is an empty
+//	table.
+//
+//	"file" is the place to read the table from
+//----------------------------------------------------------------------
+
+void
+RefCount::FetchFrom(OpenFile *file)
+{
+    int count = 0;
+
+    numRuns = numShared = 0;
+    dirty = FALSE;
+    if (file->ReadAt((char *) &count, sizeof(int), 0) < (int) sizeof(int))
+	return;
+    if (count < 0 || (1 + 3 * count) * (int) sizeof(int) > file->Length()) {
+	DEBUG(dbgFile, "Reference count table is corrupt, ignored");
+	return;
+    }
+    if (count > maxRuns) {
+	delete [] runs;
+	maxRuns = count;
+	runs = new int[3 * maxRuns];
+    }
+    file->ReadAt((char *) runs, count * 3 * sizeof(int), sizeof(int));
+    numRuns = count;
+    for (int i = 0; i < numRuns; i++)
+	numShared += RunLength(i);
+}
+
+//----------------------------------------------------------------------
+// RefCount::WriteBack
+// 	Store the table into a Nachos file, if it changed.  The file grows
+//	as needed; it never shrinks, the count at its start tells how much
+//	of it is in use.
+//
+//	"file" is the place to write the table to
+//----------------------------------------------------------------------
+
+void
+RefCount::WriteBack(OpenFile *file)
+{
+    int size = (1 + 3 * numRuns) * sizeof(int);
+    char *buf;
+
+    if (!dirty)
+	return;
+    buf = new char[size];
+    memcpy(buf, &numRuns, sizeof(int));
+    memcpy(buf + sizeof(int), runs, numRuns * 3 * sizeof(int));
+    file->WriteAt(buf, size, 0);
+    delete [] buf;
+    dirty = FALSE;
+}
+
+//----------------------------------------------------------------------
+// RefCount::Print
+// 	Print the runs of shared sectors and their extra references.
+//----------------------------------------------------------------------
+
+void
+RefCount::Print()
+{
+    printf("Shared sectors (extra references):");
+    for (int i = 0; i < numRuns; i++)
+	printf(" %d-%d(%d)", RunFirst(i), RunFirst(i) + RunLength(i) - 1,
+		RunExtra(i));
+    printf("\n");
+}
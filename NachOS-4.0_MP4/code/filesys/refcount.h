@@ -0,0 +1,64 @@
+// refcount.h
+//	Data structures for counting the references to shared data
+//	sectors, so that cloned files can share them until one of the
+//	clones writes to them (copy-on-write).
+//
+//	Almost every sector in use is referenced exactly once, and the
+//	bitmap of free sectors already says which ones those are.  So
+//	only the extra references are kept, for the sectors that more
+//	than one file points to.  A clone shares whole runs of sectors,
+//	so the table holds runs: (first sector, number of sectors, extra
+//	references), sorted by sector.  Copy-on-write splits a run where
+//	a block stops being shared.  Like the bitmap, the table is stored
+//	in a file.
+//
+// Copyright (c) 1992-1996 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#ifndef REFCOUNT_H
+#define REFCOUNT_H
+
+#include "copyright.h"
+#include "openfile.h"
+
+class RefCount {
+  public:
+    RefCount();				// Initialize an empty table
+    ~RefCount();
+
+    int Extra(int sector);		// How many references "sector" has
+					// besides the first one
+    void Share(int sector);		// Add a reference to "sector"
+    bool Unshare(int sector);		// Drop a reference to "sector";
+					// return FALSE if it had only one,
+					// and so should be freed
+    void Set(int sector, int extra);	// Force the count (for fsck)
+    int NumShared() { return numShared; }
+					// Number of shared sectors
+    int NumSaved();			// Number of sectors the extra
+					// references would take if they
+					// were not shared
+
+    void FetchFrom(OpenFile *file);	// Read the table from disk
+    void WriteBack(OpenFile *file);	// Write it back, if it changed
+
+    void Print();			// Print the shared sectors
+
+  private:
+    int Find(int sector);		// Index of the run holding "sector",
+					// or of where it would go
+    void Insert(int i, int first, int length, int extra);
+    void Delete(int i);			// Add or remove run "i"
+    void Merge(int i);			// Join runs "i" and "i"+1 if they
+					// are adjacent and alike
+
+    int numRuns;			// Runs in the table
+    int numShared;			// Sectors in all the runs
+    int maxRuns;			// Room in "runs"
+    int *runs;				// First sector, length and extra
+					// references of each run
+    bool dirty;				// Changed since FetchFrom/WriteBack?
+};
+
+#endif // REFCOUNT_H
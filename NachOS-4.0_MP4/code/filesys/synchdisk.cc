@@ -27,8 +27,10 @@
 
 SynchDisk::SynchDisk()
 {
-    semaphore = new Semaphore("synch disk", 0);
-    lock = new Lock("synch disk lock");
+    pending = new List<DiskRequest *>;
+    active = NULL;
+    headSector = 0;
+    sectorsRead = sectorsWritten = 0;
     disk = new Disk(this);
 }
 
@@ -41,8 +43,7 @@ SynchDisk::SynchDisk()
 SynchDisk::~SynchDisk()
 {
     delete disk;
-    delete lock;
-    delete semaphore;
+    delete pending;
 }
 
 //----------------------------------------------------------------------
@@ -57,10 +58,8 @@ SynchDisk::~SynchDisk()
 void
 SynchDisk::ReadSector(int sectorNumber, char* data)
 {
-    lock->Acquire();			// only one disk I/O at a time
-    disk->ReadRequest(sectorNumber, data);
-    semaphore->P();			// wait for interrupt
-    lock->Release();
+    sectorsRead++;			//MP4 iostat
+    Request(sectorNumber, data, FALSE);
 }
 
 //----------------------------------------------------------------------
@@ -75,20 +74,112 @@ SynchDisk::ReadSector(int sectorNumber, char* data)
 void
 SynchDisk::WriteSector(int sectorNumber, char* data)
 {
-    lock->Acquire();			// only one disk I/O at a time
-    disk->WriteRequest(sectorNumber, data);
-    semaphore->P();			// wait for interrupt
-    lock->Release();
+    sectorsWritten++;			//MP4 iostat
+    Request(sectorNumber, data, TRUE);
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::Checkpoint
+// 	Write the state of the disk to the UNIX file "fd": where the
+//	elevator is, and the raw disk.  No request may be in flight.
+//----------------------------------------------------------------------
+
+void
+SynchDisk::Checkpoint(int fd)
+{
+    ASSERT(active == NULL && pending->IsEmpty());
+    WriteFile(fd, (char *) &headSector, sizeof(int));
+    disk->Checkpoint(fd);
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::Restore
+// 	Read back the state Checkpoint wrote to "fd".
+//----------------------------------------------------------------------
+
+void
+SynchDisk::Restore(int fd)
+{
+    Read(fd, (char *) &headSector, sizeof(int));
+    disk->Restore(fd);
+}
+
+//MP4 lock
+//----------------------------------------------------------------------
+// SynchDisk::Request
+// 	Queue a request to read or write a disk sector, start it right
+//	away if the disk is idle, and wait until it is done.
+//
+//	Interrupts are turned off while the queue is updated, since the
+//	disk interrupt handler takes the next request from it.
+//----------------------------------------------------------------------
+
+void
+SynchDisk::Request(int sectorNumber, char *data, bool writing)
+{
+    DiskRequest request;
+    IntStatus oldLevel;
+
+    request.sector = sectorNumber;
+    request.data = data;
+    request.writing = writing;
+    request.done = new Semaphore("disk request", 0);
+
+    oldLevel = kernel->interrupt->SetLevel(IntOff);
+    pending->Append(&request);
+    if (active == NULL)
+	StartNext();
+    (void) kernel->interrupt->SetLevel(oldLevel);
+
+    request.done->P();			// wait for interrupt
+    delete request.done;
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::StartNext
+// 	Hand the disk the pending request with the lowest sector at or
+//	beyond the head; if there is none, wrap around to the lowest
+//	sector requested.  Called with interrupts off.
+//----------------------------------------------------------------------
+
+void
+SynchDisk::StartNext()
+{
+    ListIterator<DiskRequest *> iter(pending);
+    DiskRequest *next = NULL, *lowest = NULL;
+
+    for (; !iter.IsDone(); iter.Next()) {
+	DiskRequest *request = iter.Item();
+
+	if (request->sector >= headSector
+		&& (next == NULL || request->sector < next->sector))
+	    next = request;
+	if (lowest == NULL || request->sector < lowest->sector)
+	    lowest = request;
+    }
+    if (next == NULL)
+	next = lowest;
+
+    pending->Remove(next);
+    active = next;
+    headSector = next->sector;
+    if (next->writing)
+	disk->WriteRequest(next->sector, next->data);
+    else
+	disk->ReadRequest(next->sector, next->data);
 }
 
 //----------------------------------------------------------------------
 // SynchDisk::CallBack
-// 	Disk interrupt handler.  Wake up any thread waiting for the disk
-//	request to finish.
+// 	Disk interrupt handler.  Wake up the thread waiting for the disk
+//	request to finish, and start the next one.
 //----------------------------------------------------------------------
 
 void
 SynchDisk::CallBack()
 { 
-    semaphore->V();
+    active->done->V();
+    active = NULL;
+    if (!pending->IsEmpty())
+	StartNext();
 }
@@ -25,6 +25,21 @@
 // This class provides the abstraction that for any individual thread
 // making a request, it waits around until the operation finishes before
 // returning.
+//
+//MP4 lock
+// Any number of threads may have a request in flight at the same time.
+// The requests wait in a queue for the disk, which serves them in
+// elevator order: sweeping the sectors upwards from the head, and then
+// starting again from the lowest sector requested.
+
+// A read or write request waiting for the disk, or being served by it.
+class DiskRequest {
+  public:
+    int sector;				// sector to read or write
+    char *data;				// buffer to read into or write from
+    bool writing;			// write the sector, rather than read
+    Semaphore *done;			// signalled when the request is done
+};
 
 class SynchDisk : public CallBackObj {
   public:
@@ -35,21 +50,39 @@ class SynchDisk : public CallBackObj {
     void ReadSector(int sectorNumber, char* data);
     					// Read/write a disk sector, returning
     					// only once the data is actually read 
-					// or written.  These call
-    					// Disk::ReadRequest/WriteRequest and
-					// then wait until the request is done.
+					// or written.  These queue a request
+					// for Disk::ReadRequest/WriteRequest
+					// and wait until it is done.
     void WriteSector(int sectorNumber, char* data);
     
     void CallBack();			// Called by the disk device interrupt
 					// handler, to signal that the
 					// current disk operation is complete.
 
+    //MP4 iostat
+    int SectorsRead() { return sectorsRead; }
+    int SectorsWritten() { return sectorsWritten; }
+					// Sectors read/written so far, for
+					// whatever part of the file system
+
+    void UseOverlay() { disk->UseOverlay(); }
+					// Leave the disk image as it is
+					// (see Disk::UseOverlay)
+    void Checkpoint(int fd);		// Save the state of the disk to
+    void Restore(int fd);		// the UNIX file "fd", or read it back
+
   private:
+    void Request(int sectorNumber, char *data, bool writing);
+					// Queue a request, and wait for it
+    void StartNext();			// Hand the disk the next request
+					// in elevator order
+
     Disk *disk;		  		// Raw disk device
-    Semaphore *semaphore; 		// To synchronize requesting thread 
-					// with the interrupt handler
-    Lock *lock;		  		// Only one read/write request
-					// can be sent to the disk at a time
+    List<DiskRequest *> *pending;	// Requests waiting for the disk
+    DiskRequest *active;		// Request the disk is serving, or
+					// NULL if the disk is idle
+    int headSector;			// Sector of the last request started
+    int sectorsRead, sectorsWritten;	// Requests served so far
 };
 
 #endif // SYNCHDISK_H
@@ -105,15 +105,23 @@ Bitmap::Test(int which) const
 //	(In other words, find and allocate a bit.)
 //
 //	If no bits are clear, return -1.
+//
+//	Words with every bit set are skipped whole, so that allocating
+//	from a mostly full bitmap does not test it bit by bit.
 //----------------------------------------------------------------------
 
 int 
 Bitmap::FindAndSet() 
 {
-    for (int i = 0; i < numBits; i++) {
-	if (!Test(i)) {
-	    Mark(i);
-	    return i;
+    for (int w = 0; w < numWords; w++) {
+	if (map[w] == ~0u) {
+	    continue;
+	}
+	for (int i = w * BitsInWord; i < numBits && i < (w + 1) * BitsInWord; i++) {
+	    if (!Test(i)) {
+		Mark(i);
+		return i;
+	    }
 	}
     }
     return -1;
@@ -130,9 +138,18 @@ Bitmap::NumClear() const
 {
     int count = 0;
 
-    for (int i = 0; i < numBits; i++) {
-	if (!Test(i)) {
-	    count++;
+    for (int w = 0; w < numWords; w++) {
+	int first = w * BitsInWord;
+	int last = min(first + BitsInWord, numBits);
+
+	if (map[w] == 0) {			// whole word is clear
+	    count += last - first;
+	} else if (map[w] != ~0u) {
+	    for (int i = first; i < last; i++) {
+		if (!Test(i)) {
+		    count++;
+		}
+	    }
 	}
     }
     return count;
@@ -30,9 +30,12 @@
 #include <unistd.h>
 #include <sys/time.h>
 #include <sys/file.h>
+#include <sys/stat.h>
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <cerrno>
+#include <pthread.h>
+#include <sched.h>
 
 #ifdef SOLARIS
 // KMS
@@ -149,6 +152,97 @@ UDelay(unsigned int useconds)
 
 }
 
+//----------------------------------------------------------------------
+// HostSeconds
+// 	Return the wall clock time of the host, in seconds, to measure
+//	how long Nachos operations really take (as opposed to simulated
+//	time, which is kept in kernel->stats).
+//----------------------------------------------------------------------
+
+double
+HostSeconds()
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+//----------------------------------------------------------------------
+// StartHostThread
+// 	Run (*func)(arg) on a new host thread, concurrently with the
+//	caller.  The thread is never waited for: it runs until the whole
+//	process exits.
+//----------------------------------------------------------------------
+
+struct HostThreadStart {
+    void (*func)(void *);
+    void *arg;
+};
+
+static void *
+HostThreadRoot(void *start)
+{
+    HostThreadStart s = *(HostThreadStart *) start;
+
+    delete (HostThreadStart *) start;
+    (*s.func)(s.arg);
+    return NULL;
+}
+
+void
+StartHostThread(void (*func)(void *), void *arg)
+{
+    HostThreadStart *start = new HostThreadStart;
+    pthread_t thread;
+
+    start->func = func;
+    start->arg = arg;
+    if (pthread_create(&thread, NULL, HostThreadRoot, start) != 0) {
+	cerr << "Unable to start a host thread\n";
+	Abort();
+    }
+    pthread_detach(thread);
+}
+
+//----------------------------------------------------------------------
+// YieldHost
+// 	Give the host CPU to another host thread, if one is waiting, so
+//	that a thread spinning on a lock lets the holder get on with it.
+//----------------------------------------------------------------------
+
+void
+YieldHost()
+{
+    sched_yield();
+}
+
+//----------------------------------------------------------------------
+// TestAndSet, ClearWord, MemoryBarrier
+// 	The atomic operations spin locks are built from.  TestAndSet
+//	keeps later memory accesses after it, and ClearWord keeps
+//	earlier ones before it, so that a lock they make guards the
+//	data it protects.
+//----------------------------------------------------------------------
+
+bool
+TestAndSet(volatile int *word)
+{
+    return __sync_lock_test_and_set(word, 1) != 0;
+}
+
+void
+ClearWord(volatile int *word)
+{
+    __sync_lock_release(word);
+}
+
+void
+MemoryBarrier()
+{
+    __sync_synchronize();
+}
+
 //----------------------------------------------------------------------
 // Abort
 // 	Quit and drop core.
@@ -367,6 +461,46 @@ WriteFile(int fd, char *buffer, int nBytes)
     ASSERT(retVal == nBytes);
 }
 
+//----------------------------------------------------------------------
+// ReadPartialAt
+// 	Read characters from an open file, starting at "offset", returning
+//	as many as are available.  The location within the file does not
+//	change, so no Lseek is needed first.
+//----------------------------------------------------------------------
+
+int
+ReadPartialAt(int fd, char *buffer, int nBytes, int offset)
+{
+    return pread(fd, buffer, nBytes, offset);
+}
+
+//----------------------------------------------------------------------
+// WriteFileAt
+// 	Write characters to an open file, starting at "offset", without
+//	changing the location within the file.  Abort if write fails.
+//----------------------------------------------------------------------
+
+void
+WriteFileAt(int fd, char *buffer, int nBytes, int offset)
+{
+    int retVal = pwrite(fd, buffer, nBytes, offset);
+    ASSERT(retVal == nBytes);
+}
+
+//----------------------------------------------------------------------
+// FileLength
+// 	Return the number of bytes in an open file.  Abort on error.
+//----------------------------------------------------------------------
+
+int
+FileLength(int fd)
+{
+    struct stat buf;
+    int retVal = fstat(fd, &buf);
+    ASSERT(retVal == 0);
+    return buf.st_size;
+}
+
 //----------------------------------------------------------------------
 // Lseek
 // 	Change the location within an open file.  Abort on error.
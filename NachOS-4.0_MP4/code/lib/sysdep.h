@@ -24,6 +24,17 @@ extern void Abort();
 extern void Exit(int exitCode);
 extern void Delay(int seconds);
 extern void UDelay(unsigned int usec);// rcgood - to avoid spinners.
+extern double HostSeconds();		// wall clock time of the host
+
+// Host threads, and the atomic operations they need to share memory,
+// for simulating a multiprocessor
+extern void StartHostThread(void (*func)(void *), void *arg);
+extern void YieldHost();		// let other host threads run
+extern bool TestAndSet(volatile int *word);	// atomically set *word to 1,
+					// and return whether it was 1 already
+extern void ClearWord(volatile int *word);	// set *word to 0, after
+					// every earlier memory access
+extern void MemoryBarrier();		// no memory access moves across this
 
 // Initialize system so that cleanUp routine is called when user hits ctl-C
 extern void CallOnUserAbort(void (*cleanup)(int));
@@ -48,6 +59,9 @@ extern int OpenForReadWrite(char *name, bool crashOnError);
 extern void Read(int fd, char *buffer, int nBytes);
 extern int ReadPartial(int fd, char *buffer, int nBytes);
 extern void WriteFile(int fd, char *buffer, int nBytes);
+extern int ReadPartialAt(int fd, char *buffer, int nBytes, int offset);
+extern void WriteFileAt(int fd, char *buffer, int nBytes, int offset);
+extern int FileLength(int fd);
 extern void Lseek(int fd, int offset, int whence);
 extern int Tell(int fd);
 extern int Close(int fd);
@@ -19,14 +19,6 @@
 #include "sysdep.h"
 #include "main.h"
 
-// We put a magic number at the front of the UNIX file representing the
-// disk, to make it less likely we will accidentally treat a useful file 
-// as a disk (which would probably trash the file's contents).
-
-const int MagicNumber = 0x456789ab;
-const int MagicSize = sizeof(int);
-const int DiskSize = (MagicSize + (NumSectors * SectorSize));
-
 
 //----------------------------------------------------------------------
 // Disk::Disk()
@@ -62,6 +54,7 @@ Disk::Disk(CallBackObj *toCall)
 	WriteFile(fileno, (char *)&tmp, sizeof(int));  
     }
     active = FALSE;
+    overlay = NULL;
 }
 
 //----------------------------------------------------------------------
@@ -72,6 +65,11 @@ Disk::Disk(CallBackObj *toCall)
 
 Disk::~Disk()
 {
+    if (overlay != NULL) {
+	for (int i = 0; i < NumSectors; i++)
+	    delete [] overlay[i];
+	delete [] overlay;
+    }
     Close(fileno);
 }
 
@@ -119,8 +117,12 @@ Disk::ReadRequest(int sectorNumber, char* data)
     ASSERT((sectorNumber >= 0) && (sectorNumber < NumSectors));
     
     DEBUG(dbgDisk, "Reading from sector " << sectorNumber);
-    Lseek(fileno, SectorSize * sectorNumber + MagicSize, 0);
-    Read(fileno, data, SectorSize);
+    if (overlay != NULL && overlay[sectorNumber] != NULL) {
+	bcopy(overlay[sectorNumber], data, SectorSize);
+    } else {
+	Lseek(fileno, SectorSize * sectorNumber + MagicSize, 0);
+	Read(fileno, data, SectorSize);
+    }
     if (debug->IsEnabled('d'))
 	PrintSector(FALSE, sectorNumber, data);
     
@@ -139,8 +141,14 @@ Disk::WriteRequest(int sectorNumber, char* data)
     ASSERT((sectorNumber >= 0) && (sectorNumber < NumSectors));
     
     DEBUG(dbgDisk, "Writing to sector " << sectorNumber);
-    Lseek(fileno, SectorSize * sectorNumber + MagicSize, 0);
-    WriteFile(fileno, data, SectorSize);
+    if (overlay != NULL) {
+	if (overlay[sectorNumber] == NULL)
+	    overlay[sectorNumber] = new char[SectorSize];
+	bcopy(data, overlay[sectorNumber], SectorSize);
+    } else {
+	Lseek(fileno, SectorSize * sectorNumber + MagicSize, 0);
+	WriteFile(fileno, data, SectorSize);
+    }
     if (debug->IsEnabled('d'))
 	PrintSector(TRUE, sectorNumber, data);
     
@@ -266,3 +274,71 @@ Disk::UpdateLast(int newSector)
     lastSector = newSector;
     DEBUG(dbgDisk, "Updating last sector = " << lastSector << " , " << bufferInit);
 }
+
+//----------------------------------------------------------------------
+// Disk::UseOverlay
+//   	From now on, keep the data written to the disk in memory, on top
+//	of the UNIX file, which is no longer written.  A checkpoint of the
+//	disk is then just the overlay: the UNIX file is still the image
+//	the checkpointed run started from, and every run restored from the
+//	checkpoint starts from it again.
+//----------------------------------------------------------------------
+
+void
+Disk::UseOverlay()
+{
+    if (overlay == NULL) {
+	overlay = new char *[NumSectors];
+	for (int i = 0; i < NumSectors; i++)
+	    overlay[i] = NULL;
+    }
+}
+
+//----------------------------------------------------------------------
+// Disk::Checkpoint
+//   	Write the state of the disk to the UNIX file "fd": where the head
+//	is, and each sector in the overlay, ending with sector -1.  The
+//	disk must be idle.
+//----------------------------------------------------------------------
+
+void
+Disk::Checkpoint(int fd)
+{
+    int head[2] = { lastSector, bufferInit };
+    int end = -1;
+
+    ASSERT(!active && overlay != NULL);
+    WriteFile(fd, (char *) head, sizeof(head));
+    for (int i = 0; i < NumSectors; i++) {
+	if (overlay[i] != NULL) {
+	    WriteFile(fd, (char *) &i, sizeof(int));
+	    WriteFile(fd, overlay[i], SectorSize);
+	}
+    }
+    WriteFile(fd, (char *) &end, sizeof(int));
+}
+
+//----------------------------------------------------------------------
+// Disk::Restore
+//   	Read back the state Checkpoint wrote to "fd".  The disk keeps
+//	using an overlay, so the UNIX file is not changed by the run.
+//----------------------------------------------------------------------
+
+void
+Disk::Restore(int fd)
+{
+    int head[2];
+    int sector;
+
+    UseOverlay();
+    Read(fd, (char *) head, sizeof(head));
+    lastSector = head[0];
+    bufferInit = head[1];
+    for (Read(fd, (char *) &sector, sizeof(int)); sector >= 0;
+		Read(fd, (char *) &sector, sizeof(int))) {
+	ASSERT(sector < NumSectors);
+	if (overlay[sector] == NULL)
+	    overlay[sector] = new char[SectorSize];
+	Read(fd, overlay[sector], SectorSize);
+    }
+}
@@ -34,6 +34,9 @@
 // and an interrupt is invoked later to signal that the operation completed.
 //
 // The physical disk is in fact simulated via operations on a UNIX file.
+// When checkpointing (see Kernel::Checkpoint), the sectors written are
+// kept in memory instead, as an overlay on the UNIX file, so that the
+// file stays the image the checkpoint was taken over.
 //
 // To make life a little more realistic, the simulated time for
 // each operation reflects a "track buffer" -- RAM to store the contents
@@ -61,6 +64,15 @@ const int NumSectors = (SectorsPerTrack * NumTracks);
 					// total # of sectors per disk
 //now maximum disk size: NumSectors * SectorSize = 128*32*32 = 128KB
 
+// We put a magic number at the front of the UNIX file representing the
+// disk, to make it less likely we will accidentally treat a useful file 
+// as a disk (which would probably trash the file's contents).
+// (Shared with the host-side "mkfs", which builds such files directly.)
+
+const int MagicNumber = 0x456789ab;
+const int MagicSize = sizeof(int);
+const int DiskSize = (MagicSize + (NumSectors * SectorSize));
+
 class Disk : public CallBackObj {
   public:
     Disk(CallBackObj *toCall);          // Create a simulated disk.  
@@ -83,6 +95,13 @@ class Disk : public CallBackObj {
 					// newSector will take: 
 					// (seek + rotational delay + transfer)
 
+    void UseOverlay();			// From now on, keep the sectors
+					// written in memory, and leave the
+					// UNIX file as it is
+    void Checkpoint(int fd);		// Save the overlay and the head
+					// position to the UNIX file "fd"
+    void Restore(int fd);		// Read them back, using an overlay
+
   private:
     int fileno;				// UNIX file number for simulated disk 
     char diskname[32];			// name of simulated disk's file
@@ -91,6 +110,9 @@ class Disk : public CallBackObj {
     int lastSector;			// The previous disk request 
     int bufferInit;			// When the track buffer started 
 					// being loaded
+    char **overlay;			// The data written to each sector
+					// since UseOverlay, or NULL; NULL
+					// if there is no overlay
 
     int TimeToSeek(int newSector, int *rotate); // time to get to the new track
     int ModuloDiff(int to, int from);        // # sectors between to and from
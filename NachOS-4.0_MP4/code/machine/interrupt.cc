@@ -23,6 +23,10 @@
 #include "copyright.h"
 #include "interrupt.h"
 #include "main.h"
+#include "cpu.h"
+#ifndef FILESYS_STUB
+#include "iostats.h"
+#endif
 
 // String definitions for debugging messages
 
@@ -73,6 +77,7 @@ Interrupt::Interrupt()
 {
     level = IntOff;
     pending = new SortedList<PendingInterrupt *>(PendingCompare);
+    sharedPending = FALSE;
     inHandler = FALSE;
     yieldOnReturn = FALSE;
     status = SystemMode;
@@ -85,12 +90,87 @@ Interrupt::Interrupt()
 
 Interrupt::~Interrupt()
 {
+    if (sharedPending)
+	return;
     while (!pending->IsEmpty()) {
 	delete pending->RemoveFront();
     }
     delete pending;
 }
 
+//----------------------------------------------------------------------
+// Interrupt::SharePending
+// 	Make this the interrupt state of another CPU of the machine
+//	"other" is the interrupt state of.  The devices are shared, so the
+//	interrupts they schedule are too: whichever CPU gets to them first
+//	handles them.  The interrupt level, and whether the CPU is idle,
+//	in the kernel or in user mode, stay this CPU's own.
+//----------------------------------------------------------------------
+
+void
+Interrupt::SharePending(Interrupt *other)
+{
+    ASSERT(pending->IsEmpty() && !sharedPending);
+    delete pending;
+    pending = other->pending;
+    sharedPending = TRUE;
+}
+
+//----------------------------------------------------------------------
+// Interrupt::Checkpoint
+// 	Write the interrupts scheduled to the UNIX file "fd": how many
+//	there are, then the time and type of each one.
+//----------------------------------------------------------------------
+
+void
+Interrupt::Checkpoint(int fd)
+{
+    ListIterator<PendingInterrupt *> iter(pending);
+    int count = pending->NumInList();
+
+    WriteFile(fd, (char *) &count, sizeof(int));
+    for (; !iter.IsDone(); iter.Next()) {
+	int entry[2] = { iter.Item()->when, iter.Item()->type };
+
+	WriteFile(fd, (char *) entry, sizeof(entry));
+    }
+}
+
+//----------------------------------------------------------------------
+// Interrupt::Restore
+// 	Replace the interrupts scheduled with the ones Checkpoint wrote
+//	to "fd".  Each goes to the device that has an interrupt of the
+//	same type scheduled now.  Checkpoints are only taken with no I/O
+//	in flight, so the only interrupts pending are those of the
+//	devices that schedule them all the time, like the timer and the
+//	console input, and a freshly booted kernel has these too.
+//----------------------------------------------------------------------
+
+void
+Interrupt::Restore(int fd)
+{
+    CallBackObj *device[NetworkRecvInt + 1];
+    int count;
+
+    for (int i = 0; i <= NetworkRecvInt; i++)
+	device[i] = NULL;
+    while (!pending->IsEmpty()) {
+	PendingInterrupt *old = pending->RemoveFront();
+
+	device[old->type] = old->callOnInterrupt;
+	delete old;
+    }
+    ::Read(fd, (char *) &count, sizeof(int));
+    for (int i = 0; i < count; i++) {
+	int entry[2];
+
+	::Read(fd, (char *) entry, sizeof(entry));
+	ASSERT(device[entry[1]] != NULL);
+	pending->Insert(new PendingInterrupt(device[entry[1]], entry[0],
+					(IntType) entry[1]));
+    }
+}
+
 //----------------------------------------------------------------------
 // Interrupt::ChangeLevel
 // 	Change interrupts to be enabled or disabled, without advancing 
@@ -166,15 +246,53 @@ Interrupt::OneTick()
 				// interrupts disabled)
     CheckIfDue(FALSE);		// check for pending interrupts
     ChangeLevel(IntOff, IntOn);	// re-enable interrupts
+    if (oldStatus == UserMode)	// between two user instructions: a
+	kernel->CheckpointIfDue(yieldOnReturn);	// good time to checkpoint
     if (yieldOnReturn) {	// if the timer device handler asked 
     				// for a context switch, ok to do it now
 	yieldOnReturn = FALSE;
  	status = SystemMode;		// yield is a kernel routine
+	kernel->currentThread->preempted = (oldStatus == UserMode);
 	kernel->currentThread->Yield();
+	kernel->currentThread->preempted = FALSE;
 	status = oldStatus;
     }
 }
 
+//----------------------------------------------------------------------
+// Interrupt::QuietTicks
+// 	Return how many more user instructions can run before one of
+//	their ticks has anything to do besides advancing the clock --
+//	before the next pending interrupt is due.  The CPU may run that
+//	many, and then account for their time all at once (see
+//	Machine::Tick); simulated time comes out the same as with a
+//	OneTick per instruction.
+//
+//	Return 0 if the next tick must be a OneTick: a context switch is
+//	due, or the ticks are being traced.
+//
+//	On a multiprocessor, the other CPUs run quiet instructions at the
+//	same time, and their time counts too: each CPU gets its share of
+//	the ticks, so that interrupts are not handled much late.
+//----------------------------------------------------------------------
+
+static const int MaxQuietTicks = 10000;	// with nothing pending, account
+					// for the time this often anyway
+
+int
+Interrupt::QuietTicks()
+{
+    int ticks;
+
+    if (yieldOnReturn || status != UserMode || debug->IsEnabled(dbgInt))
+	return 0;
+    if (pending->IsEmpty())
+	return MaxQuietTicks / kernel->numCpus;
+    ticks = (pending->Front()->when - kernel->stats->totalTicks - 1) / UserTick;
+    ticks /= kernel->numCpus;	// all the CPUs advance the one clock
+    return max(0, min(ticks, MaxQuietTicks / kernel->numCpus));
+}
+
 //----------------------------------------------------------------------
 // Interrupt::YieldOnReturn
 // 	Called from within an interrupt handler, to cause a context switch
@@ -193,6 +311,20 @@ Interrupt::YieldOnReturn()
     yieldOnReturn = TRUE; 
 }
 
+//----------------------------------------------------------------------
+// Interrupt::Preempt
+// 	Called from an interrupt handler running on another CPU, to
+//	have this CPU context switch as if it had been interrupted too:
+//	at its next tick, unless it is idle.
+//----------------------------------------------------------------------
+
+void
+Interrupt::Preempt()
+{
+    if (status != IdleMode)
+	yieldOnReturn = TRUE;
+}
+
 //----------------------------------------------------------------------
 // Interrupt::Idle
 // 	Routine called when there is nothing in the ready queue.
@@ -203,12 +335,21 @@ Interrupt::YieldOnReturn()
 //
 //	If there are no pending interrupts, stop.  There's nothing
 //	more for us to do.
+//
+//	On a multiprocessor, the other CPUs can make a thread ready
+//	too.  Until all of them are idle as well, just let them run
+//	for a while, and return.
 //----------------------------------------------------------------------
 void
 Interrupt::Idle()
 {
     DEBUG(dbgInt, "Machine idling; checking for interrupts.");
     status = IdleMode;
+    if (!kernel->AllCpusIdle()) {
+	kernel->machine->cpu->WaitForWork();
+	status = SystemMode;
+	return;
+    }
     if (CheckIfDue(TRUE)) {	// check for any pending interrupts
 		status = SystemMode;
 		return;			// return in case there's now
@@ -242,6 +383,15 @@ Interrupt::Halt()
     cout << "This is halt\n";
     kernel->stats->Print();
 	*/
+	kernel->StopCpus();
+	for (int i = 0; i < kernel->numCpus; i++) {
+		Tlb *tlb = kernel->cpus[i]->machine->tlb;
+		if (tlb != NULL)
+			tlb->Print();
+	}
+#ifndef FILESYS_STUB
+	kernel->fileSystem->ioStats->Halt();	//MP4 iostat
+#endif
 	delete debug;
 	
     delete kernel;	// Never returns.
@@ -255,6 +405,12 @@ Interrupt::CreateFile(char *filename, int size)
 }
 //#endif
 
+int
+Interrupt::CloneFile(char *from, char *to)
+{
+    return kernel->CloneFile(from, to);
+}
+
 OpenFileId Interrupt::Open(char *name)
 {
     return kernel->Open(name);
@@ -275,6 +431,16 @@ int Interrupt::Close(OpenFileId id)
     return kernel->Close(id);
 }
 
+int Interrupt::Mmap(OpenFileId id, int length)
+{
+    return kernel->Mmap(id, length);
+}
+
+int Interrupt::Munmap(int addr)
+{
+    return kernel->Munmap(addr);
+}
+
 //----------------------------------------------------------------------
 // Interrupt::Schedule
 // 	Arrange for the CPU to be interrupted when simulated time
@@ -101,19 +101,33 @@ class Interrupt {
 	//#ifdef FILESYS_STUB
 	int CreateFile(char *filename, int size);
 	//#endif 
+    int CloneFile(char *from, char *to);
     OpenFileId Open(char *name);
     int Write(char *buf, int size, OpenFileId id);
     int Read(char *buf, int size, OpenFileId id);
     int Close(OpenFileId id);
+    int Mmap(OpenFileId id, int length);
+    int Munmap(int addr);
 
     void YieldOnReturn();	// cause a context switch on return 
 				// from an interrupt handler
+    void Preempt();		// cause a context switch at the next
+				// tick (for another CPU's interrupt state)
 
     MachineStatus getStatus() { return status; } 
     void setStatus(MachineStatus st) { status = st; }
         			// idle, kernel, user
 
     void DumpState();		// Print interrupt state
+
+    void SharePending(Interrupt *other);
+				// Take the interrupts scheduled on "other"
+				// as well: "other" is the interrupt state
+				// of another CPU of the same machine
+
+    void Checkpoint(int fd);	// Save the pending interrupts to the
+				// UNIX file "fd"
+    void Restore(int fd);	// Replace them with the ones saved
     
 
     // NOTE: the following are internal to the hardware simulation code.
@@ -127,12 +141,17 @@ class Interrupt {
     				// by the hardware device simulators.
     
     void OneTick();       	// Advance simulated time
+    int QuietTicks();		// How many user instructions can run
+				// before OneTick has more to do than
+				// advance the time
 
   private:
     IntStatus level;		// are interrupts enabled or disabled?
     SortedList<PendingInterrupt *> *pending;		
     				// the list of interrupts scheduled
 				// to occur in the future
+    bool sharedPending;		// TRUE if "pending" belongs to another
+				// CPU's interrupt state
     //int writeFileNo;            //UNIX file emulating the display
     bool inHandler;		// TRUE if we are running an interrupt handler
     //bool putBusy;               // Is a PrintInt operation in progress
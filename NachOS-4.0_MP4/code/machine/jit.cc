@@ -0,0 +1,712 @@
+// jit.cc
+//	Routines to translate hot basic blocks of MIPS instructions into
+//	host x86-64 code.  See jit.h.
+//
+//	The host code of a block is called with the machine (in %rdi, as
+//	the x86-64 calling convention has it) and the address of the
+//	simulated registers (in %rsi).  It keeps them in %r12 and %rbx,
+//	and the PC of the block's first instruction in %r13d, and does
+//	each instruction in turn by loading its operands into %eax/%ecx,
+//	and storing the result back:
+//
+//		addu r3,r1,r2	=>	mov  eax, [rbx + 4*1]
+//					add  eax, [rbx + 4*2]
+//					mov  [rbx + 4*3], eax
+//
+//	then retiring it as DelayedLoad would: the load pending from the
+//	instruction before is finished, and a load leaves its own value
+//	pending.  What is pending is known as the code is generated,
+//	except on entry.  Instructions that only compute a register and
+//	put it in register 0 are left out, as OneInstruction throws their
+//	result away too.
+//
+//	Loads and stores call Machine::JitAccess, multiplies and divides
+//	Machine::JitMulDiv, so that they compute exactly what the
+//	interpreter does.  Wherever the block can stop early -- a fault,
+//	an overflow, or a store to its own page -- the code sets the PCs
+//	and returns how many instructions it completed; the PCs are only
+//	written then, and at the end of the block.
+//
+// Copyright (c) 1992-1996 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#include "copyright.h"
+#include "jit.h"
+#include "mipssim.h"
+#include "debug.h"
+#include <sys/mman.h>
+
+// The most bytes of host code one instruction translates into, and
+// the most a block adds to that, to enter and leave
+static const int MaxInstrCode = 256;
+static const int MaxBlockCode = 128;
+
+//----------------------------------------------------------------------
+// Jit::Jit
+// 	Set aside memory for the host code, and start with nothing
+//	translated.  If the host code can't be run here, Enter will never
+//	find a translation.
+//----------------------------------------------------------------------
+
+Jit::Jit()
+{
+    int numWords = MemorySize / 4;
+
+    blocks = new JitBlock *[numWords];
+    counts = new unsigned char[numWords];
+    for (int i = 0; i < numWords; i++) {
+	blocks[i] = NULL;
+	counts[i] = 0;
+    }
+    pageTranslated = new bool[NumPhysPages];
+    for (int i = 0; i < NumPhysPages; i++)
+	pageTranslated[i] = FALSE;
+    code = NULL;
+    codeUsed = 0;
+#ifdef __x86_64__
+    void *mem = mmap(NULL, JitCodeSize, PROT_READ | PROT_WRITE | PROT_EXEC,
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem != MAP_FAILED)
+	code = (char *) mem;
+#endif
+}
+
+//----------------------------------------------------------------------
+// Jit::~Jit
+//----------------------------------------------------------------------
+
+Jit::~Jit()
+{
+    ForgetAll();
+    delete [] blocks;
+    delete [] counts;
+    delete [] pageTranslated;
+    if (code != NULL)
+	munmap(code, JitCodeSize);
+}
+
+//----------------------------------------------------------------------
+// Jit::Available
+// 	Return TRUE if this host can run the code we generate.
+//----------------------------------------------------------------------
+
+bool
+Jit::Available()
+{
+#ifdef __x86_64__
+    return TRUE;
+#else
+    return FALSE;
+#endif
+}
+
+//----------------------------------------------------------------------
+// Jit::CanTranslate
+// 	Return TRUE if "instr" can be part of a block.  LWL, LWR, SWL and
+//	SWR, system calls, and illegal instructions are left to the
+//	interpreter.
+//----------------------------------------------------------------------
+
+bool
+Jit::CanTranslate(Instruction *instr)
+{
+    switch (instr->opCode) {
+      case OP_ADD: case OP_ADDI: case OP_ADDIU: case OP_ADDU: case OP_AND:
+      case OP_ANDI: case OP_BEQ: case OP_BGEZ: case OP_BGEZAL: case OP_BGTZ:
+      case OP_BLEZ: case OP_BLTZ: case OP_BLTZAL: case OP_BNE: case OP_DIV:
+      case OP_DIVU: case OP_J: case OP_JAL: case OP_JALR: case OP_JR:
+      case OP_LB: case OP_LBU: case OP_LH: case OP_LHU: case OP_LUI:
+      case OP_LW: case OP_MFHI: case OP_MFLO: case OP_MTHI: case OP_MTLO:
+      case OP_MULT: case OP_MULTU: case OP_NOR: case OP_OR: case OP_ORI:
+      case OP_SB: case OP_SH: case OP_SLL: case OP_SLLV: case OP_SLT:
+      case OP_SLTI: case OP_SLTIU: case OP_SLTU: case OP_SRA: case OP_SRAV:
+      case OP_SRL: case OP_SRLV: case OP_SUB: case OP_SUBU: case OP_SW:
+      case OP_XOR: case OP_XORI:
+	return TRUE;
+      default:
+	return FALSE;
+    }
+}
+
+//----------------------------------------------------------------------
+// Jit::IsBranch
+// 	Return TRUE if "instr" is a branch or jump: the block ends after
+//	its delay slot.
+//----------------------------------------------------------------------
+
+bool
+Jit::IsBranch(Instruction *instr)
+{
+    switch (instr->opCode) {
+      case OP_BEQ: case OP_BGEZ: case OP_BGEZAL: case OP_BGTZ: case OP_BLEZ:
+      case OP_BLTZ: case OP_BLTZAL: case OP_BNE: case OP_J: case OP_JAL:
+      case OP_JALR: case OP_JR:
+	return TRUE;
+      default:
+	return FALSE;
+    }
+}
+
+//----------------------------------------------------------------------
+// Jit::Enter
+// 	The instruction "instr", at physical address "physAddr", is about
+//	to be interpreted, outside a delay slot.  Return the translation
+//	of the block starting there, if there is one.
+//
+//	Otherwise count the visit; on the JitHotCount'th, translate the
+//	block -- up to "maxLength" instructions, the rest of the page.  A
+//	branch whose delay slot can't be translated with it, or is on the
+//	next page, is left for the next block.  Blocks shorter than two
+//	instructions aren't worth it.
+//----------------------------------------------------------------------
+
+JitBlock *
+Jit::Enter(int physAddr, Instruction *instr, int maxLength)
+{
+    int word = physAddr / 4;
+    int length;
+    JitBlock *block;
+
+    if (blocks[word] != NULL)
+	return blocks[word];
+    if (code == NULL || !CanTranslate(instr))
+	return NULL;
+    if (counts[word] < JitHotCount) {
+	counts[word]++;
+	return NULL;
+    }
+
+    for (length = 0; length < maxLength && length < JitMaxRun; length++) {
+	if (!CanTranslate(&instr[length]))
+	    break;
+	if (IsBranch(&instr[length])) {
+	    if (length + 1 < maxLength && CanTranslate(&instr[length + 1])
+			&& !IsBranch(&instr[length + 1]))
+		length += 2;		// the branch and its delay slot
+	    break;
+	}
+    }
+    if (length < 2) {
+	counts[word] = 0;		// look again in a while
+	return NULL;
+    }
+    if (codeUsed + MaxBlockCode + length * MaxInstrCode > JitCodeSize)
+	ForgetAll();			// out of room: start over
+
+    block = Translate(instr, length);
+    blocks[word] = block;
+    pageTranslated[physAddr / PageSize] = TRUE;
+    DEBUG(dbgMach, "Translated " << length << " instructions at " << physAddr);
+    return block;
+}
+
+//----------------------------------------------------------------------
+// Emit*
+// 	Append x86-64 instructions to the host code at "*p".  Operands in
+//	memory are simulated registers, addressed from %rbx.
+//----------------------------------------------------------------------
+
+// Host registers
+enum { EAX = 0, ECX = 1, EDX = 2 };
+
+// Condition codes of jcc, setcc and cmovcc
+enum { CcNoOverflow = 0x1, CcBelow = 0x2, CcEqual = 0x4, CcNotEqual = 0x5,
+       CcLess = 0xc, CcGreaterEqual = 0xd, CcLessEqual = 0xe,
+       CcGreater = 0xf };
+
+// What load is pending when an instruction retires
+static const int NotPending = -1;	// none
+static const int MaybePending = -2;	// whatever registers[LoadReg] says
+
+static void
+EmitByte(char **p, int byte)
+{
+    *(*p)++ = (char) byte;
+}
+
+static void
+EmitWord(char **p, int word)
+{
+    for (int i = 0; i < 4; i++)
+	EmitByte(p, (word >> (8 * i)) & 0xff);
+}
+
+// <op> "host", [rbx + 4*reg]
+static void
+EmitRegOp(char **p, int op, int reg, int host = EAX)
+{
+    EmitByte(p, op);
+    EmitByte(p, 0x83 | (host << 3));	// disp32(%rbx)
+    EmitWord(p, 4 * reg);
+}
+
+static void EmitLoad(char **p, int reg, int host = EAX)
+	{ EmitRegOp(p, 0x8b, reg, host); }
+static void EmitStore(char **p, int reg, int host = EAX)
+	{ EmitRegOp(p, 0x89, reg, host); }
+
+// mov dword [rbx + 4*reg], imm32
+static void
+EmitStoreImm(char **p, int reg, int imm)
+{
+    EmitRegOp(p, 0xc7, reg);
+    EmitWord(p, imm);
+}
+
+// <op> %eax, imm32
+static void
+EmitImmOp(char **p, int op, int imm)
+{
+    EmitByte(p, op);
+    EmitWord(p, imm);
+}
+
+// lea "host", [r13 + offset]: the PC "offset" bytes into the block
+static void
+EmitPC(char **p, int offset, int host = EAX)
+{
+    EmitByte(p, 0x41);
+    EmitByte(p, 0x8d);
+    EmitByte(p, 0x85 | (host << 3));
+    EmitWord(p, offset);
+}
+
+// shl/sar %eax, by "shift", or by %cl if "shift" < 0
+static void
+EmitShift(char **p, bool left, int shift)
+{
+    if (shift < 0) {
+	EmitByte(p, 0xd3);
+	EmitByte(p, left ? 0xe0 : 0xf8);
+    } else {
+	EmitByte(p, 0xc1);
+	EmitByte(p, left ? 0xe0 : 0xf8);
+	EmitByte(p, shift);
+    }
+}
+
+// %eax = (%eax < operand) ? 1 : 0, after the cmp; "cc" is less or below
+static void
+EmitSet(char **p, int cc)
+{
+    EmitByte(p, 0x0f); EmitByte(p, 0x90 | cc); EmitByte(p, 0xc0);
+    EmitByte(p, 0x0f); EmitByte(p, 0xb6); EmitByte(p, 0xc0);	// movzx
+}
+
+// j<cc> to a place not known yet: return where to patch it in
+static char *
+EmitJump(char **p, int cc)
+{
+    EmitByte(p, 0x0f);
+    EmitByte(p, 0x80 | cc);
+    EmitWord(p, 0);
+    return *p - 4;
+}
+
+// Make the jump whose displacement is at "where" go to "target"
+static void
+PatchJump(char *where, char *target)
+{
+    EmitWord(&where, target - (where + 4));
+}
+
+// call "function" (the arguments are set up)
+static void
+EmitCall(char **p, void *function)
+{
+    unsigned long address = (unsigned long) function;
+
+    EmitByte(p, 0x48); EmitByte(p, 0xb8);	// mov rax, imm64
+    for (int i = 0; i < 8; i++)
+	EmitByte(p, (address >> (8 * i)) & 0xff);
+    EmitByte(p, 0xff); EmitByte(p, 0xd0);	// call rax
+}
+
+// Save the callee-saved registers we use, leave a scratch word at
+// [rsp] (and [rsp + 4]) with the stack aligned for calls, and load
+// %r12, %rbx and %r13d
+static void
+EmitPrologue(char **p)
+{
+    EmitByte(p, 0x53);					// push rbx
+    EmitByte(p, 0x41); EmitByte(p, 0x54);		// push r12
+    EmitByte(p, 0x41); EmitByte(p, 0x55);		// push r13
+    EmitByte(p, 0x48); EmitByte(p, 0x83);		// sub rsp, 16
+    EmitByte(p, 0xec); EmitByte(p, 0x10);
+    EmitByte(p, 0x49); EmitByte(p, 0x89); EmitByte(p, 0xfc);	// mov r12, rdi
+    EmitByte(p, 0x48); EmitByte(p, 0x89); EmitByte(p, 0xf3);	// mov rbx, rsi
+    EmitByte(p, 0x44); EmitByte(p, 0x8b); EmitByte(p, 0xab);	// mov r13d,
+    EmitWord(p, 4 * PCReg);					//  [PC]
+}
+
+// Return "n", the instructions completed, undoing the prologue
+static void
+EmitReturn(char **p, int n)
+{
+    EmitImmOp(p, 0xb8, n);				// mov eax, n
+    EmitByte(p, 0x48); EmitByte(p, 0x83);		// add rsp, 16
+    EmitByte(p, 0xc4); EmitByte(p, 0x10);
+    EmitByte(p, 0x41); EmitByte(p, 0x5d);		// pop r13
+    EmitByte(p, 0x41); EmitByte(p, 0x5c);		// pop r12
+    EmitByte(p, 0x5b);					// pop rbx
+    EmitByte(p, 0xc3);					// ret
+}
+
+// Leave the block after its first "n" instructions, with the PCs as
+// OneInstruction leaves them.  If the n'th was a delay slot, its branch
+// left where to go in NextPCReg.
+static void
+EmitExit(char **p, int n, bool branched)
+{
+    EmitPC(p, 4 * (n - 1));
+    EmitStore(p, PrevPCReg);
+    if (branched) {
+	EmitLoad(p, NextPCReg);
+	EmitStore(p, PCReg);
+	EmitImmOp(p, 0x05, 4);				// add eax, 4
+	EmitStore(p, NextPCReg);
+    } else {
+	EmitPC(p, 4 * n);
+	EmitStore(p, PCReg);
+	EmitPC(p, 4 * n + 4);
+	EmitStore(p, NextPCReg);
+    }
+    EmitReturn(p, n);
+}
+
+// Leave the block at instruction "k", which can't complete: with the
+// PCs as they were before it, and, if it overflowed, the exception
+// noted for Machine::RunTranslated to raise.  (A fault in JitAccess
+// notes itself.)  In a delay slot, NextPCReg holds the branch target.
+static void
+EmitFault(char **p, int k, bool inDelaySlot, bool overflow)
+{
+    if (overflow) {
+	EmitByte(p, 0x4c); EmitByte(p, 0x89); EmitByte(p, 0xe7); // mov rdi, r12
+	EmitImmOp(p, 0xbe, OverflowException);		// mov esi, which
+	EmitImmOp(p, 0xba, 0);				// mov edx, 0
+	EmitCall(p, (void *) Machine::JitTrap);
+    }
+    if (k > 0) {
+	EmitPC(p, 4 * (k - 1));
+	EmitStore(p, PrevPCReg);
+	EmitPC(p, 4 * k);
+	EmitStore(p, PCReg);
+	if (!inDelaySlot) {
+	    EmitPC(p, 4 * k + 4);
+	    EmitStore(p, NextPCReg);
+	}
+    }
+    EmitReturn(p, k);
+}
+
+// Call Machine::JitAccess for the load or store "op" of instruction
+// "index", at the address in %eax, with the scratch word for its value
+static void
+EmitAccess(char **p, int op, int index)
+{
+    EmitByte(p, 0x89); EmitByte(p, 0xc2);		// mov edx, eax
+    EmitByte(p, 0x4c); EmitByte(p, 0x89); EmitByte(p, 0xe7); // mov rdi, r12
+    EmitImmOp(p, 0xbe, op);				// mov esi, op
+    EmitByte(p, 0x48); EmitByte(p, 0x8d);		// lea rcx, [rsp]
+    EmitByte(p, 0x0c); EmitByte(p, 0x24);
+    EmitByte(p, 0x41); EmitImmOp(p, 0xb8, index);	// mov r8d, index
+    EmitCall(p, (void *) Machine::JitAccess);
+}
+
+// Retire an instruction, as DelayedLoad(loadReg, value) would: finish
+// the load "*pending", and leave the one to "loadReg" pending, with the
+// value in the scratch word (or none, if "loadReg" is NotPending)
+static void
+EmitRetire(char **p, int *pending, int loadReg)
+{
+    if (*pending == MaybePending) {
+	EmitLoad(p, LoadReg);
+	EmitLoad(p, LoadValueReg, ECX);
+	EmitByte(p, 0x89); EmitByte(p, 0x0c);	// mov [rbx + 4*rax], ecx
+	EmitByte(p, 0x83);
+	EmitStoreImm(p, 0, 0);
+    } else if (*pending > 0) {
+	EmitLoad(p, LoadValueReg, ECX);
+	EmitStore(p, *pending, ECX);
+    }
+    if (loadReg != NotPending) {
+	EmitByte(p, 0x8b); EmitByte(p, 0x0c);	// mov ecx, [rsp]
+	EmitByte(p, 0x24);
+	EmitStore(p, LoadValueReg, ECX);
+	EmitStoreImm(p, LoadReg, loadReg);
+    } else if (*pending != NotPending) {
+	EmitStoreImm(p, LoadReg, 0);
+	EmitStoreImm(p, LoadValueReg, 0);
+    }
+    *pending = loadReg;
+}
+
+//----------------------------------------------------------------------
+// Jit::Translate
+// 	Generate the host code for the "length" instructions at "instr",
+//	doing exactly what OneInstruction would do with them.  (Note that
+//	OneInstruction shifts SRL/SRLV arithmetically; so do we.)
+//----------------------------------------------------------------------
+
+JitBlock *
+Jit::Translate(Instruction *instr, int length)
+{
+    char *start = code + codeUsed;
+    char *p = start;
+    char *skip;
+    JitBlock *block = new JitBlock;
+    int pending = MaybePending;		// whatever is pending on entry
+    bool inDelaySlot = FALSE;
+
+    EmitPrologue(&p);
+    for (int i = 0; i < length; i++, instr++) {
+	int pc = 4 * i;			// where "instr" is in the block
+	int loadReg = NotPending;	// the register it loads, if any
+	int dest;
+	int cc;
+
+	inDelaySlot = (i > 0 && IsBranch(instr - 1));
+	switch (instr->opCode) {
+	  case OP_MTHI: case OP_MTLO:
+	    dest = (instr->opCode == OP_MTHI) ? HiReg : LoReg;
+	    break;
+	  case OP_ADDIU: case OP_ANDI: case OP_ORI: case OP_XORI:
+	  case OP_LUI: case OP_SLTI: case OP_SLTIU:
+	    dest = instr->rt;
+	    break;
+	  default:
+	    dest = instr->rd;
+	    break;
+	}
+
+	switch (instr->opCode) {
+	  case OP_ADDU:
+	    EmitLoad(&p, instr->rs); EmitRegOp(&p, 0x03, instr->rt);
+	    break;
+	  case OP_SUBU:
+	    EmitLoad(&p, instr->rs); EmitRegOp(&p, 0x2b, instr->rt);
+	    break;
+	  case OP_AND:
+	    EmitLoad(&p, instr->rs); EmitRegOp(&p, 0x23, instr->rt);
+	    break;
+	  case OP_OR:
+	    EmitLoad(&p, instr->rs); EmitRegOp(&p, 0x0b, instr->rt);
+	    break;
+	  case OP_XOR:
+	    EmitLoad(&p, instr->rs); EmitRegOp(&p, 0x33, instr->rt);
+	    break;
+	  case OP_NOR:
+	    EmitLoad(&p, instr->rs); EmitRegOp(&p, 0x0b, instr->rt);
+	    EmitByte(&p, 0xf7); EmitByte(&p, 0xd0);		// not
+	    break;
+	  case OP_ADDIU:
+	    EmitLoad(&p, instr->rs); EmitImmOp(&p, 0x05, instr->extra);
+	    break;
+	  case OP_ANDI:
+	    EmitLoad(&p, instr->rs);
+	    EmitImmOp(&p, 0x25, instr->extra & 0xffff);
+	    break;
+	  case OP_ORI:
+	    EmitLoad(&p, instr->rs);
+	    EmitImmOp(&p, 0x0d, instr->extra & 0xffff);
+	    break;
+	  case OP_XORI:
+	    EmitLoad(&p, instr->rs);
+	    EmitImmOp(&p, 0x35, instr->extra & 0xffff);
+	    break;
+	  case OP_LUI:
+	    EmitImmOp(&p, 0xb8, instr->extra << 16);		// mov
+	    break;
+	  case OP_SLL:
+	    EmitLoad(&p, instr->rt); EmitShift(&p, TRUE, instr->extra);
+	    break;
+	  case OP_SRA: case OP_SRL:
+	    EmitLoad(&p, instr->rt); EmitShift(&p, FALSE, instr->extra);
+	    break;
+	  case OP_SLLV:
+	    EmitLoad(&p, instr->rt); EmitLoad(&p, instr->rs, ECX);
+	    EmitShift(&p, TRUE, -1);
+	    break;
+	  case OP_SRAV: case OP_SRLV:
+	    EmitLoad(&p, instr->rt); EmitLoad(&p, instr->rs, ECX);
+	    EmitShift(&p, FALSE, -1);
+	    break;
+	  case OP_SLT: case OP_SLTU:
+	    EmitLoad(&p, instr->rs); EmitRegOp(&p, 0x3b, instr->rt);
+	    EmitSet(&p, (instr->opCode == OP_SLT) ? CcLess : CcBelow);
+	    break;
+	  case OP_SLTI: case OP_SLTIU:
+	    EmitLoad(&p, instr->rs); EmitImmOp(&p, 0x3d, instr->extra);
+	    EmitSet(&p, (instr->opCode == OP_SLTI) ? CcLess : CcBelow);
+	    break;
+	  case OP_MFHI:
+	    EmitLoad(&p, HiReg);
+	    break;
+	  case OP_MFLO:
+	    EmitLoad(&p, LoReg);
+	    break;
+	  case OP_MTHI: case OP_MTLO:
+	    EmitLoad(&p, instr->rs);
+	    break;
+
+	  case OP_ADD: case OP_SUB: case OP_ADDI:
+	    EmitLoad(&p, instr->rs);
+	    if (instr->opCode == OP_ADDI) {
+		EmitImmOp(&p, 0x05, instr->extra);
+		dest = instr->rt;
+	    } else
+		EmitRegOp(&p, (instr->opCode == OP_ADD) ? 0x03 : 0x2b,
+				instr->rt);
+	    skip = EmitJump(&p, CcNoOverflow);
+	    EmitFault(&p, i, inDelaySlot, TRUE);
+	    PatchJump(skip, p);
+	    break;
+
+	  case OP_MULT: case OP_MULTU: case OP_DIV: case OP_DIVU:
+	    EmitLoad(&p, instr->rs, EDX);
+	    EmitLoad(&p, instr->rt, ECX);
+	    EmitImmOp(&p, 0xbe, instr->opCode);		// mov esi, op
+	    EmitByte(&p, 0x48); EmitByte(&p, 0x89);	// mov rdi, rbx
+	    EmitByte(&p, 0xdf);
+	    EmitCall(&p, (void *) Machine::JitMulDiv);
+	    dest = 0;
+	    break;
+
+	  case OP_LB: case OP_LBU: case OP_LH: case OP_LHU: case OP_LW:
+	    EmitLoad(&p, instr->rs);
+	    EmitImmOp(&p, 0x05, instr->extra);		// add eax, offset
+	    EmitAccess(&p, instr->opCode, i);
+	    EmitByte(&p, 0x85); EmitByte(&p, 0xc0);	// test eax, eax
+	    skip = EmitJump(&p, CcNotEqual);
+	    EmitFault(&p, i, inDelaySlot, FALSE);
+	    PatchJump(skip, p);
+	    loadReg = instr->rt;
+	    dest = 0;
+	    break;
+
+	  case OP_SB: case OP_SH: case OP_SW:
+	    EmitLoad(&p, instr->rt);
+	    EmitByte(&p, 0x89); EmitByte(&p, 0x04);	// mov [rsp], eax
+	    EmitByte(&p, 0x24);
+	    EmitLoad(&p, instr->rs);
+	    EmitImmOp(&p, 0x05, instr->extra);		// add eax, offset
+	    EmitAccess(&p, instr->opCode, i);
+	    EmitByte(&p, 0x85); EmitByte(&p, 0xc0);	// test eax, eax
+	    skip = EmitJump(&p, CcNotEqual);
+	    EmitFault(&p, i, inDelaySlot, FALSE);
+	    PatchJump(skip, p);
+	    EmitByte(&p, 0x89); EmitByte(&p, 0x44);	// mov [rsp + 4], eax
+	    EmitByte(&p, 0x24); EmitByte(&p, 0x04);
+	    dest = 0;
+	    break;
+
+	  case OP_BEQ: case OP_BNE: case OP_BGEZ: case OP_BGEZAL:
+	  case OP_BGTZ: case OP_BLEZ: case OP_BLTZ: case OP_BLTZAL:
+	    EmitPC(&p, pc + 8, ECX);				// not taken
+	    EmitPC(&p, pc + 4 + IndexToAddr(instr->extra), EDX);	// taken
+	    if (instr->opCode == OP_BGEZAL || instr->opCode == OP_BLTZAL)
+		EmitStore(&p, R31, ECX);
+	    switch (instr->opCode) {
+	      case OP_BEQ: cc = CcEqual; break;
+	      case OP_BNE: cc = CcNotEqual; break;
+	      case OP_BGEZ: case OP_BGEZAL: cc = CcGreaterEqual; break;
+	      case OP_BGTZ: cc = CcGreater; break;
+	      case OP_BLEZ: cc = CcLessEqual; break;
+	      default: cc = CcLess; break;
+	    }
+	    if (instr->opCode == OP_BEQ || instr->opCode == OP_BNE) {
+		EmitLoad(&p, instr->rs);
+		EmitRegOp(&p, 0x3b, instr->rt);			// cmp
+	    } else {
+		EmitRegOp(&p, 0x83, instr->rs, 7);		// cmp ..., 0
+		EmitByte(&p, 0);
+	    }
+	    EmitByte(&p, 0x0f); EmitByte(&p, 0x40 | cc);	// cmov<cc>
+	    EmitByte(&p, 0xca);					//  ecx, edx
+	    EmitStore(&p, NextPCReg, ECX);
+	    dest = 0;
+	    break;
+
+	  case OP_J: case OP_JAL:
+	    EmitPC(&p, pc + 8, ECX);
+	    if (instr->opCode == OP_JAL)
+		EmitStore(&p, R31, ECX);
+	    EmitByte(&p, 0x89); EmitByte(&p, 0xc8);		// mov eax, ecx
+	    EmitImmOp(&p, 0x25, 0xf0000000);			// and
+	    EmitImmOp(&p, 0x0d, IndexToAddr(instr->extra));	// or
+	    EmitStore(&p, NextPCReg);
+	    dest = 0;
+	    break;
+
+	  case OP_JR: case OP_JALR:
+	    EmitPC(&p, pc + 8, ECX);
+	    if (instr->opCode == OP_JALR && instr->rd != 0)
+		EmitStore(&p, instr->rd, ECX);
+	    if (instr->opCode == OP_JALR && instr->rs == instr->rd)
+		EmitStore(&p, NextPCReg, ECX);	// it jumps to the link
+	    else {
+		EmitLoad(&p, instr->rs);
+		EmitStore(&p, NextPCReg);
+	    }
+	    dest = 0;
+	    break;
+
+	  default:
+	    ASSERTNOTREACHED();
+	}
+	if (dest != 0)
+	    EmitStore(&p, dest);
+	EmitRetire(&p, &pending, loadReg);
+
+	if ((instr->opCode == OP_SB || instr->opCode == OP_SH
+		|| instr->opCode == OP_SW) && i < length - 1) {
+	    EmitByte(&p, 0x83); EmitByte(&p, 0x7c);	// cmp [rsp + 4], 1
+	    EmitByte(&p, 0x24); EmitByte(&p, 0x04); EmitByte(&p, 0x01);
+	    skip = EmitJump(&p, CcEqual);
+	    EmitExit(&p, i + 1, FALSE);		// it wrote this page: stop
+	    PatchJump(skip, p);
+	}
+	ASSERT(p - start <= MaxBlockCode / 2 + (i + 1) * MaxInstrCode);
+    }
+    EmitExit(&p, length, inDelaySlot);
+    ASSERT(p - start <= MaxBlockCode + length * MaxInstrCode);
+
+    block->code = (JitCode) start;
+    block->length = length;
+    codeUsed += p - start;
+    return block;
+}
+
+//----------------------------------------------------------------------
+// Jit::ForgetPage
+// 	Throw away the blocks starting on page "page" of main memory, and
+//	their counts.  Blocks never cross pages, so no other block has code
+//	from this page.  (Their host code stays until ForgetAll.)
+//----------------------------------------------------------------------
+
+void
+Jit::ForgetPage(int page)
+{
+    for (int i = page * PageSize / 4; i < (page + 1) * PageSize / 4; i++) {
+	delete blocks[i];
+	blocks[i] = NULL;
+	counts[i] = 0;
+    }
+    pageTranslated[page] = FALSE;
+}
+
+//----------------------------------------------------------------------
+// Jit::ForgetAll
+// 	Throw away every block, and reuse their host code memory.
+//----------------------------------------------------------------------
+
+void
+Jit::ForgetAll()
+{
+    for (int i = 0; i < NumPhysPages; i++)
+	if (pageTranslated[i])
+	    ForgetPage(i);
+    codeUsed = 0;
+}
@@ -0,0 +1,93 @@
+// jit.h
+//	Data structures to translate hot basic blocks of MIPS instructions
+//	into host x86-64 code, so that the simulator can run them natively.
+//
+//	A block is a run of instructions up to and including the first
+//	branch or jump and its delay slot, or up to an instruction that is
+//	left to the interpreter (LWL, LWR, SWL, SWR, SYSCALL and illegal
+//	ones), or to the end of the page.  Its code leaves the simulated
+//	machine in the same state as interpreting it one instruction at a
+//	time: loads are delayed, a branch takes effect after its delay
+//	slot, and a pending load may be retired by the block's first
+//	instruction.  Loads and stores go through the simulated memory;
+//	a translation fault, or an overflow in ADD, ADDI or SUB, leaves
+//	the block with the machine as it was before the faulting
+//	instruction, and Machine::RunTranslated raises the exception as
+//	OneInstruction would have.  The time advances by one tick for
+//	each instruction run.
+//
+//	A block is translated once its first instruction has been reached
+//	JitHotCount times.  Translations are keyed by physical address,
+//	and their code is independent of where the page is mapped:
+//	remapping a page leaves them valid, but writing to the page
+//	throws them away.  A store that does so to the page of the
+//	running block ends the block after it.
+//
+//	On a loop of ALU, load, store and branch instructions, Nachos
+//	takes about a quarter of the host time with it that the switch
+//	core takes alone.
+//
+//	The translated code is only generated on an x86-64 host; anywhere
+//	else, Enter never finds a translation.
+//
+// Copyright (c) 1992-1996 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#ifndef JIT_H
+#define JIT_H
+
+#include "copyright.h"
+#include "machine.h"
+
+#define JitHotCount	16		// reaches before a block is translated
+#define JitMaxRun	32		// most instructions in one block
+#define JitCodeSize	(4 * 1024 * 1024) // bytes of host code kept at once
+
+// Host code for a block: it takes the machine and its registers, and
+// returns the number of instructions it completed
+typedef int (*JitCode)(Machine *machine, int *registers);
+
+// A translated block of instructions
+class JitBlock {
+  public:
+    JitCode code;			// its host code
+    int length;				// number of instructions it runs
+};
+
+class Jit {
+  public:
+    Jit();				// Start with nothing translated
+    ~Jit();
+
+    static bool Available();		// Can we generate host code here?
+
+    JitBlock *Enter(int physAddr, Instruction *instr, int maxLength);
+					// The block starting at "physAddr"
+					// is about to be interpreted: return
+					// its translation, if it is hot
+    void InvalidatePage(int page) {	// Page "page" of main memory was
+	if (pageTranslated[page])	// written: forget its blocks
+	    ForgetPage(page);
+    }
+
+  private:
+    JitBlock **blocks;			// the block starting at each word
+					// of main memory, if translated
+    unsigned char *counts;		// times each word started a block
+    bool *pageTranslated;		// pages with any blocks translated
+    char *code;				// host code of the blocks
+    int codeUsed;			// bytes of "code" used so far
+
+    static bool CanTranslate(Instruction *instr);
+					// Is "instr" allowed in a block?
+    static bool IsBranch(Instruction *instr);
+					// Does "instr" end a block, after
+					// its delay slot?
+    JitBlock *Translate(Instruction *instr, int length);
+					// Generate the host code of a block
+    void ForgetPage(int page);		// Throw away the blocks on a page
+    void ForgetAll();			// ... and on every page
+};
+
+#endif // JIT_H
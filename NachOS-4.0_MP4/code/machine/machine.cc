@@ -9,8 +9,12 @@
 
 #include "copyright.h"
 #include "machine.h"
+#include "jit.h"
+#include "cpu.h"
 #include "main.h"
 
+int NumPhysPages = DefaultPhysPages;	// the size of physical memory
+
 // Textual names of the exceptions that can be generated by user program
 // execution, for debugging.
 static char* exceptionNames[] = { "no exception", "syscall", 
@@ -50,28 +54,50 @@ void CheckEndian()
 //
 //	"debug" -- if TRUE, drop into the debugger after each user instruction
 //		is executed.
+//	"threaded" -- if TRUE, run user programs on the threaded
+//		interpreter core (see Machine::RunThreaded).
+//	"translate" -- if TRUE, translate hot code into host code (see
+//		jit.h), if the host allows it.
+//	"useTlb" -- if not NULL, the TLB to translate addresses through,
+//		instead of a page table.  Compiling with USE_TLB gives
+//		a small fully associative one by default.
 //----------------------------------------------------------------------
 
-Machine::Machine(bool debug)
+Machine::Machine(bool debug, bool threaded, bool translate, Tlb *useTlb)
 {
     int i;
 
     for (i = 0; i < NumTotalRegs; i++)
         registers[i] = 0;
-    mainMemory = new char[MemorySize];
-    for (i = 0; i < MemorySize; i++)
-      	mainMemory[i] = 0;
+    mainMemory = (char *) calloc(MemorySize, 1);	// the host zeroes
+				// each page when it is first touched, so a
+				// big memory only costs what is used
+    ASSERT(mainMemory != NULL);
+    decoded = new Instruction[MemorySize / 4];
+    pageDecoded = new bool[NumPhysPages];
+    for (i = 0; i < NumPhysPages; i++)
+	pageDecoded[i] = FALSE;
+    sharedMemory = FALSE;
+    cpu = NULL;
+    tlb = useTlb;
 #ifdef USE_TLB
-    tlb = new TranslationEntry[TLBSize];
-    for (i = 0; i < TLBSize; i++)
-	tlb[i].valid = FALSE;
-    pageTable = NULL;
-#else	// use linear page table
-    tlb = NULL;
-    pageTable = NULL;
+    if (tlb == NULL)
+	tlb = new Tlb(TLBSize, TLBSize, TlbRandom);
 #endif
+    pageTable = NULL;
+    FlushHostPages();
 
     singleStep = debug;
+    threadedDispatch = threaded;
+    jit = NULL;
+    if (translate && Jit::Available())
+	jit = new Jit();
+    else if (translate)
+	cerr << "No code translation on this host; interpreting instead\n";
+    jitException = NoException;
+    recordExceptions = FALSE;
+    quietTicks = 0;
+    untickedInstructions = 0;
     CheckEndian();
 }
 
@@ -82,9 +108,61 @@ Machine::Machine(bool debug)
 
 Machine::~Machine()
 {
-    delete [] mainMemory;
+    if (!sharedMemory) {
+	free(mainMemory);
+	delete [] decoded;
+	delete [] pageDecoded;
+    }
+    delete jit;
     if (tlb != NULL)
-        delete [] tlb;
+        delete tlb;
+}
+
+//----------------------------------------------------------------------
+// Machine::ShareMemory
+// 	Make this machine another CPU of the multiprocessor "other" is a
+//	CPU of: give up its own main memory, and use the one of "other".
+//	The decoded instructions go with the memory, since they are only
+//	a faster way to read it.
+//----------------------------------------------------------------------
+
+void
+Machine::ShareMemory(Machine *other)
+{
+    ASSERT(!sharedMemory);
+    free(mainMemory);
+    delete [] decoded;
+    delete [] pageDecoded;
+    mainMemory = other->mainMemory;
+    decoded = other->decoded;
+    pageDecoded = other->pageDecoded;
+    sharedMemory = TRUE;
+}
+
+//----------------------------------------------------------------------
+// Machine::Checkpoint
+// 	Write the contents of main memory to the UNIX file "fd".  The
+//	registers belong to the threads, which save them themselves.
+//----------------------------------------------------------------------
+
+void
+Machine::Checkpoint(int fd)
+{
+    WriteFile(fd, mainMemory, MemorySize);
+}
+
+//----------------------------------------------------------------------
+// Machine::Restore
+// 	Read back the main memory Checkpoint wrote to "fd", forgetting
+//	everything decoded or translated from the old contents.
+//----------------------------------------------------------------------
+
+void
+Machine::Restore(int fd)
+{
+    Read(fd, mainMemory, MemorySize);
+    InvalidateDecoded(0, MemorySize);
+    FlushHostPages();
 }
 
 //----------------------------------------------------------------------
@@ -100,12 +178,23 @@ Machine::~Machine()
 void
 Machine::RaiseException(ExceptionType which, int badVAddr)
 {
+    bool entered = cpu->Enter();	// from user mode, unless the
+					// kernel was touching user memory
+
     DEBUG(dbgMach, "Exception: " << exceptionNames[which]);
+    AccountTicks();			// the kernel must see the right time
+    quietTicks = 0;			// and may schedule interrupts sooner
     registers[BadVAddrReg] = badVAddr;
     DelayedLoad(0, 0);			// finish anything in progress
-    kernel->interrupt->setStatus(SystemMode);
-    ExceptionHandler(which);		// interrupts are enabled at this point
-    kernel->interrupt->setStatus(UserMode);
+    if (recordExceptions) {		// JitSelfTest only compares them
+	recordedException = which;
+    } else {
+	kernel->interrupt->setStatus(SystemMode);
+	ExceptionHandler(which);	// interrupts are enabled at this point
+	kernel->interrupt->setStatus(UserMode);
+    }
+    if (entered)
+	cpu->Leave();
 }
 
 //----------------------------------------------------------------------
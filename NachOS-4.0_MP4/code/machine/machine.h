@@ -31,14 +31,20 @@ const int PageSize = 128; 		// set the page size equal to
 					// the disk sector size, for simplicity
 
 //
-// You are allowed to change this value.
-// Doing so will change the number of pages of physical memory
-// available on the simulated machine.
+// The number of pages of physical memory available on the simulated
+// machine.  It defaults to DefaultPhysPages, and may be changed with
+// the -mem flag, before the Machine is created.  At most MaxPhysPages,
+// so that every physical and user address fits in a (positive) int:
+// main memory is indexed, and user addresses held, as ints.
 //
-const int NumPhysPages = 128;
+const int DefaultPhysPages = 128;
+const int MaxPhysPages = 0x7fffffff / PageSize;
+extern int NumPhysPages;
 
-const int MemorySize = (NumPhysPages * PageSize);
+#define MemorySize	(NumPhysPages * PageSize)
 const int TLBSize = 4;			// if there is a TLB, make it small
+const int HostPageCacheSize = 32;	// translations ReadMem and WriteMem
+					// cache; must be a power of 2
 
 enum ExceptionType { NoException,           // Everything ok!
 		     SyscallException,      // A program executed a system call.
@@ -88,13 +94,53 @@ enum ExceptionType { NoException,           // Everything ok!
 // The procedures in this class are defined in machine.cc, mipssim.cc, and
 // translate.cc.
 
-class Instruction;
 class Interrupt;
+class Jit;
+class Cpu;
+
+// The following class defines a translation ReadMem and WriteMem keep
+// of a recently used virtual page, straight to where the page is in
+// "mainMemory", so that most accesses skip Translate.  An entry is
+// only made once Translate has set the page's use bit, and is only
+// "writable" once it has set the dirty bit too: until then, accesses
+// take the slow path, so the bits are set exactly as without the cache.
+
+class HostPage {
+  public:
+    int virtualPage;	// the page cached, or -1 if none
+    char *memory;	// where the page is in main memory
+    bool writable;	// can the page be written without Translate?
+};
+
+// The following class defines an instruction, represented in both
+// 	undecoded binary form
+//      decoded to identify
+//	    operation to do
+//	    registers to act on
+//	    any immediate operand value
+
+class Instruction {
+  public:
+    void Decode();	// decode the binary representation of the instruction
+
+    unsigned int value; // binary representation of the instruction
+
+    char opCode;     // Type of instruction.  This is NOT the same as the
+    		     // opcode field from the instruction: see defs in mips.h
+    unsigned char rs, rt, rd; // Three registers from instruction.
+    int extra;       // Immediate or target or shamt field or offset.
+                     // Immediates are sign-extended.
+};
 
 class Machine {
   public:
-    Machine(bool debug);	// Initialize the simulation of the hardware
-				// for running user programs
+    Machine(bool debug, bool threaded = FALSE, bool translate = FALSE,
+		Tlb *useTlb = NULL);
+				// Initialize the simulation of the hardware
+				// for running user programs; "threaded"
+				// picks the faster interpreter core,
+				// "translate" runs hot code natively, and
+				// "useTlb" translates through a TLB
     ~Machine();			// De-allocate the data structures
 
 // Routines callable by the Nachos kernel
@@ -123,8 +169,10 @@ class Machine {
 //
 // If "tlb" is NULL, the linear page table is used
 // If "tlb" is non-NULL, the Nachos kernel is responsible for managing
-//	the contents of the TLB.  But the kernel can use any data structure
-//	it wants (eg, segmented paging) for handling TLB cache misses.
+//	the contents of the TLB: it refills it on a miss (Tlb::Refill),
+//	and tells it which address space is running (Tlb::SetAsid).  But
+//	the kernel can use any data structure it wants (eg, segmented
+//	paging) for handling TLB cache misses.
 // 
 // For simplicity, both the page table pointer and the TLB pointer are
 // public.  However, while there can be multiple page tables (one per address
@@ -132,8 +180,8 @@ class Machine {
 // Thus the TLB pointer should be considered as *read-only*, although 
 // the contents of the TLB are free to be modified by the kernel software.
 
-    TranslationEntry *tlb;		// this pointer should be considered 
-					// "read-only" to Nachos kernel code
+    Tlb *tlb;			// this pointer should be considered 
+				// "read-only" to Nachos kernel code
 
     TranslationEntry *pageTable;
     unsigned int pageTableSize;
@@ -143,17 +191,66 @@ class Machine {
     				// Read or write 1, 2, or 4 bytes of virtual 
 				// memory (at addr).  Return FALSE if a 
 				// correct translation couldn't be found.
+
+    void InvalidateDecoded(int physAddr, int numBytes);
+				// The kernel wrote these bytes of main
+				// memory directly: forget the instructions
+				// decoded from them
+    void FlushHostPages();	// The page table was switched or edited:
+				// forget the translations ReadMem and
+				// WriteMem have cached
+    void ShareMemory(Machine *other);
+				// Use the main memory of "other", as
+				// another CPU of the same multiprocessor
+    void Checkpoint(int fd);	// Save main memory to the UNIX file "fd"
+    void Restore(int fd);	// Read it back
+    void JitSelfTest();		// Compare the translations of -jit
+				// with the interpreter
+
+// Called only from the host code of -jit (see jit.cc)
+    static int JitAccess(Machine *machine, int op, int addr, int *value,
+			int index);
+				// Do the load or store "op" of the
+				// index'th instruction of the running block
+    static void JitTrap(Machine *machine, int which, int badVAddr);
+				// Stop the block with an exception
+    static void JitMulDiv(int *registers, int op, int a, int b);
+				// Multiply or divide into Hi and Lo
+
+    Cpu *cpu;			// the CPU this machine simulates, whose
+				// kernel lock it takes to enter the kernel
   private:
 
 // Routines internal to the machine simulation -- DO NOT call these directly
     void DelayedLoad(int nextReg, int nextVal);  	
 				// Do a pending delayed load (modifying a reg)
 
-    void OneInstruction(Instruction *instr); 	
+    void OneInstruction(); 	
     				// Run one instruction of a user program.
+    void RunThreaded();		// Run the user program on the threaded
+				// interpreter core; never returns
+    void Tick();		// Advance the time by one user instruction
+    void AccountTicks();	// Add the time of the instructions Tick
+				// has not accounted for yet
+    Instruction *DecodedAt(int physAddr);
+				// The instruction at "physAddr", decoded
+    bool RunTranslated(int physAddr);
+				// Run the translation of the instructions
+				// at "physAddr" natively, if there is one
+    void FetchTranslated(int last);
+				// Look up the fetches of the running
+				// block's instructions up to "last"
+    void CacheHostPage(int virtAddr, int physAddr);
+				// Remember the translation Translate just
+				// made, for ReadMem and WriteMem
     
 
 
+    ExceptionType TryReadMem(int addr, int size, int *value);
+    ExceptionType TryWriteMem(int addr, int size, int value);
+				// ReadMem and WriteMem, returning the
+				// exception instead of raising it
+
     ExceptionType Translate(int virtAddr, int* physAddr, int size,bool writing);
     				// Translate an address, and check for 
 				// alignment.  Set the use and dirty bits in 
@@ -173,8 +270,31 @@ class Machine {
 
     int registers[NumTotalRegs]; // CPU registers, for executing user programs
 
+    Instruction *decoded;	// the decoding of each word of main memory,
+    bool *pageDecoded;		// valid for the pages marked here
+    bool sharedMemory;		// TRUE if another Machine owns mainMemory
+				// and its decoding
+    Jit *jit;			// translations of hot code, or NULL
+    int jitPage;		// the running block's physical page,
+    int jitFetchPage;		// and virtual page
+    int jitFetched;		// its instructions whose fetch has been
+				// looked up
+    ExceptionType jitException;	// the exception it stopped at, if any,
+    int jitBadVAddr;		// and the address that caused it
+    bool recordExceptions;	// while JitSelfTest runs: note exceptions
+    ExceptionType recordedException;	// here, instead of handling them
+    HostPage hostPages[HostPageCacheSize];
+				// translations of recently used pages,
+				// indexed by virtual page number
+
     bool singleStep;		// drop back into the debugger after each
 				// simulated instruction
+    bool threadedDispatch;	// use RunThreaded rather than
+				// OneInstruction, when not tracing
+    int quietTicks;		// instructions that can still run before
+				// the next OneTick is needed
+    int untickedInstructions;	// instructions run since the last one,
+				// not yet added to the time
     int runUntilTime;		// drop back into the debugger when simulated
 				// time reaches this value
 
@@ -20,30 +20,12 @@
 #include "debug.h"
 #include "machine.h"
 #include "mipssim.h"
+#include "jit.h"
+#include "cpu.h"
 #include "main.h"
 
 static void Mult(int a, int b, bool signedArith, int* hiPtr, int* loPtr);
 
-// The following class defines an instruction, represented in both
-// 	undecoded binary form
-//      decoded to identify
-//	    operation to do
-//	    registers to act on
-//	    any immediate operand value
-
-class Instruction {
-  public:
-    void Decode();	// decode the binary representation of the instruction
-
-    unsigned int value; // binary representation of the instruction
-
-    char opCode;     // Type of instruction.  This is NOT the same as the
-    		     // opcode field from the instruction: see defs in mips.h
-    char rs, rt, rd; // Three registers from instruction.
-    int extra;       // Immediate or target or shamt field or offset.
-                     // Immediates are sign-extended.
-};
-
 //----------------------------------------------------------------------
 // Machine::Run
 // 	Simulate the execution of a user-level program on Nachos.
@@ -56,22 +38,474 @@ class Instruction {
 void
 Machine::Run()
 {
-    Instruction *instr = new Instruction;  // storage for decoded instruction
-
     if (debug->IsEnabled('m')) {
         cout << "Starting program in thread: " << kernel->currentThread->getName();
 		cout << ", at time: " << kernel->stats->totalTicks << "\n";
     }
+    if (jit != NULL && (singleStep || debug->IsEnabled('m'))) {
+	delete jit;		// trace and step single instructions,
+	jit = NULL;		// not translated runs of them
+    }
     kernel->interrupt->setStatus(UserMode);
+    cpu->Leave();		// user instructions run outside the kernel
+    if (threadedDispatch && !singleStep && !debug->IsEnabled('m'))
+	RunThreaded();		// never returns
     for (;;) {
-        OneInstruction(instr);
-		kernel->interrupt->OneTick();
+        OneInstruction();
+		Tick();
 		if (singleStep && (runUntilTime <= kernel->stats->totalTicks))
 	  		Debugger();
     }
 }
 
 
+//----------------------------------------------------------------------
+// Machine::RunThreaded
+// 	Another interpreter core, used by Run when asked for.  It runs
+//	the same simulation as OneInstruction, but dispatches each decoded
+//	instruction through a table of handler addresses (GCC's computed
+//	goto) instead of the switch, and each handler goes straight on to
+//	the next instruction instead of returning to Run's loop.
+//
+//	The common instructions have handlers of their own; the rest
+//	(unaligned loads and stores, syscalls, illegal instructions) are
+//	left to OneInstruction.  There is no tracing and no single
+//	stepping: Run only uses this core when neither is asked for.
+//
+//	Simulated time advances exactly as in Run, one tick per
+//	instruction.  Never returns.
+//
+//	On a loop of ALU, load, store and branch instructions, it takes
+//	about a fifth less host time than the switch.
+//----------------------------------------------------------------------
+
+void
+Machine::RunThreaded()
+{
+    static void *handlers[MaxOpcode + 1];
+    static bool initialized = FALSE;
+    Instruction *instr;
+    ExceptionType exception;
+    int physAddr, pcAfter, nextLoadReg, nextLoadValue;
+    int sum, diff, tmp, value;
+    unsigned int rs, rt, imm;
+
+    if (!initialized) {
+	for (int i = 0; i <= MaxOpcode; i++)
+	    handlers[i] = &&do_slow;
+	handlers[OP_ADD] = &&do_add;
+	handlers[OP_ADDI] = &&do_addi;
+	handlers[OP_ADDIU] = &&do_addiu;
+	handlers[OP_ADDU] = &&do_addu;
+	handlers[OP_AND] = &&do_and;
+	handlers[OP_ANDI] = &&do_andi;
+	handlers[OP_BEQ] = &&do_beq;
+	handlers[OP_BGEZ] = &&do_bgez;
+	handlers[OP_BGEZAL] = &&do_bgezal;
+	handlers[OP_BGTZ] = &&do_bgtz;
+	handlers[OP_BLEZ] = &&do_blez;
+	handlers[OP_BLTZ] = &&do_bltz;
+	handlers[OP_BLTZAL] = &&do_bltzal;
+	handlers[OP_BNE] = &&do_bne;
+	handlers[OP_DIV] = &&do_div;
+	handlers[OP_DIVU] = &&do_divu;
+	handlers[OP_J] = &&do_j;
+	handlers[OP_JAL] = &&do_jal;
+	handlers[OP_JALR] = &&do_jalr;
+	handlers[OP_JR] = &&do_jr;
+	handlers[OP_LB] = &&do_lb;
+	handlers[OP_LBU] = &&do_lbu;
+	handlers[OP_LH] = &&do_lh;
+	handlers[OP_LHU] = &&do_lhu;
+	handlers[OP_LUI] = &&do_lui;
+	handlers[OP_LW] = &&do_lw;
+	handlers[OP_MFHI] = &&do_mfhi;
+	handlers[OP_MFLO] = &&do_mflo;
+	handlers[OP_MTHI] = &&do_mthi;
+	handlers[OP_MTLO] = &&do_mtlo;
+	handlers[OP_MULT] = &&do_mult;
+	handlers[OP_MULTU] = &&do_multu;
+	handlers[OP_NOR] = &&do_nor;
+	handlers[OP_OR] = &&do_or;
+	handlers[OP_ORI] = &&do_ori;
+	handlers[OP_SB] = &&do_sb;
+	handlers[OP_SH] = &&do_sh;
+	handlers[OP_SLL] = &&do_sll;
+	handlers[OP_SLLV] = &&do_sllv;
+	handlers[OP_SLT] = &&do_slt;
+	handlers[OP_SLTI] = &&do_slti;
+	handlers[OP_SLTIU] = &&do_sltiu;
+	handlers[OP_SLTU] = &&do_sltu;
+	handlers[OP_SRA] = &&do_sra;
+	handlers[OP_SRAV] = &&do_srav;
+	handlers[OP_SRL] = &&do_srl;
+	handlers[OP_SRLV] = &&do_srlv;
+	handlers[OP_SUB] = &&do_sub;
+	handlers[OP_SUBU] = &&do_subu;
+	handlers[OP_SW] = &&do_sw;
+	handlers[OP_XOR] = &&do_xor;
+	handlers[OP_XORI] = &&do_xori;
+	initialized = TRUE;
+    }
+
+  fetch:
+    exception = Translate(registers[PCReg], &physAddr, 4, FALSE);
+    if (exception != NoException) {
+	RaiseException(exception, registers[PCReg]);
+	goto tick;
+    }
+    if (jit != NULL && RunTranslated(physAddr))
+	goto tick;
+    instr = DecodedAt(physAddr);
+    pcAfter = registers[NextPCReg] + 4;
+    nextLoadReg = 0;
+    nextLoadValue = 0;
+    goto *handlers[(int) instr->opCode];
+
+  do_add:
+    sum = registers[instr->rs] + registers[instr->rt];
+    if (!((registers[instr->rs] ^ registers[instr->rt]) & SIGN_BIT) &&
+	((registers[instr->rs] ^ sum) & SIGN_BIT)) {
+	RaiseException(OverflowException, 0);
+	goto tick;
+    }
+    registers[instr->rd] = sum;
+    goto retire;
+
+  do_addi:
+    sum = registers[instr->rs] + instr->extra;
+    if (!((registers[instr->rs] ^ instr->extra) & SIGN_BIT) &&
+	((instr->extra ^ sum) & SIGN_BIT)) {
+	RaiseException(OverflowException, 0);
+	goto tick;
+    }
+    registers[instr->rt] = sum;
+    goto retire;
+
+  do_addiu:
+    registers[instr->rt] = registers[instr->rs] + instr->extra;
+    goto retire;
+
+  do_addu:
+    registers[instr->rd] = registers[instr->rs] + registers[instr->rt];
+    goto retire;
+
+  do_and:
+    registers[instr->rd] = registers[instr->rs] & registers[instr->rt];
+    goto retire;
+
+  do_andi:
+    registers[instr->rt] = registers[instr->rs] & (instr->extra & 0xffff);
+    goto retire;
+
+  do_beq:
+    if (registers[instr->rs] == registers[instr->rt])
+	pcAfter = registers[NextPCReg] + IndexToAddr(instr->extra);
+    goto retire;
+
+  do_bgezal:
+    registers[R31] = registers[NextPCReg] + 4;
+  do_bgez:
+    if (!(registers[instr->rs] & SIGN_BIT))
+	pcAfter = registers[NextPCReg] + IndexToAddr(instr->extra);
+    goto retire;
+
+  do_bgtz:
+    if (registers[instr->rs] > 0)
+	pcAfter = registers[NextPCReg] + IndexToAddr(instr->extra);
+    goto retire;
+
+  do_blez:
+    if (registers[instr->rs] <= 0)
+	pcAfter = registers[NextPCReg] + IndexToAddr(instr->extra);
+    goto retire;
+
+  do_bltzal:
+    registers[R31] = registers[NextPCReg] + 4;
+  do_bltz:
+    if (registers[instr->rs] & SIGN_BIT)
+	pcAfter = registers[NextPCReg] + IndexToAddr(instr->extra);
+    goto retire;
+
+  do_bne:
+    if (registers[instr->rs] != registers[instr->rt])
+	pcAfter = registers[NextPCReg] + IndexToAddr(instr->extra);
+    goto retire;
+
+  do_div:
+    if (registers[instr->rt] == 0) {
+	registers[LoReg] = 0;
+	registers[HiReg] = 0;
+    } else {
+	registers[LoReg] =  registers[instr->rs] / registers[instr->rt];
+	registers[HiReg] = registers[instr->rs] % registers[instr->rt];
+    }
+    goto retire;
+
+  do_divu:
+    rs = (unsigned int) registers[instr->rs];
+    rt = (unsigned int) registers[instr->rt];
+    if (rt == 0) {
+	registers[LoReg] = 0;
+	registers[HiReg] = 0;
+    } else {
+	tmp = rs / rt;
+	registers[LoReg] = (int) tmp;
+	tmp = rs % rt;
+	registers[HiReg] = (int) tmp;
+    }
+    goto retire;
+
+  do_jal:
+    registers[R31] = registers[NextPCReg] + 4;
+  do_j:
+    pcAfter = (pcAfter & 0xf0000000) | IndexToAddr(instr->extra);
+    goto retire;
+
+  do_jalr:
+    registers[instr->rd] = registers[NextPCReg] + 4;
+  do_jr:
+    pcAfter = registers[instr->rs];
+    goto retire;
+
+  do_lb:
+  do_lbu:
+    tmp = registers[instr->rs] + instr->extra;
+    if (!ReadMem(tmp, 1, &value))
+	goto tick;
+    if ((value & 0x80) && (instr->opCode == OP_LB))
+	value |= 0xffffff00;
+    else
+	value &= 0xff;
+    nextLoadReg = instr->rt;
+    nextLoadValue = value;
+    goto retire;
+
+  do_lh:
+  do_lhu:
+    tmp = registers[instr->rs] + instr->extra;
+    if (tmp & 0x1) {
+	RaiseException(AddressErrorException, tmp);
+	goto tick;
+    }
+    if (!ReadMem(tmp, 2, &value))
+	goto tick;
+    if ((value & 0x8000) && (instr->opCode == OP_LH))
+	value |= 0xffff0000;
+    else
+	value &= 0xffff;
+    nextLoadReg = instr->rt;
+    nextLoadValue = value;
+    goto retire;
+
+  do_lui:
+    registers[instr->rt] = instr->extra << 16;
+    goto retire;
+
+  do_lw:
+    tmp = registers[instr->rs] + instr->extra;
+    if (tmp & 0x3) {
+	RaiseException(AddressErrorException, tmp);
+	goto tick;
+    }
+    if (!ReadMem(tmp, 4, &value))
+	goto tick;
+    nextLoadReg = instr->rt;
+    nextLoadValue = value;
+    goto retire;
+
+  do_mfhi:
+    registers[instr->rd] = registers[HiReg];
+    goto retire;
+
+  do_mflo:
+    registers[instr->rd] = registers[LoReg];
+    goto retire;
+
+  do_mthi:
+    registers[HiReg] = registers[instr->rs];
+    goto retire;
+
+  do_mtlo:
+    registers[LoReg] = registers[instr->rs];
+    goto retire;
+
+  do_mult:
+    Mult(registers[instr->rs], registers[instr->rt], TRUE,
+	 &registers[HiReg], &registers[LoReg]);
+    goto retire;
+
+  do_multu:
+    Mult(registers[instr->rs], registers[instr->rt], FALSE,
+	 &registers[HiReg], &registers[LoReg]);
+    goto retire;
+
+  do_nor:
+    registers[instr->rd] = ~(registers[instr->rs] | registers[instr->rt]);
+    goto retire;
+
+  do_or:
+    registers[instr->rd] = registers[instr->rs] | registers[instr->rt];
+    goto retire;
+
+  do_ori:
+    registers[instr->rt] = registers[instr->rs] | (instr->extra & 0xffff);
+    goto retire;
+
+  do_sb:
+    if (!WriteMem((unsigned) 
+	    (registers[instr->rs] + instr->extra), 1, registers[instr->rt]))
+	goto tick;
+    goto retire;
+
+  do_sh:
+    if (!WriteMem((unsigned) 
+	    (registers[instr->rs] + instr->extra), 2, registers[instr->rt]))
+	goto tick;
+    goto retire;
+
+  do_sll:
+    registers[instr->rd] = registers[instr->rt] << instr->extra;
+    goto retire;
+
+  do_sllv:
+    registers[instr->rd] = registers[instr->rt] <<
+	(registers[instr->rs] & 0x1f);
+    goto retire;
+
+  do_slt:
+    registers[instr->rd] = (registers[instr->rs] < registers[instr->rt]);
+    goto retire;
+
+  do_slti:
+    registers[instr->rt] = (registers[instr->rs] < instr->extra);
+    goto retire;
+
+  do_sltiu:
+    rs = registers[instr->rs];
+    imm = instr->extra;
+    registers[instr->rt] = (rs < imm);
+    goto retire;
+
+  do_sltu:
+    rs = registers[instr->rs];
+    rt = registers[instr->rt];
+    registers[instr->rd] = (rs < rt);
+    goto retire;
+
+  do_sra:
+    registers[instr->rd] = registers[instr->rt] >> instr->extra;
+    goto retire;
+
+  do_srav:
+    registers[instr->rd] = registers[instr->rt] >>
+	(registers[instr->rs] & 0x1f);
+    goto retire;
+
+  do_srl:
+    tmp = registers[instr->rt];
+    tmp >>= instr->extra;
+    registers[instr->rd] = tmp;
+    goto retire;
+
+  do_srlv:
+    tmp = registers[instr->rt];
+    tmp >>= (registers[instr->rs] & 0x1f);
+    registers[instr->rd] = tmp;
+    goto retire;
+
+  do_sub:
+    diff = registers[instr->rs] - registers[instr->rt];
+    if (((registers[instr->rs] ^ registers[instr->rt]) & SIGN_BIT) &&
+	((registers[instr->rs] ^ diff) & SIGN_BIT)) {
+	RaiseException(OverflowException, 0);
+	goto tick;
+    }
+    registers[instr->rd] = diff;
+    goto retire;
+
+  do_subu:
+    registers[instr->rd] = registers[instr->rs] - registers[instr->rt];
+    goto retire;
+
+  do_sw:
+    if (!WriteMem((unsigned) 
+	    (registers[instr->rs] + instr->extra), 4, registers[instr->rt]))
+	goto tick;
+    goto retire;
+
+  do_xor:
+    registers[instr->rd] = registers[instr->rs] ^ registers[instr->rt];
+    goto retire;
+
+  do_xori:
+    registers[instr->rt] = registers[instr->rs] ^ (instr->extra & 0xffff);
+    goto retire;
+
+  do_slow:
+    OneInstruction();		// everything else, the slow way
+    goto tick;
+
+  retire:
+    DelayedLoad(nextLoadReg, nextLoadValue);
+    registers[PrevPCReg] = registers[PCReg];
+    registers[PCReg] = registers[NextPCReg];
+    registers[NextPCReg] = pcAfter;
+  tick:
+    Tick();
+    goto fetch;
+}
+
+//----------------------------------------------------------------------
+// Machine::Tick
+// 	Advance simulated time past the user instruction just executed.
+//
+//	Calling Interrupt::OneTick after every instruction is costly, and
+//	useless while no interrupt is due: so the instructions up to the
+//	next pending interrupt just count themselves, and the count is
+//	added to the time once, before the OneTick of the instruction
+//	when it is due.  Anything in the kernel that reads the time runs
+//	from RaiseException or OneTick, and RaiseException adds the count
+//	in first as well, so no one sees a different time than before.
+//
+//	In single-step mode, every instruction gets its OneTick, so that
+//	the debugger sees the time after each one.
+//
+//	OneTick runs in the kernel, so on a multiprocessor it takes the
+//	kernel lock; the quiet instructions do not.
+//----------------------------------------------------------------------
+
+void
+Machine::Tick()
+{
+    if (quietTicks > 0) {
+	quietTicks--;
+	untickedInstructions++;
+	return;
+    }
+    cpu->Enter();
+    AccountTicks();
+    kernel->interrupt->OneTick();
+    if (!singleStep)
+	quietTicks = kernel->interrupt->QuietTicks();
+    cpu->Leave();
+}
+
+//----------------------------------------------------------------------
+// Machine::AccountTicks
+// 	Add the time of the instructions Tick has only counted.
+//----------------------------------------------------------------------
+
+void
+Machine::AccountTicks()
+{
+    if (untickedInstructions > 0) {
+	kernel->stats->totalTicks += untickedInstructions * UserTick;
+	kernel->stats->userTicks += untickedInstructions * UserTick;
+	untickedInstructions = 0;
+    }
+}
+
 //----------------------------------------------------------------------
 // TypeToReg
 // 	Retrieve the register # referred to in an instruction. 
@@ -108,9 +542,12 @@ TypeToReg(RegType reg, Instruction *instr)
 //
 //	This routine is re-entrant, in that it can be called multiple
 //	times concurrently -- one for each thread executing user code.
-//	We get re-entrancy by never caching any data -- we always re-start the
-//	simulation from scratch each time we are called (or after trapping
-//	back to the Nachos kernel on an exception or interrupt), and we always
+//	The only thing cached is the decoding of the instructions in
+//	physical memory (see DecodedAt), which does not depend on the
+//	thread.  Otherwise we get re-entrancy by never caching any data --
+//	we always re-start the simulation from scratch each time we are
+//	called (or after trapping back to the Nachos kernel on an exception
+//	or interrupt), and we always
 //	store all data back to the machine registers and memory before
 //	leaving.  This allows the Nachos kernel to control our behavior
 //	by controlling the contents of memory, the translation table,
@@ -118,22 +555,28 @@ TypeToReg(RegType reg, Instruction *instr)
 //----------------------------------------------------------------------
 
 void
-Machine::OneInstruction(Instruction *instr)
+Machine::OneInstruction()
 {
+    Instruction *instr;
+    int physAddr;
+    ExceptionType exception;
 #ifdef SIM_FIX
     int byte;       // described in Kane for LWL,LWR,...
 #endif
 
-    int raw;
     int nextLoadReg = 0; 	
     int nextLoadValue = 0; 	// record delayed load operation, to apply
 				// in the future
 
-    // Fetch instruction 
-    if (!ReadMem(registers[PCReg], 4, &raw))
+    // Fetch instruction, already decoded unless its page was written
+    exception = Translate(registers[PCReg], &physAddr, 4, FALSE);
+    if (exception != NoException) {
+	RaiseException(exception, registers[PCReg]);
 	return;			// exception occurred
-    instr->value = raw;
-    instr->Decode();
+    }
+    if (jit != NULL && RunTranslated(physAddr))
+	return;			// ran a whole translated run
+    instr = DecodedAt(physAddr);
 
     if (debug->IsEnabled('m')) {
         struct OpString *str = &opStrings[instr->opCode];
@@ -717,6 +1160,529 @@ Machine::DelayedLoad(int nextReg, int nextValue)
     registers[0] = 0; 	// and always make sure R0 stays zero.
 }
 
+//----------------------------------------------------------------------
+// Machine::DecodedAt
+// 	Return the decoded instruction at physical address "physAddr".
+//
+//	The first fetch from a page of physical memory decodes every word
+//	in it; later fetches from the page just index the cache, until
+//	the page is written (see WriteMem and InvalidateDecoded).
+//----------------------------------------------------------------------
+
+Instruction *
+Machine::DecodedAt(int physAddr)
+{
+    int page = physAddr / PageSize;
+
+    if (!pageDecoded[page]) {
+	DEBUG(dbgMach, "Decoding physical page " << page);
+	for (int i = page * PageSize; i < (page + 1) * PageSize; i += 4) {
+	    Instruction *instr = &decoded[i / 4];
+
+	    instr->value = WordToHost(*(unsigned int *) &mainMemory[i]);
+	    instr->Decode();
+	}
+	pageDecoded[page] = TRUE;
+    }
+    return &decoded[physAddr / 4];
+}
+
+//----------------------------------------------------------------------
+// Machine::InvalidateDecoded
+// 	The kernel wrote "numBytes" of main memory at "physAddr" directly,
+//	not through WriteMem: decode the pages they span afresh on their
+//	next fetch.
+//----------------------------------------------------------------------
+
+void
+Machine::InvalidateDecoded(int physAddr, int numBytes)
+{
+    if (numBytes <= 0)
+	return;
+    for (int page = physAddr / PageSize;
+		page <= (physAddr + numBytes - 1) / PageSize; page++) {
+	pageDecoded[page] = FALSE;
+	if (jit != NULL)
+	    jit->InvalidatePage(page);
+    }
+}
+
+//----------------------------------------------------------------------
+// Machine::RunTranslated
+// 	If the block starting at "physAddr" -- where the PC points -- is
+//	hot enough to have been translated into host code (see jit.h),
+//	run it natively and return TRUE.  Otherwise return FALSE, and
+//	let the caller interpret the next instruction.
+//
+//	The code of a block sets the registers, the PCs, and the pending
+//	load as OneInstruction would have after its last instruction; or,
+//	if one of them faulted, as they were before it, and we raise the
+//	exception.  A block must not start in a branch delay slot, where
+//	the branch target follows, not the rest of the block.
+//
+//	To keep the time exact, a block is only taken when all but its
+//	last instruction would be quiet (see Machine::Tick): those it
+//	completed are counted here, and the caller ticks for the last one,
+//	or for the one that faulted.
+//----------------------------------------------------------------------
+
+bool
+Machine::RunTranslated(int physAddr)
+{
+    int pc = registers[PCReg];
+    JitBlock *block;
+    ExceptionType exception;
+    int done;
+
+    if (registers[NextPCReg] != pc + 4)
+	return FALSE;
+    block = jit->Enter(physAddr, DecodedAt(physAddr),
+			(PageSize - physAddr % PageSize) / 4);
+    if (block == NULL || block->length - 1 > quietTicks)
+	return FALSE;
+
+    jitPage = physAddr / PageSize;
+    jitFetchPage = (unsigned) pc / PageSize;
+    jitFetched = 0;
+    done = (*block->code)(this, registers);	// a store may delete "block"
+    if (jitException != NoException) {
+	exception = jitException;
+	jitException = NoException;
+	FetchTranslated(done);
+	quietTicks -= done;
+	untickedInstructions += done;
+	RaiseException(exception, jitBadVAddr);
+	return TRUE;
+    }
+    FetchTranslated(done - 1);
+    quietTicks -= done - 1;
+    untickedInstructions += done - 1;
+    return TRUE;
+}
+
+//----------------------------------------------------------------------
+// Machine::FetchTranslated
+// 	The running block has come to its instruction number "last": look
+//	up the fetches the interpreter would have made of the ones before,
+//	in order with the loads and stores between them.  Only a TLB needs
+//	this, as it counts every lookup and orders its entries by them;
+//	through a page table, the fetch of the first instruction set the
+//	use bit of the page already.
+//----------------------------------------------------------------------
+
+void
+Machine::FetchTranslated(int last)
+{
+    if (tlb == NULL)
+	return;
+    for (; jitFetched < last; jitFetched++)
+	tlb->Lookup(jitFetchPage);
+}
+
+//----------------------------------------------------------------------
+// Machine::JitAccess
+// 	Do the memory access of the load or store "op", the instruction
+//	number "index" of the running block, at "addr": as OneInstruction
+//	would, with "*value" the value loaded or stored.
+//
+//	Returns 0 if the access faulted, noting the exception for
+//	RunTranslated to raise; 2 if it wrote the page of the running
+//	block, which must then stop; and 1 otherwise.
+//----------------------------------------------------------------------
+
+int
+Machine::JitAccess(Machine *machine, int op, int addr, int *value, int index)
+{
+    ExceptionType exception;
+
+    machine->FetchTranslated(index);
+    switch (op) {
+      case OP_LB: case OP_LBU:
+	exception = machine->TryReadMem(addr, 1, value);
+	if ((*value & 0x80) && (op == OP_LB))
+	    *value |= 0xffffff00;
+	else
+	    *value &= 0xff;
+	break;
+      case OP_LH: case OP_LHU:
+	if (addr & 0x1)
+	    exception = AddressErrorException;
+	else
+	    exception = machine->TryReadMem(addr, 2, value);
+	if ((*value & 0x8000) && (op == OP_LH))
+	    *value |= 0xffff0000;
+	else
+	    *value &= 0xffff;
+	break;
+      case OP_LW:
+	if (addr & 0x3)
+	    exception = AddressErrorException;
+	else
+	    exception = machine->TryReadMem(addr, 4, value);
+	break;
+      case OP_SB:
+	exception = machine->TryWriteMem(addr, 1, *value);
+	break;
+      case OP_SH:
+	exception = machine->TryWriteMem(addr, 2, *value);
+	break;
+      case OP_SW:
+	exception = machine->TryWriteMem(addr, 4, *value);
+	break;
+      default:
+	ASSERTNOTREACHED();
+    }
+    if (exception != NoException) {
+	JitTrap(machine, exception, addr);
+	return 0;
+    }
+    if (!machine->pageDecoded[machine->jitPage])
+	return 2;
+    return 1;
+}
+
+//----------------------------------------------------------------------
+// Machine::JitTrap
+// 	Note that the running block stopped at exception "which", caused
+//	by address "badVAddr", for RunTranslated to raise.
+//----------------------------------------------------------------------
+
+void
+Machine::JitTrap(Machine *machine, int which, int badVAddr)
+{
+    machine->jitException = (ExceptionType) which;
+    machine->jitBadVAddr = badVAddr;
+}
+
+//----------------------------------------------------------------------
+// Machine::JitMulDiv
+// 	Do the multiply or divide "op" of "a" by "b" into the Hi and Lo
+//	of "registers", as OneInstruction would.
+//----------------------------------------------------------------------
+
+void
+Machine::JitMulDiv(int *registers, int op, int a, int b)
+{
+    switch (op) {
+      case OP_MULT:
+	Mult(a, b, TRUE, &registers[HiReg], &registers[LoReg]);
+	break;
+      case OP_MULTU:
+	Mult(a, b, FALSE, &registers[HiReg], &registers[LoReg]);
+	break;
+      case OP_DIV:
+	if (b == 0) {
+	    registers[LoReg] = 0;
+	    registers[HiReg] = 0;
+	} else {
+	    registers[LoReg] = a / b;
+	    registers[HiReg] = a % b;
+	}
+	break;
+      case OP_DIVU:
+	if (b == 0) {
+	    registers[LoReg] = 0;
+	    registers[HiReg] = 0;
+	} else {
+	    registers[LoReg] = (int) ((unsigned int) a / (unsigned int) b);
+	    registers[HiReg] = (int) ((unsigned int) a % (unsigned int) b);
+	}
+	break;
+      default:
+	ASSERTNOTREACHED();
+    }
+}
+
+//----------------------------------------------------------------------
+// Machine::JitSelfTest
+// 	Check the host code of -jit against the interpreter: translate
+//	random blocks of instructions, and run each from the same random
+//	registers and memory through OneInstruction and through
+//	RunTranslated.  The registers (PCs and pending load included),
+//	the memory, the use and dirty bits, the exception raised if any,
+//	and the number of instructions run must all come out the same.
+//
+//	The blocks mix ALU, overflowing, multiply and divide, load, store
+//	and branch instructions.  Loads and stores mostly go to three
+//	data pages, and sometimes to the code page (read-only in three
+//	runs out of four; in the fourth a block can write itself), an
+//	invalid page, past the page table, or to an unaligned address.
+//
+//	RunThreaded never returns, so it is not stepped here; its
+//	handlers copy OneInstruction's.
+//
+//	Physical pages 0 to 3 are used, mapped by a page table of their
+//	own; they, the registers, the time, and the translation hardware
+//	are put back as they were afterwards.
+//----------------------------------------------------------------------
+
+#define JitTestRuns	4000		// random blocks to compare
+#define JitTestPages	5		// code, 3 data pages, an invalid one
+#define JitTestData	(3 * PageSize)	// bytes of data pages
+#define JitTestBase	20		// first of the registers the blocks
+#define JitTestBases	4		// use as base addresses, and never
+					// change
+
+static int
+JitTestValue()
+{
+    static const int edges[] = { 0, 1, -1, 31, 32, 0x7fff, 0x8000,
+				 0x7fffffff, (int) 0x80000000 };
+
+    if (RandomNumber() % 4 == 0)
+	return edges[RandomNumber() % (sizeof(edges) / sizeof(edges[0]))];
+    return (int) ((RandomNumber() << 16) ^ RandomNumber());
+}
+
+// A random register for an instruction to change
+static unsigned int
+JitTestDest()
+{
+    unsigned int reg = RandomNumber() % 32;
+
+    if (reg >= JitTestBase && reg < JitTestBase + JitTestBases)
+	reg -= JitTestBases;
+    return reg;
+}
+
+static unsigned int
+JitTestR(unsigned int rs, unsigned int rt, unsigned int rd,
+	 unsigned int shamt, unsigned int funct)
+{
+    return (rs << 21) | (rt << 16) | (rd << 11) | (shamt << 6) | funct;
+}
+
+static unsigned int
+JitTestI(unsigned int op, unsigned int rs, unsigned int rt, int imm)
+{
+    return (op << 26) | (rs << 21) | (rt << 16) | (imm & 0xffff);
+}
+
+// A random instruction, as encoded in memory: a block's "first" one is
+// one the JIT translates
+static unsigned int
+JitTestInstruction(bool first)
+{
+    static const unsigned int alu[] = { 0, 2, 3, 4, 6, 7, 16, 17, 18, 19,
+					33, 35, 36, 37, 38, 39, 42, 43 };
+    static const unsigned int loads[] = { 32, 33, 35, 36, 37 };
+    static const unsigned int stores[] = { 40, 41, 43 };
+    static const unsigned int bconds[] = { 0, 1, 16, 17 };
+    unsigned int kind = RandomNumber() % 32;
+    unsigned int rs = RandomNumber() % 32;
+    unsigned int rt = RandomNumber() % 32;
+    unsigned int base = JitTestBase + RandomNumber() % JitTestBases;
+    int imm = JitTestValue();
+    int offset = 4 * (int) (RandomNumber() % 17) - 32;
+    unsigned int op;
+
+    if (RandomNumber() % 8 == 0)	// from anywhere
+	base = rs;
+    if (RandomNumber() % 8 == 0)	// unaligned, or far away
+	offset = (RandomNumber() % 2) ? offset + RandomNumber() % 4 : imm;
+
+    if (kind < 14)			// register ALU, hi and lo
+	return JitTestR(rs, rt, JitTestDest(), RandomNumber() % 32,
+			alu[RandomNumber() % (sizeof(alu) / sizeof(alu[0]))]);
+    if (kind < 16)			// addiu to lui
+	return JitTestI(9 + RandomNumber() % 7, rs, JitTestDest(), imm);
+    if (kind < 19) {			// add, sub, addi
+	switch (RandomNumber() % 3) {
+	  case 0: return JitTestR(rs, rt, JitTestDest(), 0, 32);
+	  case 1: return JitTestR(rs, rt, JitTestDest(), 0, 34);
+	  default: return JitTestI(8, rs, JitTestDest(), imm);
+	}
+    }
+    if (kind < 21) {			// mult, multu, div, divu
+	op = 24 + RandomNumber() % 4;
+	if (op == 26)			// never INT_MIN / -1, which traps
+	    rt = (RandomNumber() % 2) ? 0 :	// on the host
+			JitTestBase + RandomNumber() % JitTestBases;
+	return JitTestR(rs, rt, 0, 0, op);
+    }
+    if (kind < 26)			// lb, lh, lw, lbu, lhu
+	return JitTestI(loads[RandomNumber() % 5], base, JitTestDest(), offset);
+    if (kind < 30)			// sb, sh, sw
+	return JitTestI(stores[RandomNumber() % 3], base, rt, offset);
+    if (kind == 30 || first) {		// branches and jumps
+	switch (RandomNumber() % 5) {
+	  case 0:			// beq, bne, blez, bgtz
+	    op = 4 + RandomNumber() % 4;
+	    return JitTestI(op, rs, (op < 6) ? rt : 0, imm);
+	  case 1:			// bltz, bgez, bltzal, bgezal
+	    return JitTestI(1, rs, bconds[RandomNumber() % 4], imm);
+	  case 2:			// j, jal
+	    return ((2 + RandomNumber() % 2) << 26)
+			| (((RandomNumber() << 16) ^ RandomNumber()) & 0x3ffffff);
+	  case 3:			// jr
+	    return JitTestR(rs, 0, 0, 0, 8);
+	  default:			// jalr
+	    return JitTestR(rs, 0, JitTestDest(), 0, 9);
+	}
+    }
+    if (RandomNumber() % 2)		// lwl, or syscall: interpreted
+	return JitTestI(34, base, JitTestDest(), offset);
+    return 12;
+}
+
+void
+Machine::JitSelfTest()
+{
+    TranslationEntry entries[JitTestPages], initial[JitTestPages];
+    TranslationEntry translatedEntries[JitTestPages];
+    TranslationEntry *savedPageTable = pageTable;
+    unsigned int savedPageTableSize = pageTableSize;
+    Tlb *savedTlb = tlb;
+    Jit *savedJit = jit;
+    int savedRegisters[NumTotalRegs];
+    char savedPages[(JitTestPages - 1) * PageSize];
+    int savedTotalTicks = kernel->stats->totalTicks;
+    int savedUserTicks = kernel->stats->userTicks;
+    int savedQuietTicks = quietTicks;
+    int savedUnticked = untickedInstructions;
+    int start[NumTotalRegs], translated[NumTotalRegs];
+    char data[JitTestData], translatedData[JitTestData];
+    ExceptionType translatedException;
+    unsigned int words[PageSize / 4];
+    int physAddr, steps, interpretedSteps, length, ticks;
+    int blocks = 0, faults = 0, mismatches = 0;
+
+    if (jit == NULL) {
+	cout << "JIT self test skipped: run it with -jit, on x86-64\n";
+	return;
+    }
+    ASSERT(NumPhysPages >= JitTestPages - 1);
+    memcpy(savedRegisters, registers, sizeof(registers));
+    memcpy(savedPages, mainMemory, sizeof(savedPages));
+    for (int i = 0; i < JitTestPages; i++) {
+	initial[i].virtualPage = i;
+	initial[i].physicalPage = (i < JitTestPages - 1) ? i : 0;
+	initial[i].valid = (i < JitTestPages - 1);
+	initial[i].readOnly = FALSE;
+	initial[i].use = FALSE;
+	initial[i].dirty = FALSE;
+    }
+    pageTable = entries;
+    pageTableSize = JitTestPages;
+    tlb = NULL;
+    recordExceptions = TRUE;
+
+    for (int run = 0; run < JitTestRuns && mismatches == 0; run++) {
+	JitBlock *block = NULL;
+
+	initial[0].readOnly = (run % 4 != 0);	// or blocks write themselves
+	for (int i = 0; i < PageSize / 4; i++) {
+	    words[i] = JitTestInstruction(i == 0);
+	    *(unsigned int *) &mainMemory[4 * i] = WordToMachine(words[i]);
+	}
+	InvalidateDecoded(0, PageSize);
+	for (int i = 0; i < JitTestData; i++)
+	    data[i] = RandomNumber();
+	for (int r = 0; r < NumTotalRegs; r++)
+	    start[r] = JitTestValue();
+	for (int r = JitTestBase; r < JitTestBase + JitTestBases; r++)
+	    start[r] = PageSize + 4 * (RandomNumber() % (JitTestData / 4));
+	start[0] = 0;
+	start[PCReg] = 0;
+	start[NextPCReg] = 4;
+	start[LoadReg] = (RandomNumber() % 2) ? JitTestDest() : 0;
+
+	for (int tries = 0; block == NULL && tries <= JitHotCount; tries++)
+	    block = jit->Enter(0, DecodedAt(0), PageSize / 4);
+	if (block == NULL)
+	    continue;			// no block starts with this one
+	length = block->length;
+	blocks++;
+
+	// Translated, fetching the first as OneInstruction does...
+	memcpy(registers, start, sizeof(registers));
+	memcpy(&mainMemory[PageSize], data, JitTestData);
+	memcpy(entries, initial, sizeof(entries));
+	FlushHostPages();
+	recordedException = NoException;
+	untickedInstructions = 0;
+	quietTicks = JitMaxRun;
+	ticks = kernel->stats->userTicks;
+	ASSERT(Translate(0, &physAddr, 4, FALSE) == NoException);
+	ASSERT(RunTranslated(physAddr));
+	steps = (kernel->stats->userTicks - ticks) / UserTick
+			+ untickedInstructions + 1;
+	memcpy(translated, registers, sizeof(registers));
+	memcpy(translatedData, &mainMemory[PageSize], JitTestData);
+	memcpy(translatedEntries, entries, sizeof(entries));
+	translatedException = recordedException;
+
+	// ... and one instruction at a time, up to where a block stops
+	for (int i = 0; i < PageSize / 4; i++)
+	    *(unsigned int *) &mainMemory[4 * i] = WordToMachine(words[i]);
+	InvalidateDecoded(0, PageSize);
+	memcpy(registers, start, sizeof(registers));
+	memcpy(&mainMemory[PageSize], data, JitTestData);
+	memcpy(entries, initial, sizeof(entries));
+	FlushHostPages();
+	recordedException = NoException;
+	jit = NULL;
+	for (interpretedSteps = 0; interpretedSteps < length
+		&& recordedException == NoException; ) {
+	    OneInstruction();
+	    interpretedSteps++;
+	    if (!pageDecoded[0])
+		break;			// it wrote its own page
+	}
+	jit = savedJit;
+
+	for (int r = 0; r < NumTotalRegs; r++)
+	    if (translated[r] != registers[r]) {
+		cout << "JIT self test: register " << r << " is "
+		     << translated[r] << ", not " << registers[r] << "\n";
+		mismatches++;
+	    }
+	if (memcmp(translatedData, &mainMemory[PageSize], JitTestData) != 0) {
+	    cout << "JIT self test: the data pages differ\n";
+	    mismatches++;
+	}
+	for (int i = 0; i < JitTestPages; i++)
+	    if (translatedEntries[i].use != entries[i].use
+			|| translatedEntries[i].dirty != entries[i].dirty) {
+		cout << "JIT self test: the bits of page " << i << " differ\n";
+		mismatches++;
+	    }
+	if (translatedException != recordedException
+			|| steps != interpretedSteps) {
+	    cout << "JIT self test: exception " << translatedException
+		 << " after " << steps << " instructions, not "
+		 << recordedException << " after " << interpretedSteps
+		 << "\n";
+	    mismatches++;
+	}
+	if (mismatches > 0) {
+	    cout << "JIT self test: in run " << run << ", block of "
+		 << length << ", with r" << start[LoadReg] << " pending:\n";
+	    for (int i = 0; i < length; i++)
+		cout << "\t" << hex << words[i] << dec << "\n";
+	}
+	if (recordedException != NoException)
+	    faults++;
+    }
+
+    memcpy(mainMemory, savedPages, sizeof(savedPages));
+    InvalidateDecoded(0, sizeof(savedPages));
+    memcpy(registers, savedRegisters, sizeof(registers));
+    pageTable = savedPageTable;
+    pageTableSize = savedPageTableSize;
+    tlb = savedTlb;
+    FlushHostPages();
+    recordExceptions = FALSE;
+    kernel->stats->totalTicks = savedTotalTicks;
+    kernel->stats->userTicks = savedUserTicks;
+    quietTicks = savedQuietTicks;
+    untickedInstructions = savedUnticked;
+
+    ASSERT(mismatches == 0);
+    cout << "JIT self test passed: " << blocks << " random blocks matched "
+	 << "the interpreter, " << faults << " of them up to an exception\n";
+}
+
 //----------------------------------------------------------------------
 // Instruction::Decode
 // 	Decode a MIPS instruction 
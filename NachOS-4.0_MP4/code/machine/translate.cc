@@ -21,7 +21,8 @@
 //	anything at all about that.
 //
 //	Note that the contents of the TLB are specific to an address space.
-//	If the address space changes, so does the contents of the TLB!
+//	Each entry is tagged with the id of its address space, so that
+//	the TLB need not be flushed when the address space changes.
 //
 // DO NOT CHANGE -- part of the machine emulation
 //
@@ -31,6 +32,7 @@
 
 #include "copyright.h"
 #include "main.h"
+#include "jit.h"
 
 // Routines for converting Words and Short Words to and from the
 // simulated machine's format of little endian.  These end up
@@ -84,31 +86,56 @@ ShortToMachine(unsigned short shortword) { return ShortToHost(shortword); }
 
 bool
 Machine::ReadMem(int addr, int size, int *value)
+{
+    ExceptionType exception = TryReadMem(addr, size, value);
+
+    if (exception != NoException) {
+	RaiseException(exception, addr);
+	return FALSE;
+    }
+    return TRUE;
+}
+
+//----------------------------------------------------------------------
+// Machine::TryReadMem
+//      Do the work of ReadMem, but return the exception, if the
+//	translation fails, instead of raising it.
+//----------------------------------------------------------------------
+
+ExceptionType
+Machine::TryReadMem(int addr, int size, int *value)
 {
     int data;
     ExceptionType exception;
     int physicalAddress;
+    int vpn = (unsigned) addr / PageSize;
+    HostPage *cached = &hostPages[vpn % HostPageCacheSize];
+    char *where;
     
-    DEBUG(dbgAddr, "Reading VA " << addr << ", size " << size);
+    if (cached->virtualPage == vpn && (addr & (size - 1)) == 0) {
+	where = &cached->memory[(unsigned) addr % PageSize];
+    } else {
+	DEBUG(dbgAddr, "Reading VA " << addr << ", size " << size);
     
-    exception = Translate(addr, &physicalAddress, size, FALSE);
-    if (exception != NoException) {
-	RaiseException(exception, addr);
-	return FALSE;
+	exception = Translate(addr, &physicalAddress, size, FALSE);
+	if (exception != NoException)
+	    return exception;
+	CacheHostPage(addr, physicalAddress);
+	where = &mainMemory[physicalAddress];
     }
     switch (size) {
       case 1:
-	data = mainMemory[physicalAddress];
+	data = *where;
 	*value = data;
 	break;
 	
       case 2:
-	data = *(unsigned short *) &mainMemory[physicalAddress];
+	data = *(unsigned short *) where;
 	*value = ShortToHost(data);
 	break;
 	
       case 4:
-	data = *(unsigned int *) &mainMemory[physicalAddress];
+	data = *(unsigned int *) where;
 	*value = WordToHost(data);
 	break;
 
@@ -116,7 +143,7 @@ Machine::ReadMem(int addr, int size, int *value)
     }
     
     DEBUG(dbgAddr, "\tvalue read = " << *value);
-    return (TRUE);
+    return NoException;
 }
 
 //----------------------------------------------------------------------
@@ -135,35 +162,106 @@ Machine::ReadMem(int addr, int size, int *value)
 bool
 Machine::WriteMem(int addr, int size, int value)
 {
-    ExceptionType exception;
-    int physicalAddress;
-     
-    DEBUG(dbgAddr, "Writing VA " << addr << ", size " << size << ", value " << value);
+    ExceptionType exception = TryWriteMem(addr, size, value);
 
-    exception = Translate(addr, &physicalAddress, size, TRUE);
     if (exception != NoException) {
 	RaiseException(exception, addr);
 	return FALSE;
     }
+    return TRUE;
+}
+
+//----------------------------------------------------------------------
+// Machine::TryWriteMem
+//      Do the work of WriteMem, but return the exception, if the
+//	translation fails, instead of raising it.
+//----------------------------------------------------------------------
+
+ExceptionType
+Machine::TryWriteMem(int addr, int size, int value)
+{
+    ExceptionType exception;
+    int physicalAddress;
+    int vpn = (unsigned) addr / PageSize;
+    HostPage *cached = &hostPages[vpn % HostPageCacheSize];
+    char *where;
+     
+    if (cached->virtualPage == vpn && cached->writable
+		&& (addr & (size - 1)) == 0) {
+	where = &cached->memory[(unsigned) addr % PageSize];
+	physicalAddress = where - mainMemory;
+    } else {
+	DEBUG(dbgAddr, "Writing VA " << addr << ", size " << size << ", value " << value);
+
+	exception = Translate(addr, &physicalAddress, size, TRUE);
+	if (exception != NoException)
+	    return exception;
+	CacheHostPage(addr, physicalAddress);
+	where = &mainMemory[physicalAddress];
+    }
     switch (size) {
       case 1:
-	mainMemory[physicalAddress] = (unsigned char) (value & 0xff);
+	*where = (unsigned char) (value & 0xff);
 	break;
 
       case 2:
-	*(unsigned short *) &mainMemory[physicalAddress]
+	*(unsigned short *) where
 		= ShortToMachine((unsigned short) (value & 0xffff));
 	break;
       
       case 4:
-	*(unsigned int *) &mainMemory[physicalAddress]
+	*(unsigned int *) where
 		= WordToMachine((unsigned int) value);
 	break;
 	
       default: ASSERT(FALSE);
     }
+    pageDecoded[physicalAddress / PageSize] = FALSE;	// it may be code
+    if (jit != NULL)
+	jit->InvalidatePage(physicalAddress / PageSize);
     
-    return TRUE;
+    return NoException;
+}
+
+//----------------------------------------------------------------------
+// Machine::CacheHostPage
+// 	Translate just translated "virtAddr" into "physAddr" through the
+//	page table, setting its use bit (and dirty bit, on a write): cache
+//	where the page is in main memory, so that ReadMem and WriteMem can
+//	skip Translate on the next access to it.  The page may only be
+//	written through the cache once its dirty bit is set.
+//
+//	Nothing is cached when translating through a TLB, which must see
+//	(and count) every access, or while tracing translations with the
+//	'a' debug flag.
+//----------------------------------------------------------------------
+
+void
+Machine::CacheHostPage(int virtAddr, int physAddr)
+{
+    int vpn = (unsigned) virtAddr / PageSize;
+    HostPage *cached = &hostPages[vpn % HostPageCacheSize];
+
+    if (tlb != NULL || debug->IsEnabled(dbgAddr))
+	return;
+    cached->virtualPage = vpn;
+    cached->memory = &mainMemory[physAddr - (unsigned) virtAddr % PageSize];
+    cached->writable = pageTable[vpn].dirty && !pageTable[vpn].readOnly;
+}
+
+//----------------------------------------------------------------------
+// Machine::FlushHostPages
+// 	Forget every translation cached by CacheHostPage.  The kernel
+//	must call this whenever it switches page tables, or changes an
+//	entry of the current one -- in particular, clears its valid, use
+//	or dirty bit.
+//----------------------------------------------------------------------
+
+void
+Machine::FlushHostPages()
+{
+    for (int i = 0; i < HostPageCacheSize; i++)
+	hostPages[i].virtualPage = -1;
 }
 
 //----------------------------------------------------------------------
@@ -184,7 +282,6 @@ Machine::WriteMem(int addr, int size, int value)
 ExceptionType
 Machine::Translate(int virtAddr, int* physAddr, int size, bool writing)
 {
-    int i;
     unsigned int vpn, offset;
     TranslationEntry *entry;
     unsigned int pageFrame;
@@ -215,11 +312,7 @@ Machine::Translate(int virtAddr, int* physAddr, int size, bool writing)
 	}
 	entry = &pageTable[vpn];
     } else {
-        for (entry = NULL, i = 0; i < TLBSize; i++)
-    	    if (tlb[i].valid && (tlb[i].virtualPage == ((int)vpn))) {
-		entry = &tlb[i];			// FOUND!
-		break;
-	    }
+	entry = tlb->Lookup(vpn);
 	if (entry == NULL) {				// not found
     	    DEBUG(dbgAddr, "Invalid TLB entry for this virtual page!");
     	    return PageFaultException;		// really, this is a TLB fault,
@@ -236,7 +329,7 @@ Machine::Translate(int virtAddr, int* physAddr, int size, bool writing)
 
     // if the pageFrame is too big, there is something really wrong! 
     // An invalid translation was loaded into the page table or TLB. 
-    if (pageFrame >= NumPhysPages) { 
+    if (pageFrame >= (unsigned) NumPhysPages) { 
 	DEBUG(dbgAddr, "Illegal pageframe " << pageFrame);
 	return BusErrorException;
     }
@@ -248,3 +341,195 @@ Machine::Translate(int virtAddr, int* physAddr, int size, bool writing)
     DEBUG(dbgAddr, "phys addr = " << *physAddr);
     return NoException;
 }
+
+static char *policyNames[] = { "random", "fifo", "lru", "clock" };
+
+//----------------------------------------------------------------------
+// Tlb::Tlb
+// 	Initialize an empty TLB of "size" entries, in sets of "ways"
+//	entries, replacing them by "policy".
+//----------------------------------------------------------------------
+
+Tlb::Tlb(int size, int ways, TlbPolicy policy)
+{
+    ASSERT(size > 0 && ways >= 2 && size % ways == 0);
+    this->size = size;
+    this->ways = ways;
+    this->policy = policy;
+    numSets = size / ways;
+    entries = new TlbEntry[size];
+    for (int i = 0; i < size; i++)
+	entries[i].translation = NULL;
+    hands = new int[numSets];
+    for (int i = 0; i < numSets; i++)
+	hands[i] = 0;
+    asid = 0;
+    now = 0;
+    lastHit = NULL;
+    hits = misses = refills = evictions = 0;
+}
+
+//----------------------------------------------------------------------
+// Tlb::~Tlb
+//----------------------------------------------------------------------
+
+Tlb::~Tlb()
+{
+    delete [] entries;
+    delete [] hands;
+}
+
+//----------------------------------------------------------------------
+// Tlb::Lookup
+// 	Search the set of page "vpn" for its translation in the current
+//	address space.  An entry whose page table entry was made invalid
+//	since it was loaded is dropped, and the lookup misses.
+//----------------------------------------------------------------------
+
+TranslationEntry *
+Tlb::Lookup(int vpn)
+{
+    TlbEntry *set = &entries[(vpn % numSets) * ways];
+
+    now++;
+    for (int i = 0; i < ways; i++) {
+	TlbEntry *entry = &set[i];
+
+	if (entry->translation == NULL || entry->virtualPage != vpn
+		|| entry->asid != asid)
+	    continue;
+	if (!entry->translation->valid) {
+	    entry->translation = NULL;
+	    break;
+	}
+	hits++;
+	entry->used = now;
+	entry->referenced = TRUE;
+	lastHit = entry;
+	return entry->translation;
+    }
+    misses++;
+    return NULL;
+}
+
+//----------------------------------------------------------------------
+// Tlb::Refill
+// 	Load "translation" as that of page "vpn" of the current address
+//	space, into an unused entry of its set if there is one, and
+//	otherwise into the one the replacement policy picks among the
+//	others than the entry of the last hit -- most likely the page
+//	the faulting instruction was fetched from, which it needs again
+//	when it is restarted.
+//----------------------------------------------------------------------
+
+void
+Tlb::Refill(int vpn, TranslationEntry *translation)
+{
+    int setNum = vpn % numSets;
+    TlbEntry *set = &entries[setNum * ways];
+    int victim = -1;
+
+    for (int i = 0; i < ways && victim < 0; i++)
+	if (set[i].translation == NULL)
+	    victim = i;
+    if (victim < 0) {
+	switch (policy) {
+	  case TlbRandom:
+	    victim = RandomNumber() % ways;
+	    if (&set[victim] == lastHit)
+		victim = (victim + 1) % ways;
+	    break;
+	  case TlbFifo:
+	  case TlbLru:
+	    for (int i = 0; i < ways; i++) {
+		if (&set[i] == lastHit)
+		    continue;
+		long long age = (policy == TlbFifo) ? set[i].loaded
+						    : set[i].used;
+		if (victim < 0 || age < ((policy == TlbFifo)
+			? set[victim].loaded : set[victim].used))
+		    victim = i;
+	    }
+	    break;
+	  case TlbClock:
+	    while (set[hands[setNum]].referenced
+		    || &set[hands[setNum]] == lastHit) {
+		set[hands[setNum]].referenced = FALSE;
+		hands[setNum] = (hands[setNum] + 1) % ways;
+	    }
+	    victim = hands[setNum];
+	    hands[setNum] = (hands[setNum] + 1) % ways;
+	    break;
+	}
+	evictions++;
+    }
+    DEBUG(dbgAddr, "TLB refill of page " << vpn << " into set " << setNum
+	  << ", way " << victim);
+    set[victim].asid = asid;
+    set[victim].virtualPage = vpn;
+    set[victim].translation = translation;
+    set[victim].loaded = set[victim].used = now;
+    set[victim].referenced = TRUE;
+    refills++;
+}
+
+//----------------------------------------------------------------------
+// Tlb::SetAsid
+// 	Translate for address space "asid" from now on.  The entries of
+//	the others stay, for when they run again.
+//----------------------------------------------------------------------
+
+void
+Tlb::SetAsid(int asid)
+{
+    this->asid = asid;
+}
+
+//----------------------------------------------------------------------
+// Tlb::FlushAsid
+// 	Address space "asid" is going away: drop its entries, which point
+//	into its page table.
+//----------------------------------------------------------------------
+
+void
+Tlb::FlushAsid(int asid)
+{
+    for (int i = 0; i < size; i++)
+	if (entries[i].asid == asid)
+	    entries[i].translation = NULL;
+}
+
+//----------------------------------------------------------------------
+// Tlb::Print
+// 	Print the configuration of the TLB, and how it did.
+//----------------------------------------------------------------------
+
+void
+Tlb::Print()
+{
+    long long lookups = hits + misses;
+
+    cout << "TLB: " << size << " entries, " << ways << "-way, "
+	 << policyNames[policy] << " replacement\n";
+    cout << "TLB: lookups " << lookups << ", hits " << hits << ", misses "
+	 << misses << " (hit rate "
+	 << ((lookups > 0) ? hits * 100.0 / lookups : 0.0) << "%)\n";
+    cout << "TLB: refills " << refills << ", evictions " << evictions << "\n";
+}
+
+//----------------------------------------------------------------------
+// Tlb::ParsePolicy
+// 	Set "policy" to the replacement policy called "name" -- "random",
+//	"fifo", "lru", or "clock".  Return FALSE if there is no such policy.
+//----------------------------------------------------------------------
+
+bool
+Tlb::ParsePolicy(char *name, TlbPolicy *policy)
+{
+    for (int i = TlbRandom; i <= TlbClock; i++)
+	if (strcmp(name, policyNames[i]) == 0) {
+	    *policy = (TlbPolicy) i;
+	    return TRUE;
+	}
+    return FALSE;
+}
@@ -42,4 +42,82 @@ class TranslationEntry {
 			// page is modified.
 };
 
+// The policies a TLB can use to pick which entry of a full set a
+// refill replaces
+
+enum TlbPolicy { TlbRandom,	// any entry
+		 TlbFifo,	// the one loaded first
+		 TlbLru,	// the one used least recently
+		 TlbClock	// the next one not used since the clock
+				// hand last passed it
+};
+
+// The following class defines an entry of the TLB: the translation of
+// a virtual page of one address space.  It points at the page table
+// entry it caches, so the use and dirty bits are set there directly,
+// and clearing the valid bit there drops the entry too.
+
+class TlbEntry {
+  public:
+    int asid;			// the address space the page is in
+    int virtualPage;		// the page
+    TranslationEntry *translation;	// its page table entry, or NULL if
+				// this TLB entry is unused
+    long long loaded;		// when the entry was loaded, and
+    long long used;		// last used, for TlbFifo and TlbLru
+    bool referenced;		// used since the clock hand passed it
+};
+
+// The following class defines a software-loaded TLB of "size" entries,
+// split into sets of "ways" entries.  A page can only be cached in one
+// set; a fully associative TLB is the special case of a single set.
+// Entries are tagged with
+// the id of their address space, so switching address spaces needs no
+// flush.
+//
+// The TLB counts its hits, misses, refills, and evictions, to measure
+// how well a configuration does for a workload.
+//
+// An instruction may need two pages at once, the one it is fetched
+// from and the one it loads or stores, so a set needs at least two
+// ways: a refill never evicts the entry of the last hit, or the two
+// pages could keep evicting each other and the instruction never
+// complete.
+
+class Tlb {
+  public:
+    Tlb(int size, int ways, TlbPolicy policy);
+				// Initialize an empty TLB; "ways"
+				// must be at least 2
+    ~Tlb();
+
+    TranslationEntry *Lookup(int vpn);
+				// The translation of page "vpn" of the
+				// current address space, or NULL on a miss
+    void Refill(int vpn, TranslationEntry *translation);
+				// Load "translation" as that of page "vpn"
+				// of the current address space
+    void SetAsid(int asid);	// Switch to address space "asid"
+    void FlushAsid(int asid);	// Drop the entries of address space "asid"
+
+    void Print();		// Print the configuration and counters
+
+    static bool ParsePolicy(char *name, TlbPolicy *policy);
+				// The policy called "name"; FALSE if none
+
+  private:
+    TlbEntry *entries;		// the entries, set after set
+    int size;			// number of entries
+    int ways;			// entries in each set
+    int numSets;		// number of sets
+    TlbPolicy policy;		// how to pick an entry to replace
+    int *hands;			// each set's clock hand, for TlbClock
+    int asid;			// the current address space
+    long long now;		// counts lookups, to order them
+    TlbEntry *lastHit;		// entry of the last hit, kept by Refill
+
+    long long hits, misses, refills, evictions;
+				// how the TLB did so far
+};
+
 #endif
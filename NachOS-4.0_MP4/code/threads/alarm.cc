@@ -11,6 +11,7 @@
 #include "copyright.h"
 #include "alarm.h"
 #include "main.h"
+#include "cpu.h"
 
 //----------------------------------------------------------------------
 // Alarm::Alarm
@@ -41,6 +42,9 @@ Alarm::Alarm(bool doRandom)
 //
 //	For now, just provide time-slicing.  Only need to time slice 
 //      if we're currently running something (in other words, not idle).
+//
+//	On a multiprocessor, the timer interrupts every CPU, so the
+//	others get time-sliced as well.
 //----------------------------------------------------------------------
 
 void 
@@ -52,4 +56,8 @@ Alarm::CallBack()
     if (status != IdleMode) {
 	interrupt->YieldOnReturn();
     }
+    for (int i = 0; i < kernel->numCpus; i++) {
+	if (kernel->cpus[i]->interrupt != interrupt)
+	    kernel->cpus[i]->interrupt->Preempt();
+    }
 }
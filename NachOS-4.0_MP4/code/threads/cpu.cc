@@ -0,0 +1,170 @@
+// cpu.cc
+//	Routines to simulate the CPUs of a shared-memory multiprocessor,
+//	and the kernel lock that serializes them (see cpu.h).
+//
+// Copyright (c) 1992-1996 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#include "copyright.h"
+#include "cpu.h"
+#include "main.h"
+#include "sysdep.h"
+
+// The kernel lock, and how the CPUs share it.  These belong to no
+// object, so that a CPU still spinning on the lock when Nachos halts
+// (and deletes the kernel) keeps spinning on memory that is there.
+static int numCpus = 1;
+static bool inTurn = FALSE;		// take the lock round robin
+static volatile int lockHeld = 1;	// CPU 0 starts in the kernel
+static volatile int lockTurn = 0;	// round robin: who may take it
+
+//----------------------------------------------------------------------
+// Cpu::Cpu
+// 	Initialize a simulated CPU.
+//
+//	"cpuId" is the CPU's number; CPU 0 is the one Nachos starts on,
+//		holding the kernel lock.
+//	"mach" is the machine it simulates.
+//	"intr" is its interrupt state.
+//----------------------------------------------------------------------
+
+Cpu::Cpu(int cpuId, Machine *mach, Interrupt *intr)
+{
+    id = cpuId;
+    machine = mach;
+    interrupt = intr;
+    currentThread = NULL;
+    inKernel = (id == 0);	// the others enter once they start,
+    idle = (id != 0);		// and have nothing to do until then
+    machine->cpu = this;
+}
+
+//----------------------------------------------------------------------
+// Cpu::~Cpu
+// 	De-allocate a CPU.  Its machine and interrupt state are the
+//	kernel's to delete.
+//----------------------------------------------------------------------
+
+Cpu::~Cpu()
+{
+}
+
+//----------------------------------------------------------------------
+// Cpu::Configure
+// 	Set up the kernel lock for "cpus" CPUs, taken round robin if
+//	"deterministic".  Called once, before any CPU but 0 starts.
+//----------------------------------------------------------------------
+
+void
+Cpu::Configure(int cpus, bool deterministic)
+{
+    numCpus = cpus;
+    inTurn = deterministic;
+}
+
+//----------------------------------------------------------------------
+// Cpu::Enter
+// 	Enter the kernel from user mode: to take an exception, or to
+//	let an interrupt in.  With one CPU, there is no lock to take.
+//
+//	Returns FALSE if this CPU is in the kernel already -- as when
+//	the kernel itself touches user memory that is not in the TLB --
+//	in which case the caller must not Leave.
+//----------------------------------------------------------------------
+
+bool
+Cpu::Enter()
+{
+    if (inKernel)
+	return FALSE;
+    inKernel = TRUE;
+    if (numCpus > 1) {
+	Acquire();
+	Install();
+    }
+    return TRUE;
+}
+
+//----------------------------------------------------------------------
+// Cpu::Leave
+// 	Go back to running user instructions: save what the kernel
+//	globals say about this CPU, and release the kernel lock.
+//----------------------------------------------------------------------
+
+void
+Cpu::Leave()
+{
+    ASSERT(inKernel);
+    if (numCpus > 1)
+	currentThread = kernel->currentThread;
+    inKernel = FALSE;
+    if (numCpus > 1)
+	Release();
+}
+
+//----------------------------------------------------------------------
+// Cpu::WaitForWork
+// 	Called by Interrupt::Idle when this CPU has nothing to run, but
+//	other CPUs are still busy and may make something ready for it.
+//	Let them have the kernel lock for a while, then take it back.
+//----------------------------------------------------------------------
+
+void
+Cpu::WaitForWork()
+{
+    currentThread = kernel->currentThread;
+    idle = TRUE;
+    Release();
+    YieldHost();
+    Acquire();
+    Install();
+}
+
+//----------------------------------------------------------------------
+// Cpu::Acquire, Cpu::Release
+// 	Take and give up the kernel lock: either a test-and-set spin
+//	lock, or, in deterministic mode, a turn that goes round the CPUs.
+//----------------------------------------------------------------------
+
+void
+Cpu::Acquire()
+{
+    int me = id;		// the Cpu is not read while spinning: it
+				// is deleted if Nachos halts meanwhile
+
+    if (inTurn) {
+	while (lockTurn != me)
+	    YieldHost();
+	MemoryBarrier();
+    } else {
+	while (TestAndSet(&lockHeld))
+	    YieldHost();
+    }
+}
+
+void
+Cpu::Release()
+{
+    if (inTurn) {
+	MemoryBarrier();
+	lockTurn = (id + 1) % numCpus;
+    } else {
+	ClearWord(&lockHeld);
+    }
+}
+
+//----------------------------------------------------------------------
+// Cpu::Install
+// 	This CPU now holds the kernel lock, and is no longer idle:
+//	point the kernel globals at its state.
+//----------------------------------------------------------------------
+
+void
+Cpu::Install()
+{
+    idle = FALSE;
+    kernel->currentThread = currentThread;
+    kernel->machine = machine;
+    kernel->interrupt = interrupt;
+}
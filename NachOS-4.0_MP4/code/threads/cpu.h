@@ -0,0 +1,81 @@
+// cpu.h
+//	Data structures for simulating a shared-memory multiprocessor.
+//
+//	With "-smp", Nachos runs several simulated CPUs, each on a host
+//	thread of its own.  Every CPU has its own Machine (registers,
+//	TLB, interpreter) over the one physical memory they share, its
+//	own interrupt state, and its own ready list.  A thread stays on
+//	the CPU it is first scheduled on: once it runs a user program,
+//	its stack holds that CPU's interpreter loop.
+//
+//	The kernel itself is not multiprocessor safe, so it runs under a
+//	single spin lock, the kernel lock, which a CPU holds whenever it
+//	is not executing user instructions.  The CPU holding it has its
+//	state installed in the kernel globals (kernel->currentThread,
+//	kernel->machine, kernel->interrupt), so the rest of the kernel
+//	runs as it always has.  Simulated time is one clock, which every
+//	CPU advances by the instructions it runs.
+//
+//	In deterministic mode, the CPUs take the kernel lock in turn,
+//	round robin, instead of whenever they get to it first.  Each CPU
+//	only touches shared state while it holds the lock, so every run
+//	of the same programs does the same things at the same simulated
+//	times, however the host schedules its threads.
+//
+// Copyright (c) 1992-1996 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#ifndef CPU_H
+#define CPU_H
+
+#include "copyright.h"
+#include "utility.h"
+
+class Machine;
+class Interrupt;
+class Thread;
+
+// The following class defines one simulated CPU.
+class Cpu {
+  public:
+    Cpu(int cpuId, Machine *mach, Interrupt *intr);
+				// Initialize a CPU that runs "mach",
+				// interrupted through "intr"
+    ~Cpu();
+
+    static void Configure(int cpus, bool deterministic);
+				// Set how many CPUs there are, and how
+				// they share the kernel lock
+
+    bool Enter();		// Take the kernel lock, coming from user
+				// mode.  FALSE if this CPU is in the
+				// kernel already, and needn't leave it
+    void Leave();		// Release the kernel lock, going back to
+				// user mode
+    void WaitForWork();		// Nothing to run: release the kernel
+				// lock for a while, so that other CPUs
+				// can make something ready
+
+    int getId() { return id; }
+    bool InKernel() { return inKernel; }
+    bool IsIdle() { return idle; }
+
+    Machine *machine;		// this CPU's registers, TLB, interpreter
+    Interrupt *interrupt;	// this CPU's interrupt level and mode
+    Thread *currentThread;	// the thread this CPU runs, saved here
+				// while another CPU holds the kernel lock
+
+  private:
+    int id;			// this CPU's number, from 0
+    volatile bool inKernel;	// TRUE unless executing user instructions
+				// (or not started yet)
+    bool idle;			// TRUE while in WaitForWork, or not
+				// started yet
+
+    void Acquire();		// take the kernel lock
+    void Release();		// give it up
+    void Install();		// make this CPU's state the kernel's
+};
+
+#endif // CPU_H
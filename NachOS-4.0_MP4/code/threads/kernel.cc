@@ -17,6 +17,7 @@
 #include "synchdisk.h"
 #include "post.h"
 #include "synchconsole.h"
+#include "cpu.h"
 
 //----------------------------------------------------------------------
 // Kernel::Kernel
@@ -28,6 +29,14 @@ Kernel::Kernel(int argc, char **argv)
 {
     randomSlice = FALSE; 
     debugUserProg = FALSE;
+    threadedDispatch = FALSE;
+    translateCode = FALSE;
+    tlbSize = 0;
+    numCpus = 1;
+    cpusInTurn = FALSE;
+    checkpointFile = NULL;
+    checkpointTicks = 0;
+    restoreFile = NULL;
     consoleIn = NULL;          // default is stdin
     consoleOut = NULL;         // default is stdout
 #ifndef FILESYS_STUB
@@ -49,6 +58,57 @@ Kernel::Kernel(int argc, char **argv)
 	    	i++;
         } else if (strcmp(argv[i], "-s") == 0) {
             debugUserProg = TRUE;
+        } else if (strcmp(argv[i], "-sim") == 0) {
+	    	ASSERT(i + 1 < argc);
+	    	threadedDispatch = (strcmp(argv[i + 1], "threaded") == 0);
+	    	i++;
+        } else if (strcmp(argv[i], "-jit") == 0) {
+	    	translateCode = TRUE;
+        } else if (strcmp(argv[i], "-mem") == 0) {
+	    	ASSERT(i + 1 < argc);
+	    	{
+	    	char *end;
+	    	// (strtol, unlike atoi, gives LONG_MAX for too big a number)
+	    	long pages = strtol(argv[i + 1], &end, 10);
+	    	if (*end != '\0' || pages <= 0 || pages > MaxPhysPages) {
+			cerr << "Usage: -mem <pages of physical memory, 1 to "
+			     << MaxPhysPages << ">\n";
+			Exit(1);
+	    	}
+	    	NumPhysPages = (int) pages;
+	    	}
+	    	i++;
+        } else if (strcmp(argv[i], "-tlb") == 0) {
+	    	ASSERT(i + 3 < argc);
+	    	tlbSize = atoi(argv[i + 1]);
+	    	tlbWays = atoi(argv[i + 2]);
+	    	// (one way lets an instruction's two pages evict each other)
+	    	if (tlbSize <= 0 || tlbWays < 2 || tlbSize % tlbWays != 0
+			|| !Tlb::ParsePolicy(argv[i + 3], &tlbPolicy)) {
+			cerr << "Usage: -tlb <entries> <ways, 2 or more> "
+			     << "<random|fifo|lru|clock>\n";
+			Exit(1);
+	    	}
+	    	i += 3;
+        } else if (strcmp(argv[i], "-smp") == 0) {
+	    	ASSERT(i + 2 < argc);
+	    	numCpus = atoi(argv[i + 1]);
+	    	cpusInTurn = (strcmp(argv[i + 2], "det") == 0);
+	    	if (numCpus <= 0 || (!cpusInTurn
+			&& strcmp(argv[i + 2], "free") != 0)) {
+			cerr << "Usage: -smp <cpus> <det|free>\n";
+			Exit(1);
+	    	}
+	    	i += 2;
+        } else if (strcmp(argv[i], "-ckpt") == 0) {
+	    	ASSERT(i + 2 < argc);
+	    	checkpointFile = argv[i + 1];
+	    	checkpointTicks = atoi(argv[i + 2]);
+	    	i += 2;
+        } else if (strcmp(argv[i], "-restore") == 0) {
+	    	ASSERT(i + 1 < argc);
+	    	restoreFile = argv[i + 1];
+	    	i++;
 		} else if (strcmp(argv[i], "-e") == 0) {
         	execfile[++execfileNum]= argv[++i];
 			cout << execfile[execfileNum] << "\n";
@@ -74,7 +134,11 @@ Kernel::Kernel(int argc, char **argv)
             i++;
         } else if (strcmp(argv[i], "-u") == 0) {
             cout << "Partial usage: nachos [-rs randomSeed]\n";
-	   		cout << "Partial usage: nachos [-s]\n";
+	   		cout << "Partial usage: nachos [-s] [-sim switch|threaded] [-jit]\n";
+	   		cout << "Partial usage: nachos [-tlb entries ways policy]\n";
+	   		cout << "Partial usage: nachos [-mem pages]\n";
+	   		cout << "Partial usage: nachos [-smp cpus det|free]\n";
+	   		cout << "Partial usage: nachos [-ckpt file ticks] [-restore file]\n";
             cout << "Partial usage: nachos [-ci consoleIn] [-co consoleOut]\n";
 #ifndef FILESYS_STUB
 	    	cout << "Partial usage: nachos [-nf]\n";
@@ -82,6 +146,25 @@ Kernel::Kernel(int argc, char **argv)
             cout << "Partial usage: nachos [-n #] [-m #]\n";
 		}
     }
+    if ((checkpointFile != NULL || restoreFile != NULL) && numCpus > 1) {
+	cerr << "Checkpoints are of a single CPU: no -ckpt or -restore "
+	     << "with -smp\n";
+	Exit(1);
+    }
+}
+
+//----------------------------------------------------------------------
+// CpuBoot
+// 	What the host thread of each CPU but the first runs: enter the
+//	kernel, and idle until a thread is ready to run on this CPU.
+//	The thread doing this never runs again, so it gets deleted.
+//----------------------------------------------------------------------
+
+static void
+CpuBoot(void *cpu)
+{
+    ((Cpu *) cpu)->Enter();
+    kernel->currentThread->Finish();
 }
 
 //----------------------------------------------------------------------
@@ -104,12 +187,38 @@ Kernel::Initialize()
 
     stats = new Statistics();		// collect statistics
     interrupt = new Interrupt;		// start up interrupt handling
-    scheduler = new Scheduler();	// initialize the ready queue
+    scheduler = new Scheduler(numCpus);	// initialize the ready queues
+    scheduler->Assign(currentThread, 0);
     alarm = new Alarm(randomSlice);	// start up time slicing
-    machine = new Machine(debugUserProg);
+    if (translateCode && numCpus > 1) {	// translations are not shared
+	cerr << "No code translation with -smp; interpreting instead\n";
+	translateCode = FALSE;
+    }
+    machine = new Machine(debugUserProg, threadedDispatch, translateCode,
+		(tlbSize > 0) ? new Tlb(tlbSize, tlbWays, tlbPolicy) : NULL);
+    cpus = new Cpu *[numCpus];
+    cpus[0] = new Cpu(0, machine, interrupt);
+    for (int i = 1; i < numCpus; i++) {	// the other CPUs, if -smp
+	Machine *other = new Machine(debugUserProg, threadedDispatch, FALSE,
+		(tlbSize > 0) ? new Tlb(tlbSize, tlbWays, tlbPolicy) : NULL);
+	Interrupt *otherInterrupt = new Interrupt;
+
+	other->ShareMemory(machine);
+	otherInterrupt->SharePending(interrupt);
+	cpus[i] = new Cpu(i, other, otherInterrupt);
+	cpus[i]->currentThread = new Thread("idle", 0);
+	cpus[i]->currentThread->setStatus(RUNNING);
+	scheduler->Assign(cpus[i]->currentThread, i);
+    }
+    Cpu::Configure(numCpus, cpusInTurn);
     synchConsoleIn = new SynchConsoleInput(consoleIn); // input from stdin
     synchConsoleOut = new SynchConsoleOutput(consoleOut); // output to stdout
     synchDisk = new SynchDisk();    //
+    if (restoreFile != NULL)
+	RestoreDisk();			// before the file system reads it
+    else if (checkpointFile != NULL)
+	synchDisk->UseOverlay();	// the checkpoint is taken over the
+					// disk image as it is now
 #ifdef FILESYS_STUB
     fileSystem = new FileSystem();
 #else
@@ -123,6 +232,42 @@ Kernel::Initialize()
 	*/
 
     interrupt->Enable();
+    for (int i = 1; i < numCpus; i++)
+	StartHostThread(CpuBoot, cpus[i]);
+}
+
+//----------------------------------------------------------------------
+// Kernel::AllCpusIdle
+// 	Return TRUE if no CPU has anything to run, or is running
+//	anything that could make a thread ready: all the others are
+//	idle, and there is no thread ready to run anywhere.  Called with
+//	the current CPU out of work.
+//----------------------------------------------------------------------
+
+bool
+Kernel::AllCpusIdle()
+{
+    for (int i = 0; i < numCpus; i++) {
+	if (cpus[i]->machine != machine && !cpus[i]->IsIdle())
+	    return FALSE;
+    }
+    return !scheduler->AnyReady();
+}
+
+//----------------------------------------------------------------------
+// Kernel::StopCpus
+// 	Nachos is halting: wait until no other CPU is running user
+//	instructions.  They stop once they try to enter the kernel,
+//	since the kernel lock will never be released again.
+//----------------------------------------------------------------------
+
+void
+Kernel::StopCpus()
+{
+    for (int i = 0; i < numCpus; i++) {
+	while (!cpus[i]->InKernel())
+	    YieldHost();
+    }
 }
 
 //----------------------------------------------------------------------
@@ -146,6 +291,15 @@ Kernel::PrepareToEnd()
 
 Kernel::~Kernel()
 {
+    machine = cpus[0]->machine;		// the one whose memory the
+    interrupt = cpus[0]->interrupt;	// others share goes last
+    for (int i = 1; i < numCpus; i++) {
+	delete cpus[i]->machine;
+	delete cpus[i]->interrupt;
+	delete cpus[i];
+    }
+    delete cpus[0];
+    delete [] cpus;
     delete stats;
     delete interrupt;
     delete scheduler;
@@ -274,6 +428,11 @@ Kernel::NetworkTest() {
     // Then we're done!
 }
 
+//----------------------------------------------------------------------
+// ForkExecute
+// 	Load and run the program "t" is named after.
+//----------------------------------------------------------------------
+
 void ForkExecute(Thread *t)
 {
 	if ( !t->space->Load(t->getName()) ) {
@@ -284,8 +443,25 @@ void ForkExecute(Thread *t)
 
 }
 
+//----------------------------------------------------------------------
+// ForkResume
+// 	Go on running the user program "t" got from a checkpoint, from
+//	the instruction it had got to.
+//----------------------------------------------------------------------
+
+void ForkResume(Thread *t)
+{
+    t->RestoreUserState();
+    t->space->RestoreState();
+    kernel->machine->Run();
+
+    ASSERTNOTREACHED();
+}
+
 void Kernel::ExecAll()
 {
+	if (restoreFile != NULL)
+		Restore();
 	for (int i=1;i<=execfileNum;i++) {
 		int a = Exec(execfile[i]);
 	}
@@ -336,47 +512,234 @@ int Kernel::CreateFile(char *filename, int size)
     if(!success)    return -1;
     return 1;
 }
+int Kernel::CloneFile(char *from, char *to)
+{
+    if(!fileSystem->Clone(from, to))    return -1;
+    return 1;
+}
 OpenFileId Kernel::Open(char *name)
 {
     OpenFile* file = fileSystem->Open(name);
     if(file==NULL)  return -1;
-    else{
-        return (OpenFileId)file;
-    } 
+    return currentThread->space->openFiles->Add(file);
 }
 
 int Kernel::Write(char *buf, int size, OpenFileId id)
 {
-    OpenFile* file = (OpenFile*)id;
-    for(int i=0;i<fileSystem->top;i++){
-        if(fileSystem->fileDescriptorTable[i]==file){
-            file = fileSystem->fileDescriptorTable[i];
-            return file->Write(buf, size);
-        }
-    }
-    return -1;
+    OpenFile* file = currentThread->space->openFiles->Get(id);
+    if(file==NULL)  return -1;
+    return file->Write(buf, size);
 }
 int Kernel::Read(char *buf, int size, OpenFileId id)
 {
-    OpenFile* file = (OpenFile*)id;
-    for(int i=0;i<fileSystem->top;i++){
-        if(fileSystem->fileDescriptorTable[i]==file){
-            file = fileSystem->fileDescriptorTable[i];
-            return file->Read(buf, size);
-        }
-    }
-    return -1;
+    OpenFile* file = currentThread->space->openFiles->Get(id);
+    if(file==NULL)  return -1;
+    return file->Read(buf, size);
 }
 int Kernel::Close(OpenFileId id)
 {
-    OpenFile* file = (OpenFile*)id;
-    for(int i=0;i<fileSystem->top;i++){
-        if(fileSystem->fileDescriptorTable[i]==file){
-            fileSystem->top--;
-            //Close(file);
-            delete file;
-            return 1;
-        }
+    OpenFile* file = currentThread->space->openFiles->Remove(id);
+    if(file==NULL)  return 0;
+    currentThread->space->UnmapFile(file);
+    delete file;
+    return 1;
+}
+int Kernel::Mmap(OpenFileId id, int length)
+{
+    OpenFile* file = currentThread->space->openFiles->Get(id);
+    if(file==NULL)  return -1;
+    return currentThread->space->Mmap(file, length);
+}
+int Kernel::Munmap(int addr)
+{
+    if(!currentThread->space->Munmap(addr))    return -1;
+    return 1;
+}
+
+//----------------------------------------------------------------------
+// Checkpoints
+//	"-ckpt" saves the state of the simulated machine to a UNIX file,
+//	once the time given has passed, and halts; "-restore" boots from
+//	the disk image the checkpointed run started from, and then resumes
+//	the user programs from the file, where they were -- skipping the
+//	setup a test needs before it gets interesting.
+//
+//	Only user programs are saved, not the threads running them: a
+//	thread in the kernel has host state on its stack that cannot be
+//	saved.  So once the time has come, each thread that gets to a
+//	tick between two user instructions stops there, yielding to the
+//	others, until every thread has: those in a system call finish it
+//	first.  Then there is no I/O in flight either, as nothing waits
+//	for it.  (A thread that never gets back to user code, like one
+//	waiting for console input that does not come, holds the checkpoint
+//	off for good.)
+//
+//	The file holds, in order: a magic number and the size of main
+//	memory, the disk (the sectors written since boot, kept in memory
+//	while checkpointing -- see Disk::UseOverlay), the statistics,
+//	with the time, the pending interrupts, main memory, and then each
+//	thread: its id and name, its registers, and its address space,
+//	with its page table, open files and mappings.  The threads are
+//	saved in the order they will run.
+//
+//	The restored programs start a few ticks after the time saved,
+//	as the kernel enables interrupts to get them running; and the time
+//	slices of "-rs" are not repeated, as the random number generator
+//	is not saved.
+//----------------------------------------------------------------------
+
+static const int CheckpointMagic = 0x4e434b50;
+static const int MaxCheckpointName = 1024;	// longest program name saved
+
+//----------------------------------------------------------------------
+// Kernel::CheckpointIfDue
+// 	Called by Interrupt::OneTick at each tick between two user
+//	instructions: if a checkpoint was asked for and its time has
+//	come, take it, as soon as the user programs are all there is to
+//	save.  Until then, keep the current thread from running any more
+//	user code.  "yielding" is TRUE if the current thread is about to
+//	be preempted anyway.
+//----------------------------------------------------------------------
+
+void
+Kernel::CheckpointIfDue(bool yielding)
+{
+    List<Thread *> *ready;
+
+    if (checkpointFile == NULL || stats->totalTicks < checkpointTicks)
+	return;
+    for (;;) {
+	ready = scheduler->PreemptedThreads();
+	if (ready != NULL)
+	    Checkpoint(ready, yielding);	// never returns
+	yielding = FALSE;
+	interrupt->setStatus(SystemMode);	// wait for the others,
+	currentThread->preempted = TRUE;	// as if preempted here
+	currentThread->Yield();
+	currentThread->preempted = FALSE;
+	interrupt->setStatus(UserMode);
+    }
+}
+
+//----------------------------------------------------------------------
+// CheckpointThread
+// 	Write "thread" to the checkpoint "fd": its id and its name, then
+//	the user program it runs.  The name only labels the thread (the
+//	program is in the memory saved), so a name longer than
+//	MaxCheckpointName is cut short.
+//----------------------------------------------------------------------
+
+static void
+CheckpointThread(int fd, Thread *thread)
+{
+    int length = (int) min(strlen(thread->getName()),
+			   (size_t) MaxCheckpointName);
+    int head[2] = { thread->getID(), length };
+
+    WriteFile(fd, (char *) head, sizeof(head));
+    WriteFile(fd, thread->getName(), head[1]);
+    thread->Checkpoint(fd);
+}
+
+//----------------------------------------------------------------------
+// Kernel::Checkpoint
+// 	Save the machine to "checkpointFile", and halt.  The current
+//	thread is between two user instructions, and the threads on
+//	"ready" were preempted between two as well.  If the current thread
+//	is "yielding", it goes after them.
+//----------------------------------------------------------------------
+
+void
+Kernel::Checkpoint(List<Thread *> *ready, bool yielding)
+{
+    ListIterator<Thread *> iter(ready);
+    int header[2] = { CheckpointMagic, NumPhysPages };
+    int count = ready->NumInList() + 1;
+    int fd = OpenForWrite(checkpointFile);
+
+    currentThread->SaveUserState();
+    WriteFile(fd, (char *) header, sizeof(header));
+    synchDisk->Checkpoint(fd);
+    WriteFile(fd, (char *) stats, sizeof(Statistics));
+    interrupt->Checkpoint(fd);
+    machine->Checkpoint(fd);
+    WriteFile(fd, (char *) &count, sizeof(int));
+    if (!yielding)
+	CheckpointThread(fd, currentThread);
+    for (; !iter.IsDone(); iter.Next())
+	CheckpointThread(fd, iter.Item());
+    if (yielding)
+	CheckpointThread(fd, currentThread);
+    ::Close(fd);
+
+    cout << "Checkpoint saved to " << checkpointFile << " at tick "
+	 << stats->totalTicks << "\n";
+    interrupt->Halt();
+}
+
+//----------------------------------------------------------------------
+// Kernel::RestoreDisk
+// 	Open "restoreFile", check it is a checkpoint of a machine like
+//	this one, and read back the disk.  Done before the file system is
+//	started, so it finds the disk as it was.
+//----------------------------------------------------------------------
+
+void
+Kernel::RestoreDisk()
+{
+    int header[2];
+
+    restoreFd = OpenForReadWrite(restoreFile, FALSE);
+    if (restoreFd < 0) {
+	cerr << "Unable to open checkpoint " << restoreFile << "\n";
+	Exit(1);
+    }
+    ::Read(restoreFd, (char *) header, sizeof(header));
+    if (header[0] != CheckpointMagic || header[1] != NumPhysPages) {
+	cerr << restoreFile << " is not a checkpoint of a machine with "
+	     << NumPhysPages << " pages of memory (see -mem)\n";
+	Exit(1);
+    }
+    synchDisk->Restore(restoreFd);
+}
+
+//----------------------------------------------------------------------
+// Kernel::Restore
+// 	Read back the rest of the checkpoint: the time, the pending
+//	interrupts, main memory, and the user programs, each forked to
+//	resume where it was.
+//----------------------------------------------------------------------
+
+void
+Kernel::Restore()
+{
+    IntStatus oldLevel = interrupt->SetLevel(IntOff);
+    int count;
+
+    ::Read(restoreFd, (char *) stats, sizeof(Statistics));
+    interrupt->Restore(restoreFd);
+    machine->Restore(restoreFd);
+    ::Read(restoreFd, (char *) &count, sizeof(int));
+    for (int i = 0; i < count; i++) {
+	int head[2];
+	char *name;
+	Thread *thread;
+
+	::Read(restoreFd, (char *) head, sizeof(head));
+	if (head[0] < 0 || head[0] >= (int) (sizeof(t) / sizeof(t[0]))
+		|| head[1] < 0 || head[1] > MaxCheckpointName) {
+	    cerr << restoreFile << " is not a checkpoint of this Nachos\n";
+	    Exit(1);
+	}
+	name = new char[head[1] + 1];
+	::Read(restoreFd, name, head[1]);
+	name[head[1]] = '\0';
+	thread = new Thread(name, head[0]);
+	thread->Restore(restoreFd);
+	t[head[0]] = thread;
+	threadNum = max(threadNum, head[0] + 1);
+	thread->Fork((VoidFunctionPtr) &ForkResume, (void *) thread);
     }
-    return 0;
+    ::Close(restoreFd);
+    (void) interrupt->SetLevel(oldLevel);
 }
@@ -25,6 +25,7 @@ class PostOfficeOutput;
 class SynchConsoleInput;
 class SynchConsoleOutput;
 class SynchDisk;
+class Cpu;
 
 
 
@@ -41,6 +42,14 @@ class Kernel {
 	// 2015.11.25 added
 	void PrepareToEnd(); // called before all running programs end
 	
+	bool AllCpusIdle();	// is every CPU out of work? (always,
+				// once the only CPU is)
+	void StopCpus();	// halting: wait for the other CPUs to
+				// stop running user programs
+	void CheckpointIfDue(bool yielding);
+				// between user instructions: save the
+				// machine and halt, if "-ckpt" asked to
+
 	void ExecAll();
 	int Exec(char* name);
     void ThreadSelfTest();	// self test of threads and synchronization
@@ -53,10 +62,13 @@ class Kernel {
     
 	int CreateFile(char* filename, int size); // fileSystem call
 	//#endif
+    int CloneFile(char *from, char *to);	// copy-on-write clone
     OpenFileId Open(char *name);
     int Write(char *buf, int size, OpenFileId id);
     int Read(char *buf, int size, OpenFileId id);
     int Close(OpenFileId id);
+    int Mmap(OpenFileId id, int length);	// demand-paged file mapping
+    int Munmap(int addr);
 
 // These are public for notational convenience; really, 
 // they're global variables used everywhere.
@@ -67,6 +79,8 @@ class Kernel {
     Statistics *stats;		// performance metrics
     Alarm *alarm;		// the software alarm clock    
     Machine *machine;           // the simulated CPU
+    Cpu **cpus;			// the simulated CPUs, when "machine"
+    int numCpus;		// is one of several (-smp)
     SynchConsoleInput *synchConsoleIn;
     SynchConsoleOutput *synchConsoleOut;
     SynchDisk *synchDisk;
@@ -84,6 +98,24 @@ class Kernel {
 	int threadNum;
     bool randomSlice;		// enable pseudo-random time slicing
     bool debugUserProg;         // single step user program
+    bool threadedDispatch;	// run user programs on the threaded
+				// interpreter core
+    bool translateCode;		// run hot user code as host code
+    int tlbSize;		// entries of the TLB, or 0 to translate
+				// through page tables
+    int tlbWays;		// entries in each set of the TLB
+    TlbPolicy tlbPolicy;	// how the TLB picks entries to replace
+    bool cpusInTurn;		// CPUs take the kernel lock round robin,
+				// for a deterministic run
+    char *checkpointFile;	// UNIX file to save the machine to, at
+    int checkpointTicks;	// the first chance after this time
+    char *restoreFile;		// UNIX file to resume the machine from,
+    int restoreFd;		// and its file descriptor
+    void Checkpoint(List<Thread *> *ready, bool yielding);
+				// save the machine, and halt
+    void RestoreDisk();		// read the disk back from restoreFile
+    void Restore();		// read back the rest, and resume the
+				// user programs
     double reliability;         // likelihood messages are dropped
     char *consoleIn;            // file to read console input from
     char *consoleOut;           // file to send console output to
@@ -3,16 +3,41 @@
 //	operating system kernel.  
 //
 // Usage: nachos -d <debugflags> -rs <random seed #>
-//              -s -x <nachos file> -ci <consoleIn> -co <consoleOut>
-//              -f -cp <unix file> <nachos file>
+//              -s -sim <switch|threaded> -jit -x <nachos file>
+//              -tlb <entries> <ways> <random|fifo|lru|clock> -mem <pages>
+//              -smp <cpus> <det|free>
+//              -ckpt <unix file> <ticks> -restore <unix file>
+//              -ci <consoleIn> -co <consoleOut>
+//              -f -cp <unix file> <nachos file> -cpz <unix file> <nachos file>
+//              -cpout <nachos file> <unix file> -verify -time
+//              -clone <nachos file> <nachos file> -dedup
+//              -script <command file> -iostat -iostatjson <unix file> -F
 //              -p <nachos file> -r <nachos file> -l -D
 //              -n <network reliability> -m <machine id>
-//              -z -K -C -N
+//              -z -K -C -N -J
 //
 //    -d causes certain debugging messages to be printed (see debug.h)
 //    -rs causes Yield to occur at random (but repeatable) spots
 //    -z prints the copyright message
 //    -s causes user programs to be executed in single-step mode
+//    -sim picks the interpreter core for user programs: the original
+//	switch ("switch", the default), or a faster one dispatching
+//	through a table of handlers ("threaded"), without tracing
+//    -jit translates hot basic blocks of user code into host code, on
+//	64-bit x86 hosts only (see machine/jit.h)
+//    -tlb translates user addresses through a TLB of the given number
+//	of entries, in sets of "ways" entries (at least 2), with the given
+//	replacement policy; its hit rate is printed when Nachos halts
+//    -mem sets the number of pages of physical memory (128 by default)
+//    -smp simulates a multiprocessor of the given number of CPUs, each
+//	running on a host thread of its own (see threads/cpu.h); with
+//	"det", they take turns in the kernel, so that every run is the
+//	same, and with "free", whichever gets there first goes first
+//    -ckpt saves the state of the machine to a UNIX file, once the given
+//	time has passed and the user programs can be saved, and halts;
+//	the disk image is left as it was (see Kernel::Checkpoint)
+//    -restore resumes the user programs from such a file, on the disk
+//	image it was taken over, which again is left as it was
 //    -x runs a user program
 //    -ci specify file for console input (stdin is the default)
 //    -co specify file for console output (stdout is the default)
@@ -21,14 +46,32 @@
 //    -K run a simple self test of kernel threads and synchronization
 //    -C run an interactive console test
 //    -N run a two-machine network test (see Kernel::NetworkTest)
+//    -J check the host code of "-jit" against the interpreter, on
+//	random blocks of instructions (see Machine::JitSelfTest)
 //
 //    Filesystem-related flags:
 //    -f forces the Nachos disk to be formatted
 //    -cp copies a file from UNIX to Nachos
+//    -cpz does the same, into a compressed Nachos file
+//    -cpout copies a file from Nachos to UNIX
+//    -verify checks "-cp", "-cpz" and "-cpout" copies against a checksum
+//    -time reports the time and throughput of "-cp" and "-cpout"
+//    -clone makes a copy-on-write clone of a Nachos file, sharing its data
+//    -dedup shares data blocks written with the same contents as blocks
+//	already on disk, and reports the space saved
 //    -p prints a Nachos file to stdout
 //    -r removes a Nachos file from the file system
 //    -l lists the contents of the Nachos directory
 //    -D prints the contents of the entire file system 
+//    -frag reports per-file extents and free space fragmentation
+//    -defrag moves fragmented files into contiguous runs of sectors
+//    -defragd does the same from a kernel thread, alongside "-e" programs
+//    -script runs the file system commands in a file ("-" for stdin),
+//	one per line, in a single boot, e.g. "cp num_100.txt /t0/f1"
+//    -iostat prints the disk traffic of each file and directory, and the
+//	latency of each file system operation, when Nachos halts
+//    -iostatjson writes the same counters to a UNIX file, as JSON
+//    -F runs a self test of the file system on a scratch file
 //
 //  Note: the file system flags are not used if the stub filesystem
 //        is being used
@@ -43,7 +86,10 @@
 
 #include "main.h"
 #include "filesys.h"
+#include "iostats.h"
 #include "openfile.h"
+#include "filehdr.h"
+#include "compress.h"
 #include "sysdep.h"
 
 // global variables
@@ -64,26 +110,126 @@ Cleanup(int x)
 }
 
 //-------------------------------------------------------------------
-// Constant used by "Copy" and "Print"
+// Constant used by "Copy", "Export" and "Print"
 //   It is the number of bytes read from the Unix file (for Copy)
-//   or the Nachos file (for Print) by each read operation
+//   or the Nachos file (for Export and Print) by each read operation.
+//   It is a whole number of header extents (MaxFileSize bytes each),
+//   so that every transfer starts on a sector boundary and the
+//   Nachos file is walked header by header, not 128 bytes at a time.
 //-------------------------------------------------------------------
-static const int TransferSize = 128;
+static const int TransferSize = 32 * MaxFileSize;
 
+//MP4 compress: a compressed file needs room for the data it is written
+//before the data is compressed, so it is copied a few extents at a time
+static const int CompressedTransferSize = 8 * ExtentSize;
 
 #ifndef FILESYS_STUB
+static bool verifyFlag = false;		// re-read and checksum copies
+static bool timeFlag = false;		// report time and throughput
+
+//----------------------------------------------------------------------
+// Checksum
+//      Fold "numBytes" bytes of "buffer" into the running checksum
+//	"sum" (32-bit FNV-1a), and return the result.  Start a new
+//	checksum with ChecksumInit.
+//----------------------------------------------------------------------
+
+static const unsigned int ChecksumInit = 2166136261u;
+
+static unsigned int
+Checksum(unsigned int sum, char *buffer, int numBytes)
+{
+    for (int i = 0; i < numBytes; i++) {
+        sum ^= (unsigned char) buffer[i];
+        sum *= 16777619u;
+    }
+    return sum;
+}
+
+//----------------------------------------------------------------------
+// ReportTransfer
+//      Print how long it took to move "numBytes" bytes, in host time
+//	since "start" and in simulated ticks since "startTicks".
+//----------------------------------------------------------------------
+
+static void
+ReportTransfer(char *what, int numBytes, double start, int startTicks)
+{
+    double elapsed = HostSeconds() - start;
+
+    printf("%s: %d bytes in %.3f s", what, numBytes, elapsed);
+    if (elapsed > 0)
+        printf(" (%.2f MB/s)", numBytes / elapsed / (1024 * 1024));
+    printf(", %d ticks\n", kernel->stats->totalTicks - startTicks);
+}
+
+//----------------------------------------------------------------------
+// NachosChecksum
+//      Return the checksum of the whole Nachos file "openFile".
+//----------------------------------------------------------------------
+
+static unsigned int
+NachosChecksum(OpenFile *openFile, char *buffer)
+{
+    unsigned int sum = ChecksumInit;
+    int amountRead, position = 0;
+
+    while ((amountRead = openFile->ReadAt(buffer, TransferSize, position)) > 0) {
+        sum = Checksum(sum, buffer, amountRead);
+        position += amountRead;
+    }
+    return sum;
+}
+
+//----------------------------------------------------------------------
+// UnixChecksum
+//      Return the checksum of the whole UNIX file "fd".
+//----------------------------------------------------------------------
+
+static unsigned int
+UnixChecksum(int fd, char *buffer)
+{
+    unsigned int sum = ChecksumInit;
+    int amountRead;
+
+    Lseek(fd, 0, 0);
+    while ((amountRead = ReadPartial(fd, buffer, TransferSize)) > 0)
+        sum = Checksum(sum, buffer, amountRead);
+    return sum;
+}
+
+//----------------------------------------------------------------------
+// ReportVerify
+//      Compare the checksums of the source and the copy.
+//----------------------------------------------------------------------
+
+static void
+ReportVerify(char *what, unsigned int source, unsigned int copy)
+{
+    if (source == copy)
+        printf("%s: verified, checksum %08x\n", what, copy);
+    else
+        printf("%s: MISMATCH, source checksum %08x, copy %08x\n",
+                what, source, copy);
+}
+
 //----------------------------------------------------------------------
 // Copy
-//      Copy the contents of the UNIX file "from" to the Nachos file "to"
+//      Copy the contents of the UNIX file "from" to the Nachos file "to",
+//	compressing it if "compress"
 //----------------------------------------------------------------------
 
 static void
-Copy(char *from, char *to)
+Copy(char *from, char *to, bool compress)
 {
     int fd;
     OpenFile* openFile;
-    int amountRead, fileLength;
+    int amountRead, amountWritten, fileLength;
+    int chunk = compress ? CompressedTransferSize : TransferSize;
     char *buffer;
+    double start = HostSeconds();
+    int startTicks = kernel->stats->totalTicks;
+    unsigned int sum = ChecksumInit;
 
 // Open UNIX file
     if ((fd = OpenForReadWrite(from,FALSE)) < 0) {       
@@ -96,9 +242,10 @@ Copy(char *from, char *to)
     fileLength = Tell(fd);
     Lseek(fd, 0, 0);
 
-// Create a Nachos file of the same length
+// Create a Nachos file of the same length (or an empty one, which
+// grows as the compressed data is written)
     DEBUG('f', "Copying file " << from << " of size " << fileLength <<  " to file " << to);
-    if (!kernel->fileSystem->Create(to, fileLength, FALSE)) {   // Create Nachos file
+    if (!kernel->fileSystem->Create(to, compress ? 0 : fileLength, FALSE)) {
         printf("Copy: couldn't create output file %s\n", to);
         Close(fd);
         return;
@@ -106,11 +253,25 @@ Copy(char *from, char *to)
     
     openFile = kernel->fileSystem->Open(to);
     ASSERT(openFile != NULL);
+    if (compress)
+        openFile->SetCompressed();
     
 // Copy the data in TransferSize chunks
     buffer = new char[TransferSize];
-    while ((amountRead=ReadPartial(fd, buffer, sizeof(char)*TransferSize)) > 0)
-        openFile->Write(buffer, amountRead);    
+    amountWritten = 0;
+    while ((amountRead=ReadPartial(fd, buffer, sizeof(char)*chunk)) > 0) {
+        if (verifyFlag)
+            sum = Checksum(sum, buffer, amountRead);
+        if (openFile->Write(buffer, amountRead) != amountRead) {
+            printf("Copy: short write to %s\n", to);
+            break;
+        }
+        amountWritten += amountRead;
+    }
+    if (timeFlag)
+        ReportTransfer("Copy", amountWritten, start, startTicks);
+    if (verifyFlag)
+        ReportVerify("Copy", sum, NachosChecksum(openFile, buffer));
     delete [] buffer;
 
 // Close the UNIX and the Nachos files
@@ -118,6 +279,54 @@ Copy(char *from, char *to)
     Close(fd);
 }
 
+//----------------------------------------------------------------------
+// Export
+//      Copy the contents of the Nachos file "from" to the UNIX file "to"
+//----------------------------------------------------------------------
+
+static void
+Export(char *from, char *to)
+{
+    int fd;
+    OpenFile* openFile;
+    int amountRead, amountWritten;
+    char *buffer;
+    double start = HostSeconds();
+    int startTicks = kernel->stats->totalTicks;
+    unsigned int sum = ChecksumInit;
+
+    if ((openFile = kernel->fileSystem->Open(from)) == NULL) {
+        printf("Export: unable to open file %s\n", from);
+        return;
+    }
+    if ((fd = OpenForWrite(to)) < 0) {
+        printf("Export: couldn't create output file %s\n", to);
+        delete openFile;
+        return;
+    }
+
+    DEBUG('f', "Exporting file " << from << " of size " << openFile->Length() << " to file " << to);
+    buffer = new char[TransferSize];
+    amountWritten = 0;
+    while ((amountRead = openFile->Read(buffer, TransferSize)) > 0) {
+        if (verifyFlag)
+            sum = Checksum(sum, buffer, amountRead);
+        WriteFile(fd, buffer, amountRead);
+        amountWritten += amountRead;
+    }
+    if (timeFlag)
+        ReportTransfer("Export", amountWritten, start, startTicks);
+    if (verifyFlag) {
+        Close(fd);
+        fd = OpenForReadWrite(to, TRUE);
+        ReportVerify("Export", sum, UnixChecksum(fd, buffer));
+    }
+    delete [] buffer;
+
+    delete openFile;
+    Close(fd);
+}
+
 #endif // FILESYS_STUB
 
 //----------------------------------------------------------------------
@@ -129,7 +338,7 @@ void
 Print(char *name)
 {
     OpenFile *openFile;    
-    int i, amountRead;
+    int amountRead;
     char *buffer;
 
     if ((openFile = kernel->fileSystem->Open(name)) == NULL) {
@@ -139,8 +348,7 @@ Print(char *name)
 //    printf("Open File Length: %d\n", openFile->Length());
     buffer = new char[TransferSize];
     while ((amountRead = openFile->Read(buffer, TransferSize)) > 0)
-        for (i = 0; i < amountRead; i++)
-            printf("%c", buffer[i]);
+        fwrite(buffer, sizeof(char), amountRead, stdout);
 
     delete [] buffer;
 
@@ -162,6 +370,141 @@ CreateDirectory(char *name)
     
 }
 
+#ifndef FILESYS_STUB
+//----------------------------------------------------------------------
+// CloneFile
+//      Create the Nachos file "to" as a copy-on-write clone of "from"
+//----------------------------------------------------------------------
+static void
+CloneFile(char *from, char *to)
+{
+    if (!kernel->fileSystem->Clone(from, to))
+        printf("Clone: couldn't clone %s to %s\n", from, to);
+}
+
+//----------------------------------------------------------------------
+// DefragThread
+//      Body of the kernel thread forked for "-defragd"; defragments
+//	the file system while the user programs run.
+//----------------------------------------------------------------------
+static void
+DefragThread(void *unused)
+{
+    kernel->fileSystem->Defrag(TRUE);
+}
+#endif // FILESYS_STUB
+
+#ifndef FILESYS_STUB
+//----------------------------------------------------------------------
+// RunCommand
+//      Execute one file system command of a "-script" file.  The
+//	commands are named after the command line flags, with or without
+//	the leading "-": cp, cpz, cpout, clone, p, r, rr, l, lr, mkdir, D, frag,
+//	defrag, iostat.
+//	Return FALSE if the command is unknown or has the wrong number
+//	of arguments.
+//
+//	"argc" is the number of words in the command, including its name
+//	"argv" is the words of the command
+//----------------------------------------------------------------------
+
+static bool
+RunCommand(int argc, char **argv)
+{
+    char *cmd = argv[0];
+
+    if (cmd[0] == '-')
+        cmd++;
+    if (strcmp(cmd, "cp") == 0 && argc == 3) {
+        Copy(argv[1], argv[2], FALSE);
+    } else if (strcmp(cmd, "cpz") == 0 && argc == 3) {
+        Copy(argv[1], argv[2], TRUE);
+    } else if (strcmp(cmd, "cpout") == 0 && argc == 3) {
+        Export(argv[1], argv[2]);
+    } else if (strcmp(cmd, "clone") == 0 && argc == 3) {
+        CloneFile(argv[1], argv[2]);
+    } else if (strcmp(cmd, "p") == 0 && argc == 2) {
+        Print(argv[1]);
+    } else if ((strcmp(cmd, "r") == 0 || strcmp(cmd, "rr") == 0) && argc == 2) {
+        kernel->fileSystem->Remove(strcmp(cmd, "rr") == 0, argv[1]);
+    } else if ((strcmp(cmd, "l") == 0 || strcmp(cmd, "lr") == 0) && argc == 2) {
+        kernel->fileSystem->List(strcmp(cmd, "lr") == 0, argv[1]);
+    } else if (strcmp(cmd, "mkdir") == 0 && argc == 2) {
+        CreateDirectory(argv[1]);
+    } else if (strcmp(cmd, "D") == 0 && argc == 1) {
+        kernel->fileSystem->Print();
+    } else if ((strcmp(cmd, "frag") == 0 || strcmp(cmd, "defrag") == 0)
+                && argc == 1) {
+        kernel->fileSystem->Defrag(strcmp(cmd, "defrag") == 0);
+    } else if (strcmp(cmd, "iostat") == 0 && argc == 1) {
+        kernel->fileSystem->ioStats->Print();
+    } else {
+        return FALSE;
+    }
+    return TRUE;
+}
+
+//----------------------------------------------------------------------
+// RunScript
+//      Execute the file system commands in the UNIX file "name" ("-"
+//	for stdin), one per line, against the file system mounted by this
+//	boot.  Blank lines and lines starting with "#" are skipped.
+//	With "-time", report how long each command took.
+//----------------------------------------------------------------------
+
+static void
+RunScript(char *name)
+{
+    FILE *script;
+    char line[1024];
+    char *words[4];
+    int lineNum = 0, numWords;
+    double start, scriptStart = HostSeconds();
+    int startTicks, scriptTicks = kernel->stats->totalTicks;
+
+    if (strcmp(name, "-") == 0) {
+        script = stdin;
+    } else if ((script = fopen(name, "r")) == NULL) {
+        printf("Script: couldn't open %s\n", name);
+        return;
+    }
+
+    while (fgets(line, sizeof(line), script) != NULL) {
+        lineNum++;
+        numWords = 0;
+        for (char *word = strtok(line, " \t\r\n"); word != NULL;
+                word = strtok(NULL, " \t\r\n")) {
+            if (numWords == 4) {
+                numWords++;		// too many, reject the line
+                break;
+            }
+            words[numWords++] = word;
+        }
+        if (numWords == 0 || words[0][0] == '#')
+            continue;
+
+        DEBUG(dbgFile, "Script line " << lineNum << ": " << words[0]);
+        start = HostSeconds();
+        startTicks = kernel->stats->totalTicks;
+        if (numWords > 4 || !RunCommand(numWords, words)) {
+            printf("Script: bad command at line %d: %s\n", lineNum, words[0]);
+            continue;
+        }
+        if (timeFlag)
+            printf("Script: line %d, %s: %.3f s, %d ticks\n", lineNum,
+                    words[0], HostSeconds() - start,
+                    kernel->stats->totalTicks - startTicks);
+    }
+    if (timeFlag)
+        printf("Script: %d lines in %.3f s, %d ticks\n", lineNum,
+                HostSeconds() - scriptStart,
+                kernel->stats->totalTicks - scriptTicks);
+
+    if (script != stdin)
+        fclose(script);
+}
+#endif // FILESYS_STUB
+
 //----------------------------------------------------------------------
 // main
 // 	Bootstrap the operating system kernel.  
@@ -185,9 +528,15 @@ main(int argc, char **argv)
     bool threadTestFlag = false;
     bool consoleTestFlag = false;
     bool networkTestFlag = false;
+    bool jitTestFlag = false;
 #ifndef FILESYS_STUB
     char *copyUnixFileName = NULL;    // UNIX file to be copied into Nachos
     char *copyNachosFileName = NULL;  // name of copied file in Nachos
+    bool compressCopyFlag = false;    // compress the copied file
+    char *exportNachosFileName = NULL;	// Nachos file to be copied out
+    char *exportUnixFileName = NULL;	// name of the copy in UNIX
+    char *cloneFromName = NULL;		// Nachos file to be cloned
+    char *cloneToName = NULL;		// name of the clone
     char *printFileName = NULL; 
     char *removeFileName = NULL;
     bool dirListFlag = false;
@@ -198,6 +547,14 @@ main(int argc, char **argv)
 	bool mkdirFlag = false;
 	bool recursiveListFlag = false;
 	bool recursiveRemoveFlag = false;
+	bool fragFlag = false;
+	bool defragFlag = false;
+	bool defragThreadFlag = false;
+	bool dedupFlag = false;
+	char *scriptFileName = NULL;
+	bool ioStatFlag = false;
+	char *ioStatFileName = NULL;	// UNIX file for the JSON counters
+	bool fsTestFlag = false;
 #endif //FILESYS_STUB
 
     // some command line arguments are handled here.
@@ -226,6 +583,9 @@ main(int argc, char **argv)
 	else if (strcmp(argv[i], "-N") == 0) {
 	    networkTestFlag = TRUE;
 	}
+	else if (strcmp(argv[i], "-J") == 0) {
+	    jitTestFlag = TRUE;
+	}
 #ifndef FILESYS_STUB
 	else if (strcmp(argv[i], "-cp") == 0) {
 	    ASSERT(i + 2 < argc);
@@ -233,6 +593,34 @@ main(int argc, char **argv)
 	    copyNachosFileName = argv[i + 2];
 	    i += 2;
 	}
+	else if (strcmp(argv[i], "-cpz") == 0) {
+	    ASSERT(i + 2 < argc);
+	    copyUnixFileName = argv[i + 1];
+	    copyNachosFileName = argv[i + 2];
+	    compressCopyFlag = true;
+	    i += 2;
+	}
+	else if (strcmp(argv[i], "-cpout") == 0) {
+	    ASSERT(i + 2 < argc);
+	    exportNachosFileName = argv[i + 1];
+	    exportUnixFileName = argv[i + 2];
+	    i += 2;
+	}
+	else if (strcmp(argv[i], "-clone") == 0) {
+	    ASSERT(i + 2 < argc);
+	    cloneFromName = argv[i + 1];
+	    cloneToName = argv[i + 2];
+	    i += 2;
+	}
+	else if (strcmp(argv[i], "-dedup") == 0) {
+	    dedupFlag = true;
+	}
+	else if (strcmp(argv[i], "-verify") == 0) {
+	    verifyFlag = true;
+	}
+	else if (strcmp(argv[i], "-time") == 0) {
+	    timeFlag = true;
+	}
 	else if (strcmp(argv[i], "-p") == 0) {
 	    ASSERT(i + 1 < argc);
 	    printFileName = argv[i + 1];
@@ -276,15 +664,49 @@ main(int argc, char **argv)
 	else if (strcmp(argv[i], "-D") == 0) {
 	    dumpFlag = true;
 	}
+	else if (strcmp(argv[i], "-frag") == 0) {
+	    fragFlag = true;
+	}
+	else if (strcmp(argv[i], "-defrag") == 0) {
+	    defragFlag = true;
+	}
+	else if (strcmp(argv[i], "-defragd") == 0) {
+	    defragThreadFlag = true;
+	}
+	else if (strcmp(argv[i], "-iostat") == 0) {
+	    ioStatFlag = true;
+	}
+	else if (strcmp(argv[i], "-iostatjson") == 0) {
+	    ASSERT(i + 1 < argc);
+	    ioStatFileName = argv[i + 1];
+	    i++;
+	}
+	else if (strcmp(argv[i], "-script") == 0) {
+	    ASSERT(i + 1 < argc);
+	    scriptFileName = argv[i + 1];
+	    i++;
+	}
+	else if (strcmp(argv[i], "-F") == 0) {
+	    fsTestFlag = true;
+	}
 #endif //FILESYS_STUB
 	else if (strcmp(argv[i], "-u") == 0) {
             cout << "Partial usage: nachos [-z -d debugFlags]\n";
             cout << "Partial usage: nachos [-x programName]\n";
-	    cout << "Partial usage: nachos [-K] [-C] [-N]\n";
+	    cout << "Partial usage: nachos [-K] [-C] [-N] [-J]\n";
 #ifndef FILESYS_STUB
             cout << "Partial usage: nachos [-cp UnixFile NachosFile]\n";
+            cout << "Partial usage: nachos [-cpz UnixFile NachosFile]\n";
+            cout << "Partial usage: nachos [-cpout NachosFile UnixFile]\n";
+            cout << "Partial usage: nachos [-verify] [-time]\n";
+            cout << "Partial usage: nachos [-clone NachosFile NachosFile]\n";
+            cout << "Partial usage: nachos [-dedup]\n";
             cout << "Partial usage: nachos [-p fileName] [-r fileName]\n";
             cout << "Partial usage: nachos [-l] [-D]\n";
+            cout << "Partial usage: nachos [-frag] [-defrag] [-defragd]\n";
+            cout << "Partial usage: nachos [-script commandFile]\n";
+            cout << "Partial usage: nachos [-iostat] [-iostatjson UnixFile]\n";
+            cout << "Partial usage: nachos [-F]\n";
 #endif //FILESYS_STUB
 	}
 
@@ -310,15 +732,40 @@ main(int argc, char **argv)
     if (networkTestFlag) {
       kernel->NetworkTest();   // two-machine test of the network
     }
+    if (jitTestFlag) {
+      kernel->machine->JitSelfTest();   // -jit against the interpreter
+    }
 
 #ifndef FILESYS_STUB
 
     /* MP4 */
+    if (ioStatFlag || ioStatFileName != NULL) {
+		kernel->fileSystem->ioStats->ReportAtHalt(ioStatFlag, ioStatFileName);
+    }
+    if (dedupFlag) {
+		kernel->fileSystem->EnableDedup();
+    }
+    if (fsTestFlag) {
+		kernel->fileSystem->SelfTest();
+    }
     if (removeFileName != NULL) {
 		kernel->fileSystem->Remove(recursiveRemoveFlag, removeFileName);
     }
     if (copyUnixFileName != NULL && copyNachosFileName != NULL) {
-		Copy(copyUnixFileName,copyNachosFileName);
+		Copy(copyUnixFileName,copyNachosFileName,compressCopyFlag);
+    }
+    if (exportNachosFileName != NULL && exportUnixFileName != NULL) {
+		Export(exportNachosFileName,exportUnixFileName);
+    }
+    if (cloneFromName != NULL && cloneToName != NULL) {
+		CloneFile(cloneFromName, cloneToName);
+    }
+    if (fragFlag || defragFlag) {
+		kernel->fileSystem->Defrag(defragFlag);
+    }
+    if (defragThreadFlag) {
+		Thread *defragThread = new Thread("defrag", 1);
+		defragThread->Fork((VoidFunctionPtr) DefragThread, NULL);
     }
     if (dumpFlag) {
 		kernel->fileSystem->Print();
@@ -334,6 +781,12 @@ main(int argc, char **argv)
     if (printFileName != NULL) {
       Print(printFileName);
     }
+    if (scriptFileName != NULL) {
+		RunScript(scriptFileName);
+    }
+    if (dedupFlag) {
+		kernel->fileSystem->DedupReport();
+    }
 #endif // FILESYS_STUB
 
     // finally, run an initial user program if requested to do so
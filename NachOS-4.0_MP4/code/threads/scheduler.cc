@@ -29,9 +29,15 @@
 //	Initially, no ready threads.
 //----------------------------------------------------------------------
 
-Scheduler::Scheduler()
+Scheduler::Scheduler(int cpus)
 { 
-    readyList = new List<Thread *>; 
+    numCpus = cpus;
+    readyList = new List<Thread *> *[numCpus];
+    assigned = new int[numCpus];
+    for (int i = 0; i < numCpus; i++) {
+	readyList[i] = new List<Thread *>;
+	assigned[i] = 0;
+    }
     toBeDestroyed = NULL;
 } 
 
@@ -42,7 +48,10 @@ Scheduler::Scheduler()
 
 Scheduler::~Scheduler()
 { 
-    delete readyList; 
+    for (int i = 0; i < numCpus; i++)
+	delete readyList[i];
+    delete [] readyList;
+    delete [] assigned;
 } 
 
 //----------------------------------------------------------------------
@@ -59,13 +68,76 @@ Scheduler::ReadyToRun (Thread *thread)
     ASSERT(kernel->interrupt->getLevel() == IntOff);
     DEBUG(dbgThread, "Putting thread on ready list: " << thread->getName());
 	//cout << "Putting thread on ready list: " << thread->getName() << endl ;
+    if (thread->getCpu() < 0) {		// new: pick the least busy CPU
+	int cpu = 0;
+	for (int i = 1; i < numCpus; i++) {
+	    if (assigned[i] < assigned[cpu])
+		cpu = i;
+	}
+	Assign(thread, cpu);
+    }
     thread->setStatus(READY);
-    readyList->Append(thread);
+    readyList[thread->getCpu()]->Append(thread);
+}
+
+//----------------------------------------------------------------------
+// Scheduler::Assign
+// 	Make "thread" run on CPU "cpu", from now until it is destroyed.
+//	Threads never move between CPUs: one that runs a user program
+//	has the interpreter loop of its CPU's Machine on its stack.
+//----------------------------------------------------------------------
+
+void
+Scheduler::Assign(Thread *thread, int cpu)
+{
+    ASSERT(thread->getCpu() < 0 && cpu >= 0 && cpu < numCpus);
+    DEBUG(dbgThread, "Assigning thread " << thread->getName() << " to CPU " << cpu);
+    thread->setCpu(cpu);
+    assigned[cpu]++;
+}
+
+//----------------------------------------------------------------------
+// Scheduler::AnyReady
+// 	Return TRUE if some CPU has a thread ready to run.
+//----------------------------------------------------------------------
+
+bool
+Scheduler::AnyReady()
+{
+    for (int i = 0; i < numCpus; i++) {
+	if (!readyList[i]->IsEmpty())
+	    return TRUE;
+    }
+    return FALSE;
+}
+
+//----------------------------------------------------------------------
+// Scheduler::PreemptedThreads
+// 	Return the list of ready threads, if all the other threads are on
+//	it, and were switched out by the timer while running user code --
+//	so that the user programs are all that is left of them.  Otherwise,
+//	or on a multiprocessor, return NULL.  Used to checkpoint the
+//	machine (see Kernel::Checkpoint).
+//----------------------------------------------------------------------
+
+List<Thread *> *
+Scheduler::PreemptedThreads()
+{
+    ListIterator<Thread *> iter(readyList[0]);
+
+    if (numCpus > 1 || assigned[0] != (int) readyList[0]->NumInList() + 1)
+	return NULL;			// some thread is blocked
+    for (; !iter.IsDone(); iter.Next()) {
+	if (!iter.Item()->preempted)
+	    return NULL;
+    }
+    return readyList[0];
 }
 
 //----------------------------------------------------------------------
 // Scheduler::FindNextToRun
-// 	Return the next thread to be scheduled onto the CPU.
+// 	Return the next thread to be scheduled onto the CPU -- the one
+//	the current thread runs on.
 //	If there are no ready threads, return NULL.
 // Side effect:
 //	Thread is removed from the ready list.
@@ -74,12 +146,14 @@ Scheduler::ReadyToRun (Thread *thread)
 Thread *
 Scheduler::FindNextToRun ()
 {
+    List<Thread *> *list = readyList[kernel->currentThread->getCpu()];
+
     ASSERT(kernel->interrupt->getLevel() == IntOff);
 
-    if (readyList->IsEmpty()) {
+    if (list->IsEmpty()) {
 		return NULL;
     } else {
-    	return readyList->RemoveFront();
+    	return list->RemoveFront();
     }
 }
 
@@ -161,6 +235,7 @@ void
 Scheduler::CheckToBeDestroyed()
 {
     if (toBeDestroyed != NULL) {
+        assigned[toBeDestroyed->getCpu()]--;
         delete toBeDestroyed;
 	toBeDestroyed = NULL;
     }
@@ -175,5 +250,9 @@ void
 Scheduler::Print()
 {
     cout << "Ready list contents:\n";
-    readyList->Apply(ThreadPrint);
+    for (int i = 0; i < numCpus; i++) {
+	if (numCpus > 1)
+	    cout << "CPU " << i << ":\n";
+	readyList[i]->Apply(ThreadPrint);
+    }
 }
@@ -17,15 +17,27 @@
 // the data structures and operations needed to keep track of which 
 // thread is running, and which threads are ready but not running.
 
+//
+// On a multiprocessor, each CPU has a ready list of its own, and each
+// thread runs on one CPU only: the one it is assigned to when it first
+// becomes ready, whichever has the fewest threads.
+
 class Scheduler {
   public:
-    Scheduler();		// Initialize list of ready threads 
+    Scheduler(int cpus = 1);	// Initialize list of ready threads 
     ~Scheduler();		// De-allocate ready list
 
     void ReadyToRun(Thread* thread);	
     				// Thread can be dispatched.
     Thread* FindNextToRun();	// Dequeue first thread on the ready 
 				// list, if any, and return thread.
+    void Assign(Thread *thread, int cpu);
+				// Run "thread" on CPU "cpu" only
+    bool AnyReady();		// Is any thread ready, on any CPU?
+    List<Thread *> *PreemptedThreads();
+				// The ready list, if every thread but
+				// the current one is on it, preempted
+				// between user instructions; or NULL
     void Run(Thread* nextThread, bool finishing);
     				// Cause nextThread to start running
     void CheckToBeDestroyed();// Check if thread that had been
@@ -35,8 +47,10 @@ class Scheduler {
     // SelfTest for scheduler is implemented in class Thread
     
   private:
-    List<Thread *> *readyList;  // queue of threads that are ready to run,
-				// but not running
+    List<Thread *> **readyList; // queue of threads that are ready to run,
+				// but not running, for each CPU
+    int *assigned;		// number of threads assigned to each CPU
+    int numCpus;
     Thread *toBeDestroyed;	// finishing thread to be destroyed
     				// by the next thread that runs
 };
@@ -295,3 +295,96 @@ void Condition::Broadcast(Lock* conditionLock)
         Signal(conditionLock);
     }
 }
+
+//MP4 lock
+//----------------------------------------------------------------------
+// RWLock::RWLock
+// 	Initialize a readers/writer lock, so that it can be used for
+//	synchronization.  Initially, no thread holds it.
+//
+//	"debugName" is an arbitrary name, useful for debugging.
+//----------------------------------------------------------------------
+
+RWLock::RWLock(char* debugName)
+{
+    name = debugName;
+    lock = new Lock(debugName);
+    changed = new Condition(debugName);
+    numReaders = 0;
+    numWaitingWriters = 0;
+    writer = NULL;
+}
+
+//----------------------------------------------------------------------
+// RWLock::~RWLock
+// 	Deallocate a readers/writer lock.  Like a Lock, it may still be
+//	held when Nachos halts: a program on another CPU may be waiting
+//	in the file system when one calls Halt.
+//----------------------------------------------------------------------
+
+RWLock::~RWLock()
+{
+    delete changed;
+    delete lock;
+}
+
+//----------------------------------------------------------------------
+// RWLock::AcquireRead
+// 	Wait until no thread holds the lock for writing, or waits to, and
+//	then hold it for reading along with any other readers.
+//----------------------------------------------------------------------
+
+void RWLock::AcquireRead()
+{
+    lock->Acquire();
+    ASSERT(writer != kernel->currentThread);
+    while (writer != NULL || numWaitingWriters > 0)
+	changed->Wait(lock);
+    numReaders++;
+    lock->Release();
+}
+
+//----------------------------------------------------------------------
+// RWLock::ReleaseRead
+// 	Stop reading; the last reader out lets a waiting writer in.
+//----------------------------------------------------------------------
+
+void RWLock::ReleaseRead()
+{
+    lock->Acquire();
+    ASSERT(numReaders > 0);
+    if (--numReaders == 0)
+	changed->Broadcast(lock);
+    lock->Release();
+}
+
+//----------------------------------------------------------------------
+// RWLock::AcquireWrite
+// 	Wait until no thread holds the lock at all, and then hold it alone.
+//----------------------------------------------------------------------
+
+void RWLock::AcquireWrite()
+{
+    lock->Acquire();
+    ASSERT(writer != kernel->currentThread);
+    numWaitingWriters++;
+    while (writer != NULL || numReaders > 0)
+	changed->Wait(lock);
+    numWaitingWriters--;
+    writer = kernel->currentThread;
+    lock->Release();
+}
+
+//----------------------------------------------------------------------
+// RWLock::ReleaseWrite
+// 	Stop writing, and let the waiting readers or writers in.
+//----------------------------------------------------------------------
+
+void RWLock::ReleaseWrite()
+{
+    lock->Acquire();
+    ASSERT(IsWriteHeldByCurrentThread());
+    writer = NULL;
+    changed->Broadcast(lock);
+    lock->Release();
+}
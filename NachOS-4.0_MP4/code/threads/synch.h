@@ -141,4 +141,39 @@ class Condition {
     char* name;
     List<Semaphore *> *waitQueue;	// list of waiting threads
 };
+
+//MP4 lock
+// The following class defines a "readers/writer lock".  Any number of
+// threads may hold the lock for reading at the same time, but a thread
+// holding it for writing holds it alone.
+//
+// Writers are preferred: once a writer waits for the lock, new readers
+// wait behind it, so that a steady stream of readers cannot starve it.
+// As a consequence, a thread must not acquire the lock for reading
+// while it already holds it, for reading or for writing.
+
+class RWLock {
+  public:
+    RWLock(char* debugName);	// initialize lock to be FREE
+    ~RWLock();			// deallocate lock
+    char* getName() { return name; }	// debugging assist
+
+    void AcquireRead();		// wait until no thread writes, nor
+				// waits to
+    void ReleaseRead();
+    void AcquireWrite();	// wait until no thread reads or writes
+    void ReleaseWrite();
+
+    bool IsWriteHeldByCurrentThread() {
+		return writer == kernel->currentThread; }
+
+  private:
+    char *name;			// debugging assist
+    Lock *lock;			// protects the fields below
+    Condition *changed;		// signalled when the lock is released
+    int numReaders;		// threads holding the lock for reading
+    int numWaitingWriters;	// threads waiting to write
+    Thread *writer;		// thread holding the lock for writing,
+				// or NULL
+};
 #endif // SYNCH_H
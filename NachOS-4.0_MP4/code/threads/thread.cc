@@ -40,12 +40,14 @@ Thread::Thread(char* threadName, int threadID)
     stackTop = NULL;
     stack = NULL;
     status = JUST_CREATED;
+    cpu = -1;
     for (int i = 0; i < MachineStateSize; i++) {
 	machineState[i] = NULL;		// not strictly necessary, since
 					// new thread ignores contents 
 					// of machine registers
     }
     space = NULL;
+    preempted = FALSE;
 }
 
 //----------------------------------------------------------------------
@@ -66,6 +68,7 @@ Thread::~Thread()
     ASSERT(this != kernel->currentThread);
     if (stack != NULL)
 	DeallocBoundedArray((char *) stack, StackSize * sizeof(int));
+    delete space;		// give back the program's memory
 }
 
 //----------------------------------------------------------------------
@@ -95,7 +98,7 @@ Thread::Fork(VoidFunctionPtr func, void *arg)
     Scheduler *scheduler = kernel->scheduler;
     IntStatus oldLevel;
     
-    DEBUG(dbgThread, "Forking thread: " << name << " f(a): " << (int) func << " " << arg);
+    DEBUG(dbgThread, "Forking thread: " << name << " f(a): " << (void *) func << " " << arg);
     StackAllocate(func, arg);
 
     oldLevel = interrupt->SetLevel(IntOff);
@@ -248,7 +251,8 @@ Thread::Sleep (bool finishing)
     status = BLOCKED;
 	//cout << "debug Thread::Sleep " << name << "wait for Idle\n";
     while ((nextThread = kernel->scheduler->FindNextToRun()) == NULL) {
-		kernel->PrepareToEnd();
+		if (kernel->AllCpusIdle())
+			kernel->PrepareToEnd();
 		kernel->interrupt->Idle();	// no one to run, wait for an interrupt
 	}    
     // returns when it's time for us to run
@@ -346,6 +350,15 @@ Thread::StackAllocate (VoidFunctionPtr func, void *arg)
     *(--stackTop) = (int) ThreadRoot;
     *stack = STACK_FENCEPOST;
 #endif
+
+#ifdef x86_64
+    // as on the x86, SWITCH() returns to ThreadRoot through the stack.
+    // The ABI wants the stack 16-byte aligned at each call, so ThreadRoot
+    // must start with rsp + 8 aligned: the return address slot is.
+    stackTop = (int *) ((long) (stack + StackSize - 4) & ~15L);
+    *(void **) stackTop = (void *) ThreadRoot;
+    *stack = STACK_FENCEPOST;
+#endif
     
 #ifdef PARISC
     machineState[PCState] = PLabelToAddr(ThreadRoot);
@@ -396,6 +409,37 @@ Thread::RestoreUserState()
 	kernel->machine->WriteRegister(i, userRegisters[i]);
 }
 
+//----------------------------------------------------------------------
+// Thread::Checkpoint
+//	Write the user program this thread runs to the UNIX file "fd":
+//	its saved user-level registers, and its address space.  The
+//	thread itself, running in the kernel, is not saved: it must be
+//	switched out between two user instructions, so that a new
+//	thread can pick up the program where it is.
+//----------------------------------------------------------------------
+
+void
+Thread::Checkpoint(int fd)
+{
+    WriteFile(fd, (char *) userRegisters, sizeof(userRegisters));
+    space->Checkpoint(fd);
+}
+
+//----------------------------------------------------------------------
+// Thread::Restore
+//	Read back the user program Checkpoint wrote to "fd", into a new
+//	address space.  The thread then runs it once it is forked (see
+//	Kernel::Restore).
+//----------------------------------------------------------------------
+
+void
+Thread::Restore(int fd)
+{
+    Read(fd, (char *) userRegisters, sizeof(userRegisters));
+    space = new AddrSpace();
+    space->Restore(fd);
+}
+
 
 //----------------------------------------------------------------------
 // SimpleThread
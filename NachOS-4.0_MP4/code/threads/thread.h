@@ -104,6 +104,8 @@ class Thread {
 	char* getName() { return (name); }
     
 	int getID() { return (ID); }
+    int getCpu() { return (cpu); }
+    void setCpu(int c) { cpu = c; }
     void Print() { cout << name; }
     void SelfTest();		// test whether thread impl is working
 
@@ -116,6 +118,8 @@ class Thread {
     ThreadStatus status;	// ready, running or blocked
     char* name;
 	int   ID;
+    int cpu;			// the CPU this thread runs on, or -1
+				// until it is first ready to run
     void StackAllocate(VoidFunctionPtr func, void *arg);
     				// Allocate a stack for thread.
 				// Used internally by Fork()
@@ -129,8 +133,13 @@ class Thread {
   public:
     void SaveUserState();		// save user-level register state
     void RestoreUserState();		// restore user-level register state
+    void Checkpoint(int fd);		// save the user-level state and the
+					// address space to the UNIX file "fd"
+    void Restore(int fd);		// read them back, into a new space
 
     AddrSpace *space;			// User code this thread is running.
+    bool preempted;			// TRUE while switched out by a timer
+					// interrupt between user instructions
 };
 
 // external function, dummy routine whose sole job is to call Thread::Print
@@ -57,28 +57,38 @@ SwapHeader (NoffHeader *noffH)
 #endif
 }
 
+Bitmap *AddrSpace::usedFrames = NULL;
+
 //----------------------------------------------------------------------
 // AddrSpace::AddrSpace
 // 	Create an address space to run a user program.
 //	Set up the translation from program memory to physical 
-//	memory.  For now, this is really simple (1:1), since we are
-//	only uniprogramming, and we have a single unsegmented page table
+//	memory.  There is a single unsegmented page table, as big as
+//	physical memory; it is empty until Load gives the program its
+//	page frames.
 //----------------------------------------------------------------------
 
 AddrSpace::AddrSpace()
 {
+    static int nextAsid = 0;
+
+    if (usedFrames == NULL)
+	usedFrames = new Bitmap(NumPhysPages);
+    asid = nextAsid++;
     pageTable = new TranslationEntry[NumPhysPages];
+    mapped = new MmapRegion *[NumPhysPages];
+    numPages = 0;
     for (int i = 0; i < NumPhysPages; i++) {
-	pageTable[i].virtualPage = i;	// for now, virt page # = phys page #
-	pageTable[i].physicalPage = i;
-	pageTable[i].valid = TRUE;
+	pageTable[i].virtualPage = i;
+	pageTable[i].physicalPage = -1;
+	pageTable[i].valid = FALSE;
 	pageTable[i].use = FALSE;
 	pageTable[i].dirty = FALSE;
 	pageTable[i].readOnly = FALSE;  
+	mapped[i] = NULL;
     }
     
-    // zero out the entire address space
-    bzero(kernel->machine->mainMemory, MemorySize);
+    openFiles = new FileTable();
 }
 
 //----------------------------------------------------------------------
@@ -88,6 +98,13 @@ AddrSpace::AddrSpace()
 
 AddrSpace::~AddrSpace()
 {
+   UnmapAll();
+   for (unsigned int i = 0; i < numPages; i++)
+       usedFrames->Clear(pageTable[i].physicalPage);
+   if (kernel->machine->tlb != NULL)
+       kernel->machine->tlb->FlushAsid(asid);
+   delete openFiles;
+   delete [] mapped;
    delete pageTable;
 }
 
@@ -108,6 +125,8 @@ AddrSpace::Load(char *fileName)
     OpenFile *executable = kernel->fileSystem->Open(fileName);
     NoffHeader noffH;
     unsigned int size;
+    int first = -1;
+    char *base;
 
     if (executable == NULL) {
 	cerr << "Unable to open file " << fileName << "\n";
@@ -135,27 +154,60 @@ AddrSpace::Load(char *fileName)
     numPages = divRoundUp(size, PageSize);
     size = numPages * PageSize;
 
-    ASSERT(numPages <= NumPhysPages);		// check we're not trying
+    if (numPages > (unsigned) NumPhysPages) {		// check we're not trying
 						// to run anything too big --
 						// at least until we have
 						// virtual memory
+	cerr << fileName << " needs " << numPages << " pages of memory, but "
+	     << "there are only " << NumPhysPages << " (see -mem)\n";
+	numPages = 0;
+	delete executable;
+	return FALSE;
+    }
+
+// find the program a run of free page frames: other programs may be
+// in memory too, and keeping it contiguous lets the system calls use
+// a buffer of the program as one piece of main memory
+    for (int i = 0, run = 0; i < NumPhysPages && first < 0; i++) {
+	run = usedFrames->Test(i) ? 0 : run + 1;
+	if (run == (int) numPages)
+	    first = i - numPages + 1;
+    }
+    if (first < 0) {
+	cerr << fileName << " needs " << numPages << " pages of memory, but "
+	     << "other programs are using too much of it\n";
+	numPages = 0;
+	delete executable;
+	return FALSE;
+    }
+    base = &(kernel->machine->mainMemory[first * PageSize]);
+
+    DEBUG(dbgAddr, "Initializing address space: " << numPages << ", " << size
+	  << " at page frame " << first);
+
+// the pages past the program are left for Mmap, and are invalid until
+// a mapping of them is touched
+    for (unsigned int i = 0; i < numPages; i++) {
+	usedFrames->Mark(first + i);
+	pageTable[i].physicalPage = first + i;
+	pageTable[i].valid = TRUE;
+    }
 
-    DEBUG(dbgAddr, "Initializing address space: " << numPages << ", " << size);
+// zero out the pages of the program; the rest are only touched once
+// they are mapped, and Mmap zeroes them then
+    bzero(base, size);
 
 // then, copy in the code and data segments into memory
-// Note: this code assumes that virtual address = physical address
     if (noffH.code.size > 0) {
         DEBUG(dbgAddr, "Initializing code segment.");
 	DEBUG(dbgAddr, noffH.code.virtualAddr << ", " << noffH.code.size);
-        executable->ReadAt(
-		&(kernel->machine->mainMemory[noffH.code.virtualAddr]), 
+        executable->ReadAt(&base[noffH.code.virtualAddr], 
 			noffH.code.size, noffH.code.inFileAddr);
     }
     if (noffH.initData.size > 0) {
         DEBUG(dbgAddr, "Initializing data segment.");
 	DEBUG(dbgAddr, noffH.initData.virtualAddr << ", " << noffH.initData.size);
-        executable->ReadAt(
-		&(kernel->machine->mainMemory[noffH.initData.virtualAddr]),
+        executable->ReadAt(&base[noffH.initData.virtualAddr],
 			noffH.initData.size, noffH.initData.inFileAddr);
     }
 
@@ -163,12 +215,14 @@ AddrSpace::Load(char *fileName)
     if (noffH.readonlyData.size > 0) {
         DEBUG(dbgAddr, "Initializing read only data segment.");
 	DEBUG(dbgAddr, noffH.readonlyData.virtualAddr << ", " << noffH.readonlyData.size);
-        executable->ReadAt(
-		&(kernel->machine->mainMemory[noffH.readonlyData.virtualAddr]),
+        executable->ReadAt(&base[noffH.readonlyData.virtualAddr],
 			noffH.readonlyData.size, noffH.readonlyData.inFileAddr);
     }
 #endif
 
+    kernel->machine->InvalidateDecoded(first * PageSize, size);
+					// forget the code decoded from
+					// whatever was there before
     delete executable;			// close file
     return TRUE;			// success
 }
@@ -251,13 +305,22 @@ void AddrSpace::SaveState()
 // 	On a context switch, restore the machine state so that
 //	this address space can run.
 //
-//      For now, tell the machine where to find the page table.
+//      For now, tell the machine where to find the page table.  It
+//	covers the pages Mmap may use, so that touching a mapped page
+//	that is not in memory yet raises a PageFaultException.  With a
+//	TLB, just tell it which address space runs; PageFault refills it
+//	from the page table.
 //----------------------------------------------------------------------
 
 void AddrSpace::RestoreState() 
 {
+    if (kernel->machine->tlb != NULL) {
+        kernel->machine->tlb->SetAsid(asid);	// its entries are tagged
+        return;
+    }
     kernel->machine->pageTable = pageTable;
-    kernel->machine->pageTableSize = numPages;
+    kernel->machine->pageTableSize = NumPhysPages;
+    kernel->machine->FlushHostPages();
 }
 
 
@@ -277,12 +340,17 @@ AddrSpace::Translate(unsigned int vaddr, unsigned int *paddr, int isReadWrite)
     unsigned int      vpn    = vaddr / PageSize;
     unsigned int      offset = vaddr % PageSize;
 
-    if(vpn >= numPages) {
+    if(vpn >= (unsigned) NumPhysPages) {
         return AddressErrorException;
     }
 
     pte = &pageTable[vpn];
 
+    if(!pte->valid) {
+        return (mapped[vpn] != NULL) ? PageFaultException
+                                     : AddressErrorException;
+    }
+
     if(isReadWrite && pte->readOnly) {
         return ReadOnlyException;
     }
@@ -303,7 +371,7 @@ AddrSpace::Translate(unsigned int vaddr, unsigned int *paddr, int isReadWrite)
 
     *paddr = pfn*PageSize + offset;
 
-    ASSERT((*paddr < MemorySize));
+    ASSERT((*paddr < (unsigned) MemorySize));
 
     //cerr << " -- AddrSpace::Translate(): vaddr: " << vaddr <<
     //  ", paddr: " << *paddr << "\n";
@@ -311,6 +379,377 @@ AddrSpace::Translate(unsigned int vaddr, unsigned int *paddr, int isReadWrite)
     return NoException;
 }
 
+//----------------------------------------------------------------------
+// AddrSpace::Mmap
+//  Map the first "length" bytes of the open file "file" into this
+//  address space, at the first run of free pages past the program.
+//  Nothing is read yet: each page is read in from the file when it
+//  is first touched (see PageFault), straight into the page frame.
+//
+//  The virtual address space is only as big as physical memory, so
+//  only the pages past the program can be mapped.
+//
+//  Return the virtual address of the mapping, or -1 if "length" is
+//  not positive or there is no room for it.
+//----------------------------------------------------------------------
+
+int
+AddrSpace::Mmap(OpenFile *file, int length)
+{
+    MmapRegion *region;
+    int pages = divRoundUp(length, PageSize);
+    int run = 0;
+
+    if (length <= 0)
+        return -1;
+    for (int i = numPages; i < NumPhysPages; i++) {
+        run = (mapped[i] == NULL) ? run + 1 : 0;
+        if (run < pages)
+            continue;
+
+        region = new MmapRegion;
+        region->file = file;
+        region->firstPage = i - pages + 1;
+        region->numPages = pages;
+        region->length = length;
+        for (int j = region->firstPage; j <= i; j++) {
+            mapped[j] = region;
+            pageTable[j].valid = FALSE;
+            pageTable[j].use = FALSE;
+            pageTable[j].dirty = FALSE;
+        }
+        kernel->machine->FlushHostPages();
+        DEBUG(dbgAddr, "Mapped " << length << " bytes at page "
+              << region->firstPage);
+        return region->firstPage * PageSize;
+    }
+    return -1;
+}
 
+//----------------------------------------------------------------------
+// AddrSpace::PageFault
+//  The user program touched the page at "vaddr", which is not in
+//  memory, or -- when translating through a TLB -- not in the TLB.
+//  If it is mapped, read it in from the file; whatever lies past the
+//  end of the file or of the mapping reads as zero.  Then refill the
+//  TLB, if there is one.
+//
+//  Return FALSE if "vaddr" is not mapped at all.
+//----------------------------------------------------------------------
+
+bool
+AddrSpace::PageFault(unsigned int vaddr)
+{
+    unsigned int vpn = vaddr / PageSize;
+    TranslationEntry *pte;
 
+    if (vpn >= (unsigned) NumPhysPages)
+        return FALSE;
+    pte = &pageTable[vpn];
+    if (!pte->valid && !FaultIn(vpn))
+        return FALSE;
+    if (kernel->machine->tlb != NULL)
+        kernel->machine->tlb->Refill(vpn, pte);
+    return TRUE;
+}
 
+//----------------------------------------------------------------------
+// AddrSpace::HostAddress
+//  Return where the byte at "vaddr" is in main memory.  A mapped page
+//  is read in first.  Only the rest of that page follows in main
+//  memory: the pages of a mapping are wherever there were free frames.
+//
+//  Return NULL if "vaddr" is not in this address space.
+//----------------------------------------------------------------------
+
+char *
+AddrSpace::HostAddress(unsigned int vaddr)
+{
+    unsigned int vpn = vaddr / PageSize;
+    TranslationEntry *pte;
+
+    if (vpn >= (unsigned) NumPhysPages)
+        return NULL;
+    pte = &pageTable[vpn];
+    if (!pte->valid && !FaultIn(vpn))
+        return NULL;
+    return &(kernel->machine->mainMemory[pte->physicalPage * PageSize
+                                         + vaddr % PageSize]);
+}
+
+//----------------------------------------------------------------------
+// AddrSpace::CheckBuffer
+//  Return TRUE if the "size" bytes at "vaddr" are all in this address
+//  space, reading in the mapped pages among them, and -- if "writing"
+//  -- none of them is read-only.  A system call checks a buffer
+//  before it does anything, so that a bad one changes nothing.
+//----------------------------------------------------------------------
+
+bool
+AddrSpace::CheckBuffer(unsigned int vaddr, int size, bool writing)
+{
+    unsigned int first = vaddr / PageSize;
+    unsigned int last = (vaddr + size - 1) / PageSize;
+
+    if (size < 0 || vaddr + size < vaddr)	// wraps around
+        return FALSE;
+    for (unsigned int vpn = first; size > 0 && vpn <= last; vpn++) {
+        if (HostAddress(vpn * PageSize) == NULL
+                || (writing && pageTable[vpn].readOnly))
+            return FALSE;
+    }
+    return TRUE;
+}
+
+//----------------------------------------------------------------------
+// AddrSpace::CopyIn/CopyOut
+//  Copy "size" bytes from the user buffer at "vaddr" into the kernel
+//  buffer "buf", or from "buf" out to the user buffer, a page at a
+//  time.  Pages copied out to are marked dirty, so that a mapping
+//  writes them back, and the instructions decoded from them are
+//  forgotten.
+//
+//  Return FALSE if CheckBuffer would; then nothing is copied.
+//----------------------------------------------------------------------
+
+bool
+AddrSpace::CopyIn(unsigned int vaddr, char *buf, int size)
+{
+    int done, amount;
+
+    if (!CheckBuffer(vaddr, size, FALSE))
+        return FALSE;
+    for (done = 0; done < size; done += amount) {
+        amount = min(size - done,
+                     PageSize - (int) ((vaddr + done) % PageSize));
+        bcopy(HostAddress(vaddr + done), &buf[done], amount);
+    }
+    return TRUE;
+}
+
+bool
+AddrSpace::CopyOut(unsigned int vaddr, char *buf, int size)
+{
+    int done, amount;
+    char *to;
+
+    if (!CheckBuffer(vaddr, size, TRUE))
+        return FALSE;
+    for (done = 0; done < size; done += amount) {
+        amount = min(size - done,
+                     PageSize - (int) ((vaddr + done) % PageSize));
+        to = HostAddress(vaddr + done);
+        bcopy(&buf[done], to, amount);
+        pageTable[(vaddr + done) / PageSize].use = TRUE;
+        pageTable[(vaddr + done) / PageSize].dirty = TRUE;
+        kernel->machine->InvalidateDecoded(
+            to - kernel->machine->mainMemory, amount);
+    }
+    return TRUE;
+}
+
+//----------------------------------------------------------------------
+// AddrSpace::CopyInString
+//  Copy the null-terminated string at "vaddr" into the kernel buffer
+//  "buf" of "size" bytes.  Return FALSE if it is not all in this
+//  address space, or does not fit.
+//----------------------------------------------------------------------
+
+bool
+AddrSpace::CopyInString(unsigned int vaddr, char *buf, int size)
+{
+    char *from;
+
+    for (int i = 0; i < size; i++) {
+        if (i == 0 || (vaddr + i) % PageSize == 0) {
+            from = HostAddress(vaddr + i);	// next page
+            if (from == NULL)
+                return FALSE;
+        }
+        buf[i] = *from++;
+        if (buf[i] == '\0')
+            return TRUE;
+    }
+    return FALSE;
+}
+
+//----------------------------------------------------------------------
+// AddrSpace::Checkpoint
+//  Write this address space to the UNIX file "fd": the size of the
+//  program, the page table, the open files, and the mappings, each as
+//  its first page, its size, and the id of the file mapped.  The pages
+//  themselves are saved with the rest of main memory.
+//----------------------------------------------------------------------
+
+void
+AddrSpace::Checkpoint(int fd)
+{
+    int regions = 0;
+
+    WriteFile(fd, (char *) &numPages, sizeof(numPages));
+    WriteFile(fd, (char *) pageTable, NumPhysPages * sizeof(TranslationEntry));
+    openFiles->Checkpoint(fd);
+    for (int i = numPages; i < NumPhysPages; i++) {
+        if (mapped[i] != NULL && mapped[i]->firstPage == i)
+            regions++;
+    }
+    WriteFile(fd, (char *) &regions, sizeof(int));
+    for (int i = numPages; i < NumPhysPages; i++) {
+        if (mapped[i] != NULL && mapped[i]->firstPage == i) {
+            MmapRegion *region = mapped[i];
+            int entry[4] = { region->firstPage, region->numPages,
+                             region->length, openFiles->Find(region->file) };
+
+            WriteFile(fd, (char *) entry, sizeof(entry));
+        }
+    }
+}
+
+//----------------------------------------------------------------------
+// AddrSpace::Restore
+//  Read back the address space Checkpoint wrote to "fd", into this
+//  one, which must be new.  Its pages are in main memory already: the
+//  frames they are in are taken again.
+//----------------------------------------------------------------------
+
+void
+AddrSpace::Restore(int fd)
+{
+    int regions;
+
+    Read(fd, (char *) &numPages, sizeof(numPages));
+    Read(fd, (char *) pageTable, NumPhysPages * sizeof(TranslationEntry));
+    for (int i = 0; i < NumPhysPages; i++) {
+        if (pageTable[i].valid)
+            usedFrames->Mark(pageTable[i].physicalPage);
+    }
+    openFiles->Restore(fd);
+    Read(fd, (char *) &regions, sizeof(int));
+    for (int i = 0; i < regions; i++) {
+        MmapRegion *region = new MmapRegion;
+        int entry[4];
+
+        Read(fd, (char *) entry, sizeof(entry));
+        region->firstPage = entry[0];
+        region->numPages = entry[1];
+        region->length = entry[2];
+        region->file = openFiles->Get(entry[3]);
+        ASSERT(region->file != NULL);
+        for (int j = 0; j < region->numPages; j++)
+            mapped[region->firstPage + j] = region;
+    }
+}
+
+//----------------------------------------------------------------------
+// AddrSpace::FaultIn
+//  Read in the page "vpn" from the file mapped there, if any.
+//  Return FALSE if the page is not mapped.
+//----------------------------------------------------------------------
+
+bool
+AddrSpace::FaultIn(unsigned int vpn)
+{
+    MmapRegion *region = mapped[vpn];
+    TranslationEntry *pte = &pageTable[vpn];
+    char *frame;
+    int offset;
+
+    if (region == NULL)
+        return FALSE;
+    pte->physicalPage = usedFrames->FindAndSet();
+    if (pte->physicalPage < 0) {
+        cerr << "No memory left to read in mapped page " << vpn << "\n";
+        return FALSE;
+    }
+    frame = &(kernel->machine->mainMemory[pte->physicalPage * PageSize]);
+    offset = (vpn - region->firstPage) * PageSize;
+
+    DEBUG(dbgAddr, "Faulting in mapped page " << vpn);
+    bzero(frame, PageSize);
+    region->file->ReadAt(frame, min(PageSize, region->length - offset),
+                         offset);
+    kernel->machine->InvalidateDecoded(pte->physicalPage * PageSize,
+                                       PageSize);
+    pte->valid = TRUE;
+    pte->use = FALSE;
+    pte->dirty = FALSE;
+    kernel->machine->FlushHostPages();
+    return TRUE;
+}
+
+//----------------------------------------------------------------------
+// AddrSpace::Unmap
+//  Write the dirty pages of "region" back to its file, and free it.
+//  Pages that were never touched, or only read, cost no disk traffic.
+//----------------------------------------------------------------------
+
+void
+AddrSpace::Unmap(MmapRegion *region)
+{
+    for (int i = 0; i < region->numPages; i++) {
+        int vpn = region->firstPage + i;
+        TranslationEntry *pte = &pageTable[vpn];
+        int offset = i * PageSize;
+
+        if (pte->valid && pte->dirty) {
+            DEBUG(dbgAddr, "Writing back mapped page " << vpn);
+            region->file->WriteAt(
+                &(kernel->machine->mainMemory[pte->physicalPage * PageSize]),
+                min(PageSize, region->length - offset), offset);
+        }
+        if (pte->valid)
+            usedFrames->Clear(pte->physicalPage);
+        pte->valid = FALSE;
+        pte->use = FALSE;
+        pte->dirty = FALSE;
+        mapped[vpn] = NULL;
+    }
+    kernel->machine->FlushHostPages();
+    delete region;
+}
+
+//----------------------------------------------------------------------
+// AddrSpace::Munmap
+//  Unmap the mapping that Mmap returned "addr" for.
+//  Return FALSE if there is none.
+//----------------------------------------------------------------------
+
+bool
+AddrSpace::Munmap(int addr)
+{
+    int vpn = addr / PageSize;
+
+    if (addr < 0 || addr % PageSize != 0 || vpn >= NumPhysPages
+            || mapped[vpn] == NULL || mapped[vpn]->firstPage != vpn)
+        return FALSE;
+    Unmap(mapped[vpn]);
+    return TRUE;
+}
+
+//----------------------------------------------------------------------
+// AddrSpace::UnmapFile
+//  "file" is about to be closed: unmap every mapping of it.
+//----------------------------------------------------------------------
+
+void
+AddrSpace::UnmapFile(OpenFile *file)
+{
+    for (int i = numPages; i < NumPhysPages; i++) {
+        if (mapped[i] != NULL && mapped[i]->file == file)
+            Unmap(mapped[i]);
+    }
+}
+
+//----------------------------------------------------------------------
+// AddrSpace::UnmapAll
+//  The program is done: unmap everything it still has mapped.
+//----------------------------------------------------------------------
+
+void
+AddrSpace::UnmapAll()
+{
+    for (int i = numPages; i < NumPhysPages; i++) {
+        if (mapped[i] != NULL)
+            Unmap(mapped[i]);
+    }
+}
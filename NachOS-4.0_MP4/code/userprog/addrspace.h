@@ -15,9 +15,22 @@
 
 #include "copyright.h"
 #include "filesys.h"
+#include "filetable.h"
+#include "bitmap.h"
 
 #define UserStackSize		1024 	// increase this as necessary!
 
+// A Nachos file mapped into an address space by Mmap.  Its pages are
+// read in from the file the first time they are touched, and the dirty
+// ones are written back when the mapping goes away.
+class MmapRegion {
+  public:
+    OpenFile *file;			// the file that is mapped
+    int firstPage;			// first virtual page of the mapping
+    int numPages;			// number of pages it spans
+    int length;				// number of bytes of the file mapped
+};
+
 class AddrSpace {
   public:
     AddrSpace();			// Create an address space.
@@ -39,14 +52,56 @@ class AddrSpace {
     // is 0 for Read, 1 for Write.
     ExceptionType Translate(unsigned int vaddr, unsigned int *paddr, int mode);
 
+    int Mmap(OpenFile *file, int length);
+					// Map the first "length" bytes of
+					// "file"; return the virtual address
+					// of the mapping, or -1
+    bool Munmap(int addr);		// Unmap the mapping at "addr"
+    void UnmapFile(OpenFile *file);	// Unmap every mapping of "file"
+    void UnmapAll();			// Unmap everything
+    bool PageFault(unsigned int vaddr);	// Read in the mapped page at
+					// "vaddr", and refill the TLB;
+					// FALSE if it isn't mapped
+    bool CheckBuffer(unsigned int vaddr, int size, bool writing);
+					// Is the user buffer at "vaddr" all
+					// in this space (and writable)?
+    bool CopyIn(unsigned int vaddr, char *buf, int size);
+    bool CopyOut(unsigned int vaddr, char *buf, int size);
+					// Copy a user buffer into/out of
+					// the kernel buffer "buf"; FALSE,
+					// copying nothing, if it isn't all
+					// in this space
+    bool CopyInString(unsigned int vaddr, char *buf, int size);
+					// Copy in a null-terminated string;
+					// FALSE if it doesn't fit in "buf"
+
+    void Checkpoint(int fd);		// Save the page table, mappings and
+					// open files to the UNIX file "fd"
+    void Restore(int fd);		// Read them back into this (new)
+					// address space
+
+    FileTable *openFiles;		// The files this program has open
+
   private:
+    static Bitmap *usedFrames;		// the page frames of physical
+					// memory some address space has
+    int asid;				// tags this address space's
+					// entries in the TLB
     TranslationEntry *pageTable;	// Assume linear page table translation
 					// for now!
     unsigned int numPages;		// Number of pages in the virtual 
 					// address space
+    MmapRegion **mapped;		// the mapping covering each page
+					// past the program, or NULL
 
     void InitRegisters();		// Initialize user-level CPU registers,
 					// before jumping to user code
+    void Unmap(MmapRegion *region);	// Write back and free a mapping
+    bool FaultIn(unsigned int vpn);	// Read in a mapped page
+    char *HostAddress(unsigned int vaddr);
+					// Where "vaddr" is in main memory,
+					// reading it in if it is mapped;
+					// NULL if it isn't in this space
 
 };
 
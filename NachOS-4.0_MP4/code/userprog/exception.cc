@@ -25,6 +25,10 @@
 #include "main.h"
 #include "syscall.h"
 #include "ksyscall.h"
+
+// Longest path name a system call takes, with its terminating null
+// (FileSystem::Create allows 255 characters)
+#define MaxPathLength	256
 //----------------------------------------------------------------------
 // ExceptionHandler
 // 	Entry point into the Nachos kernel.  Called when a user program
@@ -41,6 +45,10 @@
 //
 //	The result of the system call, if any, must be put back into r2. 
 //
+//	Buffers and names in user memory are copied in and out through the
+//	address space, page by page; a system call given one that is not
+//	all in the address space returns -1.
+//
 // If you are handling a system call, don't forget to increment the pc
 // before returning. (Or else you'll loop making the same system call forever!)
 //
@@ -68,8 +76,10 @@ ExceptionHandler(ExceptionType which)
 			DEBUG(dbgSys, "Message received.\n");
 			val = kernel->machine->ReadRegister(4);
 			{
-			char *msg = &(kernel->machine->mainMemory[val]);
-			cout << msg << endl;
+			char msg[MaxPathLength];
+			if (kernel->currentThread->space->CopyInString(val, msg,
+								MaxPathLength))
+				cout << msg << endl;
 			}
 			SysHalt();
 			ASSERTNOTREACHED();
@@ -79,10 +89,13 @@ ExceptionHandler(ExceptionType which)
 		case SC_Create:
 			val = kernel->machine->ReadRegister(4);
 			{
-				char *filename = &(kernel->machine->mainMemory[val]);
+				char filename[MaxPathLength];
 				int size = kernel->machine->ReadRegister(5);
-				//cout << filename << endl;
-				status = SysCreate(filename, size);
+				if (kernel->currentThread->space->CopyInString(val,
+						filename, MaxPathLength))
+					status = SysCreate(filename, size);
+				else
+					status = -1;
 				kernel->machine->WriteRegister(2, (int) status);
 			}
 			kernel->machine->WriteRegister(PrevPCReg, kernel->machine->ReadRegister(PCReg));
@@ -92,11 +105,35 @@ ExceptionHandler(ExceptionType which)
 			ASSERTNOTREACHED();
             break;
 		//#endif
+		case SC_Clone:
+			val = kernel->machine->ReadRegister(4);
+			{
+				char from[MaxPathLength], to[MaxPathLength];
+				AddrSpace *space = kernel->currentThread->space;
+				if (space->CopyInString(val, from, MaxPathLength)
+				    && space->CopyInString(
+					kernel->machine->ReadRegister(5), to,
+					MaxPathLength))
+					status = SysClone(from, to);
+				else
+					status = -1;
+				kernel->machine->WriteRegister(2, (int) status);
+			}
+			kernel->machine->WriteRegister(PrevPCReg, kernel->machine->ReadRegister(PCReg));
+			kernel->machine->WriteRegister(PCReg, kernel->machine->ReadRegister(PCReg) + 4);
+			kernel->machine->WriteRegister(NextPCReg, kernel->machine->ReadRegister(PCReg)+4);
+			return;
+			ASSERTNOTREACHED();
+			break;
         case SC_Open:
 			val = kernel->machine->ReadRegister(4);
             {
-                char *filename = &(kernel->machine->mainMemory[val]);
-				status = SysOpen(filename);
+                char filename[MaxPathLength];
+                if (kernel->currentThread->space->CopyInString(val,
+                        filename, MaxPathLength))
+                    status = SysOpen(filename);
+                else
+                    status = -1;
                 kernel->machine->WriteRegister(2, (int) status);
             }
             kernel->machine->WriteRegister(PrevPCReg, kernel->machine->ReadRegister(PCReg));
@@ -108,10 +145,19 @@ ExceptionHandler(ExceptionType which)
         case SC_Write:
 			val = kernel->machine->ReadRegister(4);
 			{
-            	char *filename = &(kernel->machine->mainMemory[val]);
 				int size = kernel->machine->ReadRegister(5);
 				int id = kernel->machine->ReadRegister(6);
-                status = SysWrite(filename, size, id);
+				char *buffer;
+				if (kernel->currentThread->space->CheckBuffer(val,
+						size, FALSE)) {
+					buffer = new char[size + 1];
+					kernel->currentThread->space->CopyIn(val,
+						buffer, size);
+					status = SysWrite(buffer, size, id);
+					delete [] buffer;
+				} else {
+					status = -1;
+				}
                 kernel->machine->WriteRegister(2, (int) status);
             }
             kernel->machine->WriteRegister(PrevPCReg, kernel->machine->ReadRegister(PCReg));
@@ -123,10 +169,20 @@ ExceptionHandler(ExceptionType which)
         case SC_Read:
 			val = kernel->machine->ReadRegister(4);
 			{
-				char *filename = &(kernel->machine->mainMemory[val]);
 				int size = kernel->machine->ReadRegister(5);
 				int id = kernel->machine->ReadRegister(6);
-				status = SysRead(filename, size, id);
+				char *buffer;
+				if (kernel->currentThread->space->CheckBuffer(val,
+						size, TRUE)) {
+					buffer = new char[size + 1];
+					status = SysRead(buffer, size, id);
+					if (status > 0)
+						kernel->currentThread->space->CopyOut(
+							val, buffer, status);
+					delete [] buffer;
+				} else {
+					status = -1;
+				}
 				kernel->machine->WriteRegister(2, (int) status);
 			}
 			kernel->machine->WriteRegister(PrevPCReg, kernel->machine->ReadRegister(PCReg));
@@ -147,6 +203,31 @@ ExceptionHandler(ExceptionType which)
 			return;
 			ASSERTNOTREACHED();
 			break;
+		case SC_Mmap:
+			val = kernel->machine->ReadRegister(4);
+			{
+				int length = kernel->machine->ReadRegister(5);
+				status = SysMmap(val, length);
+				kernel->machine->WriteRegister(2, (int) status);
+			}
+			kernel->machine->WriteRegister(PrevPCReg, kernel->machine->ReadRegister(PCReg));
+			kernel->machine->WriteRegister(PCReg, kernel->machine->ReadRegister(PCReg) + 4);
+			kernel->machine->WriteRegister(NextPCReg, kernel->machine->ReadRegister(PCReg)+4);
+			return;
+			ASSERTNOTREACHED();
+			break;
+		case SC_Munmap:
+			val = kernel->machine->ReadRegister(4);
+			{
+				status = SysMunmap(val);
+				kernel->machine->WriteRegister(2, (int) status);
+			}
+			kernel->machine->WriteRegister(PrevPCReg, kernel->machine->ReadRegister(PCReg));
+			kernel->machine->WriteRegister(PCReg, kernel->machine->ReadRegister(PCReg) + 4);
+			kernel->machine->WriteRegister(NextPCReg, kernel->machine->ReadRegister(PCReg)+4);
+			return;
+			ASSERTNOTREACHED();
+			break;
       	case SC_Add:
 			DEBUG(dbgSys, "Add " << kernel->machine->ReadRegister(4) << " + " << kernel->machine->ReadRegister(5) << "\n");
 			/* Process SysAdd Systemcall*/
@@ -175,6 +256,7 @@ ExceptionHandler(ExceptionType which)
 			DEBUG(dbgAddr, "Program exit\n");
             val=kernel->machine->ReadRegister(4);
             cout << "return value:" << val << endl;
+			kernel->currentThread->space->UnmapAll();	// write back mapped files
 			kernel->currentThread->Finish();
             break;
       	default:
@@ -182,6 +264,22 @@ ExceptionHandler(ExceptionType which)
 			break;
 		}
 		break;
+	case PageFaultException:
+		// a page mapped by Mmap, touched for the first time, or
+		// a TLB miss; the faulting instruction is restarted once
+		// the page is read in and the TLB refilled
+		val = kernel->machine->ReadRegister(BadVAddrReg);
+		if (kernel->currentThread->space->PageFault(val))
+			return;
+		// not mapped, or no frame left to read it into (other
+		// CPUs' programs may hold them): end this program only,
+		// as Exit would, rather than all of Nachos
+		cerr << "Page fault at address " << val << " cannot be "
+		     << "served; ending " << kernel->currentThread->getName()
+		     << "\n";
+		kernel->currentThread->space->UnmapAll();
+		kernel->currentThread->Finish();
+		return;
 	default:
 		cerr << "Unexpected user mode exception " << (int)which << "\n";
 		break;
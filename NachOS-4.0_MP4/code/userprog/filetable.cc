@@ -0,0 +1,214 @@
+// filetable.cc
+//	Routines to manage the table of files a user program has open.
+//	See filetable.h.
+//
+// Copyright (c) 1992-1996 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation 
+// of liability and disclaimer of warranty provisions.
+
+#include "copyright.h"
+#include "filetable.h"
+#include "main.h"
+
+//----------------------------------------------------------------------
+// FileTable::FileTable
+// 	Create a table with no files open.  Every slot but the console's
+//	is free.
+//----------------------------------------------------------------------
+
+FileTable::FileTable()
+{
+    size = FileTableInitSize;
+    files = new OpenFile *[size];
+    nextFree = new int[size];
+    firstFree = -1;
+    for (int i = size - 1; i >= 0; i--) {
+	files[i] = NULL;
+	if (i != SysConsoleInput && i != SysConsoleOutput) {
+	    nextFree[i] = firstFree;
+	    firstFree = i;
+	}
+    }
+}
+
+//----------------------------------------------------------------------
+// FileTable::~FileTable
+// 	The program is done: close the files it left open.
+//----------------------------------------------------------------------
+
+FileTable::~FileTable()
+{
+    for (int i = 0; i < size; i++) {
+	if (files[i] != NULL)
+	    delete Remove(i);
+    }
+    delete [] files;
+    delete [] nextFree;
+}
+
+//----------------------------------------------------------------------
+// FileTable::Grow
+// 	Double the number of slots, putting the new ones on the free list,
+//	lowest first.
+//----------------------------------------------------------------------
+
+void
+FileTable::Grow()
+{
+    int newSize = size * 2;
+    OpenFile **newFiles = new OpenFile *[newSize];
+    int *newNextFree = new int[newSize];
+
+    for (int i = 0; i < size; i++) {
+	newFiles[i] = files[i];
+	newNextFree[i] = nextFree[i];
+    }
+    for (int i = newSize - 1; i >= size; i--) {
+	newFiles[i] = NULL;
+	newNextFree[i] = firstFree;
+	firstFree = i;
+    }
+    delete [] files;
+    delete [] nextFree;
+    files = newFiles;
+    nextFree = newNextFree;
+    size = newSize;
+}
+
+//----------------------------------------------------------------------
+// FileTable::Add
+// 	Put "file" in a free slot -- the one freed most recently, if any --
+//	and return the slot as its OpenFileId.
+//----------------------------------------------------------------------
+
+OpenFileId
+FileTable::Add(OpenFile *file)
+{
+    OpenFileId id;
+
+    if (firstFree == -1)
+	Grow();
+    id = firstFree;
+    firstFree = nextFree[id];
+    files[id] = file;
+#ifndef FILESYS_STUB
+    kernel->fileSystem->FileOpened(file->HeaderSector());
+#endif
+    return id;
+}
+
+//----------------------------------------------------------------------
+// FileTable::Get
+// 	Return the file "id" stands for, or NULL if "id" is out of range,
+//	or isn't open.
+//----------------------------------------------------------------------
+
+OpenFile *
+FileTable::Get(OpenFileId id)
+{
+    if (id < 0 || id >= size)
+	return NULL;
+    return files[id];
+}
+
+//----------------------------------------------------------------------
+// FileTable::Remove
+// 	Free the slot of "id", and return the file that was in it; the
+//	caller closes it.  Return NULL if "id" isn't open.
+//----------------------------------------------------------------------
+
+OpenFile *
+FileTable::Remove(OpenFileId id)
+{
+    OpenFile *file = Get(id);
+
+    if (file == NULL)
+	return NULL;
+    files[id] = NULL;
+    nextFree[id] = firstFree;
+    firstFree = id;
+#ifndef FILESYS_STUB
+    kernel->fileSystem->FileClosed(file->HeaderSector());
+#endif
+    return file;
+}
+
+//----------------------------------------------------------------------
+// FileTable::Find
+// 	Return the id "file" is open as, or -1 if it isn't in the table.
+//----------------------------------------------------------------------
+
+OpenFileId
+FileTable::Find(OpenFile *file)
+{
+    for (int i = 0; i < size; i++) {
+	if (files[i] == file)
+	    return i;
+    }
+    return -1;
+}
+
+//----------------------------------------------------------------------
+// FileTable::Checkpoint
+// 	Write the table to the UNIX file "fd": its size and free list,
+//	and, for each slot, where the file open in it has its header on
+//	disk (-1 if none), and where it is positioned.  The file system
+//	on disk is saved along with the table, so the same files can be
+//	opened again.
+//
+//	The UNIX files of the stub file system cannot: they are dropped,
+//	and their slots are lost.
+//----------------------------------------------------------------------
+
+void
+FileTable::Checkpoint(int fd)
+{
+    int head[2] = { size, firstFree };
+
+    WriteFile(fd, (char *) head, sizeof(head));
+    for (int i = 0; i < size; i++) {
+	int entry[3] = { nextFree[i], -1, 0 };
+
+#ifndef FILESYS_STUB
+	if (files[i] != NULL) {
+	    entry[1] = files[i]->HeaderSector();
+	    entry[2] = files[i]->Position();
+	}
+#endif
+	WriteFile(fd, (char *) entry, sizeof(entry));
+    }
+}
+
+//----------------------------------------------------------------------
+// FileTable::Restore
+// 	Replace the (empty) table with the one Checkpoint wrote to "fd",
+//	opening its files again.
+//----------------------------------------------------------------------
+
+void
+FileTable::Restore(int fd)
+{
+    int head[2];
+
+    Read(fd, (char *) head, sizeof(head));
+    delete [] files;
+    delete [] nextFree;
+    size = head[0];
+    firstFree = head[1];
+    files = new OpenFile *[size];
+    nextFree = new int[size];
+    for (int i = 0; i < size; i++) {
+	int entry[3];
+
+	Read(fd, (char *) entry, sizeof(entry));
+	nextFree[i] = entry[0];
+	files[i] = NULL;
+#ifndef FILESYS_STUB
+	if (entry[1] >= 0) {
+	    files[i] = new OpenFile(entry[1]);
+	    files[i]->Seek(entry[2]);
+	    kernel->fileSystem->FileOpened(entry[1]);
+	}
+#endif
+    }
+}
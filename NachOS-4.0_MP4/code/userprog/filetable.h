@@ -0,0 +1,53 @@
+// filetable.h
+//	Data structures to keep track of the Nachos files a user program
+//	has open.
+//
+//	Each address space has its own table.  An OpenFileId is an index
+//	into it, so a system call finds -- and validates -- its file in
+//	constant time.  The table grows as files are opened, and the slots
+//	of closed files are kept on a free list, to be reused first.
+//
+//	Ids 0 and 1 stand for the console (see syscall.h), and are never
+//	handed out.
+//
+// Copyright (c) 1992-1996 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation 
+// of liability and disclaimer of warranty provisions.
+
+#ifndef FILETABLE_H
+#define FILETABLE_H
+
+#include "copyright.h"
+#include "openfile.h"
+#include "syscall.h"
+
+#define FileTableInitSize	16	// slots in a new table, including
+					// the two for the console
+
+class FileTable {
+  public:
+    FileTable();			// Create an empty table
+    ~FileTable();			// Close the files still open
+
+    OpenFileId Add(OpenFile *file);	// Enter "file" in the table, and
+					// return its id
+    OpenFile *Get(OpenFileId id);	// Return the file "id" stands for,
+					// or NULL if it isn't open
+    OpenFile *Remove(OpenFileId id);	// Take "id" out of the table, and
+					// return its file, or NULL
+    OpenFileId Find(OpenFile *file);	// Return the id of "file", or -1
+
+    void Checkpoint(int fd);		// Save the table to the UNIX file
+					// "fd", files by header sector
+    void Restore(int fd);		// Read it back, reopening the files
+
+  private:
+    OpenFile **files;			// the file in each slot, or NULL
+    int *nextFree;			// the free slot after each free slot
+    int firstFree;			// first free slot, or -1 if none
+    int size;				// number of slots
+
+    void Grow();			// Double the number of slots
+};
+
+#endif // FILETABLE_H
@@ -35,6 +35,11 @@ int SysCreate(char *filename, int size)
 	return kernel->interrupt->CreateFile(filename, size);
 }
 //#endif
+int SysClone(char *from, char *to)
+{
+	return kernel->interrupt->CloneFile(from, to);
+}
+
 OpenFileId SysOpen(char *name)
 {
 	return kernel->interrupt->Open(name);
@@ -55,5 +60,15 @@ int SysClose(OpenFileId id)
 	return kernel->interrupt->Close(id);	
 }
 
+int SysMmap(OpenFileId id, int length)
+{
+	return kernel->interrupt->Mmap(id, length);
+}
+
+int SysMunmap(int addr)
+{
+	return kernel->interrupt->Munmap(addr);
+}
+
 
 #endif /* ! __USERPROG_KSYSCALL_H__ */
@@ -34,6 +34,9 @@
 #define SC_ExecV	13
 #define SC_ThreadExit   14
 #define SC_ThreadJoin   15
+#define SC_Clone	16
+#define SC_Mmap		17
+#define SC_Munmap	18
 #define SC_Add		42
 #define SC_MSG		100
 
@@ -119,8 +122,16 @@ int Create(char *name, int size);
 /* Remove a Nachos file, with name "name" */
 int Remove(char *name);
 
+/* Create the Nachos file "to" as a clone of the file "from": it shares
+ * the data of "from" until either file writes to it (copy-on-write).
+ * Return 1 on success, negative error code on failure
+ */
+int Clone(char *from, char *to);
+
 /* Open the Nachos file "name", and return an "OpenFileId" that can 
- * be used to read and write to the file.
+ * be used to read and write to the file, or -1 on failure.  Ids are
+ * small integers, private to the address space; the id of a closed
+ * file may be returned again by a later Open.
  */
 OpenFileId Open(char *name);
 
@@ -144,10 +155,26 @@ int Read(char *buffer, int size, OpenFileId id);
 int Seek(int position, OpenFileId id);
 
 /* Close the file, we're done reading and writing to it.
+ * Any mapping of the file is unmapped first (see Munmap).
  * Return 1 on success, negative error code on failure
  */
 int Close(OpenFileId id);
 
+/* Map the first "length" bytes of the open file "id" into the address
+ * space, and return the address of the mapping, or -1 on failure.
+ * Each page is read from the file when it is first touched, so a large
+ * file that is mostly read is not copied through a buffer.  Bytes past
+ * the end of the file read as zero.  A buffer in mapped memory passed
+ * to the other system calls is read in as needed.
+ */
+int Mmap(OpenFileId id, int length);
+
+/* Unmap the mapping at "addr", writing the pages that were modified
+ * back to the file.
+ * Return 1 on success, negative error code on failure
+ */
+int Munmap(int addr);
+
 
 /* User-level thread operations: Fork and Yield.  To allow multiple
  * threads to run within a user program. 